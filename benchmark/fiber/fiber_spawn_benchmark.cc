@@ -0,0 +1,150 @@
+/****************************************************************
+ * Copyright (c) 2022, liyinbin
+ * All rights reserved.
+ * Author by liyinbin (jeff.li) lijippy@163.com
+ *****************************************************************/
+
+
+#include <stdlib.h>
+#include <atomic>
+#include <functional>
+#include <new>
+#include <benchmark/benchmark.h>
+#include "flare/fiber/fiber.h"
+
+// Spawns fibers from a fiber and joins them, which is what a server handling
+// a request with several concurrent sub-tasks does. The closure captures a
+// few pointers so that it doesn't fit in the small buffer of std::function.
+// BM_spawn_join* spawn with FIBER_NOSIGNAL so that the fiber runs in the same
+// worker once the spawner blocks in join, without waking up other workers,
+// which shows the cost of spawning itself.
+
+static const size_t kBatch = 64;
+
+// Counts allocations to report `allocs' per fiber.
+static std::atomic<int64_t> g_nalloc(0);
+
+void *operator new(size_t size) {
+    g_nalloc.fetch_add(1, std::memory_order_relaxed);
+    void *p = malloc(size);
+    if (p == nullptr) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void *p) noexcept {
+    free(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+    free(p);
+}
+
+struct Context {
+    std::atomic<int64_t> counter{0};
+};
+
+// Runs `bench' in a fiber, spawning from a worker is the common case.
+template<typename Bench>
+static void run_in_fiber(benchmark::State &state, Bench bench) {
+    int64_t nalloc = 0;
+    fiber_id_t tid;
+    if (fiber_start_background(&tid, nullptr, std::function<void *(void *)>(
+            [&state, &bench, &nalloc](void *) -> void * {
+                const int64_t nalloc_before = g_nalloc.load(std::memory_order_relaxed);
+                bench(state);
+                nalloc = g_nalloc.load(std::memory_order_relaxed) - nalloc_before;
+                return nullptr;
+            }), nullptr) != 0) {
+        state.SkipWithError("Fail to start fiber");
+        return;
+    }
+    fiber_join(tid, nullptr);
+    state.counters["allocs"] = benchmark::Counter(nalloc, benchmark::Counter::kAvgIterations);
+}
+
+static const fiber_attribute kNoSignal = {FIBER_STACKTYPE_NORMAL, FIBER_NOSIGNAL, nullptr};
+
+static const flare::attribute kAttrNoSignal{.policy = flare::launch_policy::eLazy,
+        .stack_type = FIBER_STACKTYPE_NORMAL,
+        .flags = FIBER_NOSIGNAL,
+        .keytable_pool = nullptr};
+
+static void BM_spawn_join_std_function(benchmark::State &state) {
+    run_in_fiber(state, [](benchmark::State &state) {
+        Context ctx;
+        int64_t a = 1, b = 2;
+        for (auto _ : state) {
+            fiber_id_t tid;
+            std::function<void *(void *)> fn = [&ctx, &a, &b](void *) -> void * {
+                ctx.counter.fetch_add(a + b, std::memory_order_relaxed);
+                return nullptr;
+            };
+            fiber_start_background(&tid, &kNoSignal, std::move(fn), nullptr);
+            fiber_join(tid, nullptr);
+        }
+    });
+    state.SetItemsProcessed(state.iterations());
+}
+
+static void BM_spawn_join(benchmark::State &state) {
+    run_in_fiber(state, [](benchmark::State &state) {
+        Context ctx;
+        int64_t a = 1, b = 2;
+        for (auto _ : state) {
+            flare::fiber fb(kAttrNoSignal, [&ctx, &a, &b](void *) -> void * {
+                ctx.counter.fetch_add(a + b, std::memory_order_relaxed);
+                return nullptr;
+            });
+            fb.join();
+        }
+    });
+    state.SetItemsProcessed(state.iterations());
+}
+
+// Spawns `kBatch' fibers one by one then joins them, each spawning wakes up
+// a worker.
+static void BM_spawn_join_loop(benchmark::State &state) {
+    run_in_fiber(state, [](benchmark::State &state) {
+        Context ctx;
+        int64_t a = 1, b = 2;
+        fiber_id_t tids[kBatch];
+        for (auto _ : state) {
+            for (size_t i = 0; i < kBatch; ++i) {
+                flare::fiber_internal::start_fiber(&tids[i], nullptr, [&ctx, &a, &b](void *) -> void * {
+                    ctx.counter.fetch_add(a + b, std::memory_order_relaxed);
+                    return nullptr;
+                }, nullptr, false);
+            }
+            for (size_t i = 0; i < kBatch; ++i) {
+                fiber_join(tids[i], nullptr);
+            }
+        }
+    });
+    state.SetItemsProcessed(state.iterations() * kBatch);
+}
+
+// Spawns `kBatch' fibers at once then joins them, workers are woken up once.
+static void BM_spawn_join_n(benchmark::State &state) {
+    run_in_fiber(state, [](benchmark::State &state) {
+        Context ctx;
+        int64_t a = 1, b = 2;
+        fiber_id_t tids[kBatch];
+        for (auto _ : state) {
+            fiber_start_background_n(tids, kBatch, nullptr, [&ctx, &a, &b](void *) -> void * {
+                ctx.counter.fetch_add(a + b, std::memory_order_relaxed);
+                return nullptr;
+            }, nullptr);
+            for (size_t i = 0; i < kBatch; ++i) {
+                fiber_join(tids[i], nullptr);
+            }
+        }
+    });
+    state.SetItemsProcessed(state.iterations() * kBatch);
+}
+
+BENCHMARK(BM_spawn_join_std_function)->UseRealTime();
+BENCHMARK(BM_spawn_join)->UseRealTime();
+BENCHMARK(BM_spawn_join_loop)->UseRealTime();
+BENCHMARK(BM_spawn_join_n)->UseRealTime();
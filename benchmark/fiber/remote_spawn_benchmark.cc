@@ -0,0 +1,67 @@
+/****************************************************************
+ * Copyright (c) 2022, liyinbin
+ * All rights reserved.
+ * Author by liyinbin (jeff.li) lijippy@163.com
+ *****************************************************************/
+
+
+#include <sched.h>
+#include <atomic>
+#include <benchmark/benchmark.h>
+#include "flare/fiber/internal/fiber.h"
+#include "flare/fiber/internal/unstable.h"
+
+// Pthreads which are not fiber workers (I/O callbacks, legacy thread pools)
+// spawning fibers at full speed. Such fibers are pushed into RemoteTaskQueue
+// of a randomly chosen fiber_worker. The time includes running the fibers.
+
+static std::atomic<int64_t> g_pending(0);
+
+static void *noop_fiber(void *) {
+    g_pending.fetch_sub(1, std::memory_order_relaxed);
+    return nullptr;
+}
+
+static void BM_spawn_from_pthreads(benchmark::State &state) {
+    for (auto _ : state) {
+        fiber_id_t tid;
+        g_pending.fetch_add(1, std::memory_order_relaxed);
+        if (fiber_start_background(&tid, nullptr, noop_fiber, nullptr) != 0) {
+            state.SkipWithError("Fail to start fiber");
+            return;
+        }
+    }
+    while (g_pending.load(std::memory_order_relaxed) != 0) {
+        sched_yield();
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// Spawns fibers with FIBER_NOSIGNAL in batches of state.range(0) and signals
+// workers once per batch by fiber_flush().
+static void BM_spawn_nosignal_from_pthreads(benchmark::State &state) {
+    const int batch = state.range(0);
+    fiber_attribute attr = FIBER_ATTR_NORMAL;
+    attr.flags |= FIBER_NOSIGNAL;
+    int n = 0;
+    for (auto _ : state) {
+        fiber_id_t tid;
+        g_pending.fetch_add(1, std::memory_order_relaxed);
+        if (fiber_start_background(&tid, &attr, noop_fiber, nullptr) != 0) {
+            state.SkipWithError("Fail to start fiber");
+            return;
+        }
+        if (++n == batch) {
+            n = 0;
+            fiber_flush();
+        }
+    }
+    fiber_flush();
+    while (g_pending.load(std::memory_order_relaxed) != 0) {
+        sched_yield();
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK(BM_spawn_from_pthreads)->ThreadRange(1, 8)->UseRealTime();
+BENCHMARK(BM_spawn_nosignal_from_pthreads)->Arg(16)->ThreadRange(1, 8)->UseRealTime();
@@ -0,0 +1,100 @@
+/****************************************************************
+ * Copyright (c) 2022, liyinbin
+ * All rights reserved.
+ * Author by liyinbin (jeff.li) lijippy@163.com
+ *****************************************************************/
+
+
+#include <atomic>
+#include <mutex>
+#include <benchmark/benchmark.h>
+#include "flare/fiber/internal/sys_futex.h"
+#include "flare/fiber/internal/timer_thread.h"
+
+// Compares the binary heap and the timing wheel of TimerThread with 1M
+// pending timers, which is what a busy RPC server carrying timeouts and
+// backup-request timers looks like.
+
+using flare::fiber_internal::TimerThread;
+using flare::fiber_internal::TimerThreadOptions;
+
+static const size_t kPendingTimers = 1000000;
+
+static void noop(void *) {}
+
+// TimerThread with `kPendingTimers' timers due in an hour, shared by all
+// benchmarks of the same kind.
+static TimerThread *pending_timer_thread(bool use_timing_wheel) {
+    static TimerThread *timer_threads[2] = {nullptr, nullptr};
+    static std::once_flag once[2];
+    std::call_once(once[use_timing_wheel], [use_timing_wheel] {
+        TimerThreadOptions options;
+        options.use_timing_wheel = use_timing_wheel;
+        auto timer_thread = new TimerThread;
+        timer_thread->start(&options);
+        const int64_t now = flare::get_current_time_micros();
+        for (size_t i = 0; i < kPendingTimers; ++i) {
+            // Spread the timers over 10 minutes one hour later.
+            const int64_t run_time = now + 3600000000L + (int64_t) (i * 7919 % 600000000);
+            timer_thread->schedule(noop, nullptr,
+                                   flare::time_point::from_unix_micros(run_time).to_timespec());
+        }
+        timer_threads[use_timing_wheel] = timer_thread;
+    });
+    return timer_threads[use_timing_wheel];
+}
+
+// The RPC pattern: arm a timeout when a call starts and cancel it when the
+// response arrives.
+template<bool kUseTimingWheel>
+static void BM_schedule_unschedule(benchmark::State &state) {
+    TimerThread *timer_thread = pending_timer_thread(kUseTimingWheel);
+    for (auto _ : state) {
+        const timespec abstime = flare::time_point::future_unix_millis(1000).to_timespec();
+        auto id = timer_thread->schedule(noop, nullptr, abstime);
+        benchmark::DoNotOptimize(timer_thread->unschedule(id));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK_TEMPLATE(BM_schedule_unschedule, false)->ThreadRange(1, 8)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_schedule_unschedule, true)->ThreadRange(1, 8)->UseRealTime();
+
+struct ExpireBatch {
+    std::atomic<int> remaining{0};
+    int nsignals = 0;
+
+    static void on_expire(void *arg) {
+        auto batch = static_cast<ExpireBatch *>(arg);
+        if (batch->remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            reinterpret_cast<std::atomic<int> *>(&batch->nsignals)->fetch_add(1);
+            flare::fiber_internal::futex_wake_private(&batch->nsignals, 1);
+        }
+    }
+};
+
+// Schedule a batch of timers which are already due and wait until all of
+// them ran, which includes the cost of the timer thread ordering them
+// against the pending ones. Deadlines in the past keep the tick of the
+// wheel out of the measurement.
+template<bool kUseTimingWheel>
+static void BM_expire(benchmark::State &state) {
+    TimerThread *timer_thread = pending_timer_thread(kUseTimingWheel);
+    const int batch_size = state.range(0);
+    ExpireBatch batch;
+    for (auto _ : state) {
+        const int expected = batch.nsignals;
+        batch.remaining.store(batch_size, std::memory_order_relaxed);
+        const timespec abstime = flare::time_point::future_unix_millis(-1).to_timespec();
+        for (int i = 0; i < batch_size; ++i) {
+            timer_thread->schedule(ExpireBatch::on_expire, &batch, abstime);
+        }
+        while (reinterpret_cast<std::atomic<int> *>(&batch.nsignals)->load() == expected) {
+            flare::fiber_internal::futex_wait_private(&batch.nsignals, expected, nullptr);
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * batch_size);
+}
+
+BENCHMARK_TEMPLATE(BM_expire, false)->Arg(1000)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_expire, true)->Arg(1000)->UseRealTime();
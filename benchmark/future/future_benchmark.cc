@@ -7,7 +7,9 @@
 
 
 #include <benchmark/benchmark.h>
+#include <thread>
 #include "flare/future/future.h"
+#include "flare/fiber/fiber_future.h"
 
 // This is not the fairest of tests.
 static void BM_std_future_reference(benchmark::State &state) {
@@ -88,9 +90,111 @@ static void BM_using_flare_future_normal(benchmark::State &state) {
         benchmark::DoNotOptimize(total);
     }
 }
+
+// Fan-out/fan-in of 10k futures.
+static const size_t kFanOut = 10000;
+
+// Runs `bench' in a fiber, which is where fan-out happens in a server.
+template<typename Bench>
+static void run_in_fiber(benchmark::State &state, Bench bench) {
+    fiber_id_t tid;
+    if (fiber_start_background(&tid, nullptr, std::function<void *(void *)>(
+            [&state, &bench](void *) -> void * {
+                bench(state);
+                return nullptr;
+            }), nullptr) != 0) {
+        state.SkipWithError("Fail to start fiber");
+        return;
+    }
+    fiber_join(tid, nullptr);
+    state.SetItemsProcessed(state.iterations() * kFanOut);
+}
+
+// Full_filled by a pthread, continuations run inline in it and the caller
+// blocks the pthread.
+static void BM_fan_out_fan_in_pthread(benchmark::State &state) {
+    for (auto _ : state) {
+        std::vector<flare::promise<size_t>> proms(kFanOut);
+        std::vector<flare::future<size_t>> futs;
+        futs.reserve(proms.size());
+        for (auto &p : proms) {
+            futs.push_back(p.get_future().then([](size_t v) { return v + 1; }));
+        }
+        auto all = flare::when_all(std::move(futs));
+
+        std::thread worker([ps = std::move(proms)]() mutable {
+            size_t i = 0;
+            for (auto &p : ps) {
+                p.set_value(++i);
+            }
+        });
+        worker.join();
+
+        size_t total = 0;
+        for (auto &v : all.get()) {
+            total += *v;
+        }
+        benchmark::DoNotOptimize(total);
+    }
+    state.SetItemsProcessed(state.iterations() * kFanOut);
+}
+
+// Every future is produced by a fiber, the caller fiber is suspended until
+// all of them are done.
+static void BM_fan_out_fan_in_fiber(benchmark::State &state) {
+    run_in_fiber(state, [](benchmark::State &state) {
+        for (auto _ : state) {
+            std::vector<flare::future<size_t>> futs;
+            futs.reserve(kFanOut);
+            for (size_t i = 0; i < kFanOut; ++i) {
+                futs.push_back(flare::async(flare::fiber_executor::instance(), [i] { return i + 1; }));
+            }
+            size_t total = 0;
+            for (auto &v : flare::fiber_get(flare::when_all(std::move(futs)))) {
+                total += *v;
+            }
+            benchmark::DoNotOptimize(total);
+        }
+    });
+}
+
+// Same as above with at most 256 futures unfinished.
+static void BM_fan_out_fan_in_fiber_bounded(benchmark::State &state) {
+    run_in_fiber(state, [](benchmark::State &state) {
+        for (auto _ : state) {
+            auto all = flare::when_all(kFanOut, 256, [](size_t i) {
+                return flare::async(flare::fiber_executor::instance(), [i] { return i + 1; });
+            });
+            size_t total = 0;
+            for (auto &v : flare::fiber_get(std::move(all))) {
+                total += *v;
+            }
+            benchmark::DoNotOptimize(total);
+        }
+    });
+}
+
+// Waits for the first of 10k futures produced by fibers.
+static void BM_fan_out_when_any_fiber(benchmark::State &state) {
+    run_in_fiber(state, [](benchmark::State &state) {
+        for (auto _ : state) {
+            std::vector<flare::future<size_t>> futs;
+            futs.reserve(kFanOut);
+            for (size_t i = 0; i < kFanOut; ++i) {
+                futs.push_back(flare::async(flare::fiber_executor::instance(), [i] { return i + 1; }));
+            }
+            benchmark::DoNotOptimize(flare::fiber_get(flare::when_any(std::move(futs))));
+        }
+    });
+}
+
 // Register the function as a benchmark
 BENCHMARK(BM_std_future_reference);
 BENCHMARK(BM_using_flare_future_normal);
 BENCHMARK(BM_using_flare_future_fair);
+BENCHMARK(BM_fan_out_fan_in_pthread)->UseRealTime();
+BENCHMARK(BM_fan_out_fan_in_fiber)->UseRealTime();
+BENCHMARK(BM_fan_out_fan_in_fiber_bounded)->UseRealTime();
+BENCHMARK(BM_fan_out_when_any_fiber)->UseRealTime();
 // Run the benchmark
 BENCHMARK_MAIN();
\ No newline at end of file
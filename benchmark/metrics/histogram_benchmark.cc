@@ -0,0 +1,81 @@
+/****************************************************************
+ * Copyright (c) 2022, liyinbin
+ * All rights reserved.
+ * Author by liyinbin (jeff.li) lijippy@163.com
+ *****************************************************************/
+
+
+#include <vector>
+#include <benchmark/benchmark.h>
+#include "flare/metrics/histogram.h"
+#include "flare/metrics/exponential_histogram.h"
+#include "flare/base/fast_rand.h"
+
+// Cost of recording a latency, which is done on every rpc. Samples are
+// spread over 1us..100ms so that the bucket of the linear histogram is found
+// at different positions of the boundaries.
+
+static std::vector<double> make_samples() {
+    std::vector<double> samples(4096);
+    for (auto &v : samples) {
+        v = static_cast<double>(flare::base::fast_rand_in(1, 100000));
+    }
+    return samples;
+}
+
+static const std::vector<double> g_samples = make_samples();
+
+static flare::histogram g_linear_10("bm_linear_10", "",
+                                    flare::bucket_builder::liner_values(10000, 10000, 10));
+static flare::histogram g_linear_50("bm_linear_50", "",
+                                    flare::bucket_builder::liner_values(2000, 2000, 50));
+static flare::histogram g_exp_buckets("bm_exp_buckets", "",
+                                      flare::bucket_builder::exponential_values(1, 2, 17));
+// About the resolution of exponential_histogram (9%) over the same range.
+static flare::histogram g_exp_buckets_140("bm_exp_buckets_140", "",
+                                          flare::bucket_builder::exponential_values(1, 1.0905, 140));
+static flare::exponential_histogram g_exponential("bm_exponential", "");
+
+template<typename H>
+static void observe(benchmark::State &state, H &h) {
+    size_t i = 0;
+    for (auto _ : state) {
+        h.observe(g_samples[i++ & (g_samples.size() - 1)]);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+static void BM_histogram_linear_10(benchmark::State &state) {
+    observe(state, g_linear_10);
+}
+
+static void BM_histogram_linear_50(benchmark::State &state) {
+    observe(state, g_linear_50);
+}
+
+static void BM_histogram_exponential_17(benchmark::State &state) {
+    observe(state, g_exp_buckets);
+}
+
+static void BM_histogram_exponential_140(benchmark::State &state) {
+    observe(state, g_exp_buckets_140);
+}
+
+static void BM_exponential_histogram(benchmark::State &state) {
+    observe(state, g_exponential);
+}
+
+BENCHMARK(BM_histogram_linear_10)->ThreadRange(1, 4);
+BENCHMARK(BM_histogram_linear_50)->ThreadRange(1, 4);
+BENCHMARK(BM_histogram_exponential_17)->ThreadRange(1, 4);
+BENCHMARK(BM_histogram_exponential_140)->ThreadRange(1, 4);
+BENCHMARK(BM_exponential_histogram)->ThreadRange(1, 4);
+
+// Combining the shards when scraped.
+static void BM_exponential_histogram_snapshot(benchmark::State &state) {
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(g_exponential.snapshot());
+    }
+}
+
+BENCHMARK(BM_exponential_histogram_snapshot);
@@ -0,0 +1,165 @@
+/****************************************************************
+ * Copyright (c) 2022, liyinbin
+ * All rights reserved.
+ * Author by liyinbin (jeff.li) lijippy@163.com
+ *****************************************************************/
+
+
+#include <mutex>
+#include <string>
+#include <vector>
+#include <benchmark/benchmark.h>
+#include "flare/container/flat_map.h"
+#include "flare/rpc/details/h2_stream_table.h"
+#include "flare/rpc/details/h2_write_scheduler.h"
+
+// Streams of one http2 connection with 1000 concurrent streams:
+//  - Frames of different streams are dispatched by threads looking up the
+//    stream table, compared with a FlatMap guarded by one mutex.
+//  - One large response shares the connection with unary responses, bytes
+//    written before all unary responses complete are compared between
+//    sending messages one after another and the write scheduler.
+
+static const int NSTREAM = 1000;
+
+struct Stream {
+    int id;
+};
+
+class MutexStreamMap {
+public:
+    MutexStreamMap() { _map.init(64, 70); }
+
+    Stream *seek(int id) {
+        std::unique_lock<std::mutex> mu(_mutex);
+        Stream **p = _map.seek(id);
+        return p ? *p : nullptr;
+    }
+
+    void insert(int id, Stream *s) {
+        std::unique_lock<std::mutex> mu(_mutex);
+        _map[id] = s;
+    }
+
+    Stream *erase(int id) {
+        Stream *s = nullptr;
+        std::unique_lock<std::mutex> mu(_mutex);
+        _map.erase(id, &s);
+        return s;
+    }
+
+private:
+    std::mutex _mutex;
+    flare::container::FlatMap<int, Stream *> _map;
+};
+
+static std::vector<Stream> &Streams() {
+    static std::vector<Stream> streams(NSTREAM);
+    return streams;
+}
+
+// Each iteration handles a frame: find the stream, and every 16 frames a
+// stream ends and a new one is created, like short gRPC calls.
+template<typename Map>
+static void RunFrames(benchmark::State &state, Map &map) {
+    std::vector<Stream> &streams = Streams();
+    uint32_t i = state.thread_index() * 7919;
+    for (auto _ : state) {
+        const int index = (i * 2654435761u >> 8) % NSTREAM;
+        const int id = index * 2 + 1;
+        benchmark::DoNotOptimize(map.seek(id));
+        if ((i & 15) == 0) {
+            map.erase(id);
+            map.insert(id, &streams[index]);
+        }
+        ++i;
+    }
+}
+
+static void BM_mutex_flat_map(benchmark::State &state) {
+    static MutexStreamMap *map = nullptr;
+    if (state.thread_index() == 0) {
+        map = new MutexStreamMap;
+        for (int i = 0; i < NSTREAM; ++i) {
+            map->insert(i * 2 + 1, &Streams()[i]);
+        }
+    }
+    RunFrames(state, *map);
+}
+
+static void BM_stream_table(benchmark::State &state) {
+    static flare::rpc::H2StreamTable<Stream> *table = nullptr;
+    if (state.thread_index() == 0) {
+        table = new flare::rpc::H2StreamTable<Stream>;
+        table->init(8);
+        for (int i = 0; i < NSTREAM; ++i) {
+            table->insert(i * 2 + 1, &Streams()[i]);
+        }
+    }
+    RunFrames(state, *table);
+}
+
+BENCHMARK(BM_mutex_flat_map)->ThreadRange(1, 8)->UseRealTime();
+BENCHMARK(BM_stream_table)->ThreadRange(1, 8)->UseRealTime();
+
+static const size_t LARGE_SIZE = 16 * 1024 * 1024;
+static const size_t UNARY_SIZE = 1024;
+static const uint32_t FRAME_SIZE = 16384;
+
+// Before the scheduler, each response was packed into the connection as a
+// whole in the order of writing. The large response comes first.
+static void BM_fifo(benchmark::State &state) {
+    const std::string large(LARGE_SIZE, 'l');
+    const std::string unary(UNARY_SIZE, 'u');
+    size_t written = 0;
+    for (auto _ : state) {
+        flare::cord_buf out;
+        out.append(large);
+        for (int i = 1; i < NSTREAM; ++i) {
+            out.append(unary);
+        }
+        written = out.size();
+        benchmark::DoNotOptimize(written);
+    }
+    state.counters["bytes_before_unary_done"] = written;
+}
+
+static void BM_write_scheduler(benchmark::State &state) {
+    const int64_t round_size = state.range(0);
+    const std::string large(LARGE_SIZE, 'l');
+    const std::string unary(UNARY_SIZE, 'u');
+    size_t written = 0;
+    size_t nround = 0;
+    for (auto _ : state) {
+        flare::rpc::H2WriteScheduler s;
+        s.Init();
+        flare::cord_buf data;
+        data.append(large);
+        s.Push(1, flare::rpc::H2_DEFAULT_STREAM_WEIGHT, INT32_MAX, &data, nullptr);
+        for (int i = 1; i < NSTREAM; ++i) {
+            data.append(unary);
+            s.Push(i * 2 + 1, flare::rpc::H2_DEFAULT_STREAM_WEIGHT, INT32_MAX, &data, nullptr);
+        }
+        written = 0;
+        nround = 0;
+        int nunary = NSTREAM - 1;
+        std::vector<flare::rpc::H2WriteScheduler::Frame> frames;
+        while (s.stream_count()) {
+            frames.clear();
+            written += s.Pop(INT32_MAX, FRAME_SIZE, round_size, &frames);
+            ++nround;
+            for (size_t i = 0; i < frames.size(); ++i) {
+                nunary -= (frames[i].end_of_stream && frames[i].stream_id != 1);
+            }
+            if (nunary == 0) {
+                break;
+            }
+        }
+    }
+    state.counters["bytes_before_unary_done"] = written;
+    state.counters["rounds"] = nround;
+}
+
+BENCHMARK(BM_fifo)->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_write_scheduler)->Arg(16 * 1024)->Arg(64 * 1024)->Arg(256 * 1024)
+        ->Unit(benchmark::kMicrosecond);
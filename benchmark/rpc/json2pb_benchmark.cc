@@ -0,0 +1,158 @@
+/****************************************************************
+ * Copyright (c) 2022, liyinbin
+ * All rights reserved.
+ * Author by liyinbin (jeff.li) lijippy@163.com
+ *****************************************************************/
+
+
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include <benchmark/benchmark.h>
+#include <google/protobuf/descriptor.pb.h>
+#include "flare/io/cord_buf.h"
+#include "flare/json2pb/json_to_pb.h"
+#include "flare/json2pb/pb_to_json.h"
+#include "flare/rapidjson/document.h"
+
+// Converts json of FileDescriptorSet (nested repeated messages, strings,
+// enums and integers) into protobuf and back, from/to std::string and
+// cord_buf which is how http bodies are converted. The set holds
+// descriptor.proto repeated state.range(0) times without options.
+// `dom_bytes' is memory of a rapidjson DOM of the json, which is not built
+// by the conversion.
+
+using google::protobuf::FileDescriptorSet;
+
+// *Options messages have extensions up to 2^29-1, which are irrelevant to
+// the conversion of plain data.
+static void ClearOptions(google::protobuf::Message *msg) {
+    const google::protobuf::Reflection *reflection = msg->GetReflection();
+    std::vector<const google::protobuf::FieldDescriptor *> fields;
+    reflection->ListFields(*msg, &fields);
+    for (size_t i = 0; i < fields.size(); ++i) {
+        const google::protobuf::FieldDescriptor *field = fields[i];
+        if (field->cpp_type() != google::protobuf::FieldDescriptor::CPPTYPE_MESSAGE) {
+            continue;
+        }
+        if (field->message_type()->extension_range_count() > 0) {
+            reflection->ClearField(msg, field);
+        } else if (field->is_repeated()) {
+            for (int j = 0; j < reflection->FieldSize(*msg, field); ++j) {
+                ClearOptions(reflection->MutableRepeatedMessage(msg, field, j));
+            }
+        } else {
+            ClearOptions(reflection->MutableMessage(msg, field));
+        }
+    }
+}
+
+static const std::string &Json(int ncopy) {
+    static std::string json;
+    static int cached = 0;
+    if (cached != ncopy) {
+        FileDescriptorSet set;
+        for (int i = 0; i < ncopy; ++i) {
+            FileDescriptorSet::descriptor()->file()->CopyTo(set.add_file());
+        }
+        ClearOptions(&set);
+        json.clear();
+        json2pb::ProtoMessageToJson(set, &json);
+        cached = ncopy;
+    }
+    return json;
+}
+
+static void BM_json_to_pb_string(benchmark::State &state) {
+    const std::string &json = Json(state.range(0));
+    for (auto _ : state) {
+        FileDescriptorSet set;
+        if (!json2pb::JsonToProtoMessage(json, &set)) {
+            state.SkipWithError("Fail to convert");
+            return;
+        }
+        benchmark::DoNotOptimize(set);
+    }
+    state.SetBytesProcessed(state.iterations() * json.size());
+    rapidjson::Document d;
+    d.Parse<0>(json.c_str());
+    state.counters["dom_bytes"] = d.GetAllocator().Size();
+}
+
+static void BM_json_to_pb_cord_buf(benchmark::State &state) {
+    flare::cord_buf buf;
+    buf.append(Json(state.range(0)));
+    for (auto _ : state) {
+        FileDescriptorSet set;
+        flare::cord_buf_as_zero_copy_input_stream stream(buf);
+        if (!json2pb::JsonToProtoMessage(&stream, &set)) {
+            state.SkipWithError("Fail to convert");
+            return;
+        }
+        benchmark::DoNotOptimize(set);
+    }
+    state.SetBytesProcessed(state.iterations() * buf.size());
+}
+
+static const FileDescriptorSet &Message(int ncopy) {
+    static FileDescriptorSet set;
+    static int cached = 0;
+    if (cached != ncopy) {
+        set.Clear();
+        if (!json2pb::JsonToProtoMessage(Json(ncopy), &set)) {
+            abort();
+        }
+        cached = ncopy;
+    }
+    return set;
+}
+
+static void BM_pb_to_json_string(benchmark::State &state) {
+    const FileDescriptorSet &set = Message(state.range(0));
+    size_t bytes = 0;
+    for (auto _ : state) {
+        std::string json;
+        if (!json2pb::ProtoMessageToJson(set, &json)) {
+            state.SkipWithError("Fail to convert");
+            return;
+        }
+        bytes += json.size();
+    }
+    state.SetBytesProcessed(bytes);
+}
+
+// Through cord_buf_as_zero_copy_output_stream.
+static void BM_pb_to_json_zero_copy_stream(benchmark::State &state) {
+    const FileDescriptorSet &set = Message(state.range(0));
+    size_t bytes = 0;
+    for (auto _ : state) {
+        flare::cord_buf buf;
+        flare::cord_buf_as_zero_copy_output_stream stream(&buf);
+        if (!json2pb::ProtoMessageToJson(set, &stream)) {
+            state.SkipWithError("Fail to convert");
+            return;
+        }
+        bytes += stream.ByteCount();
+    }
+    state.SetBytesProcessed(bytes);
+}
+
+static void BM_pb_to_json_cord_buf(benchmark::State &state) {
+    const FileDescriptorSet &set = Message(state.range(0));
+    size_t bytes = 0;
+    for (auto _ : state) {
+        flare::cord_buf buf;
+        if (!json2pb::ProtoMessageToJson(set, &buf)) {
+            state.SkipWithError("Fail to convert");
+            return;
+        }
+        bytes += buf.size();
+    }
+    state.SetBytesProcessed(bytes);
+}
+
+BENCHMARK(BM_json_to_pb_string)->Arg(1)->Arg(32)->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_json_to_pb_cord_buf)->Arg(1)->Arg(32)->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_pb_to_json_string)->Arg(1)->Arg(32)->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_pb_to_json_zero_copy_stream)->Arg(1)->Arg(32)->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_pb_to_json_cord_buf)->Arg(1)->Arg(32)->Unit(benchmark::kMicrosecond);
@@ -0,0 +1,135 @@
+/****************************************************************
+ * Copyright (c) 2022, liyinbin
+ * All rights reserved.
+ * Author by liyinbin (jeff.li) lijippy@163.com
+ *****************************************************************/
+
+
+#include <stdio.h>
+#include <memory>
+#include <vector>
+#include <benchmark/benchmark.h>
+#include "flare/rpc/socket.h"
+#include "flare/rpc/policy/hasher.h"
+#include "flare/rpc/policy/consistent_hashing_load_balancer.h"
+#include "flare/rpc/policy/maglev_load_balancer.h"
+
+// Compares the hash ring of c_murmurhash with lookup tables of c_maglev and
+// c_jump: latency of SelectServer(), time to rebuild after servers change
+// and ratio of keys moved to other servers when one server is removed.
+
+using flare::rpc::LoadBalancer;
+using flare::rpc::ServerId;
+
+enum LbKind {
+    LB_RING = 0,
+    LB_MAGLEV = 1,
+    LB_JUMP = 2,
+};
+
+static LoadBalancer *NewLb(int kind) {
+    switch (kind) {
+        case LB_RING:
+            return new flare::rpc::policy::ConsistentHashingLoadBalancer(
+                    flare::rpc::policy::CONS_HASH_LB_MURMUR3);
+        case LB_MAGLEV:
+            return new flare::rpc::policy::MaglevLoadBalancer(
+                    flare::rpc::policy::MAGLEV_LB_PERMUTATION);
+        default:
+            return new flare::rpc::policy::MaglevLoadBalancer(
+                    flare::rpc::policy::MAGLEV_LB_JUMP);
+    }
+}
+
+// Sockets are shared by all benchmarks, never recycled.
+static const std::vector<ServerId> &GetServers(size_t n) {
+    static std::vector<ServerId> servers;
+    while (servers.size() < n) {
+        const size_t i = servers.size();
+        char addr[32];
+        snprintf(addr, sizeof(addr), "10.%lu.%lu.%lu:8000",
+                 i >> 16, (i >> 8) & 0xFF, i & 0xFF);
+        flare::rpc::SocketOptions options;
+        str2endpoint(addr, &options.remote_side);
+        ServerId id(0);
+        flare::rpc::Socket::Create(options, &id.id);
+        servers.push_back(id);
+    }
+    return servers;
+}
+
+static void BM_select_server(benchmark::State &state) {
+    const size_t n = state.range(1);
+    const std::vector<ServerId> servers(GetServers(n).begin(), GetServers(n).begin() + n);
+    std::unique_ptr<LoadBalancer, void (*)(LoadBalancer *)> lb(
+            NewLb(state.range(0)), [](LoadBalancer *p) { p->Destroy(); });
+    lb->AddServersInBatch(servers);
+    flare::rpc::SocketUniquePtr ptr;
+    LoadBalancer::SelectIn in = {0, false, true, 0, NULL};
+    LoadBalancer::SelectOut out(&ptr);
+    uint64_t i = 0;
+    for (auto _ : state) {
+        in.request_code = flare::rpc::policy::MurmurHash32(&i, sizeof(i));
+        ++i;
+        benchmark::DoNotOptimize(lb->SelectServer(in, &out));
+    }
+}
+
+static void BM_rebuild(benchmark::State &state) {
+    const size_t n = state.range(1);
+    const std::vector<ServerId> servers(GetServers(n).begin(), GetServers(n).begin() + n);
+    const std::vector<ServerId> one(1, servers[n / 2]);
+    std::unique_ptr<LoadBalancer, void (*)(LoadBalancer *)> lb(
+            NewLb(state.range(0)), [](LoadBalancer *p) { p->Destroy(); });
+    lb->AddServersInBatch(servers);
+    for (auto _ : state) {
+        lb->RemoveServersInBatch(one);
+        lb->AddServersInBatch(one);
+    }
+}
+
+// Keys which moved although their server was not removed.
+static void BM_remap_ratio(benchmark::State &state) {
+    const size_t n = state.range(1);
+    const size_t NKEY = 100000;
+    const std::vector<ServerId> servers(GetServers(n).begin(), GetServers(n).begin() + n);
+    const ServerId removed = servers[n / 2];
+    double ratio = 0;
+    for (auto _ : state) {
+        std::unique_ptr<LoadBalancer, void (*)(LoadBalancer *)> lb(
+                NewLb(state.range(0)), [](LoadBalancer *p) { p->Destroy(); });
+        lb->AddServersInBatch(servers);
+        flare::rpc::SocketUniquePtr ptr;
+        LoadBalancer::SelectIn in = {0, false, true, 0, NULL};
+        LoadBalancer::SelectOut out(&ptr);
+        std::vector<flare::rpc::SocketId> before(NKEY);
+        for (uint64_t i = 0; i < NKEY; ++i) {
+            in.request_code = flare::rpc::policy::MurmurHash32(&i, sizeof(i));
+            lb->SelectServer(in, &out);
+            before[i] = ptr->id();
+        }
+        lb->RemoveServer(removed);
+        size_t moved = 0;
+        for (uint64_t i = 0; i < NKEY; ++i) {
+            in.request_code = flare::rpc::policy::MurmurHash32(&i, sizeof(i));
+            lb->SelectServer(in, &out);
+            if (before[i] != removed.id && before[i] != ptr->id()) {
+                ++moved;
+            }
+        }
+        ratio = (double) moved / NKEY;
+    }
+    state.counters["remap_ratio"] = ratio;
+}
+
+static void LbArgs(benchmark::internal::Benchmark *b) {
+    for (int kind = LB_RING; kind <= LB_JUMP; ++kind) {
+        for (int n : {16, 256, 2048}) {
+            b->Args({kind, n});
+        }
+    }
+}
+
+BENCHMARK(BM_select_server)->Apply(LbArgs);
+BENCHMARK(BM_rebuild)->Apply(LbArgs)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_remap_ratio)->Apply(LbArgs)->Iterations(1);
@@ -0,0 +1,116 @@
+/****************************************************************
+ * Copyright (c) 2022, liyinbin
+ * All rights reserved.
+ * Author by liyinbin (jeff.li) lijippy@163.com
+ *****************************************************************/
+
+
+#include <string.h>
+#include <algorithm>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <benchmark/benchmark.h>
+#include "flare/container/flat_map.h"
+#include "flare/rpc/details/method_index.h"
+
+// Finds methods of a server with 500 methods (50 services x 10 methods)
+// by the service and method names carried by requests, in random order.
+// BM_flat_map is how Server looked up methods before MethodIndex:
+// concatenating the names and seeking FlatMap<std::string, ...>.
+
+static const int NSERVICE = 50;
+static const int NMETHOD = 10;
+
+struct Request {
+    std::string service;
+    std::string method;
+};
+
+static std::vector<std::string> &Names() {
+    static std::vector<std::string> names;
+    if (names.empty()) {
+        for (int i = 0; i < NSERVICE; ++i) {
+            for (int j = 0; j < NMETHOD; ++j) {
+                names.push_back("example.search.v1.SearchService" + std::to_string(i) +
+                                ".QueryMethod" + std::to_string(j));
+            }
+        }
+    }
+    return names;
+}
+
+static std::vector<Request> &Requests() {
+    static std::vector<Request> reqs;
+    if (reqs.empty()) {
+        for (const std::string &name : Names()) {
+            const size_t pos = name.rfind('.');
+            reqs.push_back(Request{name.substr(0, pos), name.substr(pos + 1)});
+        }
+        std::shuffle(reqs.begin(), reqs.end(), std::mt19937(1));
+    }
+    return reqs;
+}
+
+static void BM_flat_map(benchmark::State &state) {
+    flare::container::FlatMap<std::string, int> map;
+    map.init(NSERVICE * NMETHOD * 2);
+    for (size_t i = 0; i < Names().size(); ++i) {
+        map[Names()[i]] = i;
+    }
+    const std::vector<Request> &reqs = Requests();
+    size_t i = 0;
+    for (auto _ : state) {
+        const Request &r = reqs[i];
+        i = (i + 1 == reqs.size() ? 0 : i + 1);
+        const size_t len = r.service.size() + 1 + r.method.size();
+        char buf[len];
+        memcpy(buf, r.service.data(), r.service.size());
+        buf[r.service.size()] = '.';
+        memcpy(buf + r.service.size() + 1, r.method.data(), r.method.size());
+        benchmark::DoNotOptimize(map.seek(std::string_view(buf, len)));
+    }
+}
+
+static void BM_method_index(benchmark::State &state) {
+    flare::rpc::MethodIndex index;
+    if (index.init(Names()) != 0) {
+        state.SkipWithError("Fail to init");
+        return;
+    }
+    const std::vector<Request> &reqs = Requests();
+    size_t i = 0;
+    for (auto _ : state) {
+        const Request &r = reqs[i];
+        i = (i + 1 == reqs.size() ? 0 : i + 1);
+        benchmark::DoNotOptimize(index.find(r.service, r.method));
+    }
+}
+
+static void BM_method_index_full_name(benchmark::State &state) {
+    flare::rpc::MethodIndex index;
+    if (index.init(Names()) != 0) {
+        state.SkipWithError("Fail to init");
+        return;
+    }
+    std::vector<std::string> names = Names();
+    std::shuffle(names.begin(), names.end(), std::mt19937(1));
+    size_t i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(index.find(names[i]));
+        i = (i + 1 == names.size() ? 0 : i + 1);
+    }
+}
+
+static void BM_method_index_init(benchmark::State &state) {
+    for (auto _ : state) {
+        flare::rpc::MethodIndex index;
+        benchmark::DoNotOptimize(index.init(Names()));
+    }
+}
+
+BENCHMARK(BM_flat_map);
+BENCHMARK(BM_method_index);
+BENCHMARK(BM_method_index_full_name);
+BENCHMARK(BM_method_index_init)->Unit(benchmark::kMicrosecond);
@@ -0,0 +1,66 @@
+/****************************************************************
+ * Copyright (c) 2022, liyinbin
+ * All rights reserved.
+ * Author by liyinbin (jeff.li) lijippy@163.com
+ *****************************************************************/
+
+
+#include <string>
+#include <benchmark/benchmark.h>
+#include "flare/io/cord_buf.h"
+#include "flare/rpc/redis.h"
+
+// Parses replies of 16 pipelined GETs of state.range(0)-byte values from
+// the input, which is what a redis client does for each response, with
+// bulk strings copied into the arena or referencing blocks of the input.
+
+static const int kReplyCount = 16;
+
+static std::string Replies(size_t value_size) {
+    std::string value(value_size, 'x');
+    std::string replies;
+    for (int i = 0; i < kReplyCount; ++i) {
+        replies.append("$" + std::to_string(value_size) + "\r\n");
+        replies.append(value);
+        replies.append("\r\n");
+    }
+    return replies;
+}
+
+static void ParseReplies(benchmark::State &state, size_t ref_min_size, bool get_data) {
+    flare::cord_buf input;
+    input.append(Replies(state.range(0)));
+    flare::rpc::RedisResponse response;
+    response.set_bulk_string_ref_min_size(ref_min_size);
+    for (auto _ : state) {
+        flare::cord_buf buf(input);
+        response.Clear();
+        if (response.ConsumePartialCordBuf(buf, kReplyCount) != flare::rpc::PARSE_OK) {
+            state.SkipWithError("Fail to parse");
+            return;
+        }
+        if (get_data) {
+            for (int i = 0; i < kReplyCount; ++i) {
+                benchmark::DoNotOptimize(response.reply(i).data().data());
+            }
+        }
+    }
+    state.SetBytesProcessed(state.iterations() * input.size());
+}
+
+static void BM_parse_copy(benchmark::State &state) {
+    ParseReplies(state, 0, false);
+}
+
+static void BM_parse_ref(benchmark::State &state) {
+    ParseReplies(state, 1024, false);
+}
+
+// Referenced strings are copied when data() is called.
+static void BM_parse_ref_and_data(benchmark::State &state) {
+    ParseReplies(state, 1024, true);
+}
+
+BENCHMARK(BM_parse_copy)->Arg(64)->Arg(4096)->Arg(100 * 1024)->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_parse_ref)->Arg(64)->Arg(4096)->Arg(100 * 1024)->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_parse_ref_and_data)->Arg(64)->Arg(4096)->Arg(100 * 1024)->Unit(benchmark::kMicrosecond);
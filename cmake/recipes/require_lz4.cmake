@@ -0,0 +1,6 @@
+find_path(LZ4_INCLUDE_PATH NAMES lz4frame.h)
+find_library(LZ4_LIB NAMES lz4)
+if ((NOT LZ4_INCLUDE_PATH) OR (NOT LZ4_LIB))
+    message(FATAL_ERROR "Fail to find lz4")
+endif()
+include_directories(${LZ4_INCLUDE_PATH})
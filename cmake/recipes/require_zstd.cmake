@@ -0,0 +1,6 @@
+find_path(ZSTD_INCLUDE_PATH NAMES zstd.h)
+find_library(ZSTD_LIB NAMES zstd)
+if ((NOT ZSTD_INCLUDE_PATH) OR (NOT ZSTD_LIB))
+    message(FATAL_ERROR "Fail to find zstd")
+endif()
+include_directories(${ZSTD_INCLUDE_PATH})
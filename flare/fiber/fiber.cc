@@ -13,20 +13,6 @@ namespace flare {
 
     }
 
-    fiber::fiber(const attribute &attr, std::function<void *(void *)> &&fn, void *args)
-            : _save_error(0),
-              _fid(INVALID_FIBER_ID), _detached(false) {
-        fiber_attribute tmp;
-        tmp.stack_type = attr.stack_type;
-        tmp.flags = attr.flags;
-        tmp.keytable_pool = attr.keytable_pool;
-        if (attr.policy == launch_policy::eImmediately) {
-            _save_error = fiber_start_urgent(&_fid, &tmp, std::move(fn), args);
-        } else {
-            _save_error = fiber_start_background(&_fid, &tmp, std::move(fn), args);
-        }
-    }
-
     void fiber::join() {
         if(!_detached) {
             ::fiber_join(_fid, nullptr);
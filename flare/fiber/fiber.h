@@ -54,16 +54,29 @@ namespace flare {
         // Create an empty (invalid) fiber.
         fiber();
 
-        explicit fiber(std::function<void *(void *)> &&fn, void *args = nullptr)
-                : fiber(kAttrNormal, std::move(fn), args) {
+        // `fn' is any callable as `void *(void *)', which is stored in the
+        // fiber without allocating memory if it's small.
+        template<typename F, typename = fiber_internal::enable_if_fiber_fn_t<F>>
+        explicit fiber(F &&fn, void *args = nullptr)
+                : fiber(kAttrNormal, std::forward<F>(fn), args) {
         }
 
-        fiber(const attribute &attr, std::function<void *(void *)> &&fn, void *args = nullptr);
+        template<typename F, typename = fiber_internal::enable_if_fiber_fn_t<F>>
+        fiber(const attribute &attr, F &&fn, void *args = nullptr)
+                : _save_error(0), _fid(INVALID_FIBER_ID), _detached(false) {
+            fiber_attribute tmp;
+            tmp.stack_type = attr.stack_type;
+            tmp.flags = attr.flags;
+            tmp.keytable_pool = attr.keytable_pool;
+            _save_error = fiber_internal::start_fiber(&_fid, &tmp, std::forward<F>(fn), args,
+                                                      attr.policy == launch_policy::eImmediately);
+        }
 
-        fiber(launch_policy policy, std::function<void *(void *)> &&fn, void *args = nullptr)
+        template<typename F, typename = fiber_internal::enable_if_fiber_fn_t<F>>
+        fiber(launch_policy policy, F &&fn, void *args = nullptr)
                 : fiber(
                 attribute{.policy = policy, .stack_type = FIBER_STACKTYPE_NORMAL, .flags = 0, .keytable_pool = nullptr},
-                std::forward<std::function<void *(void *)>>(fn),
+                std::forward<F>(fn),
                 args) {}
 
         // If a `fiber` object which owns a fiber is destructed with no prior call to
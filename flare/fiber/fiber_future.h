@@ -0,0 +1,110 @@
+
+/****************************************************************
+ * Copyright (c) 2022, liyinbin
+ * All rights reserved.
+ * Author by liyinbin (jeff.li) lijippy@163.com
+ *****************************************************************/
+
+#ifndef FLARE_FIBER_FIBER_FUTURE_H_
+#define FLARE_FIBER_FIBER_FUTURE_H_
+
+
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include "flare/future/future.h"
+#include "flare/fiber/fiber_latch.h"
+#include "flare/fiber/internal/fiber.h"
+
+namespace flare {
+
+    // Queue for `basic_future::then(queue, cb)` and friends, running each
+    // continuation in a new fiber instead of inline in whichever thread
+    // full_fills the future. Started from a worker, the fiber is queued in
+    // the schedule_group of the worker, otherwise in a random one.
+    //
+    //   auto f = fut.then(fiber_executor::instance(), [](int v) { ... });
+    //   auto g = flare::async(fiber_executor::instance(), [] { ... });
+    struct fiber_executor {
+        static fiber_executor &instance() {
+            static fiber_executor executor;
+            return executor;
+        }
+
+        template<typename F>
+        static void push(F &&f) {
+            fiber_id_t tid;
+            auto proc = [f = std::forward<F>(f)](void *) mutable -> void * {
+                f();
+                return nullptr;
+            };
+            if (fiber_internal::start_fiber(&tid, nullptr, std::move(proc), nullptr, false) != 0) {
+                // Out of fibers, run it here rather than dropping it.
+                // `proc' is not moved from since the fiber was not created,
+                // see fiber_internal::prepare_fiber().
+                proc(nullptr);
+            }
+        }
+    };
+
+    // Blocks the calling fiber (or pthread, outside of fiber runtime) until
+    // `fut` is finished, then either return the value or throw the error.
+    // Unlike basic_future::get(), the worker keeps running other fibers.
+    //
+    // @pre `fut` must be \b ready
+    // @post `fut` will be \b uninitialized
+    template<typename Alloc, typename... Ts>
+    typename basic_future<Alloc, Ts...>::value_type fiber_get(basic_future<Alloc, Ts...> &&fut) {
+        using finish_type = typename basic_future<Alloc, Ts...>::finish_type;
+        using value_type = typename basic_future<Alloc, Ts...>::value_type;
+
+        std::optional<finish_type> result;
+        fiber_latch latch(1);
+        fut.finally([&result, &latch](expected<Ts, std::exception_ptr>... e) {
+            result.emplace(std::move(e)...);
+            latch.signal();
+        });
+        latch.wait();
+
+        auto err = std::apply(future_internal::get_first_error<Ts...>, *result);
+        if (err) {
+            std::rethrow_exception(*err);
+        }
+        if constexpr (!std::is_void_v<value_type>) {
+            auto values = future_internal::finish_to_full_fill<sizeof...(Ts) - 1>(
+                    std::move(*result));
+            if constexpr (std::tuple_size_v<decltype(values)> == 1) {
+                return std::move(std::get<0>(values));
+            } else {
+                return values;
+            }
+        }
+    }
+
+    // Blocks the calling fiber until `fut` is finished, `fut` is then still
+    // \b ready and finished with the same outcome.
+    //
+    // @pre `fut` must be \b ready
+    template<typename Alloc, typename... Ts>
+    void fiber_wait(basic_future<Alloc, Ts...> &fut) {
+        using finish_type = typename basic_future<Alloc, Ts...>::finish_type;
+        using storage_type = typename basic_future<Alloc, Ts...>::storage_type;
+
+        future_internal::storage_ptr<storage_type> storage;
+        storage.allocate(fut.allocator());
+
+        std::optional<finish_type> result;
+        fiber_latch latch(1);
+        fut.finally([&result, &latch](expected<Ts, std::exception_ptr>... e) {
+            result.emplace(std::move(e)...);
+            latch.signal();
+        });
+        latch.wait();
+
+        storage->finish(std::move(*result));
+        fut = basic_future<Alloc, Ts...>(std::move(storage));
+    }
+
+}  // namespace flare
+
+#endif  // FLARE_FIBER_FIBER_FUTURE_H_
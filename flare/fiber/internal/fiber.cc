@@ -123,15 +123,15 @@ namespace flare::fiber_internal {
     __thread fiber_worker *tls_task_group_nosignal = NULL;
 
     FLARE_FORCE_INLINE int
-    start_from_non_worker(fiber_id_t *__restrict tid,
-                          const fiber_attribute *__restrict attr,
-                          std::function<void *(void *)> &&fn,
-                          void *__restrict arg) {
+    start_from_non_worker(const fiber_id_t *tids, size_t n) {
         schedule_group *c = get_or_new_task_control();
         if (NULL == c) {
+            for (size_t i = 0; i < n; ++i) {
+                fiber_worker::delete_task(fiber_worker::address_meta(tids[i]));
+            }
             return ENOMEM;
         }
-        if (attr != NULL && (attr->flags & FIBER_NOSIGNAL)) {
+        if (fiber_worker::address_meta(tids[0])->attr.flags & FIBER_NOSIGNAL) {
             // Remember the fiber_worker to insert NOSIGNAL tasks for 2 reasons:
             // 1. NOSIGNAL is often for creating many fibers in batch,
             //    inserting into the same fiber_worker maximizes the batch.
@@ -141,10 +141,53 @@ namespace flare::fiber_internal {
                 g = c->choose_one_group();
                 tls_task_group_nosignal = g;
             }
-            return g->start_background<true>(tid, attr, std::move(fn), arg);
+            g->start_background<true>(tids, n);
+            return 0;
+        }
+        c->choose_one_group()->start_background<true>(tids, n);
+        return 0;
+    }
+
+    fiber_task *prepare_fiber(fiber_id_t *__restrict tid,
+                              const fiber_attribute *__restrict attr,
+                              void *__restrict arg) {
+        // Start the runtime beforehand, so that start_prepared_fiber() does
+        // not fail after the user function is emplaced.
+        if (tls_task_group == NULL && get_or_new_task_control() == NULL) {
+            return NULL;
+        }
+        fiber_entity *m = fiber_worker::new_task(attr, arg);
+        if (m == NULL) {
+            return NULL;
+        }
+        *tid = m->tid;
+        return &m->fn;
+    }
+
+    int start_prepared_fiber(fiber_id_t tid, bool urgent) {
+        fiber_worker *g = tls_task_group;
+        if (g) {
+            // start from worker
+            if (urgent) {
+                fiber_worker::start_foreground(&g, fiber_worker::address_meta(tid));
+            } else {
+                g->start_background<false>(&tid, 1);
+            }
+            return 0;
+        }
+        return start_from_non_worker(&tid, 1);
+    }
+
+    int start_prepared_fibers_background(const fiber_id_t *tids, size_t n) {
+        if (n == 0) {
+            return 0;
+        }
+        fiber_worker *g = tls_task_group;
+        if (g) {
+            g->start_background<false>(tids, n);
+            return 0;
         }
-        return c->choose_one_group()->start_background<true>(
-                tid, attr, std::move(fn), arg);
+        return start_from_non_worker(tids, n);
     }
 
     struct TidTraits {
@@ -178,24 +221,20 @@ int fiber_start_urgent(fiber_id_t *__restrict tid,
                        const fiber_attribute *__restrict attr,
                        std::function<void *(void *)> &&fn,
                        void *__restrict arg) {
-    flare::fiber_internal::fiber_worker *g = flare::fiber_internal::tls_task_group;
-    if (g) {
-        // start from worker
-        return flare::fiber_internal::fiber_worker::start_foreground(&g, tid, attr, std::move(fn), arg);
+    if (__builtin_expect(!fn, 0)) {
+        return EINVAL;
     }
-    return flare::fiber_internal::start_from_non_worker(tid, attr, std::move(fn), arg);
+    return flare::fiber_internal::start_fiber(tid, attr, std::move(fn), arg, true);
 }
 
 int fiber_start_background(fiber_id_t *__restrict tid,
                            const fiber_attribute *__restrict attr,
                            std::function<void *(void *)> &&fn,
                            void *__restrict arg) {
-    flare::fiber_internal::fiber_worker *g = flare::fiber_internal::tls_task_group;
-    if (g) {
-        // start from worker
-        return g->start_background<false>(tid, attr, std::move(fn), arg);
+    if (__builtin_expect(!fn, 0)) {
+        return EINVAL;
     }
-    return flare::fiber_internal::start_from_non_worker(tid, attr, std::move(fn), arg);
+    return flare::fiber_internal::start_fiber(tid, attr, std::move(fn), arg, false);
 }
 
 void fiber_flush() {
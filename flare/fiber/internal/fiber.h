@@ -30,7 +30,10 @@
 #if defined(__cplusplus)
 
 #  include <iostream>
+#  include <type_traits>
+#  include <utility>
 #  include "flare/fiber/internal/mutex.h"        // use fiber_mutex_t in the RAII way
+#  include "flare/fiber/internal/fiber_task.h"
 
 #endif
 
@@ -323,4 +326,102 @@ extern void *fiber_getspecific(fiber_local_key key);
 
 __END_DECLS
 
+#if defined(__cplusplus)
+
+namespace flare::fiber_internal {
+
+    // Create fiber with attributes `attr' and argument `arg' which is not
+    // started, and put the identifier into `tid'. The user function should be
+    // emplaced into the returned task before starting the fiber by
+    // start_prepared_fiber*(), which does not fail on fibers returned here.
+    // Returns NULL when out of memory or the runtime fails to start.
+    fiber_task *prepare_fiber(fiber_id_t *__restrict tid,
+                              const fiber_attribute *__restrict attr,
+                              void *__restrict arg);
+
+    // Start a fiber prepared by prepare_fiber() like fiber_start_urgent() if
+    // `urgent' is true, like fiber_start_background() otherwise.
+    // Return 0 on success, errno otherwise.
+    int start_prepared_fiber(fiber_id_t tid, bool urgent);
+
+    // Start `n' fibers prepared by prepare_fiber() like
+    // fiber_start_background(), waking up workers only once.
+    // Return 0 on success, errno otherwise.
+    int start_prepared_fibers_background(const fiber_id_t *tids, size_t n);
+
+    // True if `fn' tests false, e.g. a NULL function pointer or an empty
+    // std::function. Callables not convertible to bool are never empty.
+    template<typename F>
+    inline bool is_empty_fiber_fn(const F &fn) {
+        if constexpr (std::is_constructible<bool, const F &>::value) {
+            return !static_cast<bool>(fn);
+        } else {
+            return false;
+        }
+    }
+
+    // Same as fiber_start_urgent() or fiber_start_background(), but `fn' (any
+    // callable as `void *(void *)') is stored in the fiber directly, without
+    // allocating memory if it's no larger than fiber_task::kInlineSize.
+    // Returns EINVAL if `fn' is empty, see is_empty_fiber_fn().
+    // `fn' is not moved from if no fiber is created.
+    template<typename F>
+    inline int start_fiber(fiber_id_t *__restrict tid,
+                           const fiber_attribute *__restrict attr,
+                           F &&fn, void *__restrict arg, bool urgent) {
+        if (is_empty_fiber_fn(fn)) {
+            return EINVAL;
+        }
+        fiber_task *task = prepare_fiber(tid, attr, arg);
+        if (task == nullptr) {
+            return ENOMEM;
+        }
+        task->emplace(std::forward<F>(fn));
+        return start_prepared_fiber(*tid, urgent);
+    }
+
+    template<typename F>
+    using enable_if_fiber_fn_t = typename std::enable_if<
+            std::is_invocable_r<void *, typename std::decay<F>::type &, void *>::value>::type;
+
+}  // namespace flare::fiber_internal
+
+// Create `n' fibers calling copies of `fn' (any callable as `void *(void *)')
+// with `args[i]' (or NULL if `args' is NULL) in background and put their
+// identifiers into `tids'. Unlike calling fiber_start_background() `n' times,
+// `fn' is stored in the fibers like flare::fiber_internal::start_fiber(), and
+// workers are woken up only once, after all fibers are runnable.
+// Return 0 on success, errno otherwise, in which case identifiers of fibers
+// not created are INVALID_FIBER_ID.
+template<typename F, typename = flare::fiber_internal::enable_if_fiber_fn_t<F>>
+inline int fiber_start_background_n(fiber_id_t *__restrict tids, size_t n,
+                                    const fiber_attribute *__restrict attr,
+                                    const F &fn, void *const *args) {
+    if (flare::fiber_internal::is_empty_fiber_fn(fn)) {
+        for (size_t i = 0; i < n; ++i) {
+            tids[i] = INVALID_FIBER_ID;
+        }
+        return EINVAL;
+    }
+    size_t nprepared = 0;
+    for (; nprepared < n; ++nprepared) {
+        flare::fiber_internal::fiber_task *task = flare::fiber_internal::prepare_fiber(
+                &tids[nprepared], attr, (args ? args[nprepared] : NULL));
+        if (task == NULL) {
+            break;
+        }
+        task->emplace(fn);
+    }
+    const int rc = flare::fiber_internal::start_prepared_fibers_background(tids, nprepared);
+    for (size_t i = (rc == 0 ? nprepared : 0); i < n; ++i) {
+        tids[i] = INVALID_FIBER_ID;
+    }
+    if (rc != 0) {
+        return rc;
+    }
+    return (nprepared == n ? 0 : ENOMEM);
+}
+
+#endif
+
 #endif  // FLARE_INTHERNAL_FIBER_H_
@@ -24,6 +24,7 @@
 #include "flare/base/static_atomic.h"          // std::atomic
 #include "flare/fiber/internal/types.h"           // fiber_attribute
 #include "flare/fiber/internal/stack.h"           // fiber_contextual_stack
+#include "flare/fiber/internal/fiber_task.h"           // fiber_task
 
 namespace flare::fiber_internal {
 
@@ -70,9 +71,8 @@ namespace flare::fiber_internal {
         // simplified if they can get tid from fiber_entity.
         fiber_id_t tid;
 
-        // User function and argument
-        //void *(*fn)(void *);
-        std::function<void*(void*)> fn;
+        // User function and argument. fn is reset as soon as it returns.
+        fiber_task fn;
         void *arg;
 
         // Stack of this task.
@@ -0,0 +1,99 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#ifndef FLARE_FIBER_INTERNAL_FIBER_TASK_H_
+#define FLARE_FIBER_INTERNAL_FIBER_TASK_H_
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include "flare/base/profile.h"
+
+namespace flare::fiber_internal {
+
+    // User function of a fiber: a callable as `void *(void *)'.
+    // Unlike std::function, it's constructed in place and never moved, so
+    // that callables up to kInlineSize bytes are stored inside the fiber
+    // without any allocation, larger ones are allocated on heap.
+    class fiber_task {
+    public:
+        static constexpr size_t kInlineSize = 48;
+
+        fiber_task() : _invoke(nullptr), _destroy(nullptr) {}
+
+        ~fiber_task() { reset(); }
+
+        template<typename F>
+        void emplace(F &&fn) {
+            typedef typename std::decay<F>::type T;
+            reset();
+            if constexpr (sizeof(T) <= kInlineSize && alignof(T) <= alignof(std::max_align_t)) {
+                new(&_storage) T(std::forward<F>(fn));
+                _invoke = invoke_inline<T>;
+                _destroy = destroy_inline<T>;
+            } else {
+                *reinterpret_cast<T **>(&_storage) = new T(std::forward<F>(fn));
+                _invoke = invoke_heap<T>;
+                _destroy = destroy_heap<T>;
+            }
+        }
+
+        // Destroy the callable along with its captures.
+        void reset() {
+            if (_destroy) {
+                _destroy(&_storage);
+                _invoke = nullptr;
+                _destroy = nullptr;
+            }
+        }
+
+        void *operator()(void *arg) { return _invoke(&_storage, arg); }
+
+        explicit operator bool() const { return _invoke != nullptr; }
+
+    private:
+        FLARE_DISALLOW_COPY_AND_ASSIGN(fiber_task);
+
+        template<typename T>
+        static void *invoke_inline(void *storage, void *arg) {
+            return (*static_cast<T *>(storage))(arg);
+        }
+
+        template<typename T>
+        static void destroy_inline(void *storage) {
+            static_cast<T *>(storage)->~T();
+        }
+
+        template<typename T>
+        static void *invoke_heap(void *storage, void *arg) {
+            return (**static_cast<T **>(storage))(arg);
+        }
+
+        template<typename T>
+        static void destroy_heap(void *storage) {
+            delete *static_cast<T **>(storage);
+        }
+
+        typename std::aligned_storage<kInlineSize, alignof(std::max_align_t)>::type _storage;
+        void *(*_invoke)(void *, void *);
+        void (*_destroy)(void *);
+    };
+
+}  // namespace flare::fiber_internal
+
+#endif  // FLARE_FIBER_INTERNAL_FIBER_TASK_H_
@@ -161,7 +161,7 @@ namespace flare::fiber_internal {
             _cur_meta(nullptr), _control(c), _num_nosignal(0), _nsignaled(0),
             _last_run_ns(flare::get_current_time_nanos()),
             _cumulated_cputime_ns(0), _nswitch(0), _last_context_remained(nullptr), _last_context_remained_arg(nullptr),
-            _pl(nullptr), _main_stack(nullptr), _main_tid(0), _remote_num_nosignal(0), _remote_nsignaled(0) {
+            _pl(nullptr), _numa_node(-1), _main_stack(nullptr), _main_tid(0), _remote_num_nosignal(0), _remote_nsignaled(0) {
         _steal_seed = flare::base::fast_rand();
         _steal_offset = OFFSET_TABLE[_steal_seed % FLARE_ARRAY_SIZE(OFFSET_TABLE)];
         _pl = &c->_pl[flare::hash::fmix64(pthread_numeric_id()) % schedule_group::PARKING_LOT_NUM];
@@ -201,7 +201,7 @@ namespace flare::fiber_internal {
         m->stop = false;
         m->interrupted = false;
         m->about_to_quit = false;
-        m->fn = nullptr;
+        m->fn.reset();
         m->arg = nullptr;
         m->local_storage = LOCAL_STORAGE_INIT;
         m->cpuwide_start_ns = flare::get_current_time_nanos();
@@ -265,6 +265,9 @@ namespace flare::fiber_internal {
             } catch (ExitException &e) {
                 thread_return = e.value();
             }
+            // Destroy captures of fn in this fiber as they may use fiber
+            // local storage.
+            m->fn.reset();
 
             // Group is probably changed
             g = tls_task_group;
@@ -324,35 +327,36 @@ namespace flare::fiber_internal {
         return_resource(get_slot(m->tid));
     }
 
-    int fiber_worker::start_foreground(fiber_worker **pg,
-                                       fiber_id_t *__restrict th,
-                                       const fiber_attribute *__restrict attr,
-                                       std::function<void *(void *)> &&fn,
-                                       void *__restrict arg) {
-        if (__builtin_expect(!fn, 0)) {
-            return EINVAL;
-        }
+    fiber_entity *fiber_worker::new_task(const fiber_attribute *__restrict attr,
+                                         void *__restrict arg) {
         const int64_t start_ns = flare::get_current_time_nanos();
-        const fiber_attribute using_attr = (attr ? *attr : FIBER_ATTR_NORMAL);
         flare::ResourceId<fiber_entity> slot;
         fiber_entity *m = flare::get_resource(&slot);
         if (__builtin_expect(!m, 0)) {
-            return ENOMEM;
+            return nullptr;
         }
         FLARE_CHECK(m->current_waiter.load(std::memory_order_relaxed) == nullptr);
         m->stop = false;
         m->interrupted = false;
         m->about_to_quit = false;
-        m->fn = std::move(fn);
         m->arg = arg;
         FLARE_CHECK(m->stack == nullptr);
-        m->attr = using_attr;
+        m->attr = (attr ? *attr : FIBER_ATTR_NORMAL);
         m->local_storage = LOCAL_STORAGE_INIT;
         m->cpuwide_start_ns = start_ns;
         m->stat = EMPTY_STAT;
         m->tid = make_tid(*m->version_butex, slot);
-        *th = m->tid;
-        if (using_attr.flags & FIBER_LOG_START_AND_FINISH) {
+        return m;
+    }
+
+    void fiber_worker::delete_task(fiber_entity *m) {
+        m->fn.reset();
+        return_resource(get_slot(m->tid));
+    }
+
+    void fiber_worker::start_foreground(fiber_worker **pg, fiber_entity *m) {
+        const bool nosignal = (m->attr.flags & FIBER_NOSIGNAL);
+        if (m->attr.flags & FIBER_LOG_START_AND_FINISH) {
             FLARE_LOG(INFO) << "Started fiber " << m->tid;
         }
 
@@ -360,7 +364,7 @@ namespace flare::fiber_internal {
         g->_control->_nfibers << 1;
         if (g->is_current_pthread_task()) {
             // never create foreground task in pthread.
-            g->ready_to_run(m->tid, (using_attr.flags & FIBER_NOSIGNAL));
+            g->ready_to_run(m->tid, nosignal);
         } else {
             // NOSIGNAL affects current task, not the new task.
             RemainedFn fn = nullptr;
@@ -371,66 +375,41 @@ namespace flare::fiber_internal {
             }
             ReadyToRunArgs args = {
                     g->current_fid(),
-                    (bool) (using_attr.flags & FIBER_NOSIGNAL)
+                    nosignal
             };
             g->set_remained(fn, &args);
             fiber_worker::sched_to(pg, m->tid);
         }
-        return 0;
     }
 
     template<bool REMOTE>
-    int fiber_worker::start_background(fiber_id_t *__restrict th,
-                                       const fiber_attribute *__restrict attr,
-                                       std::function<void *(void *)> &&fn,
-                                       void *__restrict arg) {
-        if (__builtin_expect(!fn, 0)) {
-            return EINVAL;
-        }
-        const int64_t start_ns = flare::get_current_time_nanos();
-        const fiber_attribute using_attr = (attr ? *attr : FIBER_ATTR_NORMAL);
-        flare::ResourceId<fiber_entity> slot;
-        fiber_entity *m = flare::get_resource(&slot);
-        if (__builtin_expect(!m, 0)) {
-            return ENOMEM;
-        }
-        FLARE_CHECK(m->current_waiter.load(std::memory_order_relaxed) == nullptr);
-        m->stop = false;
-        m->interrupted = false;
-        m->about_to_quit = false;
-        m->fn = std::move(fn);
-        m->arg = arg;
-        FLARE_CHECK(m->stack == nullptr);
-        m->attr = using_attr;
-        m->local_storage = LOCAL_STORAGE_INIT;
-        m->cpuwide_start_ns = start_ns;
-        m->stat = EMPTY_STAT;
-        m->tid = make_tid(*m->version_butex, slot);
-        *th = m->tid;
-        if (using_attr.flags & FIBER_LOG_START_AND_FINISH) {
-            FLARE_LOG(INFO) << "Started fiber " << m->tid;
+    void fiber_worker::start_background(const fiber_id_t *tids, size_t n) {
+        // Tasks may run and quit once pushed, read attributes before that.
+        bool signal = false;
+        for (size_t i = 0; i < n; ++i) {
+            const fiber_entity *m = address_meta(tids[i]);
+            if (m->attr.flags & FIBER_LOG_START_AND_FINISH) {
+                FLARE_LOG(INFO) << "Started fiber " << m->tid;
+            }
+            signal |= !(m->attr.flags & FIBER_NOSIGNAL);
         }
-        _control->_nfibers << 1;
-        if (REMOTE) {
-            ready_to_run_remote(m->tid, (using_attr.flags & FIBER_NOSIGNAL));
-        } else {
-            ready_to_run(m->tid, (using_attr.flags & FIBER_NOSIGNAL));
+        _control->_nfibers << (int64_t) n;
+        for (size_t i = 0; i < n; ++i) {
+            const bool nosignal = (i + 1 < n || !signal);
+            if (REMOTE) {
+                ready_to_run_remote(tids[i], nosignal);
+            } else {
+                ready_to_run(tids[i], nosignal);
+            }
         }
-        return 0;
     }
 
 // Explicit instantiations.
-    template int
-    fiber_worker::start_background<true>(fiber_id_t *__restrict th,
-                                         const fiber_attribute *__restrict attr,
-                                         std::function<void *(void *)> &&fn,
-                                         void *__restrict arg);
-
-    template int
-    fiber_worker::start_background<false>(fiber_id_t *__restrict th,
-                                          const fiber_attribute *__restrict attr,
-                                          std::function<void *(void *)> &&fn,
-                                          void *__restrict arg);
+    template void
+    fiber_worker::start_background<true>(const fiber_id_t *tids, size_t n);
+
+    template void
+    fiber_worker::start_background<false>(const fiber_id_t *tids, size_t n);
 
     int fiber_worker::join(fiber_id_t tid, void **return_value) {
         if (__builtin_expect(!tid, 0)) {  // tid of fiber is never 0.
@@ -635,38 +614,21 @@ namespace flare::fiber_internal {
     }
 
     void fiber_worker::ready_to_run_remote(fiber_id_t tid, bool nosignal) {
-        _remote_rq._mutex.lock();
-        while (!_remote_rq.push_locked(tid)) {
-            flush_nosignal_tasks_remote_locked(_remote_rq._mutex);
+        while (!_remote_rq.push(tid)) {
+            flush_nosignal_tasks_remote();
             FLARE_LOG_EVERY_SECOND(ERROR) << "_remote_rq is full, capacity="
                                     << _remote_rq.capacity();
             ::usleep(1000);
-            _remote_rq._mutex.lock();
         }
         if (nosignal) {
-            ++_remote_num_nosignal;
-            _remote_rq._mutex.unlock();
+            _remote_num_nosignal.fetch_add(1, std::memory_order_relaxed);
         } else {
-            const int additional_signal = _remote_num_nosignal;
-            _remote_num_nosignal = 0;
-            _remote_nsignaled += 1 + additional_signal;
-            _remote_rq._mutex.unlock();
+            const int additional_signal = _remote_num_nosignal.exchange(0, std::memory_order_relaxed);
+            _remote_nsignaled.fetch_add(1 + additional_signal, std::memory_order_relaxed);
             _control->signal_task(1 + additional_signal);
         }
     }
 
-    void fiber_worker::flush_nosignal_tasks_remote_locked(std::mutex &locked_mutex) {
-        const int val = _remote_num_nosignal;
-        if (!val) {
-            locked_mutex.unlock();
-            return;
-        }
-        _remote_num_nosignal = 0;
-        _remote_nsignaled += val;
-        locked_mutex.unlock();
-        _control->signal_task(val);
-    }
-
     void fiber_worker::ready_to_run_general(fiber_id_t tid, bool nosignal) {
         if (tls_task_group == this) {
             return ready_to_run(tid, nosignal);
@@ -869,7 +831,7 @@ namespace flare::fiber_internal {
         bool stop = false;
         bool interrupted = false;
         bool about_to_quit = false;
-        std::function<void *(void *)> *fn = nullptr;
+        fiber_task *fn = nullptr;
         void *arg = nullptr;
         fiber_attribute attr = FIBER_ATTR_NORMAL;
         bool has_tls = false;
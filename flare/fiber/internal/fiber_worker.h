@@ -2,6 +2,7 @@
 #ifndef FLARE_FIBER_INTERNAL_FIBER_WORKER_H_
 #define FLARE_FIBER_INTERNAL_FIBER_WORKER_H_
 
+#include <algorithm>                                      // std::min
 #include "flare/times/time.h"                             // cpuwide_time_ns
 #include "flare/fiber/internal/schedule_group.h"
 #include "flare/fiber/internal/fiber_entity.h"                     // fiber_id_t, fiber_entity
@@ -37,26 +38,27 @@ namespace flare::fiber_internal {
     // function are updated before returning.
     class fiber_worker {
     public:
-        // Create task `fn(arg)' with attributes `attr' in fiber_worker *pg and put
-        // the identifier into `tid'. Switch to the new task and schedule old task
-        // to run.
-        // Return 0 on success, errno otherwise.
-        static int start_foreground(fiber_worker **pg,
-                                    fiber_id_t *__restrict tid,
-                                    const fiber_attribute *__restrict attr,
-                                    std::function<void*(void*)> && fn,
-                                    void *__restrict arg);
-
-        // Create task `fn(arg)' with attributes `attr' in this fiber_worker, put the
-        // identifier into `tid'. Schedule the new thread to run.
+        // Create task with attributes `attr' and argument `arg' which is not
+        // started yet. The user function should be emplaced into `fn' of the
+        // returned task before starting it by start_foreground() or
+        // start_background().
+        // Returns nullptr when out of memory.
+        static fiber_entity *new_task(const fiber_attribute *__restrict attr,
+                                      void *__restrict arg);
+
+        // Release task `m' created by new_task() which is not started.
+        static void delete_task(fiber_entity *m);
+
+        // Run task `m' created by new_task() in fiber_worker *pg. Switch to the
+        // new task and schedule old task to run.
+        static void start_foreground(fiber_worker **pg, fiber_entity *m);
+
+        // Schedule `n' tasks created by new_task() to run in this fiber_worker.
+        // Workers are signalled once for all tasks without FIBER_NOSIGNAL.
         //   Called from worker: start_background<false>
         //   Called from non-worker: start_background<true>
-        // Return 0 on success, errno otherwise.
         template<bool REMOTE>
-        int start_background(fiber_id_t *__restrict tid,
-                             const fiber_attribute *__restrict attr,
-                             std::function<void*(void*)> && fn,
-                             void *__restrict arg);
+        void start_background(const fiber_id_t *tids, size_t n);
 
         // Suspend caller and run next fiber in fiber_worker *pg.
         static void sched(fiber_worker **pg);
@@ -152,8 +154,6 @@ namespace flare::fiber_internal {
         // Push a fiber into the runqueue from another non-worker thread.
         void ready_to_run_remote(fiber_id_t tid, bool nosignal = false);
 
-        void flush_nosignal_tasks_remote_locked(std::mutex &locked_mutex);
-
         void flush_nosignal_tasks_remote();
 
         // Automatically decide the caller is remote or local, and call
@@ -214,13 +214,35 @@ namespace flare::fiber_internal {
         bool wait_task(fiber_id_t *tid);
 
         bool steal_task(fiber_id_t *tid) {
-            if (_remote_rq.pop(tid)) {
+            if (pop_remote_rq(tid)) {
                 return true;
             }
 #ifndef FIBER_DONT_SAVE_PARKING_STATE
             _last_pl_state = _pl->get_state();
 #endif
-            return _control->steal_task(tid, &_steal_seed, _steal_offset);
+            return _control->steal_task(tid, &_steal_seed, _steal_offset, _numa_node);
+        }
+
+        // Pop at most this number of tasks from _remote_rq at once.
+        static constexpr size_t REMOTE_POP_BATCH = 16;
+
+        // Pop a batch of tasks from _remote_rq, the first one is returned in
+        // `tid' and others are moved into _rq where they can be stolen.
+        bool pop_remote_rq(fiber_id_t *tid) {
+            fiber_id_t tasks[REMOTE_POP_BATCH];
+            // volatile_size() is never less than the actual size when called
+            // by the owner, so pushing into _rq below always succeeds.
+            const size_t rq_free = _rq.capacity() - _rq.volatile_size();
+            const size_t n = _remote_rq.pop_n(tasks, std::min(REMOTE_POP_BATCH, rq_free + 1));
+            if (n == 0) {
+                return false;
+            }
+            *tid = tasks[0];
+            // Reversed so that the owner pops them in order.
+            for (size_t i = n - 1; i > 0; --i) {
+                _rq.push(tasks[i]);
+            }
+            return true;
         }
 
 #ifndef NDEBUG
@@ -247,12 +269,14 @@ namespace flare::fiber_internal {
 #endif
         size_t _steal_seed;
         size_t _steal_offset;
+        // NUMA node that the worker pthread is bound to, -1 if not bound.
+        int _numa_node;
         fiber_contextual_stack *_main_stack;
         fiber_id_t _main_tid;
         WorkStealingQueue<fiber_id_t> _rq;
         RemoteTaskQueue _remote_rq;
-        int _remote_num_nosignal;
-        int _remote_nsignaled;
+        std::atomic<int> _remote_num_nosignal;
+        std::atomic<int> _remote_nsignaled;
     };
 
 }  // namespace flare::fiber_internal
@@ -79,9 +79,12 @@ namespace flare::fiber_internal {
     }
 
     inline void fiber_worker::flush_nosignal_tasks_remote() {
-        if (_remote_num_nosignal) {
-            _remote_rq._mutex.lock();
-            flush_nosignal_tasks_remote_locked(_remote_rq._mutex);
+        if (_remote_num_nosignal.load(std::memory_order_relaxed)) {
+            const int val = _remote_num_nosignal.exchange(0, std::memory_order_relaxed);
+            if (val) {
+                _remote_nsignaled.fetch_add(val, std::memory_order_relaxed);
+                _control->signal_task(val);
+            }
         }
     }
 
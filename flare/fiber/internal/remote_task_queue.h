@@ -3,62 +3,140 @@
 #ifndef FLARE_FIBER_INTERNAL_REMOTE_TASK_QUEUE_H_
 #define FLARE_FIBER_INTERNAL_REMOTE_TASK_QUEUE_H_
 
-#include "flare/container/bounded_queue.h"
+#include <atomic>
+#include <new>
 #include "flare/base/profile.h"
+#include "flare/log/logging.h"
 
 namespace flare::fiber_internal {
 
     class fiber_worker;
 
-    // A queue for storing fibers created by non-workers. Since non-workers
-    // randomly choose a fiber_worker to push which distributes the contentions,
-    // this queue is simply implemented as a queue protected with a lock.
-    // The function names should be self-explanatory.
+    // A queue for storing fibers created by non-workers, which push into a
+    // randomly chosen fiber_worker concurrently. The owner of the queue pops
+    // tasks in batch while other workers steal them one by one.
+    // It's a bounded lock-free queue where each cell carries a sequence
+    // number telling whether the cell is ready to be pushed or popped in the
+    // current lap(Dmitry Vyukov's MPMC queue), push() fails when the queue is
+    // full. Producers and consumers only contend on the cacheline of the
+    // position they're moving.
     class RemoteTaskQueue {
     public:
-        RemoteTaskQueue() {}
+        RemoteTaskQueue() : _cells(NULL), _capacity(0), _head(0), _tail(0) {}
 
+        ~RemoteTaskQueue() {
+            delete[] _cells;
+            _cells = NULL;
+        }
+
+        // `cap' is rounded up to power of 2.
         int init(size_t cap) {
-            const size_t memsize = sizeof(fiber_id_t) * cap;
-            void *q_mem = malloc(memsize);
-            if (q_mem == NULL) {
+            if (_capacity != 0) {
+                FLARE_LOG(ERROR) << "Already initialized";
                 return -1;
             }
-            flare::container::bounded_queue<fiber_id_t> q(q_mem, memsize, flare::container::OWNS_STORAGE);
-            _tasks.swap(q);
+            if (cap == 0) {
+                FLARE_LOG(ERROR) << "Invalid capacity=" << cap;
+                return -1;
+            }
+            size_t capacity = 1;
+            while (capacity < cap) {
+                capacity <<= 1;
+            }
+            _cells = new(std::nothrow) Cell[capacity];
+            if (_cells == NULL) {
+                return -1;
+            }
+            for (size_t i = 0; i < capacity; ++i) {
+                _cells[i].seq.store(i, std::memory_order_relaxed);
+            }
+            _capacity = capacity;
             return 0;
         }
 
-        bool pop(fiber_id_t *task) {
-            if (_tasks.empty()) {
-                return false;
+        // Returns false when the queue is full.
+        bool push(fiber_id_t task) {
+            Cell *cell;
+            size_t pos = _tail.load(std::memory_order_relaxed);
+            while (true) {
+                cell = &_cells[pos & (_capacity - 1)];
+                const size_t seq = cell->seq.load(std::memory_order_acquire);
+                const intptr_t diff = (intptr_t) seq - (intptr_t) pos;
+                if (diff == 0) {
+                    if (_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                        break;
+                    }
+                } else if (diff < 0) {
+                    // The cell is not popped in last lap.
+                    return false;
+                } else {
+                    pos = _tail.load(std::memory_order_relaxed);
+                }
             }
-            _mutex.lock();
-            const bool result = _tasks.pop(task);
-            _mutex.unlock();
-            return result;
+            cell->task = task;
+            cell->seq.store(pos + 1, std::memory_order_release);
+            return true;
         }
 
-        bool push(fiber_id_t task) {
-            _mutex.lock();
-            const bool res = push_locked(task);
-            _mutex.unlock();
-            return res;
+        bool pop(fiber_id_t *task) {
+            return pop_n(task, 1) == 1;
         }
 
-        bool push_locked(fiber_id_t task) {
-            return _tasks.push(task);
+        // Pop at most `max' tasks at once into `tasks'.
+        // Returns number of tasks popped.
+        size_t pop_n(fiber_id_t *tasks, size_t max) {
+            size_t pos = _head.load(std::memory_order_relaxed);
+            size_t n = 0;
+            while (true) {
+                // Count consecutive cells pushed since `pos'.
+                intptr_t diff = 0;
+                for (n = 0; n < max; ++n) {
+                    const size_t seq = _cells[(pos + n) & (_capacity - 1)].seq.load(
+                            std::memory_order_acquire);
+                    diff = (intptr_t) seq - (intptr_t) (pos + n + 1);
+                    if (diff != 0) {
+                        break;
+                    }
+                }
+                if (n == 0) {
+                    if (diff < 0) {
+                        // Empty, or the first task is being pushed.
+                        return 0;
+                    }
+                    // Popped by others.
+                    pos = _head.load(std::memory_order_relaxed);
+                } else if (_head.compare_exchange_weak(pos, pos + n, std::memory_order_relaxed)) {
+                    break;
+                }
+            }
+            for (size_t i = 0; i < n; ++i) {
+                Cell &cell = _cells[(pos + i) & (_capacity - 1)];
+                tasks[i] = cell.task;
+                // Ready to be pushed in next lap.
+                cell.seq.store(pos + i + _capacity, std::memory_order_release);
+            }
+            return n;
         }
 
-        size_t capacity() const { return _tasks.capacity(); }
+        // May be inaccurate when there're concurrent pushes or pops.
+        bool empty() const {
+            return _tail.load(std::memory_order_relaxed) == _head.load(std::memory_order_relaxed);
+        }
 
-    private:
+        size_t capacity() const { return _capacity; }
 
-        friend class fiber_worker;
+    private:
         FLARE_DISALLOW_COPY_AND_ASSIGN(RemoteTaskQueue);
 
-        flare::container::bounded_queue<fiber_id_t> _tasks;
-        std::mutex _mutex;
+        struct Cell {
+            std::atomic<size_t> seq;
+            fiber_id_t task;
+        };
+
+        Cell *_cells;
+        size_t _capacity;
+        std::atomic<size_t> FLARE_CACHELINE_ALIGNMENT _head;
+        std::atomic<size_t> FLARE_CACHELINE_ALIGNMENT _tail;
     };
 
 }  // namespace flare::fiber_internal
@@ -29,6 +29,8 @@
 #include "flare/fiber/internal/fiber_worker.h"           // fiber_worker
 #include "flare/fiber/internal/schedule_group.h"
 #include "flare/fiber/internal/timer_thread.h"         // global_timer_thread
+#include "flare/thread/affinity.h"                       // core_affinity
+#include "flare/io/cord_buf.h"                           // cord_buf
 #include <gflags/gflags.h>
 #include "flare/fiber/internal/log.h"
 
@@ -38,6 +40,10 @@ DEFINE_int32(task_group_runqueue_capacity, 4096,
              "capacity of runqueue in each fiber_worker");
 DEFINE_int32(task_group_yield_before_idle, 0,
              "fiber_worker yields so many times before idle");
+DEFINE_bool(fiber_numa_aware, false,
+            "Bind workers to NUMA nodes round-robin, steal tasks from workers of "
+            "the same node first and allocate stacks and cord_buf blocks from "
+            "memory of the node. Must be set before fiber starts");
 
 namespace flare::fiber_internal {
 
@@ -60,7 +66,22 @@ namespace flare::fiber_internal {
         run_worker_startfn();
 
         schedule_group *c = static_cast<schedule_group *>(arg);
-        fiber_worker *g = c->create_group();
+        int numa_node = -1;
+        if (c->_nnuma_node > 0) {
+            // Skip ids of missing nodes and nodes without cores.
+            flare::core_affinity cores;
+            for (int i = 0; i < c->_nnuma_node && cores.count() == 0; ++i) {
+                numa_node = c->_next_worker_index.fetch_add(1, std::memory_order_relaxed) %
+                            c->_nnuma_node;
+                cores = flare::core_affinity::numa_node(numa_node);
+            }
+            const int rc = cores.bind_current_thread();
+            if (rc != 0) {
+                FLARE_LOG(WARNING) << "Fail to bind worker=" << pthread_self()
+                                   << " to numa node " << numa_node << ", " << flare_error(rc);
+            }
+        }
+        fiber_worker *g = c->create_group(numa_node);
         fiber_statistics stat;
         if (NULL == g) {
             FLARE_LOG(ERROR) << "Fail to create fiber_worker in pthread=" << pthread_self();
@@ -83,12 +104,13 @@ namespace flare::fiber_internal {
         return NULL;
     }
 
-    fiber_worker *schedule_group::create_group() {
+    fiber_worker *schedule_group::create_group(int numa_node) {
         fiber_worker *g = new(std::nothrow) fiber_worker(this);
         if (NULL == g) {
             FLARE_LOG(FATAL) << "Fail to new fiber_worker";
             return NULL;
         }
+        g->_numa_node = numa_node;
         if (g->init(FLAGS_task_group_runqueue_capacity) != 0) {
             FLARE_LOG(ERROR) << "Fail to init fiber_worker";
             delete g;
@@ -130,7 +152,7 @@ namespace flare::fiber_internal {
               _switch_per_second(&_cumulated_switch_count),
               _cumulated_signal_count(get_cumulated_signal_count_from_this, this),
               _signal_per_second(&_cumulated_signal_count), _status(print_rq_sizes_in_the_tc, this),
-              _nfibers("fiber_count") {
+              _nfibers("fiber_count"), _nnuma_node(0), _numa_nodes(NULL), _next_worker_index(0) {
         // calloc shall set memory to zero
         FLARE_CHECK(_groups) << "Fail to create array of groups";
     }
@@ -152,6 +174,10 @@ namespace flare::fiber_internal {
             return -1;
         }
 
+        if (FLAGS_fiber_numa_aware && init_numa_nodes() != 0) {
+            return -1;
+        }
+
         _workers.resize(_concurrency);
         for (int i = 0; i < _concurrency; ++i) {
             const int rc = pthread_create(&_workers[i], NULL, worker_thread, this);
@@ -174,6 +200,32 @@ namespace flare::fiber_internal {
         return 0;
     }
 
+    int schedule_group::init_numa_nodes() {
+        const int nnode = flare::core_affinity::numa_node_count();
+        _numa_nodes = new(std::nothrow) NumaNode[nnode];
+        if (_numa_nodes == NULL) {
+            FLARE_LOG(ERROR) << "Fail to new NumaNode[" << nnode << "]";
+            return -1;
+        }
+        for (int i = 0; i < nnode; ++i) {
+            NumaNode &node = _numa_nodes[i];
+            node.groups = (fiber_worker **) calloc(FIBER_MAX_CONCURRENCY, sizeof(fiber_worker *));
+            FLARE_CHECK(node.groups) << "Fail to create array of groups";
+            node.ngroup.store(0, std::memory_order_relaxed);
+            char name[64];
+            snprintf(name, sizeof(name), "fiber_numa_node%d_local_steal", i);
+            node.local_steal.expose(name, "");
+            snprintf(name, sizeof(name), "fiber_numa_node%d_remote_steal", i);
+            node.remote_steal.expose(name, "");
+        }
+        // Workers are bound before allocating anything, so first touches
+        // of blocks also happen on the node.
+        flare::cord_buf::enable_numa_local_blocks();
+        _nnuma_node = nnode;
+        FLARE_LOG(INFO) << "fiber is numa aware, nodes=" << nnode;
+        return 0;
+    }
+
     int schedule_group::add_workers(int num) {
         if (num <= 0) {
             return 0;
@@ -250,6 +302,13 @@ namespace flare::fiber_internal {
 
         free(_groups);
         _groups = NULL;
+
+        for (int i = 0; i < _nnuma_node; ++i) {
+            free(_numa_nodes[i].groups);
+        }
+        delete[] _numa_nodes;
+        _numa_nodes = NULL;
+        _nnuma_node = 0;
     }
 
     int schedule_group::_add_group(fiber_worker *g) {
@@ -265,6 +324,14 @@ namespace flare::fiber_internal {
             _groups[ngroup] = g;
             _ngroup.store(ngroup + 1, std::memory_order_release);
         }
+        if (g->_numa_node >= 0 && g->_numa_node < _nnuma_node) {
+            NumaNode &node = _numa_nodes[g->_numa_node];
+            const size_t n = node.ngroup.load(std::memory_order_relaxed);
+            if (n < (size_t) FIBER_MAX_CONCURRENCY) {
+                node.groups[n] = g;
+                node.ngroup.store(n + 1, std::memory_order_release);
+            }
+        }
         mu.unlock();
         // See the comments in _destroy_group
         // TODO: Not needed anymore since non-worker pthread cannot have fiber_worker
@@ -309,6 +376,18 @@ namespace flare::fiber_internal {
                     break;
                 }
             }
+            if (g->_numa_node >= 0 && g->_numa_node < _nnuma_node) {
+                // Same as above.
+                NumaNode &node = _numa_nodes[g->_numa_node];
+                const size_t n = node.ngroup.load(std::memory_order_relaxed);
+                for (size_t i = 0; i < n; ++i) {
+                    if (node.groups[i] == g) {
+                        node.groups[i] = node.groups[n - 1];
+                        node.ngroup.store(n - 1, std::memory_order_release);
+                        break;
+                    }
+                }
+            }
         }
 
         // Can't delete g immediately because for performance consideration,
@@ -324,27 +403,21 @@ namespace flare::fiber_internal {
         return 0;
     }
 
-    bool schedule_group::steal_task(fiber_id_t *tid, size_t *seed, size_t offset) {
-        // 1: Acquiring fence is paired with releasing fence in _add_group to
-        // avoid accessing uninitialized slot of _groups.
-        const size_t ngroup = _ngroup.load(std::memory_order_acquire/*1*/);
-        if (0 == ngroup) {
-            return false;
-        }
-
+    fiber_worker *schedule_group::steal_from(fiber_worker **groups, size_t ngroup,
+                                             fiber_id_t *tid, size_t *seed, size_t offset) {
         // NOTE: Don't return inside `for' iteration since we need to update |seed|
-        bool stolen = false;
+        fiber_worker *stolen = NULL;
         size_t s = *seed;
         for (size_t i = 0; i < ngroup; ++i, s += offset) {
-            fiber_worker *g = _groups[s % ngroup];
+            fiber_worker *g = groups[s % ngroup];
             // g is possibly NULL because of concurrent _destroy_group
             if (g) {
                 if (g->_rq.steal(tid)) {
-                    stolen = true;
+                    stolen = g;
                     break;
                 }
                 if (g->_remote_rq.pop(tid)) {
-                    stolen = true;
+                    stolen = g;
                     break;
                 }
             }
@@ -353,6 +426,37 @@ namespace flare::fiber_internal {
         return stolen;
     }
 
+    bool schedule_group::steal_task(fiber_id_t *tid, size_t *seed, size_t offset, int numa_node) {
+        if (numa_node >= 0 && numa_node < _nnuma_node) {
+            NumaNode &node = _numa_nodes[numa_node];
+            // Paired with releasing fence in _add_group as well.
+            const size_t nlocal = node.ngroup.load(std::memory_order_acquire);
+            if (nlocal != 0 && steal_from(node.groups, nlocal, tid, seed, offset)) {
+                node.local_steal << 1;
+                return true;
+            }
+        }
+        // 1: Acquiring fence is paired with releasing fence in _add_group to
+        // avoid accessing uninitialized slot of _groups.
+        const size_t ngroup = _ngroup.load(std::memory_order_acquire/*1*/);
+        if (0 == ngroup) {
+            return false;
+        }
+        fiber_worker *g = steal_from(_groups, ngroup, tid, seed, offset);
+        if (g == NULL) {
+            return false;
+        }
+        if (numa_node >= 0 && numa_node < _nnuma_node) {
+            NumaNode &node = _numa_nodes[numa_node];
+            if (g->_numa_node == numa_node) {
+                node.local_steal << 1;
+            } else {
+                node.remote_steal << 1;
+            }
+        }
+        return true;
+    }
+
     void schedule_group::signal_task(int num_task) {
         if (num_task <= 0) {
             return;
@@ -432,7 +536,7 @@ namespace flare::fiber_internal {
         for (size_t i = 0; i < ngroup; ++i) {
             fiber_worker *g = _groups[i];
             if (g) {
-                c += g->_nsignaled + g->_remote_nsignaled;
+                c += g->_nsignaled + g->_remote_nsignaled.load(std::memory_order_relaxed);
             }
         }
         return c;
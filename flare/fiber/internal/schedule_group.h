@@ -33,11 +33,13 @@ namespace flare::fiber_internal {
         // Must be called before using. `nconcurrency' is # of worker pthreads.
         int init(int nconcurrency);
 
-        // Create a fiber_worker in this control.
-        fiber_worker *create_group();
+        // Create a fiber_worker in this control. `numa_node' is the NUMA node
+        // that the calling worker pthread is bound to, -1 if it's not bound.
+        fiber_worker *create_group(int numa_node);
 
-        // Steal a task from a "random" group.
-        bool steal_task(fiber_id_t *tid, size_t *seed, size_t offset);
+        // Steal a task from a "random" group. When -fiber_numa_aware is on,
+        // groups of `numa_node' are tried before groups of other nodes.
+        bool steal_task(fiber_id_t *tid, size_t *seed, size_t offset, int numa_node);
 
         // Tell other groups that `n' tasks was just added to caller's runqueue
         void signal_task(int num_task);
@@ -74,6 +76,13 @@ namespace flare::fiber_internal {
 
         static void delete_task_group(void *arg);
 
+        // Steal a task from one of `groups', returns the group stolen from.
+        static fiber_worker *steal_from(fiber_worker **groups, size_t ngroup,
+                                        fiber_id_t *tid, size_t *seed, size_t offset);
+
+        // Setup _numa_nodes, called by init() when -fiber_numa_aware is on.
+        int init_numa_nodes();
+
         static void *worker_thread(void *task_control);
 
         flare::LatencyRecorder &exposed_pending_time();
@@ -102,6 +111,21 @@ namespace flare::fiber_internal {
 
         static const int PARKING_LOT_NUM = 4;
         ParkingLot _pl[PARKING_LOT_NUM];
+
+        // Groups bound to one NUMA node.
+        struct NumaNode {
+            fiber_worker **groups;
+            std::atomic<size_t> ngroup;
+            // Tasks stolen by workers of this node from the same node and
+            // from other nodes.
+            flare::gauge<int64_t> local_steal;
+            flare::gauge<int64_t> remote_steal;
+        };
+        // 0 when -fiber_numa_aware is off.
+        int _nnuma_node;
+        NumaNode *_numa_nodes;
+        // Workers are assigned to NUMA nodes round-robin by this index.
+        std::atomic<int> _next_worker_index;
     };
 
     inline flare::LatencyRecorder &schedule_group::exposed_pending_time() {
@@ -19,14 +19,20 @@
 
 // Date: Sun Sep  7 22:37:39 CST 2014
 
+#include <errno.h>
 #include <unistd.h>                               // getpagesize
 #include <sys/mman.h>                             // mmap, munmap, mprotect
 #include <algorithm>                              // std::max
+#include <atomic>
 #include <cstdlib>                               // posix_memalign
+#include <ostream>
+#include "flare/base/profile.h"                   // FLARE_NO_SANITIZE_ADDRESS
 #include "flare/base/singleton_on_pthread_once.h"
 #include "flare/base/dynamic_annotations/dynamic_annotations.h" // RunningOnValgrind
 #include "flare/base/valgrind/valgrind.h"   // VALGRIND_STACK_REGISTER
 #include "flare/metrics/gauge.h"
+#include "flare/memory/numa.h"                    // prefer_numa_node
+#include "flare/thread/affinity.h"                // core_affinity
 #include "flare/fiber/internal/types.h"                        // FIBER_STACKTYPE_*
 #include "flare/fiber/internal/stack.h"
 
@@ -36,6 +42,12 @@ DEFINE_int32(stack_size_large, 8388608, "size of large stacks");
 DEFINE_int32(guard_page_size, 4096, "size of guard page, allocate stacks by malloc if it's 0(not recommended)");
 DEFINE_int32(tc_stack_small, 32, "maximum small stacks cached by each thread");
 DEFINE_int32(tc_stack_normal, 8, "maximum normal stacks cached by each thread");
+DEFINE_bool(fiber_stack_usage_tracking, false, "Sample high-water usage of fiber stacks "
+            "when they're returned to the cache (shown in /fibers) and give back pages "
+            "used beneath -fiber_stack_keep_size with MADV_FREE");
+DEFINE_int32(fiber_stack_keep_size, 65536, "bytes at the top of a cached stack kept "
+             "committed when -fiber_stack_usage_tracking is on");
+DECLARE_bool(fiber_numa_aware);
 
 namespace flare::fiber_internal {
 
@@ -117,6 +129,13 @@ namespace flare::fiber_internal {
                 return -1;
             }
 
+            if (FLAGS_fiber_numa_aware) {
+                // Stacks are allocated by the worker about to run the fiber,
+                // keep them on the node of the worker.
+                flare::prefer_numa_node((char *) mem + guardsize, stacksize,
+                                        flare::core_affinity::current_numa_node());
+            }
+
             s_stack_count.fetch_add(1, std::memory_order_relaxed);
             s->bottom = (char *) mem + memsize;
             s->stacksize = stacksize;
@@ -147,6 +166,140 @@ namespace flare::fiber_internal {
         }
     }
 
+    // Pages of a stack are painted with canaries after being sampled, a page
+    // with anything else in the top words was touched by the last fiber
+    // since stacks grow downwards. Pages never touched or freed by kernel
+    // read as zero.
+    static const uint64_t STACK_CANARY = 0x5a5af1be5a5af1beULL;
+    static const int CANARY_WORDS = 4;
+    // Stop scanning after so many untouched pages in a row, a frame rarely
+    // skips over more than this with uninitialized locals.
+    static const int MAX_UNTOUCHED_GAP = 4;
+    // Usage in [0, 4KB], (4KB, 8KB] ... (4MB, 8MB] and beyond.
+    static const int STACK_USAGE_BUCKETS = 13;
+    static std::atomic<int64_t> s_stack_usage[STACK_USAGE_BUCKETS];
+    static flare::static_atomic<int64_t> s_stack_trimmed_count = FLARE_STATIC_ATOMIC_INIT(0);
+    static flare::static_atomic<int64_t> s_stack_trimmed_bytes = FLARE_STATIC_ATOMIC_INIT(0);
+
+    FLARE_NO_SANITIZE_ADDRESS
+    static bool is_page_touched(const char *page_end) {
+        const uint64_t *words = (const uint64_t *) page_end - CANARY_WORDS;
+        for (int i = 0; i < CANARY_WORDS; ++i) {
+            if (words[i] != 0 && words[i] != STACK_CANARY) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static void paint_canary(char *page_end) {
+        uint64_t *words = (uint64_t *) page_end - CANARY_WORDS;
+        for (int i = 0; i < CANARY_WORDS; ++i) {
+            words[i] = STACK_CANARY;
+        }
+    }
+
+    static int free_pages(void *addr, size_t len) {
+#ifdef MADV_FREE
+        static std::atomic<bool> s_madv_free_unsupported{false};
+        if (!s_madv_free_unsupported.load(std::memory_order_relaxed)) {
+            if (madvise(addr, len, MADV_FREE) == 0) {
+                return 0;
+            }
+            if (errno != EINVAL) {
+                return -1;
+            }
+            // Kernel before 4.5
+            s_madv_free_unsupported.store(true, std::memory_order_relaxed);
+        }
+#endif
+        return madvise(addr, len, MADV_DONTNEED);
+    }
+
+    void trim_stack_storage(fiber_stack_storage *s, const void *sp) {
+        const static int PAGESIZE = getpagesize();
+        // Stacks allocated by malloc are not page-aligned.
+        if (s->guardsize <= 0 || s->bottom == NULL) {
+            return;
+        }
+        char *const top = (char *) s->bottom;
+        const int npages = s->stacksize / PAGESIZE;
+        if ((const char *) sp > top || (const char *) sp < top - (int64_t) npages * PAGESIZE) {
+            return;
+        }
+        // Pages ending above `sp' hold live frames in their top words, they
+        // are counted as used but never scanned, painted or freed.
+        const int nlive = (int) ((top - (const char *) sp + PAGESIZE - 1) / PAGESIZE);
+        int nused = nlive;
+        for (int i = nlive, nuntouched = 0; i < npages; ++i) {
+            if (is_page_touched(top - i * PAGESIZE)) {
+                nused = i + 1;
+                nuntouched = 0;
+            } else if (++nuntouched >= MAX_UNTOUCHED_GAP) {
+                break;
+            }
+        }
+
+        const int64_t usage = (int64_t) nused * PAGESIZE;
+        int bucket = 0;
+        while (bucket + 1 < STACK_USAGE_BUCKETS && (4096LL << bucket) < usage) {
+            ++bucket;
+        }
+        s_stack_usage[bucket].fetch_add(1, std::memory_order_relaxed);
+
+        // Repaint used pages so that next fiber running on this stack is
+        // sampled from scratch, then free the ones beyond the kept size.
+        // Painting before madvise keeps the canaries if kernel does not
+        // reclaim the pages.
+        for (int i = nlive; i < nused; ++i) {
+            paint_canary(top - i * PAGESIZE);
+        }
+        const int nkept = std::max(std::max(FLAGS_fiber_stack_keep_size, 0) / PAGESIZE, nlive);
+        if (nused > nkept) {
+            const size_t len = (size_t) (nused - nkept) * PAGESIZE;
+            if (free_pages(top - nused * PAGESIZE, len) == 0) {
+                s_stack_trimmed_count.fetch_add(1, std::memory_order_relaxed);
+                s_stack_trimmed_bytes.fetch_add(len, std::memory_order_relaxed);
+            } else {
+                FLARE_PLOG_EVERY_SECOND(ERROR) << "Fail to madvise " << (void *) (top - nused * PAGESIZE)
+                                               << " length=" << len;
+            }
+        }
+    }
+
+    void print_stack_usage(std::ostream &os) {
+        if (!FLAGS_fiber_stack_usage_tracking) {
+            os << "Turn on -fiber_stack_usage_tracking to sample usage of stacks";
+            return;
+        }
+        int64_t counts[STACK_USAGE_BUCKETS];
+        int64_t total = 0;
+        int last = 0;
+        for (int i = 0; i < STACK_USAGE_BUCKETS; ++i) {
+            counts[i] = s_stack_usage[i].load(std::memory_order_relaxed);
+            total += counts[i];
+            if (counts[i] != 0) {
+                last = i;
+            }
+        }
+        // A stack may be passed to next fiber directly without going back to
+        // the cache, the sample is the high-water usage of all of them.
+        os << "high-water usage of " << total << " stacks returned to cache:\n";
+        int64_t accumulated = 0;
+        for (int i = 0; i <= last; ++i) {
+            accumulated += counts[i];
+            os << (i + 1 < STACK_USAGE_BUCKETS ? "<=" : ">")
+               << (4 << (i + 1 < STACK_USAGE_BUCKETS ? i : i - 1)) << "KB: " << counts[i];
+            if (total != 0) {
+                os << " (" << accumulated * 100 / total << "%)";
+            }
+            os << '\n';
+        }
+        os << "trimmed " << s_stack_trimmed_count.load(std::memory_order_relaxed)
+           << " stacks, " << s_stack_trimmed_bytes.load(std::memory_order_relaxed)
+           << " bytes in total\n";
+    }
+
     int *SmallStackClass::stack_size_flag = &FLAGS_stack_size_small;
     int *NormalStackClass::stack_size_flag = &FLAGS_stack_size_normal;
     int *LargeStackClass::stack_size_flag = &FLAGS_stack_size_large;
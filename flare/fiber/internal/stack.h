@@ -3,6 +3,7 @@
 #define FLARE_FIBER_INTERNAL_STACK_H_
 
 #include <assert.h>
+#include <iosfwd>
 #include <gflags/gflags.h>          // DECLARE_int32
 #include "flare/fiber/internal/types.h"
 #include "flare/fiber/internal/context.h"        // fiber_context_type
@@ -34,6 +35,17 @@ namespace flare::fiber_internal {
     // corresponding allocate_stack_storage() otherwise behavior is undefined.
     void deallocate_stack_storage(fiber_stack_storage *s);
 
+    // Sample high-water usage of a stack going back to the cache, record it
+    // into the stack usage histogram and give back pages used beneath the
+    // top -fiber_stack_keep_size bytes. Called when
+    // -fiber_stack_usage_tracking is on. The stack must not be running,
+    // frames at or above `sp' (the saved context of the suspended stack)
+    // are live and never written or freed.
+    void trim_stack_storage(fiber_stack_storage *s, const void *sp);
+
+    // Print the histogram of sampled stack usage.
+    void print_stack_usage(std::ostream &os);
+
     enum fiber_stack_type {
         STACK_TYPE_MAIN = 0,
         STACK_TYPE_PTHREAD = FIBER_STACKTYPE_PTHREAD,
@@ -6,6 +6,7 @@
 DECLARE_int32(guard_page_size);
 DECLARE_int32(tc_stack_small);
 DECLARE_int32(tc_stack_normal);
+DECLARE_bool(fiber_stack_usage_tracking);
 
 namespace flare::fiber_internal {
 
@@ -56,6 +57,11 @@ namespace flare::fiber_internal {
         }
 
         static void return_stack(fiber_contextual_stack *sc) {
+            if (FLAGS_fiber_stack_usage_tracking) {
+                // The context is reused by next fiber, it still points to
+                // the suspended frames of the fiber returning the stack.
+                trim_stack_storage(&sc->storage, sc->context);
+            }
             flare::return_object(static_cast<Wrapper *>(sc));
         }
     };
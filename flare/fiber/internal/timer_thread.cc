@@ -18,6 +18,7 @@
 // fiber - A M:N threading library to make applications more concurrent.
 
 
+#include <string.h>                        // memset
 #include <queue>                           // heap functions
 #include "flare/base/scoped_lock.h"
 #include "flare/log/logging.h"
@@ -36,11 +37,14 @@ void run_worker_startfn();
 const TimerThread::TaskId TimerThread::INVALID_TASK_ID = 0;
 
 TimerThreadOptions::TimerThreadOptions()
-    : num_buckets(13) {
+    : num_buckets(13)
+    , use_timing_wheel(false)
+    , wheel_tick_us(1000) {
 }
 
 // A task contains the necessary information for running fn(arg).
 // Tasks are created in Bucket::schedule and destroyed in TimerThread::run
+// or TimerThread::run_wheel
 struct FLARE_CACHELINE_ALIGNMENT TimerThread::Task {
     Task* next;                 // For linking tasks in a Bucket.
     int64_t run_time;           // run the task at this realtime
@@ -71,7 +75,8 @@ class FLARE_CACHELINE_ALIGNMENT TimerThread::Bucket {
 public:
     Bucket()
         : _nearest_run_time(std::numeric_limits<int64_t>::max())
-        , _task_head(NULL) {
+        , _task_head(NULL)
+        , _lockfree_head(NULL) {
     }
 
     ~Bucket() {}
@@ -90,10 +95,115 @@ public:
     // This function is called in timer thread.
     Task* consume_tasks();
 
+    // Schedule a task without locking, used with the timing wheel which
+    // does not need the nearest run time of each bucket.
+    TimerThread::TaskId schedule_lockfree(void (*fn)(void*), void* arg,
+                                          int64_t run_time);
+
+    // Pull all tasks scheduled by schedule_lockfree().
+    // This function is called in timer thread.
+    Task* consume_lockfree_tasks() {
+        if (_lockfree_head.load(std::memory_order_relaxed) == NULL) {
+            return NULL;
+        }
+        return _lockfree_head.exchange(NULL, std::memory_order_acquire);
+    }
+
+    bool has_lockfree_tasks() const {
+        return _lockfree_head.load(std::memory_order_seq_cst) != NULL;
+    }
+
 private:
     internal::FastPthreadMutex _mutex;
     int64_t _nearest_run_time;
     Task* _task_head;
+    // Treiber stack of tasks, pushed by any thread and popped as a whole
+    // by the timer thread, so there's no ABA problem.
+    std::atomic<Task*> _lockfree_head;
+};
+
+// Hierarchical timing wheel owned by the timer thread, not thread-safe.
+//
+// Time is divided into ticks of `tick_us'. A task expiring at tick E is
+// kept in the lowest level L so that E and the current tick differ only in
+// the lowest 8*(L+1) bits, at slot (E >> 8*L) & 255. When the current tick
+// crosses a boundary of level L, the slot of level L being entered is
+// cascaded into lower levels. Tasks more than 2^32 ticks away are kept in
+// an overflow list which is re-dispatched every 2^32 ticks. Adding a task
+// is O(1), a task is moved at most once per level, and bitmaps of
+// non-empty slots make finding the next tick that needs work O(1) as well,
+// so the timer thread sleeps through idle ticks instead of polling them.
+class TimerThread::Wheel {
+public:
+    explicit Wheel(int64_t tick_us)
+        : _tick_us(tick_us)
+        , _current_tick(0)
+        , _overflow(NULL)
+        , _expired(NULL)
+        , _expired_tail(&_expired)
+        , _size(0) {
+        memset(_slots, 0, sizeof(_slots));
+        memset(_bitmap, 0, sizeof(_bitmap));
+    }
+
+    // Start counting ticks from `now_us'.
+    void init(int64_t now_us) { _current_tick = now_us / _tick_us; }
+
+    // Put `task' into the wheel. Tasks already expired are appended to the
+    // list returned by the next advance().
+    void add(Task* task);
+
+    // Move the wheel to the tick of `now_us' and return all expired tasks
+    // as a list linked by Task::next.
+    Task* advance(int64_t now_us);
+
+    // The realtime that advance() has tasks to expire or to cascade,
+    // INT64_MAX when the wheel is empty.
+    int64_t next_run_time() const;
+
+    // Number of tasks in the wheel, including unscheduled ones that are not
+    // deleted yet.
+    size_t size() const { return _size; }
+
+private:
+    static const int LEVELS = 4;
+    static const int SLOT_BITS = 8;
+    static const int SLOTS = 1 << SLOT_BITS;
+    static const int WORDS = SLOTS / 64;
+
+    void place(Task* task, int64_t expire_tick);
+
+    // Move all tasks in `list' into proper slots again.
+    void cascade(Task* list);
+
+    // Detach the tasks in slot `index' of `level'.
+    Task* take_slot(int level, int index) {
+        Task* head = _slots[level][index];
+        _slots[level][index] = NULL;
+        _bitmap[level][index / 64] &= ~(1ul << (index % 64));
+        return head;
+    }
+
+    // First non-empty slot of `level' not less than `from', -1 if none.
+    int find_slot(int level, int from) const;
+
+    // The earliest tick that advance() needs to handle, INT64_MAX if none.
+    int64_t next_event_tick() const;
+
+    int64_t expire_tick_of(const Task* task) const {
+        // Round up so that tasks never run before their run time.
+        return (task->run_time + _tick_us - 1) / _tick_us;
+    }
+
+    const int64_t _tick_us;
+    // Ticks before this one were handled.
+    int64_t _current_tick;
+    Task* _slots[LEVELS][SLOTS];
+    uint64_t _bitmap[LEVELS][WORDS];
+    Task* _overflow;
+    Task* _expired;
+    Task** _expired_tail;
+    size_t _size;
 };
 
 // Utilies for making and extracting TaskId.
@@ -127,6 +237,7 @@ TimerThread::TimerThread()
     , _buckets(NULL)
     , _nearest_run_time(std::numeric_limits<int64_t>::max())
     , _nsignals(0)
+    , _wheel_wakeup_time(std::numeric_limits<int64_t>::min())
     , _thread(0) {
 }
 
@@ -151,6 +262,11 @@ int TimerThread::start(const TimerThreadOptions* options_in) {
         FLARE_LOG(ERROR) << "num_buckets=" << _options.num_buckets << " is too big";
         return EINVAL;
     }
+    if (_options.use_timing_wheel && _options.wheel_tick_us <= 0) {
+        FLARE_LOG(ERROR) << "wheel_tick_us=" << _options.wheel_tick_us
+                         << " must be positive";
+        return EINVAL;
+    }
     _buckets = new (std::nothrow) Bucket[_options.num_buckets];
     if (NULL == _buckets) {
         FLARE_LOG(ERROR) << "Fail to new _buckets";
@@ -214,6 +330,172 @@ TimerThread::Bucket::schedule(void (*fn)(void*), void* arg,
     return result;
 }
 
+TimerThread::TaskId
+TimerThread::Bucket::schedule_lockfree(void (*fn)(void*), void* arg,
+                                       int64_t run_time) {
+    flare::ResourceId<Task> slot_id;
+    Task* task = flare::get_resource<Task>(&slot_id);
+    if (task == NULL) {
+        return INVALID_TASK_ID;
+    }
+    task->fn = fn;
+    task->arg = arg;
+    task->run_time = run_time;
+    uint32_t version = task->version.load(std::memory_order_relaxed);
+    if (version == 0) {  // skip 0.
+        task->version.fetch_add(2, std::memory_order_relaxed);
+        version = 2;
+    }
+    const TaskId id = make_task_id(slot_id, version);
+    task->task_id = id;
+    Task* head = _lockfree_head.load(std::memory_order_relaxed);
+    do {
+        task->next = head;
+        // seq_cst is paired with the check of has_lockfree_tasks() in
+        // TimerThread::run_wheel before sleeping.
+    } while (!_lockfree_head.compare_exchange_weak(
+                 head, task, std::memory_order_seq_cst,
+                 std::memory_order_relaxed));
+    return id;
+}
+
+void TimerThread::Wheel::add(Task* task) {
+    ++_size;
+    const int64_t expire_tick = expire_tick_of(task);
+    if (expire_tick < _current_tick) {
+        task->next = NULL;
+        *_expired_tail = task;
+        _expired_tail = &task->next;
+        return;
+    }
+    place(task, expire_tick);
+}
+
+void TimerThread::Wheel::place(Task* task, int64_t expire_tick) {
+    const uint64_t diff = (uint64_t)expire_tick ^ (uint64_t)_current_tick;
+    for (int level = 0; level < LEVELS; ++level) {
+        if ((diff >> (SLOT_BITS * (level + 1))) == 0) {
+            const int index = (expire_tick >> (SLOT_BITS * level)) & (SLOTS - 1);
+            task->next = _slots[level][index];
+            _slots[level][index] = task;
+            _bitmap[level][index / 64] |= (1ul << (index % 64));
+            return;
+        }
+    }
+    task->next = _overflow;
+    _overflow = task;
+}
+
+void TimerThread::Wheel::cascade(Task* list) {
+    while (list) {
+        Task* next = list->next;
+        --_size;
+        // Drop unscheduled tasks instead of moving them around.
+        if (!list->try_delete()) {
+            add(list);
+        }
+        list = next;
+    }
+}
+
+int TimerThread::Wheel::find_slot(int level, int from) const {
+    if (from >= SLOTS) {
+        return -1;
+    }
+    int word = from / 64;
+    uint64_t bits = _bitmap[level][word] & (~0ul << (from % 64));
+    while (true) {
+        if (bits) {
+            return word * 64 + __builtin_ctzl(bits);
+        }
+        if (++word == WORDS) {
+            return -1;
+        }
+        bits = _bitmap[level][word];
+    }
+}
+
+int64_t TimerThread::Wheel::next_event_tick() const {
+    if (_expired) {
+        return _current_tick;
+    }
+    // A lower level always expires before the next non-empty slot of a
+    // higher level is entered, so the first hit is the earliest one.
+    for (int level = 0; level < LEVELS; ++level) {
+        const int shift = SLOT_BITS * level;
+        const int index = (_current_tick >> shift) & (SLOTS - 1);
+        // The current tick is not handled yet. If it's on a boundary of
+        // this level, e.g. reached by skipping idle ticks, the slot being
+        // entered is not cascaded yet. Otherwise it was cascaded already
+        // and only later slots of higher levels count.
+        const bool entering = (_current_tick & ((1l << shift) - 1)) == 0;
+        const int found = find_slot(level, entering ? index : index + 1);
+        if (found >= 0) {
+            const int64_t base =
+                (_current_tick >> (shift + SLOT_BITS)) << (shift + SLOT_BITS);
+            return base | ((int64_t)found << shift);
+        }
+    }
+    if (_overflow) {
+        const int shift = SLOT_BITS * LEVELS;
+        if ((_current_tick & ((1l << shift) - 1)) == 0) {
+            return _current_tick;
+        }
+        return ((_current_tick >> shift) + 1) << shift;
+    }
+    return std::numeric_limits<int64_t>::max();
+}
+
+int64_t TimerThread::Wheel::next_run_time() const {
+    const int64_t tick = next_event_tick();
+    if (tick == std::numeric_limits<int64_t>::max()) {
+        return tick;
+    }
+    return tick * _tick_us;
+}
+
+TimerThread::Task* TimerThread::Wheel::advance(int64_t now_us) {
+    const int64_t now_tick = now_us / _tick_us;
+    while (_current_tick <= now_tick) {
+        const int64_t tick = next_event_tick();
+        if (tick > now_tick) {
+            // Nothing to do in between, skip idle ticks at once.
+            _current_tick = now_tick + 1;
+            break;
+        }
+        _current_tick = tick;
+        const int overflow_shift = SLOT_BITS * LEVELS;
+        if ((_current_tick & ((1l << overflow_shift) - 1)) == 0 && _overflow) {
+            Task* list = _overflow;
+            _overflow = NULL;
+            cascade(list);
+        }
+        for (int level = LEVELS - 1; level > 0; --level) {
+            const int shift = SLOT_BITS * level;
+            if ((_current_tick & ((1l << shift) - 1)) == 0) {
+                cascade(take_slot(level, (_current_tick >> shift) & (SLOTS - 1)));
+            }
+        }
+        // Expire the whole slot in one batch.
+        Task* list = take_slot(0, _current_tick & (SLOTS - 1));
+        while (list) {
+            Task* next = list->next;
+            list->next = NULL;
+            *_expired_tail = list;
+            _expired_tail = &list->next;
+            list = next;
+        }
+        ++_current_tick;
+    }
+    Task* expired = _expired;
+    for (Task* p = expired; p; p = p->next) {
+        --_size;
+    }
+    _expired = NULL;
+    _expired_tail = &_expired;
+    return expired;
+}
+
 TimerThread::TaskId TimerThread::schedule(
     void (*fn)(void*), void* arg, const timespec& abstime) {
     if (_stop.load(std::memory_order_relaxed) || !_started) {
@@ -221,9 +503,28 @@ TimerThread::TaskId TimerThread::schedule(
         return INVALID_TASK_ID;
     }
     // Hashing by pthread id is better for cache locality.
-    const Bucket::ScheduleResult result = 
-        _buckets[flare::hash::fmix64(pthread_numeric_id()) % _options.num_buckets]
-        .schedule(fn, arg, abstime);
+    Bucket& bucket =
+        _buckets[flare::hash::fmix64(pthread_numeric_id()) % _options.num_buckets];
+    if (_options.use_timing_wheel) {
+        const int64_t run_time = flare::time_point::from_timespec(abstime).to_unix_micros();
+        const TaskId id = bucket.schedule_lockfree(fn, arg, run_time);
+        // Wake up the timer thread only if it sleeps longer than this task
+        // allows. Lowering _wheel_wakeup_time makes later tasks in the same
+        // situation skip the signal.
+        int64_t wakeup_time = _wheel_wakeup_time.load(std::memory_order_seq_cst);
+        while (run_time < wakeup_time) {
+            if (_wheel_wakeup_time.compare_exchange_weak(wakeup_time, run_time)) {
+                {
+                    FLARE_SCOPED_LOCK(_mutex);
+                    ++_nsignals;
+                }
+                futex_wake_private(&_nsignals, 1);
+                break;
+            }
+        }
+        return id;
+    }
+    const Bucket::ScheduleResult result = bucket.schedule(fn, arg, abstime);
     if (result.earlier) {
         bool earlier = false;
         const int64_t run_time =  flare::time_point::from_timespec(abstime).to_unix_micros();
@@ -334,7 +635,13 @@ void TimerThread::run() {
         ntriggered_second.expose_as(_options.variable_prefix, "triggered_second", "");
         busy_seconds_second.expose_as(_options.variable_prefix, "usage", "");
     }
-    
+
+    if (_options.use_timing_wheel) {
+        run_wheel(&nscheduled, &ntriggered, &busy_seconds);
+        BT_VLOG << "Ended TimerThread=" << pthread_self();
+        return;
+    }
+
     while (!_stop.load(std::memory_order_relaxed)) {
         // Clear _nearest_run_time before consuming tasks from buckets.
         // This helps us to be aware of earliest task of the new tasks before we
@@ -430,6 +737,75 @@ void TimerThread::run() {
     BT_VLOG << "Ended TimerThread=" << pthread_self();
 }
 
+void TimerThread::run_wheel(size_t* nscheduled, size_t* ntriggered,
+                            double* busy_seconds) {
+    int64_t last_sleep_time = flare::get_current_time_micros();
+    Wheel wheel(_options.wheel_tick_us);
+    wheel.init(last_sleep_time);
+
+    while (!_stop.load(std::memory_order_relaxed)) {
+        // Don't let schedule() signal us while we're awake, tasks scheduled
+        // from now on are pulled before sleeping.
+        _wheel_wakeup_time.store(std::numeric_limits<int64_t>::min(),
+                                 std::memory_order_seq_cst);
+
+        // Pull tasks from buckets.
+        for (size_t i = 0; i < _options.num_buckets; ++i) {
+            for (Task* p = _buckets[i].consume_lockfree_tasks(); p != NULL;
+                 ++*nscheduled) {
+                Task* next_task = p->next;
+                if (!p->try_delete()) { // remove the task if it's unscheduled
+                    wheel.add(p);
+                }
+                p = next_task;
+            }
+        }
+
+        // Run expired tasks in a batch.
+        for (Task* p = wheel.advance(flare::get_current_time_micros()); p != NULL;) {
+            Task* next_task = p->next;
+            if (p->run_and_delete()) {
+                ++*ntriggered;
+            }
+            p = next_task;
+        }
+
+        const int64_t next_run_time = wheel.next_run_time();
+        _wheel_wakeup_time.store(next_run_time, std::memory_order_seq_cst);
+        int expected_nsignals = 0;
+        {
+            FLARE_SCOPED_LOCK(_mutex);
+            expected_nsignals = _nsignals;
+        }
+        if (_stop.load(std::memory_order_relaxed)) {
+            break;
+        }
+        // Tasks pushed before schedule() saw _wheel_wakeup_time are still
+        // in buckets, pull them instead of sleeping. Otherwise the pusher
+        // bumps _nsignals after we read it and the futex won't block.
+        bool has_new_tasks = false;
+        for (size_t i = 0; i < _options.num_buckets; ++i) {
+            if (_buckets[i].has_lockfree_tasks()) {
+                has_new_tasks = true;
+                break;
+            }
+        }
+        const int64_t now = flare::get_current_time_micros();
+        if (has_new_tasks || next_run_time <= now) {
+            continue;
+        }
+        timespec* ptimeout = NULL;
+        timespec next_timeout = { 0, 0 };
+        if (next_run_time != std::numeric_limits<int64_t>::max()) {
+            next_timeout = flare::duration::microseconds(next_run_time - now).to_timespec();
+            ptimeout = &next_timeout;
+        }
+        *busy_seconds += (now - last_sleep_time) / 1000000.0;
+        futex_wait_private(&_nsignals, expected_nsignals, ptimeout);
+        last_sleep_time = flare::get_current_time_micros();
+    }
+}
+
 void TimerThread::stop_and_join() {
     _stop.store(true, std::memory_order_relaxed);
     if (_started) {
@@ -24,6 +24,17 @@ struct TimerThreadOptions {
     // Default: ""
     std::string variable_prefix;
 
+    // Keep scheduled tasks in a hierarchical timing wheel instead of a
+    // binary heap. schedule() then pushes into the bucket without locking
+    // and the timer thread expires tasks one tick at a time, so a task may
+    // run up to `wheel_tick_us' later than its run time.
+    // Default: false
+    bool use_timing_wheel;
+
+    // Granularity of the timing wheel in microseconds.
+    // Default: 1000
+    int64_t wheel_tick_us;
+
     // Constructed with default options.
     TimerThreadOptions();
 };
@@ -35,6 +46,7 @@ class TimerThread {
 public:
     struct Task;
     class Bucket;
+    class Wheel;
 
     typedef uint64_t TaskId;
     const static TaskId INVALID_TASK_ID;
@@ -71,6 +83,9 @@ private:
     void run();
     static void* run_this(void* arg);
 
+    // Loop of the timer thread when _options.use_timing_wheel is true.
+    void run_wheel(size_t* nscheduled, size_t* ntriggered, double* busy_seconds);
+
     bool _started;            // whether the timer thread was started successfully.
     std::atomic<bool> _stop;
 
@@ -81,6 +96,10 @@ private:
     // the futex for wake up timer thread. can't use _nearest_run_time because
     // it's 64-bit.
     int _nsignals;
+    // The realtime that the timer thread running the timing wheel sleeps
+    // until, INT64_MIN when it's awake. schedule() wakes the thread up only
+    // if the new task is earlier than this value.
+    std::atomic<int64_t> _wheel_wakeup_time;
     pthread_t _thread;       // all scheduled task will be run on this thread
 };
 
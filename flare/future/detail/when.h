@@ -0,0 +1,168 @@
+
+/****************************************************************
+ * Copyright (c) 2022, liyinbin
+ * All rights reserved.
+ * Author by liyinbin (jeff.li) lijippy@163.com
+ *****************************************************************/
+
+#ifndef FLARE_FUTURE_DETAIL_WHEN_H_
+#define FLARE_FUTURE_DETAIL_WHEN_H_
+
+
+#include <algorithm>
+#include <optional>
+#include <vector>
+#include "flare/future/detail/utility.h"
+
+namespace flare::future_internal {
+
+    template<typename Alloc, typename T>
+    struct any_landing {
+        std::atomic<bool> done_ = false;
+
+        using storage_type = future_storage<Alloc, std::size_t, T>;
+        storage_ptr <storage_type> dst_;
+
+        void ping(std::size_t index, expected <T, std::exception_ptr> &&e) {
+            if (!done_.exchange(true, std::memory_order_acq_rel)) {
+                dst_->finish(std::make_tuple(expected<std::size_t, std::exception_ptr>(index),
+                                             std::move(e)));
+            }
+        }
+    };
+
+    template<typename Alloc, typename T>
+    struct all_landing {
+        using result_type = std::vector<expected < T, std::exception_ptr>>;
+        using storage_type = future_storage<Alloc, result_type>;
+
+        // Filled at arbitrary order, moved into the result once all are done.
+        std::vector<std::optional<expected < T, std::exception_ptr>>> landing_;
+        std::atomic<std::size_t> full_filled_ = 0;
+        storage_ptr <storage_type> dst_;
+
+        explicit all_landing(std::size_t n) : landing_(n) {}
+
+        void ping(std::size_t index, expected <T, std::exception_ptr> &&e) {
+            landing_[index].emplace(std::move(e));
+            if (full_filled_.fetch_add(1, std::memory_order_acq_rel) + 1 == landing_.size()) {
+                finish();
+            }
+        }
+
+        void finish() {
+            result_type result;
+            result.reserve(landing_.size());
+            for (auto &e : landing_) {
+                result.push_back(std::move(*e));
+            }
+            dst_->full_fill(std::make_tuple(std::move(result)));
+        }
+    };
+
+    // Keeps at most `max_in_flight' futures made by `make_' pending.
+    template<typename Alloc, typename T, typename MakeT>
+    struct bounded_all_landing : public all_landing<Alloc, T> {
+        MakeT make_;
+        std::atomic<std::size_t> next_ = 0;
+        // Number of futures to launch, the thread seeing 0 launches them
+        // until it's back to 0. A future finishing inline in launch() only
+        // bumps the counter instead of recursing.
+        std::atomic<std::size_t> to_launch_ = 0;
+
+        bounded_all_landing(std::size_t n, MakeT make)
+                : all_landing<Alloc, T>(n), make_(std::move(make)) {}
+
+        static void launch(const std::shared_ptr<bounded_all_landing> &l) {
+            if (l->to_launch_.fetch_add(1, std::memory_order_acq_rel) != 0) {
+                return;
+            }
+            do {
+                const std::size_t i = l->next_.fetch_add(1, std::memory_order_relaxed);
+                if (i >= l->landing_.size()) {
+                    continue;
+                }
+                std::optional<std::decay_t<decltype(l->make_(i))>> fut;
+                try {
+                    fut.emplace(l->make_(i));
+                } catch (...) {
+                    // Fails slot `i' instead of throwing out of continuation
+                    // of another future, and launches the next one.
+                    l->ping(i, flare::unexpected_type<std::exception_ptr>{std::current_exception()});
+                    launch(l);
+                    continue;
+                }
+                fut->finally([l, i](expected <T, std::exception_ptr> &&e) {
+                    l->ping(i, std::move(e));
+                    launch(l);
+                });
+            } while (l->to_launch_.fetch_sub(1, std::memory_order_acq_rel) != 1);
+        }
+    };
+
+}  // namespace flare::future_internal
+
+namespace flare {
+
+    template<typename Alloc, typename T>
+    basic_future<Alloc, std::size_t, T> when_any(std::vector<basic_future<Alloc, T>> &&futs) {
+        using landing_type = future_internal::any_landing<Alloc, T>;
+        using fut_type = typename landing_type::storage_type::future_type;
+        assert(!futs.empty());
+
+        auto landing = std::make_shared<landing_type>();
+        landing->dst_.allocate(futs.front().allocator());
+        for (std::size_t i = 0; i < futs.size(); ++i) {
+            futs[i].finally([landing, i](expected<T, std::exception_ptr> &&e) {
+                landing->ping(i, std::move(e));
+            });
+        }
+        futs.clear();
+        return fut_type{landing->dst_};
+    }
+
+    template<typename Alloc, typename T>
+    basic_future<Alloc, std::vector<expected<T, std::exception_ptr>>>
+    when_all(std::vector<basic_future<Alloc, T>> &&futs) {
+        using landing_type = future_internal::all_landing<Alloc, T>;
+        using fut_type = typename landing_type::storage_type::future_type;
+
+        auto landing = std::make_shared<landing_type>(futs.size());
+        landing->dst_.allocate(futs.empty() ? Alloc() : futs.front().allocator());
+        if (futs.empty()) {
+            landing->finish();
+        }
+        for (std::size_t i = 0; i < futs.size(); ++i) {
+            futs[i].finally([landing, i](expected<T, std::exception_ptr> &&e) {
+                landing->ping(i, std::move(e));
+            });
+        }
+        futs.clear();
+        return fut_type{landing->dst_};
+    }
+
+    template<typename MakeT>
+    auto when_all(std::size_t n, std::size_t max_in_flight, MakeT &&make) {
+        using fut_t = std::decay_t<decltype(make(std::size_t()))>;
+        static_assert(is_future_v<fut_t>, "`make' should return a future");
+        using alloc_type = typename fut_t::allocator_type;
+        using value_type = typename fut_t::value_type;
+        using landing_type = future_internal::bounded_all_landing<alloc_type, value_type,
+                std::decay_t<MakeT>>;
+        using fut_type = typename landing_type::storage_type::future_type;
+
+        auto landing = std::make_shared<landing_type>(n, std::forward<MakeT>(make));
+        landing->dst_.allocate(alloc_type());
+        auto result = fut_type{landing->dst_};
+        if (n == 0) {
+            landing->finish();
+        }
+        for (std::size_t i = 0; i < std::min(n, std::max<std::size_t>(max_in_flight, 1)); ++i) {
+            landing_type::launch(landing);
+        }
+        return result;
+    }
+
+}  // namespace flare
+
+#endif  // FLARE_FUTURE_DETAIL_WHEN_H_
@@ -12,6 +12,7 @@
 
 #include <memory>
 #include <string>
+#include <vector>
 
 namespace flare {
 
@@ -299,6 +300,53 @@ namespace flare {
     template <typename... FutTs>
     auto join(FutTs&&... futures);
 
+    /**
+     * @brief Creates a future that is finished once any of the futures is
+     *        finished, with the index and the outcome of that future.
+     *
+     * @tparam Alloc
+     * @tparam T
+     * @param futures must not be empty
+     * @return basic_future<Alloc, std::size_t, T>
+     *
+     * @post `futures` will be empty.
+     */
+    template <typename Alloc, typename T>
+    basic_future<Alloc, std::size_t, T> when_any(std::vector<basic_future<Alloc, T>>&& futures);
+
+    /**
+     * @brief Ties a vector of future<> into a single future<> that is full_filled
+     *        with the outcome of each future once all of them are finished.
+     *
+     * @tparam Alloc
+     * @tparam T
+     * @param futures
+     * @return basic_future<Alloc, std::vector<expected<T, std::exception_ptr>>>
+     *
+     * @post `futures` will be empty.
+     */
+    template <typename Alloc, typename T>
+    basic_future<Alloc, std::vector<expected<T, std::exception_ptr>>>
+    when_all(std::vector<basic_future<Alloc, T>>&& futures);
+
+    /**
+     * @brief Like when_all() above, but the futures are created by `make(i)`
+     *        for i in [0, n) on demand, keeping at most `max_in_flight` of them
+     *        unfinished, which bounds fan-out over large inputs.
+     *
+     * `make` is called in the caller and then in whichever thread finishes a
+     * previous future. If `make(i)` throws, the i-th result holds the
+     * exception.
+     *
+     * @tparam MakeT
+     * @param n
+     * @param max_in_flight
+     * @param make
+     * @return auto
+     */
+    template <typename MakeT>
+    auto when_all(std::size_t n, std::size_t max_in_flight, MakeT&& make);
+
     // Convenience function that creates a promise for the result of the cb, pushes
     // cb in q, and returns a future to that promise.
 
@@ -343,5 +391,6 @@ namespace flare {
 #include "flare/future/detail/join.h"
 #include "flare/future/detail/promise.h"
 #include "flare/future/detail/storage_impl.h"
+#include "flare/future/detail/when.h"
 
 #endif  // FLARE_FUTURE_FUTURE_H_
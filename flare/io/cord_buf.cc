@@ -24,14 +24,24 @@
 #include <fcntl.h>                         // O_RDONLY
 #include <errno.h>                         // errno
 #include <limits.h>                        // CHAR_BIT
+#include <sys/socket.h>                    // sendmsg
 #include <stdexcept>                       // std::invalid_argument
+#include <mutex>                           // std::mutex
+#include <vector>                          // std::vector
+#include <sys/mman.h>                      // mmap
 #include "flare/base/static_atomic.h"                // std::atomic
 #include "flare/thread/thread.h"             // thread_atexit
+#include "flare/thread/affinity.h"           // core_affinity
+#include "flare/memory/numa.h"               // prefer_numa_node
 #include "flare/log/logging.h"                  // FLARE_CHECK, FLARE_LOG
 #include "flare/base/fd_guard.h"                 // flare::base::fd_guard
 #include "flare/io/cord_buf.h"
 #include "flare/base/profile.h"
 
+#if defined(FLARE_PLATFORM_LINUX) && !defined(MSG_ZEROCOPY)
+#define MSG_ZEROCOPY 0x4000000
+#endif
+
 namespace flare {
 
     namespace iobuf {
@@ -155,15 +165,378 @@ namespace flare {
             return memcpy(dest, src, n);
         }
 
-        // Function pointers to allocate or deallocate memory for a cord_buf::Block
-        void *(*blockmem_allocate)(size_t) = ::malloc;
+        // Function pointers to allocate or deallocate memory for a cord_buf::Block.
+        // They may be replaced while other threads are using cord_buf, the
+        // deallocator is always stored before the allocator, so whoever sees
+        // a block from the new allocator also sees the new deallocator.
+        std::atomic<void *(*)(size_t)> blockmem_allocate(::malloc);
 
-        void (*blockmem_deallocate)(void *) = ::free;
+        std::atomic<void (*)(void *)> blockmem_deallocate(::free);
 
         // Use default function pointers
         void reset_blockmem_allocate_and_deallocate() {
-            blockmem_allocate = ::malloc;
-            blockmem_deallocate = ::free;
+            blockmem_deallocate.store(::free, std::memory_order_release);
+            blockmem_allocate.store(::malloc, std::memory_order_release);
+        }
+
+        // Free blocks of DEFAULT_BLOCK_SIZE carved from chunks of memory, used
+        // by the NUMA-local and the hugepage block allocators below. Each
+        // thread caches free blocks of its home pool and exchanges them with
+        // the pool in batches of BLOCK_BATCH, so the pool mutex is taken once
+        // per batch. Chunks are never returned to the system.
+        const int BLOCK_BATCH = 32;
+        // A thread holding more free blocks than this gives a batch back.
+        const int MAX_POOLED_BLOCKS_PER_THREAD = 2 * BLOCK_BATCH;
+
+        struct BlockThreadCache;
+
+        struct BlockPool {
+            std::mutex mutex;
+            // Batches of at most BLOCK_BATCH blocks linked through the first word.
+            std::vector<void *> batches;
+            size_t num_pooled;
+            // Blocks are carved from [chunk_begin, chunk_end).
+            char *chunk_begin;
+            char *chunk_end;
+            // Reset [chunk_begin, chunk_end) to a new chunk, called with
+            // `mutex' held. Returns false if no more chunks can be added.
+            bool (*add_chunk)(BlockPool *pool);
+            int node;  // NUMA node of the chunks, used by add_chunk.
+            // Threads having a cache of this pool, for stats.
+            BlockThreadCache *threads;
+        };
+
+        void init_block_pool(BlockPool *pool, bool (*add_chunk)(BlockPool *), int node) {
+            pool->num_pooled = 0;
+            pool->chunk_begin = NULL;
+            pool->chunk_end = NULL;
+            pool->add_chunk = add_chunk;
+            pool->node = node;
+            pool->threads = NULL;
+        }
+
+        struct BlockThreadCache {
+            BlockPool *pool;
+            void *free_list;  // Linked through the first word of blocks.
+            // Only written by the owner, read by get_hugepage_block_stats().
+            std::atomic<int> num_free;
+            BlockThreadCache *prev;
+            BlockThreadCache *next;
+        };
+
+        // Only one block allocator can be installed, so is the cache.
+        static __thread BlockThreadCache *tls_block_cache = NULL;
+        // Set when the thread cache was flushed at thread exit, blocks freed
+        // by later exit handlers go to their pools directly.
+        static __thread bool tls_block_cache_exited = false;
+
+        // Cut the first `n' blocks (or less) off `*list'. Returns the head of
+        // the cut and sets `*ncut' to its length.
+        inline void *cut_block_batch(void **list, int n, int *ncut) {
+            void *head = *list;
+            void *tail = head;
+            int i = 1;
+            for (; i < n && *(void **) tail; ++i) {
+                tail = *(void **) tail;
+            }
+            *list = *(void **) tail;
+            *(void **) tail = NULL;
+            *ncut = i;
+            return head;
+        }
+
+        void flush_block_thread_cache() {
+            BlockThreadCache *c = tls_block_cache;
+            tls_block_cache_exited = true;
+            if (c == NULL) {
+                return;
+            }
+            tls_block_cache = NULL;
+            BlockPool &pool = *c->pool;
+            std::unique_lock<std::mutex> mu(pool.mutex);
+            // Refilling accepts batches of any length.
+            while (c->free_list) {
+                int n = 0;
+                pool.batches.push_back(cut_block_batch(&c->free_list, BLOCK_BATCH, &n));
+                pool.num_pooled += n;
+            }
+            if (c->prev) {
+                c->prev->next = c->next;
+            } else {
+                pool.threads = c->next;
+            }
+            if (c->next) {
+                c->next->prev = c->prev;
+            }
+            mu.unlock();
+            delete c;
+        }
+
+        BlockThreadCache *new_block_thread_cache(BlockPool *(*home_pool)()) {
+            BlockThreadCache *c = new BlockThreadCache;
+            c->pool = home_pool();
+            c->free_list = NULL;
+            c->num_free.store(0, std::memory_order_relaxed);
+            c->prev = NULL;
+            {
+                std::unique_lock<std::mutex> mu(c->pool->mutex);
+                c->next = c->pool->threads;
+                if (c->pool->threads) {
+                    c->pool->threads->prev = c;
+                }
+                c->pool->threads = c;
+            }
+            tls_block_cache = c;
+            flare::thread::atexit(flush_block_thread_cache);
+            return c;
+        }
+
+        inline BlockThreadCache *get_block_thread_cache(BlockPool *(*home_pool)()) {
+            BlockThreadCache *c = tls_block_cache;
+            if (FLARE_LIKELY(c != NULL)) {
+                return c;
+            }
+            return new_block_thread_cache(home_pool);
+        }
+
+        // Refill an empty thread cache with a batch from its pool, or carve
+        // one from the current chunk. Returns number of blocks got.
+        int refill_block_thread_cache(BlockThreadCache *c, size_t size) {
+            BlockPool &pool = *c->pool;
+            std::unique_lock<std::mutex> mu(pool.mutex);
+            if (!pool.batches.empty()) {
+                c->free_list = pool.batches.back();
+                pool.batches.pop_back();
+                int n = 0;
+                for (void *p = c->free_list; p; p = *(void **) p) {
+                    ++n;
+                }
+                pool.num_pooled -= n;
+                return n;
+            }
+            void *head = NULL;
+            int n = 0;
+            for (; n < BLOCK_BATCH; ++n) {
+                if (pool.chunk_begin + size > pool.chunk_end && !pool.add_chunk(&pool)) {
+                    break;
+                }
+                void *mem = pool.chunk_begin;
+                pool.chunk_begin += size;
+                *(void **) mem = head;
+                head = mem;
+            }
+            c->free_list = head;
+            return n;
+        }
+
+        // Allocate a block from the cache of the calling thread, which is
+        // bound to home_pool() at the first time.
+        inline void *allocate_pooled_block(size_t size, BlockPool *(*home_pool)()) {
+            if (size != cord_buf::DEFAULT_BLOCK_SIZE || tls_block_cache_exited) {
+                return ::malloc(size);
+            }
+            BlockThreadCache *c = get_block_thread_cache(home_pool);
+            int n = c->num_free.load(std::memory_order_relaxed);
+            if (c->free_list == NULL) {
+                n = refill_block_thread_cache(c, size);
+                if (n == 0) {
+                    // No more chunks can be added.
+                    return ::malloc(size);
+                }
+            }
+            void *mem = c->free_list;
+            c->free_list = *(void **) mem;
+            c->num_free.store(n - 1, std::memory_order_relaxed);
+            return mem;
+        }
+
+        // Free a block carved from `pool' into the cache of the calling thread.
+        inline void deallocate_pooled_block(BlockPool *pool, void *mem, BlockPool *(*home_pool)()) {
+            BlockThreadCache *c = (tls_block_cache_exited ? NULL : get_block_thread_cache(home_pool));
+            if (c == NULL || c->pool != pool) {
+                // Blocks of other pools go home, which is rare for threads
+                // bound to NUMA nodes. So do blocks freed after the cache is
+                // flushed at thread exit.
+                *(void **) mem = NULL;
+                std::unique_lock<std::mutex> mu(pool->mutex);
+                pool->batches.push_back(mem);
+                ++pool->num_pooled;
+                return;
+            }
+            *(void **) mem = c->free_list;
+            c->free_list = mem;
+            int n = c->num_free.load(std::memory_order_relaxed) + 1;
+            if (n > MAX_POOLED_BLOCKS_PER_THREAD) {
+                // Hand the most recently freed batch to the pool, the rest
+                // stays warm in this thread.
+                int ncut = 0;
+                void *head = cut_block_batch(&c->free_list, BLOCK_BATCH, &ncut);
+                n -= ncut;
+                std::unique_lock<std::mutex> mu(pool->mutex);
+                pool->batches.push_back(head);
+                pool->num_pooled += ncut;
+            }
+            c->num_free.store(n, std::memory_order_relaxed);
+        }
+
+        // Replace the allocator of blocks while other threads may be using
+        // cord_buf.
+        void install_blockmem_allocator(void *(*allocate)(size_t), void (*deallocate)(void *)) {
+            // Install the deallocator first, it handles blocks of the old
+            // allocator (::malloc) as well.
+            blockmem_deallocate.store(deallocate, std::memory_order_release);
+            blockmem_allocate.store(allocate, std::memory_order_release);
+        }
+
+        // Blocks carved from chunks bound to one NUMA node, installed by
+        // cord_buf::enable_numa_local_blocks(). A freed block goes back to the
+        // pool of the node owning its chunk, which is found by the address of
+        // the chunk in g_numa_chunks. Memory not in any chunk came from ::malloc.
+        const size_t NUMA_CHUNK_SIZE = 2 * 1024 * 1024;
+        const size_t MAX_NUMA_CHUNKS = 65536;  // Must be power of 2.
+
+        BlockPool *g_numa_pools = NULL;
+        int g_numa_pool_count = 0;
+        // Insert-only open-addressing table of chunk address | node.
+        std::atomic<uintptr_t> g_numa_chunks[MAX_NUMA_CHUNKS];
+
+        inline size_t numa_chunk_slot(uintptr_t chunk) {
+            return ((chunk / NUMA_CHUNK_SIZE) * 0x9E3779B97F4A7C15ULL >> 48) & (MAX_NUMA_CHUNKS - 1);
+        }
+
+        // Returns the node owning the chunk of `mem', -1 if `mem' is not in any chunk.
+        int numa_node_of_block(const void *mem) {
+            const uintptr_t chunk = (uintptr_t) mem & ~(NUMA_CHUNK_SIZE - 1);
+            size_t slot = numa_chunk_slot(chunk);
+            for (size_t i = 0; i < MAX_NUMA_CHUNKS; ++i) {
+                const uintptr_t v = g_numa_chunks[slot].load(std::memory_order_acquire);
+                if (v == 0) {
+                    return -1;
+                }
+                if ((v & ~(NUMA_CHUNK_SIZE - 1)) == chunk) {
+                    return (int) (v & (NUMA_CHUNK_SIZE - 1));
+                }
+                slot = (slot + 1) & (MAX_NUMA_CHUNKS - 1);
+            }
+            return -1;
+        }
+
+        bool register_numa_chunk(char *chunk, int node) {
+            const uintptr_t v = (uintptr_t) chunk | (uintptr_t) node;
+            size_t slot = numa_chunk_slot((uintptr_t) chunk);
+            // Keep the table at most half full to make probing short.
+            static std::atomic<size_t> nchunk(0);
+            if (nchunk.fetch_add(1, std::memory_order_relaxed) >= MAX_NUMA_CHUNKS / 2) {
+                nchunk.fetch_sub(1, std::memory_order_relaxed);
+                return false;
+            }
+            for (size_t i = 0; i < MAX_NUMA_CHUNKS; ++i) {
+                uintptr_t expected = 0;
+                if (g_numa_chunks[slot].compare_exchange_strong(
+                        expected, v, std::memory_order_release, std::memory_order_relaxed)) {
+                    return true;
+                }
+                slot = (slot + 1) & (MAX_NUMA_CHUNKS - 1);
+            }
+            return false;
+        }
+
+        // Map a chunk aligned to NUMA_CHUNK_SIZE and bind it to the node of `pool'.
+        bool add_numa_chunk(BlockPool *pool) {
+            char *mem = (char *) mmap(NULL, NUMA_CHUNK_SIZE * 2, PROT_READ | PROT_WRITE,
+                                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (mem == MAP_FAILED) {
+                return false;
+            }
+            char *chunk = (char *) (((uintptr_t) mem + NUMA_CHUNK_SIZE - 1) & ~(NUMA_CHUNK_SIZE - 1));
+            if (chunk != mem) {
+                munmap(mem, chunk - mem);
+            }
+            munmap(chunk + NUMA_CHUNK_SIZE, mem + NUMA_CHUNK_SIZE * 2 - (chunk + NUMA_CHUNK_SIZE));
+            // Pages are touched by threads of the node anyway, binding makes
+            // it explicit for pages first touched by others.
+            prefer_numa_node(chunk, NUMA_CHUNK_SIZE, pool->node);
+            if (!register_numa_chunk(chunk, pool->node)) {
+                munmap(chunk, NUMA_CHUNK_SIZE);
+                return false;
+            }
+            pool->chunk_begin = chunk;
+            pool->chunk_end = chunk + NUMA_CHUNK_SIZE;
+            return true;
+        }
+
+        BlockPool *home_numa_pool() {
+            int node = flare::core_affinity::current_numa_node();
+            if (node < 0 || node >= g_numa_pool_count) {
+                node = 0;
+            }
+            return &g_numa_pools[node];
+        }
+
+        void *numa_blockmem_allocate(size_t size) {
+            return allocate_pooled_block(size, home_numa_pool);
+        }
+
+        void numa_blockmem_deallocate(void *mem) {
+            const int node = numa_node_of_block(mem);
+            if (node < 0) {
+                return ::free(mem);
+            }
+            deallocate_pooled_block(&g_numa_pools[node], mem, home_numa_pool);
+        }
+
+        // Blocks carved from 2MB slabs backed by transparent huge pages,
+        // installed by cord_buf::enable_hugepage_blocks(). Slabs are committed
+        // one by one from a virtual range reserved up front, so whether a
+        // block came from a slab is told by its address.
+        const size_t HUGEPAGE_SLAB_SIZE = 2 * 1024 * 1024;
+
+        BlockPool *g_hp_pool = NULL;
+        char *g_hp_reserved_begin = NULL;
+        char *g_hp_reserved_end = NULL;
+        char *g_hp_committed_end = NULL;  // Guarded by g_hp_pool->mutex
+        flare::static_atomic<size_t> g_hp_slabs = FLARE_STATIC_ATOMIC_INIT(0);
+
+        inline bool in_hugepage_slabs(const void *mem) {
+            return (const char *) mem >= g_hp_reserved_begin &&
+                   (const char *) mem < g_hp_reserved_end;
+        }
+
+        // Commit the next slab of the reserved range.
+        bool commit_hugepage_slab(BlockPool *pool) {
+            char *slab = g_hp_committed_end;
+            if (slab + HUGEPAGE_SLAB_SIZE > g_hp_reserved_end) {
+                return false;
+            }
+            if (mprotect(slab, HUGEPAGE_SLAB_SIZE, PROT_READ | PROT_WRITE) != 0) {
+                FLARE_PLOG_EVERY_SECOND(WARNING) << "Fail to commit hugepage slab";
+                return false;
+            }
+#ifdef MADV_HUGEPAGE
+            // Fails harmlessly when THP is disabled, blocks are still carved
+            // from the slab but backed by normal pages.
+            madvise(slab, HUGEPAGE_SLAB_SIZE, MADV_HUGEPAGE);
+#endif
+            g_hp_committed_end = slab + HUGEPAGE_SLAB_SIZE;
+            pool->chunk_begin = slab;
+            pool->chunk_end = slab + HUGEPAGE_SLAB_SIZE;
+            g_hp_slabs.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+
+        BlockPool *home_hugepage_pool() {
+            return g_hp_pool;
+        }
+
+        void *hugepage_blockmem_allocate(size_t size) {
+            return allocate_pooled_block(size, home_hugepage_pool);
+        }
+
+        void hugepage_blockmem_deallocate(void *mem) {
+            if (!in_hugepage_slabs(mem)) {
+                return ::free(mem);
+            }
+            deallocate_pooled_block(g_hp_pool, mem, home_hugepage_pool);
         }
 
         flare::static_atomic<size_t> g_nblock = FLARE_STATIC_ATOMIC_INIT(0);
@@ -184,6 +557,82 @@ namespace flare {
         return iobuf::g_newbigview.load(std::memory_order_relaxed);
     }
 
+    void cord_buf::enable_numa_local_blocks() {
+        static std::once_flag once;
+        std::call_once(once, [] {
+            if (iobuf::blockmem_allocate.load(std::memory_order_acquire) != ::malloc) {
+                FLARE_LOG(WARNING) << "cord_buf blocks are already allocated by "
+                                      "another allocator, NUMA-local blocks are not enabled";
+                return;
+            }
+            const int nnode = flare::core_affinity::numa_node_count();
+            iobuf::g_numa_pools = new iobuf::BlockPool[nnode];
+            for (int i = 0; i < nnode; ++i) {
+                iobuf::init_block_pool(&iobuf::g_numa_pools[i], iobuf::add_numa_chunk, i);
+            }
+            iobuf::g_numa_pool_count = nnode;
+            iobuf::install_blockmem_allocator(iobuf::numa_blockmem_allocate,
+                                              iobuf::numa_blockmem_deallocate);
+        });
+    }
+
+    bool cord_buf::enable_hugepage_blocks(size_t max_memory) {
+        static std::once_flag once;
+        static bool enabled = false;
+        std::call_once(once, [max_memory] {
+            if (iobuf::blockmem_allocate.load(std::memory_order_acquire) != ::malloc) {
+                FLARE_LOG(WARNING) << "cord_buf blocks are already allocated by "
+                                      "another allocator, hugepage blocks are not enabled";
+                return;
+            }
+            const size_t slab = iobuf::HUGEPAGE_SLAB_SIZE;
+            const size_t len = (max_memory + slab - 1) / slab * slab;
+            if (len == 0) {
+                return;
+            }
+            // Reserve address space only, slabs are committed on demand.
+            char *mem = (char *) mmap(NULL, len + slab, PROT_NONE,
+                                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+            if (mem == MAP_FAILED) {
+                FLARE_PLOG(WARNING) << "Fail to reserve " << len << " bytes for hugepage blocks";
+                return;
+            }
+            char *begin = (char *) (((uintptr_t) mem + slab - 1) & ~(slab - 1));
+            if (begin != mem) {
+                munmap(mem, begin - mem);
+            }
+            munmap(begin + len, mem + len + slab - (begin + len));
+            iobuf::g_hp_pool = new iobuf::BlockPool;
+            iobuf::init_block_pool(iobuf::g_hp_pool, iobuf::commit_hugepage_slab, -1);
+            iobuf::g_hp_reserved_begin = begin;
+            iobuf::g_hp_reserved_end = begin + len;
+            iobuf::g_hp_committed_end = begin;
+            iobuf::install_blockmem_allocator(iobuf::hugepage_blockmem_allocate,
+                                              iobuf::hugepage_blockmem_deallocate);
+            enabled = true;
+        });
+        return enabled;
+    }
+
+    cord_buf::hugepage_block_stats cord_buf::get_hugepage_block_stats() {
+        hugepage_block_stats s = {0, 0, 0, 0, 0};
+        iobuf::BlockPool *pool = iobuf::g_hp_pool;
+        if (pool == NULL) {
+            return s;
+        }
+        std::unique_lock<std::mutex> mu(pool->mutex);
+        s.slab_count = iobuf::g_hp_slabs.load(std::memory_order_relaxed);
+        s.block_total = (iobuf::g_hp_committed_end - iobuf::g_hp_reserved_begin -
+                         (pool->chunk_end - pool->chunk_begin)) / DEFAULT_BLOCK_SIZE;
+        s.block_pooled = pool->num_pooled;
+        for (iobuf::BlockThreadCache *c = pool->threads; c; c = c->next) {
+            s.block_thread_cached += c->num_free.load(std::memory_order_relaxed);
+        }
+        const size_t nfree = s.block_pooled + s.block_thread_cached;
+        s.block_in_use = (s.block_total > nfree ? s.block_total - nfree : 0);
+        return s;
+    }
+
     const uint16_t CORD_BUF_BLOCK_FLAGS_USER_DATA = 0x1;
 
     typedef void (*UserDataDeleter)(void *);
@@ -246,7 +695,7 @@ namespace flare {
                     iobuf::g_blockmem.fetch_sub(cap + sizeof(Block),
                                                 std::memory_order_relaxed);
                     this->~Block();
-                    iobuf::blockmem_deallocate(this);
+                    iobuf::blockmem_deallocate.load(std::memory_order_acquire)(this);
                 } else if (flags & CORD_BUF_BLOCK_FLAGS_USER_DATA) {
                     get_user_data_extension()->deleter(data);
                     this->~Block();
@@ -286,7 +735,7 @@ namespace flare {
                 FLARE_LOG(FATAL) << "block_size=" << block_size << " is too large";
                 return NULL;
             }
-            char *mem = (char *) iobuf::blockmem_allocate(block_size);
+            char *mem = (char *) iobuf::blockmem_allocate.load(std::memory_order_acquire)(block_size);
             if (mem == NULL) {
                 return NULL;
             }
@@ -1067,6 +1516,47 @@ namespace flare {
         return nw;
     }
 
+    ssize_t cord_buf::cut_multiple_into_file_descriptor_zerocopy(
+            int fd, cord_buf *const *pieces, size_t count, cord_buf *pinned) {
+#if defined(FLARE_PLATFORM_LINUX)
+        if (FLARE_UNLIKELY(count == 0)) {
+            return 0;
+        }
+        struct iovec vec[IOBUF_IOV_MAX];
+        size_t nvec = 0;
+        for (size_t i = 0; i < count; ++i) {
+            const cord_buf *p = pieces[i];
+            const size_t nref = p->_ref_num();
+            for (size_t j = 0; j < nref && nvec < IOBUF_IOV_MAX; ++j, ++nvec) {
+                cord_buf::BlockRef const &r = p->_ref_at(j);
+                vec[nvec].iov_base = r.block->data + r.offset;
+                vec[nvec].iov_len = r.length;
+            }
+        }
+        if (nvec == 0) {
+            return 0;
+        }
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = vec;
+        msg.msg_iovlen = nvec;
+        const ssize_t nw = ::sendmsg(fd, &msg, MSG_ZEROCOPY);
+        if (nw <= 0) {
+            return nw;
+        }
+        size_t ncut_all = nw;
+        for (size_t i = 0; i < count; ++i) {
+            ncut_all -= pieces[i]->cutn(pinned, ncut_all);
+            if (ncut_all == 0) {
+                break;
+            }
+        }
+        return nw;
+#else
+        return cut_multiple_into_file_descriptor(fd, pieces, count);
+#endif
+    }
+
     ssize_t cord_buf::cut_multiple_into_writer(
             base_writer *writer, cord_buf *const *pieces, size_t count) {
         if (FLARE_UNLIKELY(count == 0)) {
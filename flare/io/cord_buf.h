@@ -204,6 +204,17 @@ namespace flare {
         static ssize_t pcut_multiple_into_file_descriptor(
                 int fd, off_t offset, cord_buf *const *pieces, size_t count);
 
+        // Cut `count' number of `pieces' into socket `fd' with MSG_ZEROCOPY.
+        // The kernel keeps referencing the sent pages until the completion
+        // is read from the error queue of `fd', so written bytes are moved
+        // into `pinned' instead of being released. Caller must keep `pinned'
+        // alive until then.
+        // Falls back to cut_multiple_into_file_descriptor on platforms without
+        // MSG_ZEROCOPY, in which case `pinned' is untouched.
+        // Returns bytes cut on success, -1 otherwise and errno is set.
+        static ssize_t cut_multiple_into_file_descriptor_zerocopy(
+                int fd, cord_buf *const *pieces, size_t count, cord_buf *pinned);
+
         // Cut `count' number of `pieces' into SSL channel `ssl'.
         // Returns bytes cut on success, -1 otherwise and errno is set.
         static ssize_t cut_multiple_into_SSL_channel(
@@ -361,6 +372,36 @@ namespace flare {
 
         static size_t block_count_hit_tls_threshold();
 
+        // Allocate blocks of DEFAULT_BLOCK_SIZE from pools of the NUMA node that
+        // the allocating thread runs on, which is meant for threads bound to
+        // nodes. Turned on by fiber when -fiber_numa_aware is set. Blocks
+        // allocated before the call are still freed correctly.
+        static void enable_numa_local_blocks();
+
+        // Allocate blocks of DEFAULT_BLOCK_SIZE from 2MB slabs backed by
+        // transparent huge pages, reserving at most `max_memory' bytes of
+        // address space for them. Free blocks are cached per thread and moved
+        // to a global pool in batches. Blocks allocated before the call and
+        // blocks beyond `max_memory' still go through malloc/free.
+        // Returns false if the slabs can't be reserved or another block
+        // allocator (e.g. enable_numa_local_blocks()) is installed.
+        static bool enable_hugepage_blocks(size_t max_memory);
+
+        struct hugepage_block_stats {
+            size_t slab_count;
+            // Blocks carved from slabs so far.
+            size_t block_total;
+            // Blocks referenced by cord_bufs.
+            size_t block_in_use;
+            // Free blocks cached by threads.
+            size_t block_thread_cached;
+            // Free blocks in the global pool.
+            size_t block_pooled;
+        };
+
+        // All zeros unless enable_hugepage_blocks() succeeded.
+        static hugepage_block_stats get_hugepage_block_stats();
+
         // Equal with a string/cord_buf or not.
         bool equals(const std::string_view &) const;
 
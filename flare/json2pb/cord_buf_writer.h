@@ -0,0 +1,193 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#ifndef  FLARE_RPC_JSON2PB_CORD_BUF_WRITER_H_
+#define  FLARE_RPC_JSON2PB_CORD_BUF_WRITER_H_
+
+#include <stdint.h>
+#include <string>
+#include <string_view>
+#include "flare/io/cord_buf.h"
+#include "flare/rapidjson/internal/dtoa.h"
+#include "flare/strings/numbers.h"
+
+namespace json2pb {
+
+// Writes compact json into a cord_buf_appender with the handler interface
+// of RAPIDJSON_NAMESPACE::OptimizedWriter used by PbToJsonConverter. The
+// output is byte-identical to OptimizedWriter over ZeroCopyStreamWriter,
+// without going through the Put()/Puts() of a ZeroCopyOutputStream. Names
+// may be written with RawKey() as fragments escaped in advance.
+// Values are not validated: the caller generates well-formed events.
+class CordBufJsonWriter {
+public:
+    typedef char Ch;
+    typedef unsigned SizeType;
+
+    explicit CordBufJsonWriter(flare::cord_buf_appender* appender)
+        : _appender(appender), _need_comma(false) {}
+
+    bool StartObject() {
+        Prefix();
+        _appender->push_back('{');
+        _need_comma = false;
+        return true;
+    }
+    bool EndObject(SizeType = 0) {
+        _appender->push_back('}');
+        _need_comma = true;
+        return true;
+    }
+    bool StartArray() {
+        Prefix();
+        _appender->push_back('[');
+        _need_comma = false;
+        return true;
+    }
+    bool EndArray(SizeType = 0) {
+        _appender->push_back(']');
+        _need_comma = true;
+        return true;
+    }
+
+    bool Key(const Ch* str, SizeType length, bool = false) {
+        Prefix();
+        WriteString(str, length);
+        _appender->push_back(':');
+        _need_comma = false;
+        return true;
+    }
+    // Writes `fragment' made by MakeRawKey() as the name of next value.
+    bool RawKey(const std::string& fragment) {
+        // Skip the leading comma of the first member.
+        const size_t skip = !_need_comma;
+        _appender->append(fragment.data() + skip, fragment.size() - skip);
+        _need_comma = false;
+        return true;
+    }
+
+    bool String(const Ch* str, SizeType length, bool = false) {
+        Prefix();
+        WriteString(str, length);
+        _need_comma = true;
+        return true;
+    }
+    bool Bool(bool b) {
+        Prefix();
+        if (b) {
+            _appender->append("true", 4);
+        } else {
+            _appender->append("false", 5);
+        }
+        _need_comma = true;
+        return true;
+    }
+    bool AddInt(int i) { return WriteInteger(i); }
+    bool AddUint(unsigned u) { return WriteInteger(u); }
+    bool AddInt64(int64_t i64) { return WriteInteger(i64); }
+    bool AddUint64(uint64_t u64) { return WriteInteger(u64); }
+    bool Double(double d) {
+        Prefix();
+        _need_comma = true;
+        if (RAPIDJSON_NAMESPACE::internal::Double(d).IsNanOrInf()) {
+            // Same as Writer without kWriteNanAndInfFlag: nothing is
+            // written and false is returned.
+            return false;
+        }
+        char buffer[25];
+        char* end = RAPIDJSON_NAMESPACE::internal::dtoa(d, buffer);
+        _appender->append(buffer, end - buffer);
+        return true;
+    }
+
+    // Returns `name' escaped and quoted, followed by a colon and preceded
+    // by a comma, to be written by RawKey().
+    static std::string MakeRawKey(const std::string& name) {
+        flare::cord_buf_appender appender;
+        CordBufJsonWriter writer(&appender);
+        writer.WriteString(name.data(), name.size());
+        std::string fragment(",");
+        fragment.append(appender.buf().to_string());
+        fragment.push_back(':');
+        return fragment;
+    }
+
+private:
+    void Prefix() {
+        if (_need_comma) {
+            _appender->push_back(',');
+        }
+    }
+
+    template <typename Integer>
+    bool WriteInteger(Integer i) {
+        Prefix();
+        char buffer[flare::numbers_internal::kFastToBufferSize];
+        char* end = flare::numbers_internal::fast_int_to_buffer(i, buffer);
+        _appender->append(buffer, end - buffer);
+        _need_comma = true;
+        return true;
+    }
+
+    // Escapes the same characters as OptimizedWriter::WriteString().
+    void WriteString(const Ch* str, SizeType length) {
+        static const char hex_digits[16] = {
+            '0', '1', '2', '3', '4', '5', '6', '7',
+            '8', '9', 'A', 'B', 'C', 'D', 'E', 'F'};
+        static const char escape[256] = {
+#define ESCAPE_ZERO_16 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
+            //0    1    2    3    4    5    6    7    8    9    A    B    C    D    E    F
+            'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'b', 't', 'n', 'u', 'f', 'r', 'u', 'u', // 00
+            'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', // 10
+            0, 0, '"', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,                               // 20
+            ESCAPE_ZERO_16, ESCAPE_ZERO_16,                                                 // 30~4F
+            0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, '\\', 0, 0, 0,                              // 50
+            ESCAPE_ZERO_16, ESCAPE_ZERO_16, ESCAPE_ZERO_16, ESCAPE_ZERO_16, ESCAPE_ZERO_16,
+            ESCAPE_ZERO_16, ESCAPE_ZERO_16, ESCAPE_ZERO_16, ESCAPE_ZERO_16, ESCAPE_ZERO_16  // 60~FF
+#undef ESCAPE_ZERO_16
+        };
+        _appender->push_back('\"');
+        SizeType begin = 0;
+        for (SizeType pos = 0; pos < length; ++pos) {
+            const char e = escape[(unsigned char)str[pos]];
+            if (__builtin_expect(e == 0, 1)) {
+                continue;
+            }
+            _appender->append(str + begin, pos - begin);
+            begin = pos + 1;
+            if (e != 'u') {
+                const char escaped[2] = { '\\', e };
+                _appender->append(escaped, 2);
+            } else {
+                const char escaped[6] = {
+                    '\\', 'u', '0', '0',
+                    hex_digits[(unsigned char)str[pos] >> 4],
+                    hex_digits[(unsigned char)str[pos] & 0xF] };
+                _appender->append(escaped, 6);
+            }
+        }
+        _appender->append(str + begin, length - begin);
+        _appender->push_back('\"');
+    }
+
+    flare::cord_buf_appender* _appender;
+    bool _need_comma;
+};
+
+}  // namespace json2pb
+
+#endif  // FLARE_RPC_JSON2PB_CORD_BUF_WRITER_H_
@@ -15,6 +15,7 @@
 // specific language governing permissions and limitations
 // under the License.
 
+#include <memory>
 #include <vector>
 #include <map>
 #include <string>
@@ -26,10 +27,12 @@
 #include <google/protobuf/descriptor.h>
 #include "flare/strings/str_format.h"
 #include "flare/strings/numbers.h"
+#include "flare/container/flat_map.h"
 #include "json_to_pb.h"
 #include "zero_copy_stream_reader.h"       // ZeroCopyStreamReader
 #include "encode_decode.h"
 #include "protobuf_map.h"
+#include "message_plan.h"
 #include "rapidjson.h"
 #include "flare/base/base64.h"
 
@@ -264,10 +267,6 @@ inline bool convert_uint64_type(const RAPIDJSON_NAMESPACE::Value& item,
     return true;
 }
 
-bool JsonValueToProtoMessage(const RAPIDJSON_NAMESPACE::Value& json_value,
-                             google::protobuf::Message* message,
-                             const Json2PbOptions& options, std::string* err);
-
 //Json value to protobuf convert rules for type:
 //Json value type                 Protobuf type                convert rules
 //int                             int uint int64_t uint64        valid convert is available
@@ -292,136 +291,45 @@ bool JsonValueToProtoMessage(const RAPIDJSON_NAMESPACE::Value& json_value,
         })
 
 
-static bool JsonValueToProtoField(const RAPIDJSON_NAMESPACE::Value& value,
-                                  const google::protobuf::FieldDescriptor* field,
-                                  google::protobuf::Message* message,
-                                  const Json2PbOptions& options,
-                                  std::string* err) {
-    if (value.IsNull()) {
-        if (field->is_required()) {
-            J2PERROR(err, "Missing required field: %s", field->full_name().c_str());
-            return false;
-        }
-        return true;
-    }
-        
-    if (field->is_repeated()) {
-        if (!value.IsArray()) {
-            J2PERROR(err, "Invalid value for repeated field: %s",
-                     field->full_name().c_str());
-            return false;
-        }
-    } 
 
+static bool JsonValueToProtoScalar(const RAPIDJSON_NAMESPACE::Value& value, bool repeated,
+                                   const google::protobuf::FieldDescriptor* field,
+                                   google::protobuf::Message* message,
+                                   const Json2PbOptions& options,
+                                   std::string* err) {
     const google::protobuf::Reflection* reflection = message->GetReflection();
     switch (field->cpp_type()) {
 #define CASE_FIELD_TYPE(cpptype, method, jsontype)                      \
-        case google::protobuf::FieldDescriptor::CPPTYPE_##cpptype: {                      \
-            if (field->is_repeated()) {                                 \
-                const RAPIDJSON_NAMESPACE::SizeType size = value.Size();          \
-                for (RAPIDJSON_NAMESPACE::SizeType index = 0; index < size; ++index) { \
-                    const RAPIDJSON_NAMESPACE::Value & item = value[index];       \
-                    if (TYPE_MATCH == J2PCHECKTYPE(item, cpptype, jsontype)) { \
-                        reflection->Add##method(message, field, item.Get##jsontype()); \
-                    }                                                   \
+        case google::protobuf::FieldDescriptor::CPPTYPE_##cpptype: {    \
+            if (TYPE_MATCH == J2PCHECKTYPE(value, cpptype, jsontype)) { \
+                if (repeated) {                                         \
+                    reflection->Add##method(message, field, value.Get##jsontype()); \
+                } else {                                                \
+                    reflection->Set##method(message, field, value.Get##jsontype()); \
                 }                                                       \
-            } else if (TYPE_MATCH == J2PCHECKTYPE(value, cpptype, jsontype)) { \
-                reflection->Set##method(message, field, value.Get##jsontype()); \
             }                                                           \
             break;                                                      \
         }                                                               \
-          
+
         CASE_FIELD_TYPE(INT32,  Int32,  Int);
         CASE_FIELD_TYPE(UINT32, UInt32, Uint);
         CASE_FIELD_TYPE(BOOL,   Bool,   Bool);
 #undef CASE_FIELD_TYPE
 
     case google::protobuf::FieldDescriptor::CPPTYPE_INT64:
-        if (field->is_repeated()) {
-            const RAPIDJSON_NAMESPACE::SizeType size = value.Size();
-            for (RAPIDJSON_NAMESPACE::SizeType index = 0; index < size;
-                 ++index) {
-                const RAPIDJSON_NAMESPACE::Value& item = value[index];
-                if (!convert_int64_type(item, true, message, field, reflection,
-                                        err)) {
-                    return false;
-                }
-            }
-        } else if (!convert_int64_type(value, false, message, field, reflection,
-                                       err)) {
-            return false;
-        }
-        break;
+        return convert_int64_type(value, repeated, message, field, reflection, err);
 
     case google::protobuf::FieldDescriptor::CPPTYPE_UINT64:
-        if (field->is_repeated()) {
-            const RAPIDJSON_NAMESPACE::SizeType size = value.Size();
-            for (RAPIDJSON_NAMESPACE::SizeType index = 0; index < size;
-                 ++index) {
-                const RAPIDJSON_NAMESPACE::Value& item = value[index];
-                if (!convert_uint64_type(item, true, message, field, reflection,
-                                         err)) {
-                    return false;
-                }
-            }
-        } else if (!convert_uint64_type(value, false, message, field, reflection,
-                                       err)) {
-            return false;
-        }
-        break;
+        return convert_uint64_type(value, repeated, message, field, reflection, err);
 
     case google::protobuf::FieldDescriptor::CPPTYPE_FLOAT:
-        if (field->is_repeated()) {
-            const RAPIDJSON_NAMESPACE::SizeType size = value.Size();
-            for (RAPIDJSON_NAMESPACE::SizeType index = 0; index < size; ++index) {
-                const RAPIDJSON_NAMESPACE::Value & item = value[index];
-                if (!convert_float_type(item, true, message, field,
-                                        reflection, err)) {
-                    return false;
-                }
-            }
-        } else if (!convert_float_type(value, false, message, field,
-                                       reflection, err)) {
-            return false;
-        }
-        break;
+        return convert_float_type(value, repeated, message, field, reflection, err);
+
+    case google::protobuf::FieldDescriptor::CPPTYPE_DOUBLE:
+        return convert_double_type(value, repeated, message, field, reflection, err);
 
-    case google::protobuf::FieldDescriptor::CPPTYPE_DOUBLE: 
-        if (field->is_repeated()) {
-            const RAPIDJSON_NAMESPACE::SizeType size = value.Size();
-            for (RAPIDJSON_NAMESPACE::SizeType index = 0; index < size; ++index) {
-                const RAPIDJSON_NAMESPACE::Value & item = value[index];
-                if (!convert_double_type(item, true, message, field,
-                                         reflection, err)) {
-                    return false;
-                }
-            }
-        } else if (!convert_double_type(value, false, message, field,
-                                        reflection, err)) {
-            return false;
-        }
-        break;
-        
     case google::protobuf::FieldDescriptor::CPPTYPE_STRING:
-        if (field->is_repeated()) {
-            const RAPIDJSON_NAMESPACE::SizeType size = value.Size();
-            for (RAPIDJSON_NAMESPACE::SizeType index = 0; index < size; ++index) {
-                const RAPIDJSON_NAMESPACE::Value & item = value[index];
-                if (TYPE_MATCH == J2PCHECKTYPE(item, string, String)) { 
-                    std::string str(item.GetString(), item.GetStringLength());
-                    if (field->type() == google::protobuf::FieldDescriptor::TYPE_BYTES &&
-                        options.base64_to_bytes) {
-                        std::string str_decoded;
-                        if (!flare::base::base64_decode(str, &str_decoded)) {
-                            J2PERROR(err, "Fail to decode base64 string=%s", str.c_str());
-                            return false;
-                        }
-                        str = str_decoded;
-                    }
-                    reflection->AddString(message, field, str);
-                }  
-            }
-        } else if (TYPE_MATCH == J2PCHECKTYPE(value, string, String)) {
+        if (TYPE_MATCH == J2PCHECKTYPE(value, string, String)) {
             std::string str(value.GetString(), value.GetStringLength());
             if (field->type() == google::protobuf::FieldDescriptor::TYPE_BYTES &&
                 options.base64_to_bytes) {
@@ -430,226 +338,447 @@ static bool JsonValueToProtoField(const RAPIDJSON_NAMESPACE::Value& value,
                     J2PERROR(err, "Fail to decode base64 string=%s", str.c_str());
                     return false;
                 }
-                str = str_decoded;
+                str.swap(str_decoded);
+            }
+            if (repeated) {
+                reflection->AddString(message, field, std::move(str));
+            } else {
+                reflection->SetString(message, field, std::move(str));
             }
-            reflection->SetString(message, field, str);
         }
         break;
 
     case google::protobuf::FieldDescriptor::CPPTYPE_ENUM:
-        if (field->is_repeated()) {
-            const RAPIDJSON_NAMESPACE::SizeType size = value.Size();
-            for (RAPIDJSON_NAMESPACE::SizeType index = 0; index < size; ++index) {
-                const RAPIDJSON_NAMESPACE::Value & item = value[index];
-                if (!convert_enum_type(item, true, message, field,
-                                       reflection, err)) {
-                    return false;
-                }
-            }
-        } else if (!convert_enum_type(value, false, message, field,
-                                      reflection, err)) {
-            return false;
-        }
-        break;
-        
+        return convert_enum_type(value, repeated, message, field, reflection, err);
+
     case google::protobuf::FieldDescriptor::CPPTYPE_MESSAGE:
-        if (field->is_repeated()) {
-            const RAPIDJSON_NAMESPACE::SizeType size = value.Size();
-            for (RAPIDJSON_NAMESPACE::SizeType index = 0; index < size; ++index) {
-                const RAPIDJSON_NAMESPACE::Value& item = value[index];
-                if (TYPE_MATCH == J2PCHECKTYPE(item, message, Object)) { 
-                    if (!JsonValueToProtoMessage(
-                            item, reflection->AddMessage(message, field), options, err)) {
-                        return false;
-                    }
-                } 
-            }
-        } else if (!JsonValueToProtoMessage(
-            value, reflection->MutableMessage(message, field), options, err)) {
-            return false;
-        }
         break;
     }
     return true;
 }
 
-bool JsonMapToProtoMap(const RAPIDJSON_NAMESPACE::Value& value,
-                       const google::protobuf::FieldDescriptor* map_desc,
-                       google::protobuf::Message* message,
+class MessagePlan;
+
+struct FieldPlan {
+    const google::protobuf::FieldDescriptor* field;
+    bool is_map;
+    // Plan of the message type (of the map entry if is_map).
+    LazyPlan<MessagePlan> message_plan;
+
+    FieldPlan() : field(NULL), is_map(false) {}
+
+    const MessagePlan* GetMessagePlan(const google::protobuf::Message* msg) const {
+        return message_plan.Get(*msg);
+    }
+};
+
+// Fields of a message type in the order they were converted from the json
+// DOM: known extensions and then fields, with names decoded by
+// decode_name() indexed for lookup.
+class MessagePlan {
+public:
+    MessagePlan(const google::protobuf::Descriptor* descriptor,
+                const google::protobuf::Reflection* reflection) {
+        std::vector<const google::protobuf::FieldDescriptor*> fields;
+        ListFieldsToConvert(descriptor, reflection, &fields);
+        _nfield = fields.size();
+        _fields.reset(new FieldPlan[_nfield]);
+        _names.init(_nfield * 2 + 8);
+        std::string name;
+        for (int i = 0; i < _nfield; ++i) {
+            _fields[i].field = fields[i];
+            _fields[i].is_map = IsProtobufMap(fields[i]);
+            if (fields[i]->is_required()) {
+                _required.push_back(i);
+            }
+            const std::string& orig_name = fields[i]->name();
+            const std::string& json_name =
+                (decode_name(orig_name, name) ? name : orig_name);
+            // Only the first field of duplicated names is filled.
+            if (_names.seek(json_name) == NULL) {
+                _names[json_name] = i;
+            }
+        }
+    }
+
+    int field_count() const { return _nfield; }
+    const FieldPlan& field(int index) const { return _fields[index]; }
+    const std::vector<int>& required_fields() const { return _required; }
+
+    // Returns index of the field named `name', -1 if not found.
+    int FindField(const char* name, size_t length) const {
+        const int* index = _names.seek(std::string_view(name, length));
+        return index ? *index : -1;
+    }
+
+private:
+    int _nfield;
+    std::unique_ptr<FieldPlan[]> _fields;
+    std::vector<int> _required;
+    flare::container::FlatMap<std::string, int> _names;
+};
+
+// Converts events of the SAX parser into `message' with the same rules
+// and errors as converting a parsed json DOM, without building the DOM.
+// Fields were converted in the order of MessagePlan and the conversion
+// stopped at the first fatal error, while events come in the order of
+// json. To produce the same error message, errors are recorded with paths
+// of their fields in the converting order, sorted and truncated at the
+// first fatal one after parsing.
+class JsonToProtoHandler : public RAPIDJSON_NAMESPACE::BaseReaderHandler<
+    RAPIDJSON_NAMESPACE::UTF8<>, JsonToProtoHandler> {
+public:
+    JsonToProtoHandler(google::protobuf::Message* message,
                        const Json2PbOptions& options,
-                       std::string* err) {
-    if (!value.IsObject()) {
-        J2PERROR(err, "Non-object value for map field: %s",
-                 map_desc->full_name().c_str());
-        return false;
+                       std::string* err)
+        : _root(message), _options(options), _err(err)
+        , _failed(false), _skip_depth(0) {}
+
+    bool Null() { return OnValue(RAPIDJSON_NAMESPACE::Value()); }
+    bool Bool(bool b) { return OnValue(RAPIDJSON_NAMESPACE::Value(b)); }
+    bool Int(int i) { return OnValue(RAPIDJSON_NAMESPACE::Value(i)); }
+    bool Uint(unsigned u) { return OnValue(RAPIDJSON_NAMESPACE::Value(u)); }
+    bool Int64(int64_t i) { return OnValue(RAPIDJSON_NAMESPACE::Value(i)); }
+    bool Uint64(uint64_t u) { return OnValue(RAPIDJSON_NAMESPACE::Value(u)); }
+    bool Double(double d) { return OnValue(RAPIDJSON_NAMESPACE::Value(d)); }
+    bool String(const char* str, RAPIDJSON_NAMESPACE::SizeType length, bool) {
+        // `str' is null-terminated.
+        return OnValue(RAPIDJSON_NAMESPACE::Value(
+                           RAPIDJSON_NAMESPACE::StringRef(str, length)));
+    }
+    bool StartObject() {
+        return OnValue(RAPIDJSON_NAMESPACE::Value(RAPIDJSON_NAMESPACE::kObjectType));
+    }
+    bool StartArray() {
+        return OnValue(RAPIDJSON_NAMESPACE::Value(RAPIDJSON_NAMESPACE::kArrayType));
+    }
+    bool Key(const char* str, RAPIDJSON_NAMESPACE::SizeType length, bool);
+    bool EndObject(RAPIDJSON_NAMESPACE::SizeType);
+    bool EndArray(RAPIDJSON_NAMESPACE::SizeType);
+
+    // Returns true if no fatal error happened, `err' is set with errors
+    // before the first fatal one.
+    bool Finish();
+
+private:
+    enum FrameType {
+        FRAME_MESSAGE,
+        FRAME_REPEATED,
+        FRAME_MAP,
+    };
+
+    struct Frame {
+        FrameType type;
+        // MESSAGE: index of the field of the current key, -1 to skip value.
+        // REPEATED/MAP: index of the current item.
+        int cursor;
+        google::protobuf::Message* message;
+        // MESSAGE: plan of `message'. MAP: plan of map entries, set at the
+        // first key.
+        const MessagePlan* plan;
+        // REPEATED: the field.
+        const FieldPlan* field;
+        // MESSAGE: offset of bits of fields seen in _seen.
+        size_t seen_offset;
+        // MAP: entry of the current key.
+        google::protobuf::Message* map_entry;
+    };
+
+    struct Error {
+        std::vector<int> path;
+        std::string text;
+        bool fatal;
+
+        bool operator<(const Error& rhs) const { return path < rhs.path; }
+    };
+
+    bool OnValue(const RAPIDJSON_NAMESPACE::Value& value);
+    bool OnFieldValue(const FieldPlan& field, google::protobuf::Message* msg,
+                      const RAPIDJSON_NAMESPACE::Value& value, bool allow_map);
+    bool OnRepeatedItem(const FieldPlan& field, google::protobuf::Message* msg,
+                        const RAPIDJSON_NAMESPACE::Value& value);
+
+    void PushMessage(google::protobuf::Message* msg, const MessagePlan* plan) {
+        Frame f = { FRAME_MESSAGE, -1, msg, plan, NULL, _seen.size(), NULL };
+        _seen.resize(_seen.size() + (plan->field_count() + 63) / 64, 0);
+        _frames.push_back(f);
     }
 
-    const google::protobuf::Reflection* reflection = message->GetReflection();
-    const google::protobuf::FieldDescriptor* key_desc =
-            map_desc->message_type()->FindFieldByName(KEY_NAME);
-    const google::protobuf::FieldDescriptor* value_desc =
-            map_desc->message_type()->FindFieldByName(VALUE_NAME);
-
-    for (RAPIDJSON_NAMESPACE::Value::ConstMemberIterator it =
-                 value.MemberBegin(); it != value.MemberEnd(); ++it) {
-        google::protobuf::Message* entry = reflection->AddMessage(message, map_desc);
-        const google::protobuf::Reflection* entry_reflection = entry->GetReflection();
-        entry_reflection->SetString(
-            entry, key_desc, std::string(it->name.GetString(),
-                                         it->name.GetStringLength()));
-        if (!JsonValueToProtoField(it->value, value_desc, entry, options, err)) {
+    void Push(FrameType type, google::protobuf::Message* msg,
+              const MessagePlan* plan, const FieldPlan* field) {
+        Frame f = { type, -1, msg, plan, field, 0, NULL };
+        _frames.push_back(f);
+    }
+
+    // Skip the rest of a value which is not converted.
+    void SkipIfContainer(const RAPIDJSON_NAMESPACE::Value& value) {
+        if (value.IsObject() || value.IsArray()) {
+            _skip_depth = 1;
+        }
+    }
+
+    std::string* scratch() { return _err ? &_scratch : NULL; }
+
+    // Record error in scratch() at the current path, `ok' is false for
+    // fatal errors. Returns false to stop parsing when nobody reads errors.
+    bool Check(bool ok);
+
+    google::protobuf::Message* _root;
+    LazyPlan<MessagePlan> _root_plan;
+    const Json2PbOptions& _options;
+    std::string* _err;
+    bool _failed;
+    int _skip_depth;
+    std::vector<Frame> _frames;
+    std::vector<uint64_t> _seen;
+    std::string _scratch;
+    std::vector<Error> _errors;
+};
+
+bool JsonToProtoHandler::Check(bool ok) {
+    if (ok && _scratch.empty()) {
+        return true;
+    }
+    if (!ok) {
+        _failed = true;
+        if (_err == NULL) {
             return false;
         }
     }
+    Error e;
+    e.path.reserve(_frames.size());
+    for (size_t i = 0; i < _frames.size(); ++i) {
+        e.path.push_back(_frames[i].cursor);
+    }
+    e.text.swap(_scratch);
+    e.fatal = !ok;
+    _errors.push_back(std::move(e));
     return true;
 }
 
-bool JsonValueToProtoMessage(const RAPIDJSON_NAMESPACE::Value& json_value,
-                             google::protobuf::Message* message,
-                             const Json2PbOptions& options,
-                             std::string* err) {
-    const google::protobuf::Descriptor* descriptor = message->GetDescriptor();
-    if (!json_value.IsObject()) {
-        J2PERROR(err, "`json_value' is not a json object. %s", descriptor->name().c_str());
-        return false;
+bool JsonToProtoHandler::OnValue(const RAPIDJSON_NAMESPACE::Value& value) {
+    if (_skip_depth) {
+        if (value.IsObject() || value.IsArray()) {
+            ++_skip_depth;
+        }
+        return true;
     }
+    if (_frames.empty()) {
+        if (value.IsObject()) {
+            PushMessage(_root, _root_plan.Get(*_root));
+            return true;
+        }
+        J2PERROR(scratch(), "`json_value' is not a json object. %s",
+                 _root->GetDescriptor()->name().c_str());
+        SkipIfContainer(value);
+        return Check(false);
+    }
+    Frame& f = _frames.back();
+    switch (f.type) {
+    case FRAME_MESSAGE:
+        if (f.cursor < 0) {
+            SkipIfContainer(value);
+            return true;
+        }
+        return OnFieldValue(f.plan->field(f.cursor), f.message, value, true);
+    case FRAME_REPEATED:
+        ++f.cursor;
+        return OnRepeatedItem(*f.field, f.message, value);
+    case FRAME_MAP:
+        return OnFieldValue(f.plan->field(VALUE_INDEX), f.map_entry, value, false);
+    }
+    return true;
+}
 
-    const google::protobuf::Reflection* reflection = message->GetReflection();
-    
-    std::vector<const google::protobuf::FieldDescriptor*> fields;
-    fields.reserve(64);
-    for (int i = 0; i < descriptor->extension_range_count(); ++i) {
-        const google::protobuf::Descriptor::ExtensionRange*
-            ext_range = descriptor->extension_range(i);
-        for (int tag_number = ext_range->start; tag_number < ext_range->end;
-             ++tag_number) {
-            const google::protobuf::FieldDescriptor* field =
-                reflection->FindKnownExtensionByNumber(tag_number);
-            if (field) {
-                fields.push_back(field);
-            }
+bool JsonToProtoHandler::OnFieldValue(const FieldPlan& fp,
+                                      google::protobuf::Message* msg,
+                                      const RAPIDJSON_NAMESPACE::Value& value,
+                                      bool allow_map) {
+    const google::protobuf::FieldDescriptor* field = fp.field;
+    if (value.IsNull()) {
+        if (field->is_required()) {
+            J2PERROR(scratch(), "Missing required field: %s", field->full_name().c_str());
+            return Check(false);
         }
+        return true;
     }
-    for (int i = 0; i < descriptor->field_count(); ++i) {
-        fields.push_back(descriptor->field(i));
-    }
-
-    std::string field_name_str_temp; 
-    const RAPIDJSON_NAMESPACE::Value* value_ptr = NULL;
-    for (size_t i = 0; i < fields.size(); ++i) {
-        const google::protobuf::FieldDescriptor* field = fields[i];
-        
-        const std::string& orig_name = field->name();
-        bool res = decode_name(orig_name, field_name_str_temp); 
-        const std::string& field_name_str = (res ? field_name_str_temp : orig_name);
-
-#ifndef RAPIDJSON_VERSION_0_1
-        RAPIDJSON_NAMESPACE::Value::ConstMemberIterator member =
-                json_value.FindMember(field_name_str.data());
-        if (member == json_value.MemberEnd()) {
-            if (field->is_required()) {
-                J2PERROR(err, "Missing required field: %s", field->full_name().c_str());
-                return false;
-            }
-            continue; 
+    if (allow_map && fp.is_map && value.IsObject()) {
+        // Try to parse json like {"key":value, ...} into protobuf map
+        Push(FRAME_MAP, msg, NULL, &fp);
+        return true;
+    }
+    if (field->is_repeated()) {
+        if (!value.IsArray()) {
+            J2PERROR(scratch(), "Invalid value for repeated field: %s",
+                     field->full_name().c_str());
+            SkipIfContainer(value);
+            return Check(false);
         }
-        value_ptr = &(member->value);
-#else 
-        const RAPIDJSON_NAMESPACE::Value::Member* member =
-                json_value.FindMember(field_name_str.data());
-        if (member == NULL) {
-            if (field->is_required()) {
-                J2PERROR(err, "Missing required field: %s", field->full_name().c_str());
-                return false;
-            }
-            continue; 
+        Push(FRAME_REPEATED, msg, NULL, &fp);
+        return true;
+    }
+    if (field->cpp_type() == google::protobuf::FieldDescriptor::CPPTYPE_MESSAGE) {
+        google::protobuf::Message* sub = msg->GetReflection()->MutableMessage(msg, field);
+        if (!value.IsObject()) {
+            J2PERROR(scratch(), "`json_value' is not a json object. %s",
+                     field->message_type()->name().c_str());
+            SkipIfContainer(value);
+            return Check(false);
         }
-        value_ptr = &(member->value);
-#endif
+        PushMessage(sub, fp.GetMessagePlan(sub));
+        return true;
+    }
+    SkipIfContainer(value);
+    return Check(JsonValueToProtoScalar(value, false, field, msg, _options, scratch()));
+}
 
-        if (IsProtobufMap(field) && value_ptr->IsObject()) {
-            // Try to parse json like {"key":value, ...} into protobuf map
-            if (!JsonMapToProtoMap(*value_ptr, field, message, options, err)) {
-                return false;
+bool JsonToProtoHandler::OnRepeatedItem(const FieldPlan& fp,
+                                        google::protobuf::Message* msg,
+                                        const RAPIDJSON_NAMESPACE::Value& value) {
+    const google::protobuf::FieldDescriptor* field = fp.field;
+    if (field->cpp_type() == google::protobuf::FieldDescriptor::CPPTYPE_MESSAGE) {
+        if (value.IsObject()) {
+            google::protobuf::Message* sub = msg->GetReflection()->AddMessage(msg, field);
+            PushMessage(sub, fp.GetMessagePlan(sub));
+            return true;
+        }
+        SkipIfContainer(value);
+        return Check(value_invalid(field, "message", value, scratch()));
+    }
+    SkipIfContainer(value);
+    return Check(JsonValueToProtoScalar(value, true, field, msg, _options, scratch()));
+}
+
+bool JsonToProtoHandler::Key(const char* str, RAPIDJSON_NAMESPACE::SizeType length, bool) {
+    if (_skip_depth) {
+        return true;
+    }
+    Frame& f = _frames.back();
+    if (f.type == FRAME_MESSAGE) {
+        // The first one of duplicated keys is converted.
+        int index = f.plan->FindField(str, length);
+        if (index >= 0) {
+            uint64_t& bits = _seen[f.seen_offset + index / 64];
+            const uint64_t mask = (uint64_t)1 << (index % 64);
+            if (bits & mask) {
+                index = -1;
+            } else {
+                bits |= mask;
             }
-        } else {
-            if (!JsonValueToProtoField(*value_ptr, field, message, options, err)) {
-                return false;
+        }
+        f.cursor = index;
+    } else {
+        ++f.cursor;
+        f.map_entry = f.message->GetReflection()->AddMessage(f.message, f.field->field);
+        f.plan = f.field->GetMessagePlan(f.map_entry);
+        f.map_entry->GetReflection()->SetString(
+            f.map_entry, f.plan->field(KEY_INDEX).field, std::string(str, length));
+    }
+    return true;
+}
+
+bool JsonToProtoHandler::EndObject(RAPIDJSON_NAMESPACE::SizeType) {
+    if (_skip_depth) {
+        --_skip_depth;
+        return true;
+    }
+    Frame& f = _frames.back();
+    if (f.type == FRAME_MESSAGE) {
+        const std::vector<int>& required = f.plan->required_fields();
+        for (size_t i = 0; i < required.size(); ++i) {
+            const int index = required[i];
+            if (!(_seen[f.seen_offset + index / 64] & ((uint64_t)1 << (index % 64)))) {
+                f.cursor = index;
+                J2PERROR(scratch(), "Missing required field: %s",
+                         f.plan->field(index).field->full_name().c_str());
+                if (!Check(false)) {
+                    return false;
+                }
             }
         }
+        _seen.resize(f.seen_offset);
     }
+    _frames.pop_back();
     return true;
 }
 
-bool ZeroCopyStreamToJson(RAPIDJSON_NAMESPACE::Document *dest,
-                          google::protobuf::io::ZeroCopyInputStream *stream) {
-    ZeroCopyStreamReader stream_reader(stream);
-    dest->ParseStream<0, RAPIDJSON_NAMESPACE::UTF8<> >(stream_reader);
-    return !dest->HasParseError();
+bool JsonToProtoHandler::EndArray(RAPIDJSON_NAMESPACE::SizeType) {
+    if (_skip_depth) {
+        --_skip_depth;
+        return true;
+    }
+    _frames.pop_back();
+    return true;
 }
 
-inline bool JsonToProtoMessageInline(const std::string& json_string, 
-                        google::protobuf::Message* message,
-                        const Json2PbOptions& options,
-                        std::string* error) {
+bool JsonToProtoHandler::Finish() {
+    if (_err && !_errors.empty()) {
+        std::stable_sort(_errors.begin(), _errors.end());
+        for (size_t i = 0; i < _errors.size(); ++i) {
+            if (!_err->empty()) {
+                _err->append(", ", 2);
+            }
+            _err->append(_errors[i].text);
+            if (_errors[i].fatal) {
+                break;
+            }
+        }
+    }
+    return !_failed;
+}
+
+template <typename InputStream>
+inline bool JsonToProtoMessageInline(InputStream& stream,
+                                     google::protobuf::Message* message,
+                                     const Json2PbOptions& options,
+                                     std::string* error) {
     if (error) {
         error->clear();
     }
-    RAPIDJSON_NAMESPACE::Document d;
-    d.Parse<0>(json_string.c_str());
-    if (d.HasParseError()) {
-        J2PERROR(error, "Invalid json format");
+    JsonToProtoHandler handler(message, options, error);
+    RAPIDJSON_NAMESPACE::Reader reader;
+    reader.Parse<0>(stream, handler);
+    if (reader.HasParseError()) {
+        if (reader.GetParseErrorCode() != RAPIDJSON_NAMESPACE::kParseErrorTermination) {
+            J2PERROR(error, "Invalid json format");
+        }
         return false;
     }
-    return json2pb::JsonValueToProtoMessage(d, message, options, error);
+    return handler.Finish();
 }
 
 bool JsonToProtoMessage(const std::string& json_string,
                         google::protobuf::Message* message,
                         const Json2PbOptions& options,
                         std::string* error) {
-    return JsonToProtoMessageInline(json_string, message, options, error);
+    RAPIDJSON_NAMESPACE::StringStream stream(json_string.c_str());
+    return JsonToProtoMessageInline(stream, message, options, error);
 }
 
 bool JsonToProtoMessage(google::protobuf::io::ZeroCopyInputStream* stream,
                         google::protobuf::Message* message,
                         const Json2PbOptions& options,
                         std::string* error) {
-    if (error) {
-        error->clear();
-    }
-    RAPIDJSON_NAMESPACE::Document d;
-    if (!json2pb::ZeroCopyStreamToJson(&d, stream)) {
-        J2PERROR(error, "Invalid json format");
-        return false;
-    }
-    return json2pb::JsonValueToProtoMessage(d, message, options, error);
+    ZeroCopyStreamReader stream_reader(stream);
+    return JsonToProtoMessageInline(stream_reader, message, options, error);
 }
 
-bool JsonToProtoMessage(const std::string& json_string, 
+bool JsonToProtoMessage(const std::string& json_string,
                         google::protobuf::Message* message,
                         std::string* error) {
-    return JsonToProtoMessageInline(json_string, message, Json2PbOptions(), error);
+    return JsonToProtoMessage(json_string, message, Json2PbOptions(), error);
 }
 
-bool JsonToProtoMessage(std::string json_string, 
+bool JsonToProtoMessage(std::string json_string,
                         google::protobuf::Message* message,
                         std::string* error) {
-    return JsonToProtoMessageInline(json_string, message, Json2PbOptions(), error);
+    return JsonToProtoMessage(json_string, message, Json2PbOptions(), error);
 }
 
 bool JsonToProtoMessage(google::protobuf::io::ZeroCopyInputStream *stream,
                         google::protobuf::Message* message,
                         std::string* error) {
-    if (error) {
-        error->clear();
-    }
-    RAPIDJSON_NAMESPACE::Document d;
-    if (!json2pb::ZeroCopyStreamToJson(&d, stream)) {
-        J2PERROR(error, "Invalid json format");
-        return false;
-    }
-    return json2pb::JsonValueToProtoMessage(d, message, Json2PbOptions(), error);
+    return JsonToProtoMessage(stream, message, Json2PbOptions(), error);
 }
 } //namespace json2pb
 
@@ -37,6 +37,8 @@ struct Json2PbOptions {
 // Convert `json' to protobuf `message'.
 // Returns true on success. `error' (if not NULL) will be set with error
 // message on failure.
+// `json' is converted while being parsed without building a DOM, thus
+// `message' may be partially filled on failure.
 bool JsonToProtoMessage(const std::string& json,
                         google::protobuf::Message* message,
                         const Json2PbOptions& options,
@@ -0,0 +1,58 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <algorithm>
+#include "message_plan.h"
+
+namespace json2pb {
+
+static bool CompareFieldNumber(const google::protobuf::FieldDescriptor* f1,
+                               const google::protobuf::FieldDescriptor* f2) {
+    return f1->number() < f2->number();
+}
+
+void ListFieldsToConvert(const google::protobuf::Descriptor* descriptor,
+                         const google::protobuf::Reflection* reflection,
+                         std::vector<const google::protobuf::FieldDescriptor*>* fields) {
+    if (descriptor->extension_range_count() > 0) {
+        // Ranges may reach 2^29-1, look up known extensions instead of
+        // trying all numbers in the ranges.
+        std::vector<const google::protobuf::FieldDescriptor*> extensions;
+        descriptor->file()->pool()->FindAllExtensions(descriptor, &extensions);
+        std::sort(extensions.begin(), extensions.end(), CompareFieldNumber);
+        for (int i = 0; i < descriptor->extension_range_count(); ++i) {
+            const google::protobuf::Descriptor::ExtensionRange*
+                ext_range = descriptor->extension_range(i);
+            for (size_t j = 0; j < extensions.size(); ++j) {
+                const int tag_number = extensions[j]->number();
+                if (tag_number < ext_range->start || tag_number >= ext_range->end) {
+                    continue;
+                }
+                const google::protobuf::FieldDescriptor* field =
+                    reflection->FindKnownExtensionByNumber(tag_number);
+                if (field) {
+                    fields->push_back(field);
+                }
+            }
+        }
+    }
+    for (int i = 0; i < descriptor->field_count(); ++i) {
+        fields->push_back(descriptor->field(i));
+    }
+}
+
+} // namespace json2pb
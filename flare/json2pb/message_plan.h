@@ -0,0 +1,117 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#ifndef FLARE_RPC_JSON2PB_MESSAGE_PLAN_H_
+#define FLARE_RPC_JSON2PB_MESSAGE_PLAN_H_
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <google/protobuf/descriptor.h>
+#include <google/protobuf/message.h>
+#include "flare/container/flat_map.h"
+
+namespace json2pb {
+
+// Append fields of `descriptor' into `fields' in the order they are
+// converted: known extensions (by number) and then fields.
+void ListFieldsToConvert(const google::protobuf::Descriptor* descriptor,
+                         const google::protobuf::Reflection* reflection,
+                         std::vector<const google::protobuf::FieldDescriptor*>* fields);
+
+// Plans of message types, built by `Plan(descriptor, reflection)' at the
+// first time a type is converted and never destroyed.
+//
+// Only types of the generated pool are cached, their descriptors live as
+// long as the process. Descriptors of other pools (e.g. DynamicMessageFactory
+// over a DescriptorPool built at runtime) may be freed and their addresses
+// reused, Get() returns NULL for them and the caller builds a plan of its own.
+//
+// Lookups hit a thread-local cache without locking, the shared map behind
+// it is locked only at the first time a thread converts a type.
+template <typename Plan>
+class PlanCache {
+public:
+    static const Plan* Get(const google::protobuf::Message& msg) {
+        const google::protobuf::Descriptor* descriptor = msg.GetDescriptor();
+        if (descriptor->file()->pool() !=
+            google::protobuf::DescriptorPool::generated_pool()) {
+            return NULL;
+        }
+        static thread_local flare::container::FlatMap<
+            const google::protobuf::Descriptor*, const Plan*> tls_plans;
+        if (!tls_plans.initialized()) {
+            tls_plans.init(64);
+        }
+        const Plan** plan = tls_plans.seek(descriptor);
+        if (plan != NULL) {
+            return *plan;
+        }
+        const Plan* p = GetShared(msg);
+        tls_plans[descriptor] = p;
+        return p;
+    }
+
+private:
+    static const Plan* GetShared(const google::protobuf::Message& msg) {
+        static std::mutex s_mutex;
+        static flare::container::FlatMap<
+            const google::protobuf::Descriptor*, const Plan*>* s_plans = NULL;
+        std::unique_lock<std::mutex> mu(s_mutex);
+        if (s_plans == NULL) {
+            s_plans = new flare::container::FlatMap<
+                const google::protobuf::Descriptor*, const Plan*>;
+            s_plans->init(64);
+        }
+        const Plan*& plan = (*s_plans)[msg.GetDescriptor()];
+        if (plan == NULL) {
+            plan = new Plan(msg.GetDescriptor(), msg.GetReflection());
+        }
+        return plan;
+    }
+};
+
+// Plan of a message field, resolved at the first time it's needed. Plans
+// of types out of the generated pool are owned by the field: such a field
+// only belongs to a plan owned by a single conversion, see PlanCache.
+template <typename Plan>
+class LazyPlan {
+public:
+    LazyPlan() : _plan(NULL) {}
+
+    const Plan* Get(const google::protobuf::Message& msg) const {
+        const Plan* plan = _plan.load(std::memory_order_acquire);
+        if (plan == NULL) {
+            plan = PlanCache<Plan>::Get(msg);
+            if (plan == NULL) {
+                _owned.reset(new Plan(msg.GetDescriptor(), msg.GetReflection()));
+                plan = _owned.get();
+            }
+            _plan.store(plan, std::memory_order_release);
+        }
+        return plan;
+    }
+
+private:
+    mutable std::atomic<const Plan*> _plan;
+    mutable std::unique_ptr<Plan> _owned;
+};
+
+} // namespace json2pb
+
+#endif  // FLARE_RPC_JSON2PB_MESSAGE_PLAN_H_
@@ -16,6 +16,7 @@
 // under the License.
 
 #include <iostream>
+#include <memory>
 #include <vector>
 #include <string>
 #include <sstream>
@@ -23,9 +24,12 @@
 #include <time.h>
 #include <google/protobuf/descriptor.h>
 #include "flare/base/base64.h"
+#include "flare/io/cord_buf.h"
 #include "zero_copy_stream_writer.h"
+#include "cord_buf_writer.h"
 #include "encode_decode.h"
 #include "protobuf_map.h"
+#include "message_plan.h"
 #include "rapidjson.h"
 #include "pb_to_json.h"
 
@@ -39,19 +43,99 @@ Pb2JsonOptions::Pb2JsonOptions()
     , always_print_primitive_fields(false) {
 }
 
+class MessageOutputPlan;
+
+struct FieldOutputPlan {
+    const google::protobuf::FieldDescriptor* field;
+    bool is_map;
+    // Name decoded by decode_name().
+    std::string name;
+    // `name' written by CordBufJsonWriter::RawKey().
+    std::string raw_key;
+    // Value field of the map entry if is_map.
+    std::unique_ptr<FieldOutputPlan> map_value;
+    // Plan of the message type.
+    LazyPlan<MessageOutputPlan> message_plan;
+
+    FieldOutputPlan() : field(NULL), is_map(false) {}
+
+    void Init(const google::protobuf::FieldDescriptor* f);
+
+    const MessageOutputPlan* GetMessagePlan(const google::protobuf::Message& msg) const {
+        return message_plan.Get(msg);
+    }
+};
+
+// Fields of a message type in the order they are converted: known
+// extensions and then fields.
+class MessageOutputPlan {
+public:
+    MessageOutputPlan(const google::protobuf::Descriptor* descriptor,
+                      const google::protobuf::Reflection* reflection) {
+        std::vector<const google::protobuf::FieldDescriptor*> fields;
+        ListFieldsToConvert(descriptor, reflection, &fields);
+        _nfield = fields.size();
+        _fields.reset(new FieldOutputPlan[_nfield]);
+        for (int i = 0; i < _nfield; ++i) {
+            _fields[i].Init(fields[i]);
+            // Extensions are never converted as maps.
+            _fields[i].is_map = (!fields[i]->is_extension() && IsProtobufMap(fields[i]));
+            if (_fields[i].is_map) {
+                _fields[i].map_value.reset(new FieldOutputPlan);
+                _fields[i].map_value->Init(
+                    fields[i]->message_type()->field(json2pb::VALUE_INDEX));
+            }
+        }
+    }
+
+    int field_count() const { return _nfield; }
+    const FieldOutputPlan& field(int index) const { return _fields[index]; }
+
+private:
+    int _nfield;
+    std::unique_ptr<FieldOutputPlan[]> _fields;
+};
+
+void FieldOutputPlan::Init(const google::protobuf::FieldDescriptor* f) {
+    field = f;
+    if (!decode_name(f->name(), name)) {
+        name = f->name();
+    }
+    raw_key = CordBufJsonWriter::MakeRawKey(name);
+}
+
+// Names of fields are escaped in advance for CordBufJsonWriter.
+template <typename Handler>
+inline void WriteFieldName(const FieldOutputPlan& fp, Handler& handler) {
+    handler.Key(fp.name.data(), fp.name.size(), false);
+}
+
+inline void WriteFieldName(const FieldOutputPlan& fp, CordBufJsonWriter& handler) {
+    handler.RawKey(fp.raw_key);
+}
+
 class PbToJsonConverter {
 public:
     explicit PbToJsonConverter(const Pb2JsonOptions& opt) : _option(opt) {}
 
     template <typename Handler>
-    bool Convert(const google::protobuf::Message& message, Handler& handler);
+    bool Convert(const google::protobuf::Message& message, Handler& handler) {
+        // Owns the plan if the type is not of the generated pool.
+        LazyPlan<MessageOutputPlan> plan;
+        return _Convert(message, plan.Get(message), handler);
+    }
 
     const std::string& ErrorText() const { return _error; }
 
 private:
+    template <typename Handler>
+    bool _Convert(const google::protobuf::Message& message,
+                  const MessageOutputPlan* plan,
+                  Handler& handler);
+
     template <typename Handler>
     bool _PbFieldToJson(const google::protobuf::Message& message,
-                        const google::protobuf::FieldDescriptor* field,
+                        const FieldOutputPlan& fp,
                         Handler& handler);
 
     std::string _error;
@@ -59,41 +143,21 @@ private:
 };
 
 template <typename Handler>
-bool PbToJsonConverter::Convert(const google::protobuf::Message& message, Handler& handler) {
+bool PbToJsonConverter::_Convert(const google::protobuf::Message& message,
+                                 const MessageOutputPlan* plan,
+                                 Handler& handler) {
     handler.StartObject();
     const google::protobuf::Reflection* reflection = message.GetReflection();
-    const google::protobuf::Descriptor* descriptor = message.GetDescriptor();
-    
-    int ext_range_count = descriptor->extension_range_count();
-    int field_count = descriptor->field_count();
-    std::vector<const google::protobuf::FieldDescriptor*> fields;
-    fields.reserve(64);
-    for (int i = 0; i < ext_range_count; ++i) {
-        const google::protobuf::Descriptor::ExtensionRange*
-            ext_range = descriptor->extension_range(i);
-        for (int tag_number = ext_range->start;
-             tag_number < ext_range->end; ++tag_number) {
-            const google::protobuf::FieldDescriptor* field =
-                    reflection->FindKnownExtensionByNumber(tag_number);
-            if (field) {
-                fields.push_back(field);
-            }
-        }
-    }
-    std::vector<const google::protobuf::FieldDescriptor*> map_fields;
-    for (int i = 0; i < field_count; ++i) {
-        const google::protobuf::FieldDescriptor* field = descriptor->field(i);
-        if (_option.enable_protobuf_map && json2pb::IsProtobufMap(field)) {
-            map_fields.push_back(field);
-        } else {
-            fields.push_back(field);
-        }
-    }
 
     // Fill in non-map fields
-    std::string field_name_str;
-    for (size_t i = 0; i < fields.size(); ++i) {
-        const google::protobuf::FieldDescriptor* field = fields[i];
+    bool has_map = false;
+    for (int i = 0; i < plan->field_count(); ++i) {
+        const FieldOutputPlan& fp = plan->field(i);
+        const google::protobuf::FieldDescriptor* field = fp.field;
+        if (_option.enable_protobuf_map && fp.is_map) {
+            has_map = true;
+            continue;
+        }
         if (!field->is_repeated() && !reflection->HasField(message, field)) {
             // Field that has not been set
             if (field->is_required()) {
@@ -111,41 +175,37 @@ bool PbToJsonConverter::Convert(const google::protobuf::Message& message, Handle
             continue;
         }
 
-        const std::string& orig_name = field->name();
-        bool decoded = decode_name(orig_name, field_name_str); 
-        const std::string& name = decoded ? field_name_str : orig_name;
-        handler.Key(name.data(), name.size(), false);
-        if (!_PbFieldToJson(message, field, handler)) {
+        WriteFieldName(fp, handler);
+        if (!_PbFieldToJson(message, fp, handler)) {
             return false;
         }
     }
 
     // Fill in map fields
-    for (size_t i = 0; i < map_fields.size(); ++i) {
-        const google::protobuf::FieldDescriptor* map_desc = map_fields[i];
+    for (int i = 0; has_map && i < plan->field_count(); ++i) {
+        const FieldOutputPlan& fp = plan->field(i);
+        if (!fp.is_map) {
+            continue;
+        }
+        const google::protobuf::FieldDescriptor* map_desc = fp.field;
         const google::protobuf::FieldDescriptor* key_desc =
                 map_desc->message_type()->field(json2pb::KEY_INDEX);
-        const google::protobuf::FieldDescriptor* value_desc =
-                map_desc->message_type()->field(json2pb::VALUE_INDEX);
 
         // Write a json object corresponding to hold protobuf map
         // such as {"key": value, ...}
-        const std::string& orig_name = map_desc->name();
-        bool decoded = decode_name(orig_name, field_name_str);
-        const std::string& name = decoded ? field_name_str : orig_name;
-        handler.Key(name.data(), name.size(), false);
+        WriteFieldName(fp, handler);
         handler.StartObject();
         std::string entry_name;
         for (int j = 0; j < reflection->FieldSize(message, map_desc); ++j) {
             const google::protobuf::Message& entry =
                     reflection->GetRepeatedMessage(message, map_desc, j);
             const google::protobuf::Reflection* entry_reflection = entry.GetReflection();
-            entry_name = entry_reflection->GetStringReference(
+            const std::string& key = entry_reflection->GetStringReference(
                 entry, key_desc, &entry_name);
-            handler.Key(entry_name.data(), entry_name.size(), false);
+            handler.Key(key.data(), key.size(), false);
 
             // Fill in entries into this json object
-            if (!_PbFieldToJson(entry, value_desc, handler)) {
+            if (!_PbFieldToJson(entry, *fp.map_value, handler)) {
                 return false;
             }
         }
@@ -160,8 +220,9 @@ bool PbToJsonConverter::Convert(const google::protobuf::Message& message, Handle
 template <typename Handler>
 bool PbToJsonConverter::_PbFieldToJson(
     const google::protobuf::Message& message,
-    const google::protobuf::FieldDescriptor* field,
+    const FieldOutputPlan& fp,
     Handler& handler) {
+    const google::protobuf::FieldDescriptor* field = fp.field;
     const google::protobuf::Reflection* reflection = message.GetReflection();
     switch (field->cpp_type()) {
 #define CASE_FIELD_TYPE(cpptype, method, valuetype, handle)             \
@@ -193,13 +254,13 @@ bool PbToJsonConverter::_PbFieldToJson(
 #undef CASE_FIELD_TYPE
 
     case google::protobuf::FieldDescriptor::CPPTYPE_STRING: {
-        std::string value;
+        std::string scratch;
         if (field->is_repeated()) {
             int field_size = reflection->FieldSize(message, field);
             handler.StartArray();
             for (int index = 0; index < field_size; ++index) {
-                value = reflection->GetRepeatedStringReference(
-                    message, field, index, &value);
+                const std::string& value = reflection->GetRepeatedStringReference(
+                    message, field, index, &scratch);
                 if (field->type() == google::protobuf::FieldDescriptor::TYPE_BYTES
                     && _option.bytes_to_base64) {
                     std::string value_decoded;
@@ -212,7 +273,8 @@ bool PbToJsonConverter::_PbFieldToJson(
             handler.EndArray(field_size);
             
         } else {
-            value = reflection->GetStringReference(message, field, &value);
+            const std::string& value =
+                reflection->GetStringReference(message, field, &scratch);
             if (field->type() == google::protobuf::FieldDescriptor::TYPE_BYTES
                 && _option.bytes_to_base64) {
                 std::string value_decoded;
@@ -260,15 +322,18 @@ bool PbToJsonConverter::_PbFieldToJson(
             int field_size = reflection->FieldSize(message, field);
             handler.StartArray();
             for (int index = 0; index < field_size; ++index) {
-                if (!Convert(reflection->GetRepeatedMessage(
-                        message, field, index), handler)) {
+                const google::protobuf::Message& sub_message =
+                    reflection->GetRepeatedMessage(message, field, index);
+                if (!_Convert(sub_message, fp.GetMessagePlan(sub_message), handler)) {
                     return false;
                 }
             }
             handler.EndArray(field_size);
             
         } else {
-            if (!Convert(reflection->GetMessage(message, field), handler)) {
+            const google::protobuf::Message& sub_message =
+                reflection->GetMessage(message, field);
+            if (!_Convert(sub_message, fp.GetMessagePlan(sub_message), handler)) {
                 return false;
             }
         }
@@ -329,4 +394,30 @@ bool ProtoMessageToJson(const google::protobuf::Message& message,
                         std::string* error) {
     return ProtoMessageToJson(message, stream, Pb2JsonOptions(), error);
 }
+
+bool ProtoMessageToJson(const google::protobuf::Message& message,
+                        flare::cord_buf* json,
+                        const Pb2JsonOptions& options, std::string* error) {
+    if (options.pretty_json) {
+        flare::cord_buf_as_zero_copy_output_stream wrapper(json);
+        return ProtoMessageToJson(message, &wrapper, options, error);
+    }
+    flare::cord_buf_appender appender;
+    CordBufJsonWriter writer(&appender);
+    PbToJsonConverter converter(options);
+    if (!converter.Convert(message, writer)) {
+        if (error) {
+            error->clear();
+            error->append(converter.ErrorText());
+        }
+        return false;
+    }
+    json->append(flare::cord_buf::Movable(appender.buf()));
+    return true;
+}
+
+bool ProtoMessageToJson(const google::protobuf::Message& message,
+                        flare::cord_buf* json, std::string* error) {
+    return ProtoMessageToJson(message, json, Pb2JsonOptions(), error);
+}
 } // namespace json2pb
@@ -24,6 +24,10 @@
 #include <google/protobuf/message.h>
 #include <google/protobuf/io/zero_copy_stream.h> // ZeroCopyOutputStream
 
+namespace flare {
+class cord_buf;
+}
+
 namespace json2pb {
 
 enum EnumOption {
@@ -79,6 +83,13 @@ bool ProtoMessageToJson(const google::protobuf::Message& message,
                         const Pb2JsonOptions& options,
                         std::string* error = NULL);
 
+// Append json to cord_buf directly, which is faster than going through a
+// ZeroCopyOutputStream. `json' is not changed on failure.
+bool ProtoMessageToJson(const google::protobuf::Message& message,
+                        flare::cord_buf* json,
+                        const Pb2JsonOptions& options,
+                        std::string* error = NULL);
+
 // Using default Pb2JsonOptions.
 bool ProtoMessageToJson(const google::protobuf::Message& message,
                         std::string* json,
@@ -86,6 +97,9 @@ bool ProtoMessageToJson(const google::protobuf::Message& message,
 bool ProtoMessageToJson(const google::protobuf::Message& message,
                         google::protobuf::io::ZeroCopyOutputStream* json,
                         std::string* error = NULL);
+bool ProtoMessageToJson(const google::protobuf::Message& message,
+                        flare::cord_buf* json,
+                        std::string* error = NULL);
 } // namespace json2pb
 
 #endif // FLARE_RPC_JSON2PB_PB_TO_JSON_H_
@@ -102,5 +102,17 @@ FLARE_LOG_DEFINE_string(flarelog_backtrace_at, "",
 FLARE_LOG_DEFINE_bool(flare_log_utc_time, false,
                       "Use UTC time for logging.");
 
+FLARE_LOG_DEFINE_bool(flare_log_async, false,
+                      "Write log files in a background thread, see "
+                      "enable_async_logging().");
+
+FLARE_LOG_DEFINE_int32(flare_log_async_buffer_kb, 1024,
+                       "Size of per-thread buffers holding lines not yet "
+                       "written by async logging, in KB.");
+
+FLARE_LOG_DEFINE_bool(flare_log_async_block_on_full, false,
+                      "Write lines synchronously rather than dropping them "
+                      "when the async logging buffer is full.");
+
 DEFINE_bool(flare_log_as_json, false, "Print log as a valid JSON");
 DEFINE_bool(flare_crash_on_fatal_log, false, "crash on fatal log");
@@ -110,6 +110,13 @@ DECLARE_bool(flare_stop_logging_if_full_disk);
 // Use UTC time for logging
 DECLARE_bool(flare_log_utc_time);
 
+// Write log files in a background thread.
+DECLARE_bool(flare_log_async);
+
+DECLARE_int32(flare_log_async_buffer_kb);
+
+DECLARE_bool(flare_log_async_block_on_full);
+
 DECLARE_bool(flare_crash_on_fatal_log);
 
 DECLARE_bool(flare_log_as_json);
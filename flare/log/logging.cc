@@ -15,6 +15,9 @@
 #include <climits>
 #include <sys/types.h>
 #include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <memory>
 #include <sys/stat.h>
 #include <sys/utsname.h>  // For uname.
 #include <ctime>
@@ -319,12 +322,76 @@ namespace flare::log {
 
     }  // namespace
 
+    // Writes log files in a background thread. Lines are copied into
+    // per-thread rings by producers (which still hold log_mutex for
+    // formatting, sinks and the line order) and drained in large batches,
+    // one write per log file, so that threads calling FLARE_LOG never wait
+    // for disk I/O.
+    class async_log_writer {
+    public:
+        static bool enabled() {
+            return enabled_.load(std::memory_order_relaxed);
+        }
+
+        // Returns false if the line should be written synchronously by the
+        // caller, e.g. FATAL lines.
+        // REQUIRES: log_mutex is held.
+        static bool append(log_severity severity, time_t timestamp,
+                           const char *message, size_t len);
+
+        // Write out all pending lines in the calling thread.
+        // Returns number of lines written.
+        static size_t drain();
+
+        // Replaces the logger of `severity', lines logged before go to the
+        // old one. The drainer writes without log_mutex, so the logger is
+        // only replaced under drain_mutex_.
+        // REQUIRES: log_mutex is held.
+        static void set_logger(log_severity severity, base::inner_logger *logger);
+
+        static void start();
+
+        static void stop();
+
+        static int64_t dropped_count() {
+            return dropped_.load(std::memory_order_relaxed);
+        }
+
+    private:
+        struct record;
+        struct ring;
+
+        static ring *get_tls_ring();
+
+        static void orphan_tls_ring();
+
+        static size_t drain_unlocked();
+
+        static void run();
+
+        static std::atomic<bool> enabled_;
+        static std::atomic<bool> fatal_seen_;
+        static std::atomic<int64_t> dropped_;
+        static uint64_t next_seq_;          // Under log_mutex.
+        static std::mutex control_mutex_;   // Serializes start() and stop().
+        static std::mutex rings_mutex_;     // Protects rings_.
+        static vector<ring *> *rings_;
+        static std::mutex drain_mutex_;     // Only one drainer at a time.
+        static std::mutex wakeup_mutex_;
+        static std::condition_variable wakeup_cond_;
+        static bool stopping_;              // Under wakeup_mutex_.
+        static std::thread *thread_;
+        static thread_local ring *tls_ring_;
+    };
+
     class log_destination {
     public:
         friend class log_message;
 
         friend void reprint_fatal_message();
 
+        friend class async_log_writer;
+
         friend base::inner_logger *base::get_logger(log_severity);
 
         friend void base::set_logger(log_severity, base::inner_logger *);
@@ -469,6 +536,8 @@ namespace flare::log {
     inline void log_destination::flush_log_files_unsafe(int min_severity) {
         // assume we have the log_mutex or we simply don't care
         // about it
+        // Lines still in the rings of async_log_writer are lost: draining
+        // them allocates and takes locks, which is not async-signal-safe.
         for (int i = min_severity; i < NUM_SEVERITIES; i++) {
             log_destination *log = log_destinations_[i];
             if (log != NULL) {
@@ -483,6 +552,9 @@ namespace flare::log {
         // Prevent any subtle race conditions by wrapping a mutex lock around
         // all this stuff.
         std::unique_lock<std::mutex> l(log_mutex);
+        if (async_log_writer::enabled()) {
+            async_log_writer::drain();
+        }
         for (int i = min_severity; i < NUM_SEVERITIES; i++) {
             log_destination *log = get_log_destination(i);
             if (log != NULL) {
@@ -641,6 +713,9 @@ namespace flare::log {
 
         if (FLAGS_flare_logtostderr) {           // global flag: never log to file
             colored_write_to_stderr(severity, message, len);
+        } else if (async_log_writer::enabled() &&
+                   async_log_writer::append(severity, timestamp, message, len)) {
+            // Written by the background thread.
         } else {
             for (int i = severity; i >= 0; --i)
                 log_destination::maybe_log_to_logfile(i, timestamp, message, len);
@@ -699,6 +774,271 @@ namespace flare::log {
         sinks_ = NULL;
     }
 
+    // Header of a line in async_log_writer::ring, followed by the line.
+    struct async_log_writer::record {
+        uint64_t seq;         // Order of the line under log_mutex
+        time_t timestamp;
+        uint32_t len;
+        int32_t severity;     // Negative for padding till end of the ring
+    };
+
+    // Single-producer single-consumer ring owned by one logging thread.
+    struct async_log_writer::ring {
+        explicit ring(size_t cap) : data(new char[cap]), capacity(cap) {}
+
+        std::unique_ptr<char[]> data;
+        const size_t capacity;
+        std::atomic<uint64_t> head{0};      // Advanced by the drainer
+        std::atomic<uint64_t> tail{0};      // Advanced by the owner thread
+        std::atomic<bool> orphaned{false};  // Owner thread has exited
+    };
+
+    static const size_t ASYNC_LOG_RECORD_ALIGN = 8;
+    // Lines are buffered at most so long if no ring is half full.
+    static const int ASYNC_LOG_IDLE_WAIT_MS = 20;
+
+    std::atomic<bool> async_log_writer::enabled_{false};
+    std::atomic<bool> async_log_writer::fatal_seen_{false};
+    std::atomic<int64_t> async_log_writer::dropped_{0};
+    uint64_t async_log_writer::next_seq_ = 0;
+    std::mutex async_log_writer::control_mutex_;
+    std::mutex async_log_writer::rings_mutex_;
+    vector<async_log_writer::ring *> *async_log_writer::rings_ = NULL;
+    std::mutex async_log_writer::drain_mutex_;
+    std::mutex async_log_writer::wakeup_mutex_;
+    std::condition_variable async_log_writer::wakeup_cond_;
+    bool async_log_writer::stopping_ = false;
+    std::thread *async_log_writer::thread_ = NULL;
+    thread_local async_log_writer::ring *async_log_writer::tls_ring_ = NULL;
+
+    async_log_writer::ring *async_log_writer::get_tls_ring() {
+        ring *r = tls_ring_;
+        if (r == NULL) {
+            const size_t cap = (size_t) std::max(FLAGS_flare_log_async_buffer_kb, 64) * 1024;
+            r = new ring(cap);
+            {
+                std::unique_lock<std::mutex> l(rings_mutex_);
+                if (rings_ == NULL) {
+                    rings_ = new vector<ring *>;
+                }
+                rings_->push_back(r);
+            }
+            tls_ring_ = r;
+            flare::thread::atexit(orphan_tls_ring);
+        }
+        return r;
+    }
+
+    void async_log_writer::orphan_tls_ring() {
+        ring *r = tls_ring_;
+        if (r != NULL) {
+            tls_ring_ = NULL;
+            // The drainer deletes the ring after writing out its lines.
+            r->orphaned.store(true, std::memory_order_release);
+        }
+    }
+
+    bool async_log_writer::append(log_severity severity, time_t timestamp,
+                                  const char *message, size_t len) {
+        if (severity >= FLARE_FATAL || fatal_seen_.load(std::memory_order_relaxed)) {
+            // Write out lines before the FATAL one and make everything since
+            // then synchronous, the process is going to die soon.
+            fatal_seen_.store(true, std::memory_order_relaxed);
+            drain();
+            return false;
+        }
+        ring *r = get_tls_ring();
+        const size_t size = (sizeof(record) + len + ASYNC_LOG_RECORD_ALIGN - 1) &
+                            ~(ASYNC_LOG_RECORD_ALIGN - 1);
+        if (size > r->capacity / 2) {
+            drain();
+            return false;
+        }
+        uint64_t pos = r->tail.load(std::memory_order_relaxed);
+        const size_t offset = pos % r->capacity;
+        const size_t to_end = r->capacity - offset;
+        // Lines are never split, skip the end of the ring if it's too short.
+        const size_t needed = (to_end < size ? to_end + size : size);
+        while (r->capacity - (pos - r->head.load(std::memory_order_acquire)) < needed) {
+            if (!FLAGS_flare_log_async_block_on_full) {
+                dropped_.fetch_add(1, std::memory_order_relaxed);
+                return true;
+            }
+            drain();
+        }
+        char *const data = r->data.get();
+        if (to_end < size) {
+            if (to_end >= sizeof(record)) {
+                record pad;
+                memset(&pad, 0, sizeof(pad));
+                pad.severity = -1;
+                memcpy(data + offset, &pad, sizeof(pad));
+            }
+            pos += to_end;
+        }
+        record h;
+        h.seq = next_seq_++;
+        h.timestamp = timestamp;
+        h.len = len;
+        h.severity = severity;
+        char *const p = data + pos % r->capacity;
+        memcpy(p, &h, sizeof(h));
+        memcpy(p + sizeof(h), message, len);
+        pos += size;
+        r->tail.store(pos, std::memory_order_release);
+        if (pos - r->head.load(std::memory_order_relaxed) > r->capacity / 2) {
+            wakeup_cond_.notify_one();
+        }
+        return true;
+    }
+
+    size_t async_log_writer::drain() {
+        std::unique_lock<std::mutex> l(drain_mutex_);
+        return drain_unlocked();
+    }
+
+    void async_log_writer::set_logger(log_severity severity, base::inner_logger *logger) {
+        std::unique_lock<std::mutex> l(drain_mutex_);
+        if (enabled()) {
+            drain_unlocked();
+        }
+        log_destination::get_log_destination(severity)->logger_ = logger;
+    }
+
+    size_t async_log_writer::drain_unlocked() {
+        // Reused between calls, under drain_mutex_.
+        static vector<ring *> rings;
+        static vector<uint64_t> tails;
+        static vector<const record *> records;
+        static string batches[NUM_SEVERITIES];
+
+        {
+            std::unique_lock<std::mutex> l(rings_mutex_);
+            if (rings_ == NULL) {
+                return 0;
+            }
+            for (size_t i = 0; i < rings_->size();) {
+                ring *r = (*rings_)[i];
+                // Check `orphaned' first, no more lines after that.
+                if (r->orphaned.load(std::memory_order_acquire) &&
+                    r->head.load(std::memory_order_relaxed) ==
+                    r->tail.load(std::memory_order_acquire)) {
+                    delete r;
+                    (*rings_)[i] = rings_->back();
+                    rings_->pop_back();
+                } else {
+                    ++i;
+                }
+            }
+            rings = *rings_;
+        }
+
+        tails.resize(rings.size());
+        records.clear();
+        for (size_t i = 0; i < rings.size(); ++i) {
+            ring *r = rings[i];
+            uint64_t pos = r->head.load(std::memory_order_relaxed);
+            const uint64_t tail = r->tail.load(std::memory_order_acquire);
+            tails[i] = tail;
+            while (pos != tail) {
+                const size_t offset = pos % r->capacity;
+                const size_t to_end = r->capacity - offset;
+                const record *rec = (const record *) (r->data.get() + offset);
+                if (to_end < sizeof(record) || rec->severity < 0) {
+                    pos += to_end;
+                    continue;
+                }
+                records.push_back(rec);
+                pos += (sizeof(record) + rec->len + ASYNC_LOG_RECORD_ALIGN - 1) &
+                       ~(ASYNC_LOG_RECORD_ALIGN - 1);
+            }
+        }
+        if (records.empty()) {
+            return 0;
+        }
+
+        // Restore the order in which the lines were logged by all threads.
+        std::sort(records.begin(), records.end(),
+                  [](const record *a, const record *b) { return a->seq < b->seq; });
+        time_t timestamps[NUM_SEVERITIES] = {0};
+        int max_severities[NUM_SEVERITIES] = {0};
+        for (const record *rec : records) {
+            // Lines go to the log files of their severity and all lower ones.
+            for (int i = rec->severity; i >= 0; --i) {
+                batches[i].append((const char *) (rec + 1), rec->len);
+                timestamps[i] = rec->timestamp;
+                max_severities[i] = std::max(max_severities[i], (int) rec->severity);
+            }
+        }
+        for (int i = 0; i < NUM_SEVERITIES; ++i) {
+            if (!batches[i].empty()) {
+                // Created in start() and never deleted before stop(). The
+                // logger is only replaced under drain_mutex_, see set_logger().
+                log_destination *destination = log_destination::log_destinations_[i];
+                // Flushed as a synchronous write of the most severe line would be.
+                destination->logger_->write(max_severities[i] > FLAGS_flare_logbuflevel,
+                                            timestamps[i], batches[i].data(),
+                                            batches[i].size());
+                batches[i].clear();
+            }
+        }
+        for (size_t i = 0; i < rings.size(); ++i) {
+            rings[i]->head.store(tails[i], std::memory_order_release);
+        }
+        return records.size();
+    }
+
+    void async_log_writer::run() {
+        while (true) {
+            const size_t n = drain();
+            std::unique_lock<std::mutex> l(wakeup_mutex_);
+            if (stopping_) {
+                break;
+            }
+            if (n == 0) {
+                wakeup_cond_.wait_for(l, std::chrono::milliseconds(ASYNC_LOG_IDLE_WAIT_MS));
+            }
+        }
+    }
+
+    void async_log_writer::start() {
+        std::unique_lock<std::mutex> cl(control_mutex_);
+        if (enabled()) {
+            return;
+        }
+        {
+            std::unique_lock<std::mutex> l(wakeup_mutex_);
+            stopping_ = false;
+        }
+        thread_ = new std::thread(run);
+        std::unique_lock<std::mutex> l(log_mutex);
+        for (int i = 0; i < NUM_SEVERITIES; ++i) {
+            log_destination::get_log_destination(i);
+        }
+        enabled_.store(true, std::memory_order_relaxed);
+    }
+
+    void async_log_writer::stop() {
+        std::unique_lock<std::mutex> cl(control_mutex_);
+        {
+            // No more appends after this, they're under log_mutex.
+            std::unique_lock<std::mutex> l(log_mutex);
+            if (!enabled()) {
+                return;
+            }
+            enabled_.store(false, std::memory_order_relaxed);
+        }
+        {
+            std::unique_lock<std::mutex> l(wakeup_mutex_);
+            stopping_ = true;
+        }
+        wakeup_cond_.notify_one();
+        thread_->join();
+        delete thread_;
+        thread_ = NULL;
+        drain();
+    }
+
     namespace {
 
         std::string g_application_fingerprint;
@@ -1715,7 +2055,7 @@ namespace flare::log {
 
     void base::set_logger(log_severity severity, base::inner_logger *logger) {
         std::unique_lock<std::mutex> l(log_mutex);
-        log_destination::get_log_destination(severity)->logger_ = logger;
+        async_log_writer::set_logger(severity, logger);
     }
 
 // L < log_mutex.  Acquires and releases mutex_.
@@ -2221,9 +2561,13 @@ namespace flare::log {
 
     void init_logging(const char *argv0) {
         log_internal::init_logging_utilities(argv0);
+        if (FLAGS_flare_log_async) {
+            async_log_writer::start();
+        }
     }
 
     void shutdown_logging() {
+        async_log_writer::stop();
         log_internal::shutdown_logging_utilities();
         log_destination::delete_log_destinations();
         delete logging_directories_list;
@@ -2238,6 +2582,18 @@ namespace flare::log {
         g_log_cleaner.disable();
     }
 
+    void enable_async_logging() {
+        async_log_writer::start();
+    }
+
+    void disable_async_logging() {
+        async_log_writer::stop();
+    }
+
+    int64_t async_logging_dropped_count() {
+        return async_log_writer::dropped_count();
+    }
+
 }  // namespace flare::log
 
 
@@ -188,6 +188,20 @@ namespace flare::log {
 
     FLARE_EXPORT void disable_log_cleaner();
 
+    // Write log files in a background thread so that logging threads never
+    // wait for disk I/O. Lines are buffered per thread, in a buffer of
+    // -flare_log_async_buffer_kb. When the buffer is full, lines are dropped
+    // unless -flare_log_async_block_on_full is set. FATAL lines and lines
+    // after them are written synchronously.
+    // Enabled by init_logging() as well when -flare_log_async is set.
+    FLARE_EXPORT void enable_async_logging();
+
+    // Write out buffered lines and go back to synchronous writing.
+    FLARE_EXPORT void disable_async_logging();
+
+    // Number of lines dropped because async logging buffers were full.
+    FLARE_EXPORT int64_t async_logging_dropped_count();
+
     FLARE_EXPORT void SetApplicationFingerprint(const std::string &fingerprint);
 
     class log_sink;  // defined below
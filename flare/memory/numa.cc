@@ -0,0 +1,41 @@
+/****************************************************************
+ * Copyright (c) 2022, liyinbin
+ * All rights reserved.
+ * Author by liyinbin (jeff.li) lijippy@163.com
+ *****************************************************************/
+
+
+#include "flare/memory/numa.h"
+#include <errno.h>
+
+#if defined(__linux__)
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace flare {
+
+    int prefer_numa_node(void *addr, size_t len, int node) {
+#if defined(__linux__) && defined(SYS_mbind)
+        // Same as MPOL_PREFERRED in <numaif.h>, which is shipped with libnuma
+        // rather than the kernel headers.
+        const int kMpolPreferred = 1;
+        const unsigned long kMaxNode = sizeof(unsigned long) * 8;
+        if (node < 0 || static_cast<unsigned long>(node) >= kMaxNode) {
+            return EINVAL;
+        }
+        unsigned long mask = 1ul << node;
+        // The kernel takes one more than the number of bits in the mask.
+        if (syscall(SYS_mbind, addr, len, kMpolPreferred, &mask, kMaxNode + 1, 0) != 0) {
+            return errno;
+        }
+        return 0;
+#else
+        (void) addr;
+        (void) len;
+        (void) node;
+        return ENOSYS;
+#endif
+    }
+
+}  // namespace flare
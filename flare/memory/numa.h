@@ -0,0 +1,24 @@
+/****************************************************************
+ * Copyright (c) 2022, liyinbin
+ * All rights reserved.
+ * Author by liyinbin (jeff.li) lijippy@163.com
+ *****************************************************************/
+
+
+#ifndef FLARE_MEMORY_NUMA_H_
+#define FLARE_MEMORY_NUMA_H_
+
+#include <cstddef>
+
+namespace flare {
+
+    // prefer_numa_node() asks the kernel to back pages in [addr, addr + len)
+    // which are not touched yet with memory of NUMA node `node', falling back
+    // to other nodes when that node runs out of memory. `addr' must be page
+    // aligned. Returns 0 on success, errno otherwise (ENOSYS when the
+    // platform has no memory policy).
+    int prefer_numa_node(void *addr, size_t len, int node);
+
+}  // namespace flare
+
+#endif  // FLARE_MEMORY_NUMA_H_
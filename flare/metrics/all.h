@@ -7,6 +7,7 @@
 #include "flare/metrics/gauge.h"
 #include "flare/metrics/counter.h"
 #include "flare/metrics/histogram.h"
+#include "flare/metrics/exponential_histogram.h"
 #include "flare/metrics/prometheus_dumper.h"
 #include "flare/metrics/latency_recorder.h"
 #include "flare/metrics/gflag.h"
@@ -9,6 +9,7 @@
 #ifndef FLARE_METRICS_CACHE_METRIC_H_
 #define FLARE_METRICS_CACHE_METRIC_H_
 
+#include <cstdint>
 #include <unordered_map>
 #include <string>
 #include <memory>
@@ -49,10 +50,29 @@ namespace flare {
             double upper_bound = 0.0;
         };
 
+        // Run of `length' consecutive native buckets, starting `offset'
+        // buckets after the end of the previous span (or at bucket `offset'
+        // for the first one).
+        struct cached_span {
+            std::int32_t offset = 0;
+            std::uint32_t length = 0;
+        };
+
         struct cached_histogram {
             std::uint64_t sample_count = 0;
             double sample_sum = 0.0;
             std::vector<cached_bucket> bucket;
+
+            // Native (sparse exponential) buckets of Prometheus, set by
+            // exponential_histogram only.
+            bool native = false;
+            std::int32_t schema = 0;
+            double zero_threshold = 0.0;
+            std::uint64_t zero_count = 0;
+            std::vector<cached_span> positive_spans;
+            // Count of each bucket in the spans, as the difference to the
+            // previous bucket.
+            std::vector<std::int64_t> positive_deltas;
         };
         cached_histogram histogram;
 
@@ -0,0 +1,196 @@
+
+/****************************************************************
+ * Copyright (c) 2022, liyinbin
+ * All rights reserved.
+ * Author by liyinbin (jeff.li) lijippy@163.com
+ *****************************************************************/
+
+#include "flare/metrics/exponential_histogram.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <ostream>
+#include "flare/log/logging.h"
+
+namespace flare {
+
+    namespace metrics_detail {
+
+        double exponential_bucket_upper_bound(int key) {
+            if (key >= kExpMaxKey) {
+                return std::numeric_limits<double>::infinity();
+            }
+            return std::exp2(static_cast<double>(key) / kExpSubBuckets);
+        }
+
+    }  // namespace metrics_detail
+
+    exponential_histogram_snapshot::exponential_histogram_snapshot()
+            : _count(0), _sum(0), _zero_count(0) {
+        memset(_chunks, 0, sizeof(_chunks));
+    }
+
+    exponential_histogram_snapshot::exponential_histogram_snapshot(
+            const exponential_histogram_snapshot &rhs)
+            : exponential_histogram_snapshot() {
+        operator=(rhs);
+    }
+
+    exponential_histogram_snapshot &exponential_histogram_snapshot::operator=(
+            const exponential_histogram_snapshot &rhs) {
+        if (this == &rhs) {
+            return *this;
+        }
+        _count = rhs._count;
+        _sum = rhs._sum;
+        _zero_count = rhs._zero_count;
+        for (int c = 0; c < kNumChunks; ++c) {
+            if (rhs._chunks[c] != nullptr) {
+                uint64_t *chunk = _chunks[c] ? _chunks[c] : new_chunk(c);
+                memcpy(chunk, rhs._chunks[c], sizeof(uint64_t) * kChunkSize);
+            } else if (_chunks[c] != nullptr) {
+                memset(_chunks[c], 0, sizeof(uint64_t) * kChunkSize);
+            }
+        }
+        return *this;
+    }
+
+    exponential_histogram_snapshot::~exponential_histogram_snapshot() {
+        for (int c = 0; c < kNumChunks; ++c) {
+            delete[] _chunks[c];
+        }
+    }
+
+    uint64_t *exponential_histogram_snapshot::new_chunk(int c) {
+        _chunks[c] = new uint64_t[kChunkSize]();
+        return _chunks[c];
+    }
+
+    void exponential_histogram_snapshot::merge(const exponential_histogram_snapshot &rhs) {
+        _count += rhs._count;
+        _sum += rhs._sum;
+        _zero_count += rhs._zero_count;
+        for (int c = 0; c < kNumChunks; ++c) {
+            if (rhs._chunks[c] == nullptr) {
+                continue;
+            }
+            uint64_t *chunk = _chunks[c] ? _chunks[c] : new_chunk(c);
+            for (int i = 0; i < kChunkSize; ++i) {
+                chunk[i] += rhs._chunks[c][i];
+            }
+        }
+    }
+
+    void exponential_histogram_snapshot::clear() {
+        _count = 0;
+        _sum = 0;
+        _zero_count = 0;
+        for (int c = 0; c < kNumChunks; ++c) {
+            if (_chunks[c] != nullptr) {
+                memset(_chunks[c], 0, sizeof(uint64_t) * kChunkSize);
+            }
+        }
+    }
+
+    uint64_t exponential_histogram_snapshot::bucket_count(int key) const {
+        if (key < metrics_detail::kExpMinKey || key > metrics_detail::kExpMaxKey) {
+            return 0;
+        }
+        const int index = key - metrics_detail::kExpMinKey;
+        const uint64_t *chunk = _chunks[index / kChunkSize];
+        return chunk ? chunk[index % kChunkSize] : 0;
+    }
+
+    double exponential_histogram_snapshot::value_at(double ratio) const {
+        if (_count == 0) {
+            return 0;
+        }
+        ratio = std::min(std::max(ratio, 0.0), 1.0);
+        // Rank of the sample, starting from 1.
+        const uint64_t rank = std::max<uint64_t>(
+                1, static_cast<uint64_t>(std::ceil(ratio * static_cast<double>(_count))));
+        if (rank <= _zero_count) {
+            return 0;
+        }
+        uint64_t seen = _zero_count;
+        double result = 0;
+        bool found = false;
+        for_each_bucket([&](int key, uint64_t n) {
+            seen += n;
+            if (!found && seen >= rank) {
+                result = metrics_detail::exponential_bucket_upper_bound(key);
+                found = true;
+            }
+        });
+        return result;
+    }
+
+    exponential_histogram::exponential_histogram(const std::string_view &name,
+                                                 const std::string_view &help,
+                                                 const variable_base::tag_type &tags) {
+        expose(name, help, tags);
+    }
+
+    exponential_histogram::~exponential_histogram() {
+        hide();
+    }
+
+    void exponential_histogram::observe(double value) noexcept {
+        agent_type *agent = _combiner.get_or_create_tls_agent();
+        if (FLARE_UNLIKELY(!agent)) {
+            FLARE_LOG(FATAL) << "Fail to create agent";
+            return;
+        }
+        // Only the owning thread writes the shard, the lock is taken by
+        // readers combining the shards.
+        agent->element.modify(add_sample(), value);
+    }
+
+    void exponential_histogram::describe(std::ostream &os, bool /*quote_string*/) const {
+        const exponential_histogram_snapshot s = snapshot();
+        os << "count=" << s.count() << " sum=" << s.sum()
+           << " p50=" << s.value_at(0.5) << " p99=" << s.value_at(0.99)
+           << " p999=" << s.value_at(0.999);
+    }
+
+    void exponential_histogram::collect_metrics(cache_metrics &metric) const {
+        copy_metric_family(metric);
+        metric.type = metrics_type::mt_histogram;
+        const exponential_histogram_snapshot s = snapshot();
+        auto &hist = metric.histogram;
+        hist.sample_count = s.count();
+        hist.sample_sum = s.sum();
+
+        // Classic buckets, only the non-empty ones since the boundaries are
+        // fixed and a bucket never becomes empty again until reset().
+        uint64_t cumulative_count = s.zero_count();
+        if (cumulative_count != 0) {
+            hist.bucket.push_back(cache_metrics::cached_bucket{
+                    cumulative_count, metrics_detail::kExpZeroThreshold});
+        }
+
+        // Native buckets, spans of consecutive non-empty buckets with counts
+        // delta-encoded.
+        hist.native = true;
+        hist.schema = metrics_detail::kExpSchema;
+        hist.zero_threshold = metrics_detail::kExpZeroThreshold;
+        hist.zero_count = s.zero_count();
+        int next_key = 0;
+        int64_t last_count = 0;
+        s.for_each_bucket([&](int key, uint64_t n) {
+            cumulative_count += n;
+            hist.bucket.push_back(cache_metrics::cached_bucket{
+                    cumulative_count, metrics_detail::exponential_bucket_upper_bound(key)});
+
+            if (hist.positive_spans.empty() || key != next_key) {
+                hist.positive_spans.push_back(cache_metrics::cached_span{
+                        hist.positive_spans.empty() ? key : key - next_key, 0});
+            }
+            ++hist.positive_spans.back().length;
+            next_key = key + 1;
+            hist.positive_deltas.push_back(static_cast<int64_t>(n) - last_count);
+            last_count = static_cast<int64_t>(n);
+        });
+    }
+
+}  // namespace flare
@@ -0,0 +1,228 @@
+
+/****************************************************************
+ * Copyright (c) 2022, liyinbin
+ * All rights reserved.
+ * Author by liyinbin (jeff.li) lijippy@163.com
+ *****************************************************************/
+
+
+#ifndef FLARE_METRICS_EXPONENTIAL_HISTOGRAM_H_
+#define FLARE_METRICS_EXPONENTIAL_HISTOGRAM_H_
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include "flare/metrics/variable_base.h"
+#include "flare/metrics/detail/combiner.h"
+
+namespace flare {
+
+    namespace metrics_detail {
+
+        // Buckets of exponential_histogram, the same as the native histogram
+        // buckets of Prometheus with schema 3: bucket `key' holds values in
+        // (2^((key-1)/8), 2^(key/8)], so every power of two is split into 8
+        // buckets of at most 9% relative width.
+        //
+        // Values no larger than kExpZeroThreshold (including 0, negative ones
+        // and NaN) are counted in the zero bucket, values beyond 2^48 are
+        // counted in the last bucket, which is unbounded.
+        static constexpr int kExpSchema = 3;
+        static constexpr int kExpSubBuckets = 1 << kExpSchema;
+        static constexpr double kExpZeroThreshold = 1.0 / 65536;   // 2^-16
+        static constexpr int kExpMinKey = -16 * kExpSubBuckets + 1;
+        static constexpr int kExpMaxKey = 48 * kExpSubBuckets;
+        static constexpr int kExpNumBuckets = kExpMaxKey - kExpMinKey + 1;
+
+        // Mantissas of 2^(k/8), k = 0..8.
+        static constexpr uint64_t kExpBoundaryMantissa[kExpSubBuckets + 1] = {
+                0x0ULL, 0x172b83c7d517bULL, 0x306fe0a31b715ULL, 0x4bfdad5362a27ULL,
+                0x6a09e667f3bcdULL, 0x8ace5422aa0dbULL, 0xae89f995ad3adULL,
+                0xd5818dcfba487ULL, 0x10000000000000ULL
+        };
+        // Number of boundaries below each 1/16 slice of the mantissa. At most
+        // one boundary lies inside a slice, which is then settled by a single
+        // comparison.
+        static constexpr uint8_t kExpSliceBase[16] = {
+                0, 1, 2, 2, 3, 4, 4, 5, 5, 6, 6, 7, 7, 7, 8, 8
+        };
+
+        // Key of the bucket holding `v', which must be larger than
+        // kExpZeroThreshold. No loop, no log(): the exponent bits give the
+        // power of two and the top 4 mantissa bits narrow the sub-bucket down
+        // to two candidates.
+        inline int exponential_bucket_key(double v) {
+            uint64_t bits;
+            memcpy(&bits, &v, sizeof(bits));
+            const int exp = static_cast<int>((bits >> 52) & 0x7ff) - 1023;
+            if (exp >= kExpMaxKey / kExpSubBuckets) {
+                return kExpMaxKey;
+            }
+            const uint64_t mantissa = bits & ((1ULL << 52) - 1);
+            int sub = kExpSliceBase[mantissa >> 48];
+            sub += mantissa > kExpBoundaryMantissa[sub];
+            return exp * kExpSubBuckets + sub;
+        }
+
+        // Upper bound of bucket `key', +Inf for the last one.
+        double exponential_bucket_upper_bound(int key);
+
+    }  // namespace metrics_detail
+
+    // Counts of samples in exponential buckets. This is both what every
+    // thread records into and what exponential_histogram::snapshot() returns,
+    // snapshots taken from different histograms (e.g. of different servers or
+    // time ranges) can be merged as long as they are of the same schema.
+    class exponential_histogram_snapshot {
+    public:
+        exponential_histogram_snapshot();
+
+        exponential_histogram_snapshot(const exponential_histogram_snapshot &rhs);
+
+        exponential_histogram_snapshot &operator=(const exponential_histogram_snapshot &rhs);
+
+        ~exponential_histogram_snapshot();
+
+        void add(double v) {
+            ++_count;
+            _sum += v;
+            if (!(v > metrics_detail::kExpZeroThreshold)) {
+                ++_zero_count;
+                return;
+            }
+            const int index = metrics_detail::exponential_bucket_key(v) - metrics_detail::kExpMinKey;
+            uint64_t *chunk = _chunks[index / kChunkSize];
+            if (FLARE_UNLIKELY(chunk == nullptr)) {
+                chunk = new_chunk(index / kChunkSize);
+            }
+            ++chunk[index % kChunkSize];
+        }
+
+        void merge(const exponential_histogram_snapshot &rhs);
+
+        void clear();
+
+        uint64_t count() const { return _count; }
+
+        double sum() const { return _sum; }
+
+        uint64_t zero_count() const { return _zero_count; }
+
+        // Number of samples in bucket `key'.
+        uint64_t bucket_count(int key) const;
+
+        // Calls fn(key, count) on every non-empty bucket in ascending order of key.
+        template<typename F>
+        void for_each_bucket(F &&fn) const {
+            for (int c = 0; c < kNumChunks; ++c) {
+                if (_chunks[c] == nullptr) {
+                    continue;
+                }
+                for (int i = 0; i < kChunkSize; ++i) {
+                    if (_chunks[c][i] != 0) {
+                        fn(c * kChunkSize + i + metrics_detail::kExpMinKey, _chunks[c][i]);
+                    }
+                }
+            }
+        }
+
+        // Upper bound of the bucket where the `ratio' (in [0, 1]) of samples
+        // are no larger than it, 0 if there's no sample or the ratio falls in
+        // the zero bucket.
+        double value_at(double ratio) const;
+
+    private:
+        static constexpr int kChunkSize = metrics_detail::kExpSubBuckets;
+        static constexpr int kNumChunks =
+                (metrics_detail::kExpNumBuckets + kChunkSize - 1) / kChunkSize;
+
+        uint64_t *new_chunk(int c);
+
+        uint64_t _count;
+        double _sum;
+        uint64_t _zero_count;
+        // Buckets are allocated 8 at a time on first use, latencies of a
+        // service usually span a few powers of two only.
+        uint64_t *_chunks[kNumChunks];
+    };
+
+    // Histogram of O(1) recording cost and bounded relative error, suitable for
+    // latencies or sizes of arbitrary range, no bucket boundaries to choose.
+    // Samples are recorded into thread-local shards without contention and
+    // combined only when read.
+    //
+    //   flare::exponential_histogram h("rpc_latency_us", "latency of rpc in us");
+    //   h << latency_us;
+    //
+    // Exported in both classic (`le' buckets) and native histogram forms,
+    // the latter is only used by prometheus_protobuf_dumper.
+    class exponential_histogram : public variable_base {
+    public:
+        struct add_snapshot {
+            void operator()(exponential_histogram_snapshot &lhs,
+                            const exponential_histogram_snapshot &rhs) const {
+                lhs.merge(rhs);
+            }
+        };
+
+        struct add_sample {
+            void operator()(exponential_histogram_snapshot &lhs, double v) const {
+                lhs.add(v);
+            }
+        };
+
+        typedef metrics_detail::agent_combiner<exponential_histogram_snapshot,
+                exponential_histogram_snapshot, add_snapshot> combiner_type;
+        typedef combiner_type::Agent agent_type;
+
+        exponential_histogram() = default;
+
+        exponential_histogram(const std::string_view &name,
+                              const std::string_view &help,
+                              const variable_base::tag_type &tags = variable_base::tag_type());
+
+        ~exponential_histogram();
+
+        int expose(const std::string_view &name,
+                   const std::string_view &help,
+                   const variable_base::tag_type &tags = variable_base::tag_type()) {
+            return variable_base::expose(name, help, tags, DISPLAY_ON_METRICS);
+        }
+
+        int expose_as(const std::string_view &prefix, const std::string_view &name,
+                      const std::string_view &help,
+                      const variable_base::tag_type &tags = variable_base::tag_type()) {
+            return variable_base::expose_as(prefix, name, help, tags, DISPLAY_ON_METRICS);
+        }
+
+        void observe(double value) noexcept;
+
+        exponential_histogram &operator<<(double v) {
+            observe(v);
+            return *this;
+        }
+
+        // Combines all the shards.
+        exponential_histogram_snapshot snapshot() const {
+            return _combiner.combine_agents();
+        }
+
+        // Combines and clears all the shards.
+        exponential_histogram_snapshot reset() {
+            return _combiner.reset_all_agents();
+        }
+
+        void describe(std::ostream &os, bool /*quote_string*/) const override;
+
+        void collect_metrics(cache_metrics &metric) const override;
+
+    private:
+        FLARE_DISALLOW_COPY_AND_ASSIGN(exponential_histogram);
+
+        mutable combiner_type _combiner;
+    };
+
+}  // namespace flare
+
+#endif  // FLARE_METRICS_EXPONENTIAL_HISTOGRAM_H_
@@ -6,6 +6,10 @@
  *****************************************************************/
 
 #include "flare/metrics/prometheus_dumper.h"
+#include <cmath>
+#include <cstring>
+#include <string>
+#include <vector>
 
 namespace flare {
 
@@ -107,6 +111,155 @@ namespace flare {
             }
         }
 
+        // Minimal protobuf encoder for the few messages of
+        // io.prometheus.client, so no generated code is needed here.
+        class pb_writer {
+        public:
+            void write_varint(int field, uint64_t v) {
+                write_tag(field, 0);
+                write_raw_varint(v);
+            }
+
+            void write_sint(int field, int64_t v) {
+                write_varint(field, zigzag(v));
+            }
+
+            void write_double(int field, double v) {
+                uint64_t bits;
+                memcpy(&bits, &v, sizeof(bits));
+                write_tag(field, 1);
+                for (int i = 0; i < 8; ++i) {
+                    _data.push_back(static_cast<char>(bits >> (i * 8)));
+                }
+            }
+
+            void write_bytes(int field, const std::string &v) {
+                write_tag(field, 2);
+                write_raw_varint(v.size());
+                _data.append(v);
+            }
+
+            void write_packed_sint(int field, const std::vector<int64_t> &vs) {
+                pb_writer packed;
+                for (auto v : vs) {
+                    packed.write_raw_varint(zigzag(v));
+                }
+                write_bytes(field, packed.data());
+            }
+
+            void write_raw_varint(uint64_t v) {
+                while (v >= 0x80) {
+                    _data.push_back(static_cast<char>(v | 0x80));
+                    v >>= 7;
+                }
+                _data.push_back(static_cast<char>(v));
+            }
+
+            const std::string &data() const { return _data; }
+
+        private:
+            static uint64_t zigzag(int64_t v) {
+                return (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63);
+            }
+
+            void write_tag(int field, int wire_type) {
+                write_raw_varint((static_cast<uint64_t>(field) << 3) | wire_type);
+            }
+
+            std::string _data;
+        };
+
+        // Field numbers and enums of metrics.proto of Prometheus.
+        enum {
+            PB_COUNTER = 0,
+            PB_GAUGE = 1,
+            PB_HISTOGRAM = 4,
+        };
+
+        std::string encode_histogram(const cache_metrics::cached_histogram &hist) {
+            pb_writer h;
+            h.write_varint(1, hist.sample_count);
+            h.write_double(2, hist.sample_sum);
+            for (auto &b : hist.bucket) {
+                // The +Inf bucket is implied by sample_count.
+                if (std::isinf(b.upper_bound)) {
+                    continue;
+                }
+                pb_writer bucket;
+                bucket.write_varint(1, b.cumulative_count);
+                bucket.write_double(2, b.upper_bound);
+                h.write_bytes(3, bucket.data());
+            }
+            if (hist.native) {
+                h.write_sint(5, hist.schema);
+                h.write_double(6, hist.zero_threshold);
+                h.write_varint(7, hist.zero_count);
+                for (auto &span : hist.positive_spans) {
+                    pb_writer s;
+                    s.write_sint(1, span.offset);
+                    s.write_varint(2, span.length);
+                    h.write_bytes(12, s.data());
+                }
+                if (!hist.positive_deltas.empty()) {
+                    h.write_packed_sint(13, hist.positive_deltas);
+                }
+            }
+            return h.data();
+        }
+
+        // Returns false if the type of metric can't be written.
+        bool encode_metric_family(const cache_metrics &metric, const flare::time_point *tp,
+                                  std::string *out) {
+            pb_writer m;
+            for (auto &tag : metric.tags) {
+                pb_writer label;
+                label.write_bytes(1, tag.first);
+                label.write_bytes(2, tag.second);
+                m.write_bytes(1, label.data());
+            }
+            int type;
+            switch (metric.type) {
+                case metrics_type::mt_counter: {
+                    pb_writer c;
+                    c.write_double(1, metric.counter.value);
+                    m.write_bytes(3, c.data());
+                    type = PB_COUNTER;
+                    break;
+                }
+                case metrics_type::mt_gauge: {
+                    pb_writer g;
+                    g.write_double(1, metric.gauge.value);
+                    m.write_bytes(2, g.data());
+                    type = PB_GAUGE;
+                    break;
+                }
+                case metrics_type::mt_histogram:
+                case metrics_type::mt_timer:
+                    m.write_bytes(7, encode_histogram(metric.histogram));
+                    type = PB_HISTOGRAM;
+                    break;
+                default:
+                    return false;
+            }
+            if (tp) {
+                m.write_varint(6, tp->to_unix_millis());
+            }
+
+            pb_writer family;
+            family.write_bytes(1, metric.name);
+            if (!metric.help.empty()) {
+                family.write_bytes(2, metric.help);
+            }
+            family.write_varint(3, type);
+            family.write_bytes(4, m.data());
+
+            pb_writer delimited;
+            delimited.write_raw_varint(family.data().size());
+            out->append(delimited.data());
+            out->append(family.data());
+            return true;
+        }
+
     }
 
     bool prometheus_dumper::dump(const cache_metrics &metric, const flare::time_point *tp) {
@@ -141,4 +294,22 @@ namespace flare {
         dumper.dump(metric, tp);
         return out.buf().to_string();
     }
-}  // namespace flare
\ No newline at end of file
+
+    const char *const prometheus_protobuf_dumper::content_type =
+            "application/vnd.google.protobuf; proto=io.prometheus.client.MetricFamily; encoding=delimited";
+
+    bool prometheus_protobuf_dumper::dump(const cache_metrics &metric, const flare::time_point *tp) {
+        std::string out;
+        if (metrics_detail::encode_metric_family(metric, tp, &out)) {
+            _buf->write(out.data(), out.size());
+        }
+        return true;
+    }
+
+    std::string prometheus_protobuf_dumper::dump_to_string(const cache_metrics &metric,
+                                                           const flare::time_point *tp) {
+        std::string out;
+        metrics_detail::encode_metric_family(metric, tp, &out);
+        return out;
+    }
+}  // namespace flare
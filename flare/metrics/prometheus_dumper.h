@@ -29,6 +29,27 @@ namespace flare {
 
         cord_buf_builder *_buf;
     };
+
+    // Writes metrics in the protobuf exposition format of Prometheus, i.e.
+    // varint length delimited io.prometheus.client.MetricFamily messages.
+    // Unlike the text format, this one carries native histograms, so it's
+    // preferred by Prometheus scraping with native histograms enabled.
+    class prometheus_protobuf_dumper : public metrics_dumper {
+    public:
+        // Value of Content-Type header of the output.
+        static const char *const content_type;
+
+        explicit prometheus_protobuf_dumper(cord_buf_builder *buf) : _buf(buf) {
+            FLARE_CHECK(_buf);
+        }
+
+        bool dump(const cache_metrics &metric, const flare::time_point *tp) override;
+
+        static std::string dump_to_string(const cache_metrics &metric, const flare::time_point *tp);
+
+    private:
+        cord_buf_builder *_buf;
+    };
 }  // namespace flare
 
 #endif  // FLARE_PROMETHUES_DUMPER_H_
@@ -24,6 +24,8 @@
 
 namespace flare::fiber_internal {
     void print_task(std::ostream &os, fiber_id_t tid);
+
+    void print_stack_usage(std::ostream &os);
 }
 
 
@@ -40,7 +42,8 @@ namespace flare::rpc {
         const std::string &constraint = cntl->http_request().unresolved_path();
 
         if (constraint.empty()) {
-            os << "Use /fibers/<fiber_id>";
+            os << "Use /fibers/<fiber_id>\n\n";
+            ::flare::fiber_internal::print_stack_usage(os);
         } else {
             char *endptr = NULL;
             fiber_id_t tid = strtoull(constraint.c_str(), &endptr, 10);
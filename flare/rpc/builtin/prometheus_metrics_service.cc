@@ -189,17 +189,26 @@ namespace flare::rpc {
                                                   ::google::protobuf::Closure *done) {
         ClosureGuard done_guard(done);
         Controller *cntl = static_cast<Controller *>(cntl_base);
-        cntl->http_response().set_content_type("text/plain");
-        if (DumpPrometheusMetricsToCordBuf(&cntl->response_attachment()) != 0) {
+        // Prometheus asks for the protobuf format first when native
+        // histograms are enabled.
+        const std::string *accept = cntl->http_request().GetHeader("Accept");
+        const bool protobuf = accept != nullptr &&
+                              accept->find("application/vnd.google.protobuf") != std::string::npos;
+        cntl->http_response().set_content_type(
+                protobuf ? flare::prometheus_protobuf_dumper::content_type : "text/plain");
+        if (DumpPrometheusMetricsToCordBuf(&cntl->response_attachment(), protobuf) != 0) {
             cntl->SetFailed("Fail to dump metrics");
             return;
         }
     }
 
-    int DumpPrometheusMetricsToCordBuf(flare::cord_buf *output) {
+    int DumpPrometheusMetricsToCordBuf(flare::cord_buf *output, bool protobuf) {
         flare::cord_buf_builder os;
-        flare::prometheus_dumper dumper(&os);
-        const int ndump = flare::variable_base::dump_metrics(&dumper, nullptr);
+        flare::prometheus_dumper text_dumper(&os);
+        flare::prometheus_protobuf_dumper protobuf_dumper(&os);
+        flare::metrics_dumper *dumper = protobuf ? static_cast<flare::metrics_dumper *>(&protobuf_dumper)
+                                                 : &text_dumper;
+        const int ndump = flare::variable_base::dump_metrics(dumper, nullptr);
         if (ndump < 0) {
             return -1;
         }
@@ -31,7 +31,9 @@ namespace flare::rpc {
                             ::google::protobuf::Closure *done) override;
     };
 
-    int DumpPrometheusMetricsToCordBuf(flare::cord_buf *output);
+    // Dumps metrics in the text format, or the protobuf format (which also
+    // carries native histograms) if `protobuf' is true.
+    int DumpPrometheusMetricsToCordBuf(flare::cord_buf *output, bool protobuf = false);
 
 } // namepace flare::rpc
 
@@ -18,6 +18,7 @@
 #ifndef FLARE_RPC_CONCURRENCY_LIMITER_H_
 #define FLARE_RPC_CONCURRENCY_LIMITER_H_
 
+#include "flare/times/time.h"
 #include "flare/rpc/describable.h"
 #include "flare/rpc/destroyable.h"
 #include "flare/rpc/extension.h"                       // Extension<T>
@@ -35,6 +36,13 @@ namespace flare::rpc {
         // return an ELIMIT error directly.
         virtual bool OnRequested(int current_concurrency) = 0;
 
+        // Same as above with the priority of the request, which is 0 by default
+        // and larger for more important requests. Limiters may reject requests
+        // of lower priority first. The default implementation ignores `priority'.
+        virtual bool OnRequested(int current_concurrency, int priority) {
+            return OnRequested(current_concurrency);
+        }
+
         // Each request should call this method before responding.
         // `error_code' : Error code obtained from the controller, 0 means success.
         // `latency' : Microseconds taken by RPC.
@@ -49,6 +57,11 @@ namespace flare::rpc {
         // Create an instance from the amc
         // Caller is responsible for delete the instance after usage.
         virtual ConcurrencyLimiter *New(const AdaptiveMaxConcurrency &amc) const = 0;
+
+    protected:
+        // Time of samples in microseconds, replaced by tests to simulate
+        // traffic faster than the real clock.
+        virtual int64_t NowUs() const { return flare::get_current_time_micros(); }
     };
 
     inline Extension<const ConcurrencyLimiter> *ConcurrencyLimiterExtension() {
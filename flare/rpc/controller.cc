@@ -252,6 +252,7 @@ namespace flare::rpc {
         _begin_time_us = 0;
         _end_time_us = 0;
         _tos = 0;
+        _request_priority = 0;
         _preferred_index = -1;
         _request_compress_type = COMPRESS_TYPE_NONE;
         _response_compress_type = COMPRESS_TYPE_NONE;
@@ -1256,6 +1257,7 @@ namespace flare::rpc {
         s->backup_request_ms = _backup_request_ms;
         s->max_retry = _max_retry;
         s->tos = _tos;
+        s->request_priority = _request_priority;
         s->connection_type = _connection_type;
         s->request_compress_type = _request_compress_type;
         s->log_id = log_id();
@@ -1268,6 +1270,7 @@ namespace flare::rpc {
         set_backup_request_ms(s.backup_request_ms);
         set_max_retry(s.max_retry);
         set_type_of_service(s.tos);
+        set_request_priority(s.request_priority);
         set_connection_type(s.connection_type);
         set_request_compress_type(s.request_compress_type);
         set_log_id(s.log_id);
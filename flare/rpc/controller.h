@@ -245,6 +245,12 @@ namespace flare::rpc {
 
         void set_request_id(std::string request_id) { _inheritable.request_id = request_id; }
 
+        // Set priority of the request, larger is more important, 0 by default.
+        // Concurrency limiters of the server, e.g. "gradient", reject requests
+        // of lower priority first when the server is overloaded. Only sent by
+        // protocol baidu_std currently.
+        void set_request_priority(int priority) { _request_priority = priority; }
+
         // Set type of service: http://en.wikipedia.org/wiki/Type_of_service
         // Current implementation has limits: If the connection is already
         // established, this setting has no effect until the connection is broken
@@ -537,6 +543,8 @@ namespace flare::rpc {
 
         const std::string &request_id() const { return _inheritable.request_id; }
 
+        int request_priority() const { return _request_priority; }
+
         CompressType request_compress_type() const { return _request_compress_type; }
 
         CompressType response_compress_type() const { return _response_compress_type; }
@@ -667,6 +675,7 @@ namespace flare::rpc {
             int32_t backup_request_ms;
             int max_retry;
             int32_t tos;
+            int request_priority;
             ConnectionType connection_type;
             CompressType request_compress_type;
             uint64_t log_id;
@@ -814,6 +823,7 @@ namespace flare::rpc {
         int64_t _begin_time_us;
         int64_t _end_time_us;
         short _tos;    // Type of service.
+        int _request_priority;
         // The index of parse function which `InputMessenger' will use
         int _preferred_index;
         CompressType _request_compress_type;
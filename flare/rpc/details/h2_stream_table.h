@@ -0,0 +1,158 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#ifndef FLARE_RPC_H2_STREAM_TABLE_H_
+#define FLARE_RPC_H2_STREAM_TABLE_H_
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include "flare/base/profile.h"                         // FLARE_CACHELINE_ALIGNMENT
+#include "flare/container/flat_map.h"
+
+namespace flare::rpc {
+
+    // Map from stream id to T* of a http2 connection. Streams are spread over
+    // shards guarded by their own mutexes, thus fibers processing frames of
+    // different streams, writing requests and cleaning abandoned streams of
+    // the same connection rarely contend.
+    template<typename T>
+    class H2StreamTable {
+    public:
+        static const size_t NSHARD_BITS = 5;
+        static const size_t NSHARD = 1 << NSHARD_BITS;
+
+        H2StreamTable() : _size(0) {}
+
+        // Returns 0 on success, -1 otherwise.
+        int init(size_t nbucket_per_shard) {
+            for (size_t i = 0; i < NSHARD; ++i) {
+                if (_shards[i].map.init(nbucket_per_shard, 70) != 0) {
+                    return -1;
+                }
+            }
+            return 0;
+        }
+
+        T *seek(int stream_id) const {
+            const Shard &s = shard(stream_id);
+            std::unique_lock<std::mutex> mu(s.mutex);
+            T *const *p = s.map.seek(stream_id);
+            return p ? *p : nullptr;
+        }
+
+        // Returns 0 if `ptr' is inserted, -1 if stream_id exists, 1 if
+        // refuse() returns true, which is called with the shard locked so that
+        // it's ordered with erase_greater() on the shard.
+        template<typename Refuse>
+        int insert(int stream_id, T *ptr, Refuse refuse) {
+            Shard &s = shard(stream_id);
+            std::unique_lock<std::mutex> mu(s.mutex);
+            if (refuse()) {
+                return 1;
+            }
+            T *&slot = s.map[stream_id];
+            if (slot != nullptr) {
+                return -1;
+            }
+            slot = ptr;
+            _size.fetch_add(1, std::memory_order_relaxed);
+            return 0;
+        }
+
+        int insert(int stream_id, T *ptr) {
+            return insert(stream_id, ptr, [] { return false; });
+        }
+
+        // Returns the removed value, NULL if stream_id does not exist.
+        T *erase(int stream_id) {
+            Shard &s = shard(stream_id);
+            T *ptr = nullptr;
+            std::unique_lock<std::mutex> mu(s.mutex);
+            if (!s.map.erase(stream_id, &ptr)) {
+                return nullptr;
+            }
+            _size.fetch_sub(1, std::memory_order_relaxed);
+            return ptr;
+        }
+
+        // Remove values whose stream ids are greater than `min_stream_id' and
+        // append them to *out.
+        void erase_greater(int min_stream_id, std::vector<T *> *out) {
+            std::vector<int> ids;
+            for (size_t i = 0; i < NSHARD; ++i) {
+                Shard &s = _shards[i];
+                ids.clear();
+                std::unique_lock<std::mutex> mu(s.mutex);
+                for (auto it = s.map.begin(); it != s.map.end(); ++it) {
+                    if (it->first > min_stream_id) {
+                        ids.push_back(it->first);
+                        out->push_back(it->second);
+                    }
+                }
+                for (size_t j = 0; j < ids.size(); ++j) {
+                    s.map.erase(ids[j]);
+                }
+                _size.fetch_sub(ids.size(), std::memory_order_relaxed);
+            }
+        }
+
+        // Call fn(stream_id, value) for all values until fn returns false,
+        // with the shard of the stream locked. Returns false if fn did.
+        template<typename Fn>
+        bool for_each(Fn fn) const {
+            for (size_t i = 0; i < NSHARD; ++i) {
+                const Shard &s = _shards[i];
+                std::unique_lock<std::mutex> mu(s.mutex);
+                for (auto it = s.map.begin(); it != s.map.end(); ++it) {
+                    if (!fn(it->first, it->second)) {
+                        return false;
+                    }
+                }
+            }
+            return true;
+        }
+
+        // Not synchronized with modifications.
+        size_t size() const { return _size.load(std::memory_order_relaxed); }
+
+    private:
+        FLARE_DISALLOW_COPY_AND_ASSIGN(H2StreamTable);
+
+        struct FLARE_CACHELINE_ALIGNMENT Shard {
+            mutable std::mutex mutex;
+            flare::container::FlatMap<int, T *> map;
+        };
+
+        // FlatMap locates buckets with low bits of stream ids, take high bits
+        // of the fibonacci hash to not put ids of a shard into the same bucket.
+        static size_t shard_index(int stream_id) {
+            return ((uint32_t) stream_id * 2654435761u) >> (32 - NSHARD_BITS);
+        }
+
+        Shard &shard(int stream_id) { return _shards[shard_index(stream_id)]; }
+
+        const Shard &shard(int stream_id) const { return _shards[shard_index(stream_id)]; }
+
+        Shard _shards[NSHARD];
+        std::atomic<size_t> _size;
+    };
+
+} // namespace flare::rpc
+
+#endif  // FLARE_RPC_H2_STREAM_TABLE_H_
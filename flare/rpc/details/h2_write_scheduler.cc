@@ -0,0 +1,212 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include <algorithm>                                    // std::min
+#include "flare/rpc/details/h2_write_scheduler.h"
+
+namespace flare::rpc {
+
+    // A sender MUST NOT allow a flow-control window to exceed 2^31-1.
+    static const int64_t MAX_WINDOW_SIZE = 0x7FFFFFFF;
+
+    H2WriteScheduler::H2WriteScheduler() : _nactive(0) {}
+
+    H2WriteScheduler::~H2WriteScheduler() {
+        for (auto it = _streams.begin(); it != _streams.end(); ++it) {
+            delete it->second;
+        }
+        _streams.clear();
+    }
+
+    int H2WriteScheduler::Init() {
+        if (_streams.init(64, 70) != 0) {
+            return -1;
+        }
+        return _reserved_windows.init(64, 70);
+    }
+
+    void H2WriteScheduler::Activate(Stream *s) {
+        if (s->active || s->window <= 0 || s->data.empty()) {
+            return;
+        }
+        s->active = true;
+        ++_nactive;
+        if (!s->queued) {
+            s->queued = true;
+            _active_streams.push_back(s->id);
+        }
+    }
+
+    int H2WriteScheduler::Reserve(int stream_id, int64_t window) {
+        std::unique_lock<std::mutex> mu(_mutex);
+        if (_streams.seek(stream_id) != nullptr ||
+            _reserved_windows.seek(stream_id) != nullptr) {
+            return -1;
+        }
+        _reserved_windows[stream_id] = window;
+        return 0;
+    }
+
+    int H2WriteScheduler::Push(int stream_id, int weight, int64_t window,
+                               flare::cord_buf *data,
+                               std::vector<HPacker::Header> *trailers) {
+        std::unique_lock<std::mutex> mu(_mutex);
+        Stream *&s = _streams[stream_id];
+        if (s != nullptr) {
+            return -1;
+        }
+        // Take over the window updated since the stream was reserved.
+        _reserved_windows.erase(stream_id, &window);
+        s = new Stream;
+        s->id = stream_id;
+        s->weight = std::max(1, std::min(weight, 256));
+        s->window = window;
+        s->deficit = 0;
+        s->active = false;
+        s->queued = false;
+        s->data.swap(*data);
+        if (trailers) {
+            s->trailers.swap(*trailers);
+        }
+        Activate(s);
+        return 0;
+    }
+
+    int64_t H2WriteScheduler::Pop(int64_t conn_window, uint32_t max_frame_size,
+                                  int64_t max_bytes, std::vector<Frame> *frames) {
+        int64_t total = 0;
+        std::unique_lock<std::mutex> mu(_mutex);
+        while (!_active_streams.empty() && total < max_bytes && conn_window > 0) {
+            const int id = _active_streams.front();
+            Stream **ps = _streams.seek(id);
+            if (ps == nullptr || !(*ps)->active) {
+                if (ps) {
+                    (*ps)->queued = false;
+                }
+                _active_streams.pop_front();
+                continue;
+            }
+            Stream *s = *ps;
+            if (s->deficit <= 0) {
+                // A new round of the stream.
+                s->deficit += s->weight * QUANTUM_PER_WEIGHT;
+            }
+            const int64_t n = std::min({(int64_t) s->data.size(), s->deficit, s->window,
+                                        conn_window, (int64_t) max_frame_size});
+            frames->emplace_back();
+            Frame &f = frames->back();
+            f.stream_id = id;
+            s->data.cutn(&f.data, n);
+            s->deficit -= n;
+            s->window -= n;
+            conn_window -= n;
+            total += n;
+            if (s->data.empty()) {
+                f.end_of_stream = true;
+                f.trailers.swap(s->trailers);
+                _active_streams.pop_front();
+                _streams.erase(id);
+                --_nactive;
+                delete s;
+            } else if (s->window <= 0) {
+                // Wait for WINDOW_UPDATE, the unused deficit is dropped.
+                s->active = false;
+                s->queued = false;
+                s->deficit = 0;
+                --_nactive;
+                _active_streams.pop_front();
+            } else if (s->deficit <= 0) {
+                _active_streams.pop_front();
+                _active_streams.push_back(id);
+            }
+        }
+        return total;
+    }
+
+    int H2WriteScheduler::AddWindow(int stream_id, int64_t inc) {
+        std::unique_lock<std::mutex> mu(_mutex);
+        Stream **ps = _streams.seek(stream_id);
+        if (ps == nullptr) {
+            int64_t *window = _reserved_windows.seek(stream_id);
+            if (window == nullptr) {
+                return -1;
+            }
+            if (*window + inc > MAX_WINDOW_SIZE) {
+                _reserved_windows.erase(stream_id);
+                return 1;
+            }
+            *window += inc;
+            return 0;
+        }
+        Stream *s = *ps;
+        if (s->window + inc > MAX_WINDOW_SIZE) {
+            if (s->active) {
+                --_nactive;
+            }
+            _streams.erase(stream_id);
+            delete s;
+            return 1;
+        }
+        s->window += inc;
+        Activate(s);
+        return 0;
+    }
+
+    void H2WriteScheduler::AddWindowToAll(int64_t diff) {
+        std::unique_lock<std::mutex> mu(_mutex);
+        for (auto it = _reserved_windows.begin(); it != _reserved_windows.end(); ++it) {
+            it->second += diff;
+        }
+        for (auto it = _streams.begin(); it != _streams.end(); ++it) {
+            Stream *s = it->second;
+            s->window += diff;
+            if (s->window > 0) {
+                Activate(s);
+            } else if (s->active) {
+                // Skipped when popped.
+                s->active = false;
+                s->deficit = 0;
+                --_nactive;
+            }
+        }
+    }
+
+    bool H2WriteScheduler::Remove(int stream_id) {
+        std::unique_lock<std::mutex> mu(_mutex);
+        Stream *s = nullptr;
+        if (!_streams.erase(stream_id, &s)) {
+            return _reserved_windows.erase(stream_id) != 0;
+        }
+        if (s->active) {
+            --_nactive;
+        }
+        delete s;
+        return true;
+    }
+
+    bool H2WriteScheduler::HasSendableStreams() const {
+        std::unique_lock<std::mutex> mu(_mutex);
+        return _nactive != 0;
+    }
+
+    size_t H2WriteScheduler::stream_count() const {
+        std::unique_lock<std::mutex> mu(_mutex);
+        return _streams.size();
+    }
+
+} // namespace flare::rpc
@@ -0,0 +1,133 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#ifndef FLARE_RPC_H2_WRITE_SCHEDULER_H_
+#define FLARE_RPC_H2_WRITE_SCHEDULER_H_
+
+#include <stdint.h>
+#include <deque>
+#include <mutex>
+#include <vector>
+#include "flare/container/flat_map.h"
+#include "flare/io/cord_buf.h"
+#include "flare/rpc/details/hpack.h"                    // HPacker::Header
+
+namespace flare::rpc {
+
+    // Default weight of http2 streams.
+    // https://tools.ietf.org/html/rfc7540#section-5.3.5
+    const int H2_DEFAULT_STREAM_WEIGHT = 16;
+
+    // Splits DATA of streams sharing a http2 connection into frames and
+    // interleaves them with deficit round robin weighted by priorities of the
+    // streams, without exceeding flow-control windows of streams and the
+    // connection. A large message is sent in rounds so that messages of
+    // other streams are not blocked behind it.
+    // Streams are queued and popped in the write path of the connection,
+    // while windows are updated in the parsing path, thus all methods are
+    // thread-safe.
+    class H2WriteScheduler {
+    public:
+        // Bytes that a stream with weight 1 can send in one round.
+        static const int64_t QUANTUM_PER_WEIGHT = 1024;
+
+        struct Frame {
+            int stream_id;
+            flare::cord_buf data;
+            // Last frame of the stream, with trailers to send after the data.
+            bool end_of_stream;
+            std::vector<HPacker::Header> trailers;
+
+            Frame() : stream_id(0), end_of_stream(false) {}
+        };
+
+        H2WriteScheduler();
+
+        ~H2WriteScheduler();
+
+        // Returns 0 on success, -1 otherwise.
+        int Init();
+
+        // Track the stream-level window of stream_id, whose data is not
+        // pushed yet, e.g. a response being processed after the request
+        // stream was closed. WINDOW_UPDATE and SETTINGS received in between
+        // are counted in and the window is taken over by Push().
+        // Returns 0 on success, -1 if stream_id is already tracked.
+        int Reserve(int stream_id, int64_t window);
+
+        // Queue non-empty `data' and optional `trailers' of stream_id, which
+        // are swapped out. `weight' is within [1, 256], `window' is the
+        // stream-level flow-control window left, ignored if the stream was
+        // reserved.
+        // Returns 0 on success, -1 if stream_id is already queued.
+        int Push(int stream_id, int weight, int64_t window,
+                 flare::cord_buf *data, std::vector<HPacker::Header> *trailers);
+
+        // Append frames of at most `max_frame_size' bytes into *frames, until
+        // no less than `max_bytes' bytes are popped, or the data allowed
+        // to send runs out, or `conn_window' is used up.
+        // Returns bytes of DATA popped.
+        int64_t Pop(int64_t conn_window, uint32_t max_frame_size,
+                    int64_t max_bytes, std::vector<Frame> *frames);
+
+        // Increase window of a queued or reserved stream.
+        // Returns 0 on success, -1 if the stream is not found, 1 if the window
+        // exceeds 2^31-1 in which case the stream is removed.
+        int AddWindow(int stream_id, int64_t inc);
+
+        // Change windows of all queued and reserved streams, after the initial stream window
+        // size of the connection is changed by SETTINGS.
+        void AddWindowToAll(int64_t diff);
+
+        // Returns true if stream_id was queued or reserved.
+        bool Remove(int stream_id);
+
+        // True if some queued stream has window to send data.
+        bool HasSendableStreams() const;
+
+        size_t stream_count() const;
+
+    private:
+        FLARE_DISALLOW_COPY_AND_ASSIGN(H2WriteScheduler);
+
+        struct Stream {
+            int id;
+            int weight;
+            int64_t window;
+            int64_t deficit;
+            bool active;        // Has data and window
+            bool queued;        // Id is in _active_streams
+            flare::cord_buf data;
+            std::vector<HPacker::Header> trailers;
+        };
+
+        void Activate(Stream *s);
+
+        mutable std::mutex _mutex;
+        flare::container::FlatMap<int, Stream *> _streams;
+        // Windows of reserved streams.
+        flare::container::FlatMap<int, int64_t> _reserved_windows;
+        // Ids of streams to be served in order. Ids of removed or inactive
+        // streams are skipped lazily, stream ids are never reused.
+        std::deque<int> _active_streams;
+        size_t _nactive;
+    };
+
+} // namespace flare::rpc
+
+#endif  // FLARE_RPC_H2_WRITE_SCHEDULER_H_
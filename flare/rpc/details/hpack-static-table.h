@@ -98,7 +98,7 @@ namespace flare::rpc {
         uint32_t bit_len;
     };
 
-    static const HuffmanCode s_huffman_table[] = {
+    static constexpr HuffmanCode s_huffman_table[] = {
             {0x1ff8,     13},
             {0x7fffd8,   23},
             {0xfffffe2,  28},
@@ -274,205 +274,196 @@ namespace flare::rpc {
            << '}';
     }
 
-    struct HuffmanNode {
-        uint16_t left_child;
-        uint16_t right_child;
-        int32_t value;
+    // Decoding automaton of the Huffman code which consumes 4 bits per step.
+    // States are internal nodes of the Huffman tree (257 leaves, thus 256
+    // internal nodes) and state 0 is the root. The table is generated from
+    // s_huffman_table at compile time.
+    enum HuffmanDecodeFlags {
+        HUFFMAN_DECODE_EMIT = 1,        // `symbol' is decoded in this step
+        HUFFMAN_DECODE_ACCEPTED = 2,    // Stream may end at `next_state'
+        HUFFMAN_DECODE_FAIL = 4,        // Reached EOS
     };
 
-    class FLARE_CACHELINE_ALIGNMENT HuffmanTree {
-        FLARE_DISALLOW_COPY_AND_ASSIGN(HuffmanTree);
-
-    public:
-        typedef uint16_t NodeId;
-        enum ConstValue {
-            NULL_NODE = 0,
-            ROOT_NODE = 1,
-            INVALID_VALUE = INT_MAX
-        };
+    struct HuffmanDecodeEntry {
+        uint8_t next_state = 0;
+        uint8_t flags = 0;
+        uint8_t symbol = 0;
+    };
 
-        HuffmanTree() {
-            // Allocate memory for root
-            HuffmanNode root = {NULL_NODE, NULL_NODE, INVALID_VALUE};
-            _node_memory.push_back(root);
-        }
+    struct HuffmanDecodeTable {
+        HuffmanDecodeEntry entries[256][16];
+    };
 
-        void AddLeafNode(int32_t value, const HuffmanCode &code) {
-            NodeId cur = ROOT_NODE;
-            for (int i = code.bit_len; i > 0; i--) {
-                FLARE_CHECK_EQ(node(cur).value, INVALID_VALUE) << "value=" << value << "cur=" << cur;
-                if (code.code & (1u << (i - 1))) {
-                    if (node(cur).right_child == NULL_NODE) {
-                        NodeId new_id = AllocNode();
-                        node(cur).right_child = new_id;
+    static constexpr HuffmanDecodeTable BuildHuffmanDecodeTable() {
+        // Children of internal nodes: 0 is none (root is never a child),
+        // [1, 256) are internal nodes, 256 + s is the leaf of symbol s.
+        uint16_t children[256][2] = {};
+        // Whether a string may end at the node: the path is a prefix of EOS
+        // (all 1s) shorter than 8 bits.
+        // https://tools.ietf.org/html/rfc7541#section-5.2
+        bool accepted[256] = {};
+        uint8_t depth[256] = {};
+        accepted[0] = true;
+        size_t nnode = 1;
+        for (size_t s = 0; s < FLARE_ARRAY_SIZE(s_huffman_table); ++s) {
+            const HuffmanCode code = s_huffman_table[s];
+            size_t cur = 0;
+            for (uint32_t i = code.bit_len - 1; i > 0; --i) {
+                const int bit = (code.code >> i) & 1;
+                if (children[cur][bit] == 0) {
+                    children[cur][bit] = nnode;
+                    depth[nnode] = depth[cur] + 1;
+                    accepted[nnode] = accepted[cur] && bit && depth[nnode] < 8;
+                    ++nnode;
+                }
+                cur = children[cur][bit];
+            }
+            children[cur][code.code & 1] = 256 + s;
+        }
+        HuffmanDecodeTable t{};
+        for (size_t state = 0; state < 256; ++state) {
+            for (size_t nibble = 0; nibble < 16; ++nibble) {
+                HuffmanDecodeEntry &e = t.entries[state][nibble];
+                size_t cur = state;
+                // Codes are at least 5 bits, at most one symbol per nibble.
+                for (int i = 3; i >= 0; --i) {
+                    const size_t child = children[cur][(nibble >> i) & 1];
+                    if (child == 0 || child == 256 + HPACK_HUFFMAN_EOS) {
+                        e.flags = HUFFMAN_DECODE_FAIL;
+                        cur = 0;
+                        break;
                     }
-                    cur = node(cur).right_child;
-                } else {
-                    if (node(cur).left_child == NULL_NODE) {
-                        NodeId new_id = AllocNode();
-                        node(cur).left_child = new_id;
+                    if (child >= 256) {
+                        e.flags |= HUFFMAN_DECODE_EMIT;
+                        e.symbol = child - 256;
+                        cur = 0;
+                    } else {
+                        cur = child;
                     }
-                    cur = node(cur).left_child;
+                }
+                e.next_state = cur;
+                if (!(e.flags & HUFFMAN_DECODE_FAIL) && accepted[cur]) {
+                    e.flags |= HUFFMAN_DECODE_ACCEPTED;
                 }
             }
-            FLARE_CHECK_EQ(INVALID_VALUE, node(cur).value) << "value=" << value << " cur=" << cur;
-            FLARE_CHECK_EQ(NULL_NODE, node(cur).left_child);
-            FLARE_CHECK_EQ(NULL_NODE, node(cur).right_child);
-            node(cur).value = value;
-        }
-
-        const HuffmanNode *node(NodeId id) const {
-            if (id == 0u) {
-                return NULL;
-            }
-            if (id > _node_memory.size()) {
-                return NULL;
-            }
-            return &_node_memory[id - 1];
-        }
-
-    private:
-
-        HuffmanNode &node(NodeId id) {
-            return _node_memory[id - 1];
-        }
-
-        NodeId AllocNode() {
-            const NodeId id = _node_memory.size() + 1;
-            HuffmanNode node = {NULL_NODE, NULL_NODE, INVALID_VALUE};
-            _node_memory.push_back(node);
-            return id;
         }
+        return t;
+    }
 
-        std::vector<HuffmanNode> _node_memory;
-
-    };
+    static constexpr HuffmanDecodeTable s_huffman_decode_table = BuildHuffmanDecodeTable();
 
     class HuffmanEncoder {
         FLARE_DISALLOW_COPY_AND_ASSIGN(HuffmanEncoder);
 
     public:
         HuffmanEncoder(flare::cord_buf_appender *out, const HuffmanCode *table)
-                : _out(out), _table(table), _partial_byte(0), _remain_bit(8), _out_bytes(0) {}
+                : _out(out), _table(table), _bits(0), _nbits(0), _nbuf(0), _out_bytes(0) {}
 
         void Encode(unsigned char byte) {
             const HuffmanCode code = _table[byte];
-            uint16_t bits_left = code.bit_len;
-            while (bits_left) {
-                const uint16_t adding_bits_len = std::min(_remain_bit, bits_left);
-                const uint8_t adding_bits = static_cast<uint8_t>(
-                        (code.code & ((1u << bits_left) - 1))   // clear leading bits
-                                >> (bits_left - adding_bits_len));  // align to LSB
-                _partial_byte |= adding_bits << (_remain_bit - adding_bits_len);
-                _remain_bit -= adding_bits_len;
-                bits_left -= adding_bits_len;
-                if (!_remain_bit) {
-                    ++_out_bytes;
-                    _out->push_back(_partial_byte);
-                    _remain_bit = 8;
-                    _partial_byte = 0;
+            // _nbits < 32 and codes are at most 30 bits, never overflows.
+            _bits = (_bits << code.bit_len) | code.code;
+            _nbits += code.bit_len;
+            if (_nbits >= 32) {
+                _nbits -= 32;
+                const uint32_t word = static_cast<uint32_t>(_bits >> _nbits);
+                _buf[_nbuf] = word >> 24;
+                _buf[_nbuf + 1] = word >> 16;
+                _buf[_nbuf + 2] = word >> 8;
+                _buf[_nbuf + 3] = word;
+                _nbuf += 4;
+                if (_nbuf == sizeof(_buf)) {
+                    Flush();
                 }
             }
         }
 
         void EndStream() {
-            if (_remain_bit == 8u) {
-                return;
-            }
-            FLARE_DCHECK_LT(_remain_bit, 8u);
-            // Add padding `1's to lsb to make _out aligned
-            _partial_byte |= (1 << _remain_bit) - 1;
-            // TODO: push_back is probably costly since it acquires tls everytime it
-            // is invoked.
-            _out->push_back(_partial_byte);
-            _partial_byte = 0;
-            _remain_bit = 0;
+            // _nbuf <= sizeof(_buf) - 4 here, enough for the pending bits.
+            while (_nbits >= 8) {
+                _nbits -= 8;
+                _buf[_nbuf++] = static_cast<uint8_t>(_bits >> _nbits);
+            }
+            if (_nbits) {
+                // Add padding `1's to lsb to make _out aligned
+                const uint32_t pad = 8 - _nbits;
+                _buf[_nbuf++] = static_cast<uint8_t>((_bits << pad) | ((1u << pad) - 1));
+                _nbits = 0;
+            }
+            Flush();
             _out = NULL;
-            ++_out_bytes;
         }
 
         uint32_t out_bytes() const { return _out_bytes; }
 
     private:
+        // Append bytes in batch, cord_buf_appender::push_back acquires tls
+        // every time it is invoked.
+        void Flush() {
+            _out->append(_buf, _nbuf);
+            _out_bytes += _nbuf;
+            _nbuf = 0;
+        }
+
         flare::cord_buf_appender *_out;
         const HuffmanCode *_table;
-        uint8_t _partial_byte;
-        uint16_t _remain_bit;
+        uint64_t _bits;         // Pending bits are the lowest _nbits bits
+        uint32_t _nbits;
+        uint32_t _nbuf;
         uint32_t _out_bytes;
+        uint8_t _buf[64];
     };
 
     class HuffmanDecoder {
         FLARE_DISALLOW_COPY_AND_ASSIGN(HuffmanDecoder);
 
     public:
-        HuffmanDecoder(std::string *out, const HuffmanTree *tree)
-        // FIXME: resizing of out is costly
-                : _out(out), _tree(tree), _cur_node(tree->node(HuffmanTree::ROOT_NODE)),
-                  _cur_depth(0)  // Depth of root node is 0
-                , _padding(true) {}
-
-        int Decode(uint8_t byte) {
-            for (int i = 7; i >= 0; --i) {
-                if (byte & (1u << i)) {
-                    _cur_node = _tree->node(_cur_node->right_child);
-                    if (FLARE_UNLIKELY(!_cur_node)) {
-                        FLARE_LOG(ERROR) << "Decoder stream reaches NULL_NODE";
-                        return -1;
-                    }
-                    if (_cur_node->value != HuffmanTree::INVALID_VALUE) {
-                        if (FLARE_UNLIKELY(_cur_node->value == HPACK_HUFFMAN_EOS)) {
-                            FLARE_LOG(ERROR) << "Decoder stream reaches EOS";
-                            return -1;
-                        }
-                        _out->push_back(static_cast<uint8_t>(_cur_node->value));
-                        _cur_node = _tree->node(HuffmanTree::ROOT_NODE);
-                        _cur_depth = 0;
-                        _padding = true;
-                        continue;
-                    }
-                    _padding &= 1;
-                } else {
-                    _cur_node = _tree->node(_cur_node->left_child);
-                    if (FLARE_UNLIKELY(!_cur_node)) {
-                        FLARE_LOG(ERROR) << "Decoder stream reaches NULL_NODE";
-                        return -1;
-                    }
-                    if (_cur_node->value != HuffmanTree::INVALID_VALUE) {
-                        if (FLARE_UNLIKELY(_cur_node->value == HPACK_HUFFMAN_EOS)) {
-                            FLARE_LOG(ERROR) << "Decoder stream reaches EOS";
-                            return -1;
-                        }
-                        _out->push_back(static_cast<uint8_t>(_cur_node->value));
-                        _cur_node = _tree->node(HuffmanTree::ROOT_NODE);
-                        _cur_depth = 0;
-                        _padding = true;
-                        continue;
-                    }
-                    _padding &= 0;
+        // Decoded bytes are written to `out' which must be able to hold
+        // 8/5 of input bytes plus one, since codes are at least 5 bits and
+        // each nibble writes one byte (not counted if not decoded).
+        explicit HuffmanDecoder(char *out)
+                : _begin(out), _out(out), _state(0), _accepted(true) {}
+
+        int Decode(const uint8_t *in, size_t n) {
+            const HuffmanDecodeEntry (*table)[16] = s_huffman_decode_table.entries;
+            char *out = _out;
+            uint8_t state = _state;
+            uint8_t flags = 0;
+            for (size_t i = 0; i < n; ++i) {
+                const HuffmanDecodeEntry &hi = table[state][in[i] >> 4];
+                *out = static_cast<char>(hi.symbol);
+                out += (hi.flags & HUFFMAN_DECODE_EMIT);
+                const HuffmanDecodeEntry &lo = table[hi.next_state][in[i] & 0xF];
+                *out = static_cast<char>(lo.symbol);
+                out += (lo.flags & HUFFMAN_DECODE_EMIT);
+                if (FLARE_UNLIKELY((hi.flags | lo.flags) & HUFFMAN_DECODE_FAIL)) {
+                    FLARE_LOG(ERROR) << "Decoder stream reaches EOS";
+                    return -1;
                 }
-                ++_cur_depth;
+                state = lo.next_state;
+                flags = lo.flags;
+            }
+            _out = out;
+            _state = state;
+            if (n) {
+                _accepted = flags & HUFFMAN_DECODE_ACCEPTED;
             }
             return 0;
         }
 
-        int EndStream() {
-            if (_cur_depth == 0) {
-                return 0;
-            }
-            if (_cur_depth <= 7 && _padding) {
-                return 0;
-            }
-            // Invalid stream, the padding is not corresponding to MSB of EOS
+        int EndStream() const {
+            // Invalid stream if the padding is not corresponding to MSB of EOS
             // https://tools.ietf.org/html/rfc7541#section-5.2
-            return -1;
+            return _accepted ? 0 : -1;
         }
 
+        size_t out_bytes() const { return _out - _begin; }
+
     private:
-        std::string *_out;
-        const HuffmanTree *_tree;
-        const HuffmanNode *_cur_node;
-        uint16_t _cur_depth;
-        bool _padding;
+        char *_begin;
+        char *_out;
+        uint8_t _state;
+        bool _accepted;
     };
 
 // Primitive Type Representations
@@ -499,15 +490,10 @@ namespace flare::rpc {
     }
 
 // Static variables
-    static HuffmanTree *s_huffman_tree = NULL;
     static IndexTable *s_static_table = NULL;
     static pthread_once_t s_create_once = PTHREAD_ONCE_INIT;
 
     static void CreateStaticTableOrDie() {
-        s_huffman_tree = new HuffmanTree;
-        for (size_t i = 0; i < FLARE_ARRAY_SIZE(s_huffman_table); ++i) {
-            s_huffman_tree->AddLeafNode(i, s_huffman_table[i]);
-        }
         IndexTableOptions options;
         options.max_size = UINT_MAX;
         options.static_table = s_static_headers;
@@ -626,15 +612,20 @@ namespace flare::rpc {
             iter.copy_and_forward(out, length);
             return in_bytes;
         }
-        HuffmanDecoder d(out, s_huffman_tree);
-        for (; iter != NULL && length; ++iter, --length) {
-            if (d.Decode(*iter) != 0) {
+        out->resize(length * 8 / 5 + 1);
+        HuffmanDecoder d(&(*out)[0]);
+        uint8_t buf[256];
+        while (length) {
+            const size_t n = iter.copy_and_forward(buf, std::min<size_t>(length, sizeof(buf)));
+            if (d.Decode(buf, n) != 0) {
                 return -1;
             }
+            length -= n;
         }
         if (d.EndStream() != 0) {
             return -1;
         }
+        out->resize(d.out_bytes());
         return in_bytes;
     }
 
@@ -28,6 +28,10 @@
 #include <cstdlib>
 #include <string.h>
 #include <limits.h>
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <immintrin.h>
+#endif
+#include "flare/base/profile.h"
 
 #ifndef ULLONG_MAX
 # define ULLONG_MAX ((uint64_t) -1) /* 2^64-1 */
@@ -678,6 +682,119 @@ parse_url_char(enum state s, const char ch)
   return s_dead;
 }
 
+/* Fast scanners for the bytes of header names and values which don't change
+ * any state of the parser, namely everything in a name or value once
+ * header_state is h_general. They return the first byte in [p, end) which
+ * needs the byte-wise state machine, or `end'. The SIMD versions are chosen
+ * at runtime according to the CPU, the scalar versions are only used to
+ * finish the tails.
+ */
+typedef const char *(*http_scan_fn)(const char *p, const char *end);
+
+static const char *scan_header_value_scalar(const char *p, const char *end) {
+  for (; p != end && *p != CR && *p != LF; ++p) {}
+  return p;
+}
+
+static const char *scan_header_field_scalar(const char *p, const char *end) {
+  for (; p != end && tokens[(unsigned char)*p]; ++p) {}
+  return p;
+}
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define HTTP_PARSER_SIMD 1
+
+static const char *scan_header_value_sse2(const char *p, const char *end) {
+  const __m128i cr = _mm_set1_epi8(CR);
+  const __m128i lf = _mm_set1_epi8(LF);
+  for (; end - p >= 16; p += 16) {
+    const __m128i v = _mm_loadu_si128((const __m128i *)p);
+    const int m = _mm_movemask_epi8(
+        _mm_or_si128(_mm_cmpeq_epi8(v, cr), _mm_cmpeq_epi8(v, lf)));
+    if (m) {
+      return p + __builtin_ctz(m);
+    }
+  }
+  return scan_header_value_scalar(p, end);
+}
+
+__attribute__((target("avx2")))
+static const char *scan_header_value_avx2(const char *p, const char *end) {
+  const __m256i cr = _mm256_set1_epi8(CR);
+  const __m256i lf = _mm256_set1_epi8(LF);
+  for (; end - p >= 32; p += 32) {
+    const __m256i v = _mm256_loadu_si256((const __m256i *)p);
+    const unsigned m = (unsigned)_mm256_movemask_epi8(
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, cr), _mm256_cmpeq_epi8(v, lf)));
+    if (m) {
+      return p + __builtin_ctz(m);
+    }
+  }
+  return scan_header_value_sse2(p, end);
+}
+
+/* Ranges of bytes stopping the scan of a header name: CTLs, space,
+ * separators of RFC 2616 and non-ASCII. '{'-0xff also covers '|' and '~'
+ * which are tokens, they're rare and left to the byte-wise parser.
+ */
+static const char header_field_stop_ranges[16] = {
+  '\x00', ' ', '"', '"', '(', ')', ',', ',',
+  '/', '/', ':', '@', '[', ']', '{', '\xff'
+};
+
+__attribute__((target("sse4.2")))
+static const char *scan_header_field_sse42(const char *p, const char *end) {
+  const __m128i ranges =
+      _mm_loadu_si128((const __m128i *)header_field_stop_ranges);
+  for (; end - p >= 16; p += 16) {
+    const __m128i v = _mm_loadu_si128((const __m128i *)p);
+    const int i = _mm_cmpestri(ranges, 16, v, 16,
+                               _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES |
+                               _SIDD_LEAST_SIGNIFICANT);
+    if (i != 16) {
+      return p + i;
+    }
+  }
+  return scan_header_field_scalar(p, end);
+}
+#endif  // __GNUC__ && __x86_64__
+
+/* NULL when parsing byte by byte. */
+static http_scan_fn scan_header_field = NULL;
+static http_scan_fn scan_header_value = NULL;
+
+bool http_parser_enable_simd(bool enable) {
+  const bool old = (scan_header_value != NULL);
+  scan_header_field = NULL;
+  scan_header_value = NULL;
+#ifdef HTTP_PARSER_SIMD
+  if (enable) {
+    __builtin_cpu_init();
+    scan_header_value = (__builtin_cpu_supports("avx2") ?
+                         scan_header_value_avx2 : scan_header_value_sse2);
+    if (__builtin_cpu_supports("sse4.2")) {
+      scan_header_field = scan_header_field_sse42;
+    }
+  }
+#endif
+  return old;
+}
+
+static const bool FLARE_ALLOW_UNUSED simd_enabled = http_parser_enable_simd(true);
+
+/* Skip to the byte before `q', counting the skipped bytes into the size of
+ * headers like the main loop does. */
+#define SKIP_BEFORE(q)                                               \
+do {                                                                 \
+  const char *q_ = (q);                                              \
+  parser->nread += q_ - p - 1;                                       \
+  if (parser->nread > (FLARE_RPC_HTTP_MAX_HEADER_SIZE)) {            \
+    SET_ERRNO(HPE_HEADER_OVERFLOW);                                  \
+    goto error;                                                      \
+  }                                                                  \
+  p = q_ - 1;                                                        \
+} while (0)
+
 size_t http_parser_execute (http_parser *parser,
                             const http_parser_settings *settings,
                             const char *data,
@@ -1398,6 +1515,9 @@ size_t http_parser_execute (http_parser *parser,
         if (c) {
           switch (parser->header_state) {
             case h_general:
+              if (scan_header_field) {
+                SKIP_BEFORE(scan_header_field(p + 1, data + len));
+              }
               break;
 
             case h_C:
@@ -1595,6 +1715,9 @@ size_t http_parser_execute (http_parser *parser,
 
         switch (parser->header_state) {
           case h_general:
+            if (scan_header_value) {
+              SKIP_BEFORE(scan_header_value(p + 1, data + len));
+            }
             break;
 
           case h_connection:
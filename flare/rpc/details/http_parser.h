@@ -288,6 +288,12 @@ size_t http_parser_execute(http_parser *parser,
                            size_t len);
 
 
+/* Scan names and values of headers in 16/32-byte chunks with SSE4.2/AVX2
+ * when the CPU supports them, which is on by default. Pass false to parse
+ * byte by byte. Returns whether it was on. Not thread-safe, meant to be
+ * called before parsing anything, e.g. in benchmarks and tests. */
+bool http_parser_enable_simd(bool enable);
+
 /* If http_should_keep_alive() in the on_headers_complete or
  * on_message_complete callback returns 0, then this should be
  * the last message on the connection.
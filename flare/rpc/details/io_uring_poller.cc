@@ -0,0 +1,478 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include "flare/base/profile.h"
+
+#if defined(FLARE_PLATFORM_LINUX)
+
+#include <errno.h>
+#include <poll.h>                                   // POLLIN
+#include <string.h>                                 // memset
+#include <unistd.h>                                 // syscall
+#include <sys/mman.h>                               // mmap
+#include <sys/syscall.h>                            // __NR_io_uring_setup
+#include <linux/io_uring.h>
+#include <atomic>
+#include "flare/base/fd_utility.h"                  // make_close_on_exec
+#include "flare/log/logging.h"
+#include "flare/base/errno.h"                       // flare_error
+#include "flare/rpc/details/io_uring_poller.h"
+
+#ifndef __NR_io_uring_setup
+#define __NR_io_uring_setup 425
+#endif
+#ifndef __NR_io_uring_enter
+#define __NR_io_uring_enter 426
+#endif
+#ifndef POLLRDHUP
+#define POLLRDHUP 0x2000
+#endif
+#ifndef IORING_FEAT_RSRC_TAGS
+#define IORING_FEAT_RSRC_TAGS (1U << 10)
+#endif
+
+namespace flare::rpc {
+
+    static int sys_io_uring_setup(unsigned entries, io_uring_params *p) {
+        return (int) syscall(__NR_io_uring_setup, entries, p);
+    }
+
+    static int sys_io_uring_enter(int fd, unsigned to_submit,
+                                  unsigned min_complete, unsigned flags) {
+        return (int) syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+                             flags, NULL, 0);
+    }
+
+    template<typename T>
+    inline T load_acquire(const T *p) {
+        return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+    }
+
+    template<typename T>
+    inline void store_release(T *p, T v) {
+        __atomic_store_n(p, v, __ATOMIC_RELEASE);
+    }
+
+    struct IoUringPoller::PollEntry {
+        SocketId socket_id;
+        int fd;
+        // Watching EPOLLOUT rather than EPOLLIN.
+        bool out;
+        // POLL_REMOVE was issued, the entry is deleted on its last completion.
+        bool removed;
+    };
+
+    struct IoUringPoller::Ring {
+        int fd = -1;
+        uint32_t features = 0;
+
+        void *sq_ptr = MAP_FAILED;
+        size_t sq_size = 0;
+        void *cq_ptr = MAP_FAILED;
+        size_t cq_size = 0;
+        io_uring_sqe *sqes = (io_uring_sqe *) MAP_FAILED;
+        size_t sqes_size = 0;
+
+        unsigned *sq_head = nullptr;
+        unsigned *sq_tail = nullptr;
+        unsigned *sq_mask = nullptr;
+        unsigned *sq_entries = nullptr;
+        unsigned *sq_array = nullptr;
+
+        unsigned *cq_head = nullptr;
+        unsigned *cq_tail = nullptr;
+        unsigned *cq_mask = nullptr;
+        io_uring_cqe *cqes = nullptr;
+
+        ~Ring() {
+            if (sqes != MAP_FAILED) {
+                munmap(sqes, sqes_size);
+            }
+            if (cq_ptr != MAP_FAILED && cq_ptr != sq_ptr) {
+                munmap(cq_ptr, cq_size);
+            }
+            if (sq_ptr != MAP_FAILED) {
+                munmap(sq_ptr, sq_size);
+            }
+            if (fd >= 0) {
+                close(fd);
+            }
+        }
+
+        int Setup(unsigned entries) {
+            io_uring_params p;
+            memset(&p, 0, sizeof(p));
+            fd = sys_io_uring_setup(entries, &p);
+            if (fd < 0) {
+                return -1;
+            }
+            flare::base::make_close_on_exec(fd);
+            features = p.features;
+            sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+            cq_size = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+            if (p.features & IORING_FEAT_SINGLE_MMAP) {
+                sq_size = std::max(sq_size, cq_size);
+                cq_size = sq_size;
+            }
+            sq_ptr = mmap(NULL, sq_size, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+            if (sq_ptr == MAP_FAILED) {
+                return -1;
+            }
+            if (p.features & IORING_FEAT_SINGLE_MMAP) {
+                cq_ptr = sq_ptr;
+            } else {
+                cq_ptr = mmap(NULL, cq_size, PROT_READ | PROT_WRITE,
+                              MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+                if (cq_ptr == MAP_FAILED) {
+                    return -1;
+                }
+            }
+            sqes_size = p.sq_entries * sizeof(io_uring_sqe);
+            sqes = (io_uring_sqe *) mmap(NULL, sqes_size, PROT_READ | PROT_WRITE,
+                                         MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+            if (sqes == MAP_FAILED) {
+                return -1;
+            }
+            char *sq = (char *) sq_ptr;
+            sq_head = (unsigned *) (sq + p.sq_off.head);
+            sq_tail = (unsigned *) (sq + p.sq_off.tail);
+            sq_mask = (unsigned *) (sq + p.sq_off.ring_mask);
+            sq_entries = (unsigned *) (sq + p.sq_off.ring_entries);
+            sq_array = (unsigned *) (sq + p.sq_off.array);
+            char *cq = (char *) cq_ptr;
+            cq_head = (unsigned *) (cq + p.cq_off.head);
+            cq_tail = (unsigned *) (cq + p.cq_off.tail);
+            cq_mask = (unsigned *) (cq + p.cq_off.ring_mask);
+            cqes = (io_uring_cqe *) (cq + p.cq_off.cqes);
+            return 0;
+        }
+
+        // Returns a zeroed sqe or NULL when the submission queue is full.
+        io_uring_sqe *GetSqe() {
+            const unsigned tail = *sq_tail;
+            if (tail - load_acquire(sq_head) >= *sq_entries) {
+                return NULL;
+            }
+            const unsigned index = tail & *sq_mask;
+            io_uring_sqe *sqe = &sqes[index];
+            memset(sqe, 0, sizeof(*sqe));
+            sq_array[index] = index;
+            return sqe;
+        }
+
+        void Commit() {
+            store_release(sq_tail, *sq_tail + 1);
+        }
+    };
+
+    IoUringPoller::IoUringPoller()
+            : _ring(NULL), _pending(0) {
+    }
+
+    IoUringPoller::~IoUringPoller() {
+        for (auto &kv : _in_entries) {
+            delete kv.second;
+        }
+        for (auto &kv : _out_entries) {
+            delete kv.second;
+        }
+        delete _ring;
+    }
+
+    int IoUringPoller::Init(unsigned entries) {
+        if (_ring != NULL) {
+            errno = EINVAL;
+            return -1;
+        }
+        Ring *ring = new Ring;
+        if (ring->Setup(entries) != 0) {
+            const int saved_errno = errno;
+            delete ring;
+            errno = saved_errno;
+            return -1;
+        }
+        // Multishot poll came in 5.13 together with IORING_FEAT_RSRC_TAGS.
+        // Without it every event needs a re-arm, which epoll in edge-triggered
+        // mode never does.
+        if (!(ring->features & IORING_FEAT_RSRC_TAGS)) {
+            delete ring;
+            errno = ENOTSUP;
+            return -1;
+        }
+        _ring = ring;
+        return 0;
+    }
+
+    bool IoUringPoller::IsSupported() {
+        io_uring_params p;
+        memset(&p, 0, sizeof(p));
+        const int fd = sys_io_uring_setup(2, &p);
+        if (fd < 0) {
+            return false;
+        }
+        close(fd);
+        return (p.features & IORING_FEAT_RSRC_TAGS);
+    }
+
+    int IoUringPoller::SubmitLocked() {
+        if (_pending == 0) {
+            return 0;
+        }
+        int rc;
+        do {
+            rc = sys_io_uring_enter(_ring->fd, _pending, 0, 0);
+        } while (rc < 0 && errno == EINTR);
+        if (rc < 0) {
+            return -1;
+        }
+        _pending -= std::min<unsigned>(rc, _pending);
+        return 0;
+    }
+
+    int IoUringPoller::PrepPollAdd(PollEntry *entry) {
+        io_uring_sqe *sqe = _ring->GetSqe();
+        if (sqe == NULL) {
+            // Submission queue is full, flush queued requests to make room.
+            if (SubmitLocked() != 0 || (sqe = _ring->GetSqe()) == NULL) {
+                errno = EBUSY;
+                return -1;
+            }
+        }
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->fd = entry->fd;
+        sqe->user_data = (uint64_t) entry;
+        if (entry->out) {
+            sqe->poll32_events = POLLOUT | POLLERR | POLLHUP;
+        } else {
+            sqe->poll32_events = POLLIN | POLLRDHUP | POLLERR | POLLHUP;
+            sqe->len = IORING_POLL_ADD_MULTI;
+        }
+        _ring->Commit();
+        ++_pending;
+        return 0;
+    }
+
+    int IoUringPoller::PrepPollRemove(PollEntry *entry) {
+        io_uring_sqe *sqe = _ring->GetSqe();
+        if (sqe == NULL) {
+            if (SubmitLocked() != 0 || (sqe = _ring->GetSqe()) == NULL) {
+                errno = EBUSY;
+                return -1;
+            }
+        }
+        sqe->opcode = IORING_OP_POLL_REMOVE;
+        sqe->fd = -1;
+        sqe->addr = (uint64_t) entry;
+        // Completion of the removal itself is ignored.
+        sqe->user_data = 0;
+        _ring->Commit();
+        ++_pending;
+        return 0;
+    }
+
+    int IoUringPoller::PrepNop() {
+        io_uring_sqe *sqe = _ring->GetSqe();
+        if (sqe == NULL) {
+            if (SubmitLocked() != 0 || (sqe = _ring->GetSqe()) == NULL) {
+                errno = EBUSY;
+                return -1;
+            }
+        }
+        sqe->opcode = IORING_OP_NOP;
+        sqe->fd = -1;
+        sqe->user_data = 0;
+        _ring->Commit();
+        ++_pending;
+        return 0;
+    }
+
+    int IoUringPoller::AddConsumer(SocketId socket_id, int fd) {
+        std::unique_lock<std::mutex> mu(_mutex);
+        if (_in_entries.find(fd) != _in_entries.end()) {
+            errno = EEXIST;
+            return -1;
+        }
+        PollEntry *entry = new PollEntry{socket_id, fd, false, false};
+        if (PrepPollAdd(entry) != 0) {
+            delete entry;
+            return -1;
+        }
+        _in_entries[fd] = entry;
+        return SubmitLocked();
+    }
+
+    int IoUringPoller::RemoveConsumer(int fd) {
+        std::unique_lock<std::mutex> mu(_mutex);
+        // Like EPOLL_CTL_DEL, both directions of the fd are unwatched.
+        auto it = _out_entries.find(fd);
+        if (it != _out_entries.end()) {
+            it->second->removed = true;
+            PrepPollRemove(it->second);
+            _out_entries.erase(it);
+        }
+        it = _in_entries.find(fd);
+        if (it == _in_entries.end()) {
+            SubmitLocked();
+            errno = ENOENT;
+            return -1;
+        }
+        it->second->removed = true;
+        const int rc = PrepPollRemove(it->second);
+        _in_entries.erase(it);
+        if (SubmitLocked() != 0) {
+            return -1;
+        }
+        return rc;
+    }
+
+    int IoUringPoller::AddPollOut(SocketId socket_id, int fd) {
+        std::unique_lock<std::mutex> mu(_mutex);
+        if (_out_entries.find(fd) != _out_entries.end()) {
+            // Still armed, the pending event covers this request.
+            return 0;
+        }
+        PollEntry *entry = new PollEntry{socket_id, fd, true, false};
+        if (PrepPollAdd(entry) != 0) {
+            delete entry;
+            return -1;
+        }
+        _out_entries[fd] = entry;
+        return SubmitLocked();
+    }
+
+    int IoUringPoller::RemovePollOut(int fd) {
+        std::unique_lock<std::mutex> mu(_mutex);
+        auto it = _out_entries.find(fd);
+        if (it == _out_entries.end()) {
+            // Already fired.
+            return 0;
+        }
+        it->second->removed = true;
+        const int rc = PrepPollRemove(it->second);
+        _out_entries.erase(it);
+        if (SubmitLocked() != 0) {
+            return -1;
+        }
+        return rc;
+    }
+
+    void IoUringPoller::Wakeup() {
+        std::unique_lock<std::mutex> mu(_mutex);
+        if (PrepNop() != 0 || SubmitLocked() != 0) {
+            FLARE_PLOG(ERROR) << "Fail to wake up io_uring fd=" << _ring->fd;
+        }
+    }
+
+    bool IoUringPoller::OnCompletion(uint64_t user_data, int res, uint32_t flags,
+                                     epoll_event *e) {
+        PollEntry *entry = (PollEntry *) user_data;
+        if (entry == NULL) {
+            // NOP or POLL_REMOVE.
+            return false;
+        }
+        const bool more = (flags & IORING_CQE_F_MORE);
+        bool filled = false;
+        if (res > 0 && !entry->removed) {
+            e->events = (uint32_t) res;
+            e->data.u64 = entry->socket_id;
+            filled = true;
+        }
+        if (more) {
+            return filled;
+        }
+        // Last completion of this request.
+        if (entry->removed) {
+            delete entry;
+            return filled;
+        }
+        if (!entry->out) {
+            if (res >= 0) {
+                // Multishot poll terminated by the kernel (e.g. when the
+                // completion queue overflowed), re-arm it. The request is
+                // submitted along with the next Wait().
+                if (PrepPollAdd(entry) == 0) {
+                    return filled;
+                }
+                FLARE_PLOG(ERROR) << "Fail to re-arm poll of fd=" << entry->fd;
+            } else {
+                FLARE_LOG(WARNING) << "Poll of fd=" << entry->fd
+                                   << " failed: " << flare_error(-res);
+            }
+        }
+        auto &entries = entry->out ? _out_entries : _in_entries;
+        auto it = entries.find(entry->fd);
+        if (it != entries.end() && it->second == entry) {
+            entries.erase(it);
+        }
+        delete entry;
+        return filled;
+    }
+
+    int IoUringPoller::Wait(epoll_event *e, int max_events) {
+        unsigned to_submit;
+        {
+            std::unique_lock<std::mutex> mu(_mutex);
+            to_submit = _pending;
+            _pending = 0;
+        }
+        Ring *const ring = _ring;
+        unsigned head = *ring->cq_head;
+        // Block only if there's no completion to reap. The kernel does not
+        // wait either when it can't submit all of `to_submit', so a request
+        // left in the submission queue never leaves us blocked.
+        const unsigned min_complete =
+                (head == load_acquire(ring->cq_tail) ? 1 : 0);
+        if (to_submit > 0 || min_complete > 0) {
+            const int rc = sys_io_uring_enter(
+                    ring->fd, to_submit, min_complete,
+                    min_complete ? IORING_ENTER_GETEVENTS : 0);
+            const int saved_errno = errno;
+            const unsigned submitted = (rc > 0 ? std::min<unsigned>(rc, to_submit) : 0);
+            if (submitted < to_submit) {
+                // Nothing (on error, including EBUSY/EAGAIN when the
+                // completion queue is full) or part of the queue is consumed
+                // by the kernel, submit the rest along with the next Wait().
+                std::unique_lock<std::mutex> mu(_mutex);
+                _pending += to_submit - submitted;
+            }
+            if (rc < 0 && saved_errno != EBUSY && saved_errno != EAGAIN) {
+                errno = saved_errno;
+                return -1;
+            }
+        }
+        int n = 0;
+        const unsigned tail = load_acquire(ring->cq_tail);
+        std::unique_lock<std::mutex> mu(_mutex);
+        while (head != tail && n < max_events) {
+            const io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+            const uint64_t user_data = cqe->user_data;
+            const int res = cqe->res;
+            const uint32_t flags = cqe->flags;
+            ++head;
+            if (OnCompletion(user_data, res, flags, &e[n])) {
+                ++n;
+            }
+        }
+        store_release(ring->cq_head, head);
+        return n;
+    }
+
+} // namespace flare::rpc
+
+#endif // defined(FLARE_PLATFORM_LINUX)
@@ -0,0 +1,144 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include <algorithm>                                    // std::sort
+#include "flare/rpc/details/method_index.h"
+
+namespace flare::rpc {
+
+    // Average number of names in a bucket. Larger values make the seeds
+    // smaller but searching them slower.
+    static const uint32_t NAMES_PER_BUCKET = 4;
+    // Seeds tried for a bucket before enlarging the table.
+    static const uint32_t MAX_SEED = 1 << 16;
+
+    int MethodIndex::init(const std::vector<std::string> &full_names) {
+        clear();
+        if (full_names.empty()) {
+            return 0;
+        }
+        std::vector<Slot> items(full_names.size());
+        for (size_t i = 0; i < full_names.size(); ++i) {
+            const std::string &name = full_names[i];
+            const size_t pos = name.rfind('.');
+            if (pos == std::string::npos) {
+                return -1;
+            }
+            items[i].service_size = pos;
+            items[i].index = i;
+            items[i].full_name = name;
+        }
+        // Names with the same hash can't be separated by any seed.
+        std::vector<uint64_t> hashes(items.size());
+        for (int sampled = 1; sampled >= 0; --sampled) {
+            _sampled = sampled;
+            for (size_t i = 0; i < items.size(); ++i) {
+                const std::string &name = items[i].full_name;
+                const size_t pos = items[i].service_size;
+                items[i].hash = Hash(std::string_view(name.data(), pos),
+                                     std::string_view(name.data() + pos + 1,
+                                                      name.size() - pos - 1));
+                hashes[i] = items[i].hash;
+            }
+            std::sort(hashes.begin(), hashes.end());
+            if (std::adjacent_find(hashes.begin(), hashes.end()) == hashes.end()) {
+                break;
+            }
+            if (!sampled) {
+                return -1;
+            }
+        }
+
+        const uint32_t nbucket = (items.size() + NAMES_PER_BUCKET - 1) / NAMES_PER_BUCKET;
+        std::vector<std::vector<uint32_t> > buckets(nbucket);
+        for (size_t i = 0; i < items.size(); ++i) {
+            buckets[Reduce(items[i].hash >> 32, nbucket)].push_back(i);
+        }
+        // Place larger buckets first while most slots are free.
+        std::vector<uint32_t> order(nbucket);
+        for (uint32_t i = 0; i < nbucket; ++i) {
+            order[i] = i;
+        }
+        std::stable_sort(order.begin(), order.end(), [&buckets](uint32_t a, uint32_t b) {
+            return buckets[a].size() > buckets[b].size();
+        });
+
+        std::vector<uint32_t> seeds;
+        std::vector<char> used;
+        std::vector<uint32_t> picked;
+        for (uint32_t nslot = items.size();; nslot += nslot / 16 + 1) {
+            seeds.assign(nbucket, 0);
+            used.assign(nslot, 0);
+            bool ok = true;
+            for (uint32_t i = 0; ok && i < nbucket; ++i) {
+                const std::vector<uint32_t> &bucket = buckets[order[i]];
+                if (bucket.empty()) {
+                    break;
+                }
+                uint32_t seed = 0;
+                for (; seed < MAX_SEED; ++seed) {
+                    picked.clear();
+                    for (size_t j = 0; j < bucket.size(); ++j) {
+                        const uint32_t slot = SlotOf(items[bucket[j]].hash, seed, nslot);
+                        if (used[slot] ||
+                            std::find(picked.begin(), picked.end(), slot) != picked.end()) {
+                            break;
+                        }
+                        picked.push_back(slot);
+                    }
+                    if (picked.size() == bucket.size()) {
+                        break;
+                    }
+                }
+                if (seed == MAX_SEED) {
+                    ok = false;
+                    break;
+                }
+                seeds[order[i]] = seed;
+                for (size_t j = 0; j < picked.size(); ++j) {
+                    used[picked[j]] = 1;
+                }
+            }
+            if (!ok) {
+                continue;
+            }
+            _slots.resize(nslot);
+            for (size_t i = 0; i < _slots.size(); ++i) {
+                _slots[i].hash = 0;
+                _slots[i].service_size = 0;
+                _slots[i].index = -1;
+            }
+            for (size_t i = 0; i < items.size(); ++i) {
+                Slot &item = items[i];
+                const uint32_t b = Reduce(item.hash >> 32, nbucket);
+                _slots[SlotOf(item.hash, seeds[b], nslot)] = std::move(item);
+            }
+            _nbucket = nbucket;
+            _seeds.swap(seeds);
+            return 0;
+        }
+    }
+
+    void MethodIndex::clear() {
+        _sampled = false;
+        _nbucket = 0;
+        _seeds.clear();
+        _slots.clear();
+    }
+
+}  // namespace flare::rpc
@@ -0,0 +1,185 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#ifndef FLARE_RPC_METHOD_INDEX_H_
+#define FLARE_RPC_METHOD_INDEX_H_
+
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace flare::rpc {
+
+    // Maps full names of methods ("package.Service.Method") to indexes with
+    // a minimal perfect hash built once. Lookups hash the name once, probe
+    // exactly one slot and compare one key, without concatenating service
+    // and method names as the protocols carry them separately.
+    // Since the key is compared anyway, only lengths and the first and last
+    // 8 bytes of the service and method names are hashed if they tell all
+    // names apart, which is the common case. Otherwise all bytes are hashed.
+    // Built with the "hash, displace and compress" scheme: names are grouped
+    // into buckets by the hash, and a seed is searched for each bucket to
+    // displace its names into free slots.
+    // Not thread-safe to build, thread-safe to find() after building.
+    class MethodIndex {
+    public:
+        MethodIndex() : _sampled(false), _nbucket(0) {}
+
+        // Index `full_names' by their positions. Returns 0 on success, -1
+        // if a name does not contain '.' or names are duplicated, in which
+        // case the index is empty.
+        int init(const std::vector<std::string> &full_names);
+
+        void clear();
+
+        bool empty() const { return _slots.empty(); }
+
+        size_t size() const { return _slots.size(); }
+
+        // Returns index of `service'.`method', -1 if not found.
+        int find(const std::string_view &service, const std::string_view &method) const;
+
+        // Returns index of `full_name', -1 if not found.
+        int find(const std::string_view &full_name) const {
+            const size_t pos = full_name.rfind('.');
+            if (pos == std::string_view::npos) {
+                return -1;
+            }
+            return find(full_name.substr(0, pos), full_name.substr(pos + 1));
+        }
+
+    private:
+        struct Slot {
+            uint64_t hash;
+            uint32_t service_size;
+            int index;
+            std::string full_name;
+        };
+
+        uint64_t Hash(const std::string_view &service, const std::string_view &method) const {
+            return _sampled ? SampledHash(service, method) : FullHash(service, method);
+        }
+
+        static uint64_t SampledHash(const std::string_view &service,
+                                    const std::string_view &method);
+
+        static uint64_t FullHash(const std::string_view &service,
+                                 const std::string_view &method);
+
+        // Mixes all bits of `x' and `y' into the result with the 128-bit
+        // product.
+        static uint64_t Fold(uint64_t x, uint64_t y) {
+            const unsigned __int128 r = (unsigned __int128) x * y;
+            return (uint64_t) r ^ (uint64_t) (r >> 64);
+        }
+
+        static uint64_t Mix(uint64_t h) {
+            h ^= h >> 33;
+            h *= 0xc4ceb9fe1a85ec53ULL;
+            h ^= h >> 33;
+            return h;
+        }
+
+        // Returns the first and last 8 bytes of `s' in `head' and `tail'.
+        static void Sample(const std::string_view &s, uint64_t *head, uint64_t *tail) {
+            if (s.size() >= 8) {
+                memcpy(head, s.data(), 8);
+                memcpy(tail, s.data() + s.size() - 8, 8);
+            } else {
+                *head = 0;
+                memcpy(head, s.data(), s.size());
+                *tail = 0;
+            }
+        }
+
+        // Maps `x' to [0, n) uniformly without division.
+        static uint32_t Reduce(uint32_t x, uint32_t n) {
+            return (uint32_t) (((uint64_t) x * n) >> 32);
+        }
+
+        static uint32_t SlotOf(uint64_t hash, uint32_t seed, uint32_t nslot) {
+            uint64_t x = (hash ^ seed) * 0xff51afd7ed558ccdULL;
+            x ^= x >> 32;
+            return Reduce((uint32_t) x, nslot);
+        }
+
+        bool _sampled;
+        uint32_t _nbucket;
+        std::vector<uint32_t> _seeds;
+        std::vector<Slot> _slots;
+    };
+
+    inline uint64_t MethodIndex::SampledHash(const std::string_view &service,
+                                             const std::string_view &method) {
+        uint64_t a, b, c, d;
+        Sample(service, &a, &b);
+        Sample(method, &c, &d);
+        // Multiplications of the service and the method run in parallel.
+        const uint64_t hs = Fold(a ^ 0x9e3779b97f4a7c15ULL, b ^ 0xff51afd7ed558ccdULL);
+        const uint64_t hm = Fold(c ^ 0xc2b2ae3d27d4eb4fULL, d ^ 0x165667b19e3779f9ULL);
+        return Fold(hs ^ (service.size() << 32 | method.size()),
+                    hm ^ 0x27d4eb2f165667c5ULL);
+    }
+
+    inline uint64_t MethodIndex::FullHash(const std::string_view &service,
+                                          const std::string_view &method) {
+        const uint64_t K = 0x9e3779b97f4a7c15ULL;
+        uint64_t h = service.size() * K + method.size();
+        const std::string_view parts[2] = {service, method};
+        for (int i = 0; i < 2; ++i) {
+            const char *p = parts[i].data();
+            size_t n = parts[i].size();
+            for (; n >= 8; p += 8, n -= 8) {
+                uint64_t w;
+                memcpy(&w, p, 8);
+                h = (h ^ w) * K;
+                h = (h << 31) | (h >> 33);
+            }
+            if (n) {
+                uint64_t w = 0;
+                memcpy(&w, p, n);
+                h = (h ^ w) * K;
+                h = (h << 31) | (h >> 33);
+            }
+        }
+        return Mix(h);
+    }
+
+    inline int MethodIndex::find(const std::string_view &service,
+                                 const std::string_view &method) const {
+        if (_slots.empty()) {
+            return -1;
+        }
+        const uint64_t h = Hash(service, method);
+        const Slot &s = _slots[SlotOf(h, _seeds[Reduce(h >> 32, _nbucket)],
+                                      _slots.size())];
+        if (s.hash != h || s.service_size != service.size() ||
+            s.full_name.size() != service.size() + 1 + method.size() ||
+            memcmp(s.full_name.data(), service.data(), service.size()) != 0 ||
+            memcmp(s.full_name.data() + service.size() + 1,
+                   method.data(), method.size()) != 0) {
+            return -1;
+        }
+        return s.index;
+    }
+
+}  // namespace flare::rpc
+
+#endif  // FLARE_RPC_METHOD_INDEX_H_
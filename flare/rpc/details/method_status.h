@@ -40,8 +40,9 @@ namespace flare::rpc {
 
         // Call this function when the method is about to be called.
         // Returns false when the method is overloaded. If rejected_cc is not
-        // nullptr, it's set with the rejected concurrency.
-        bool OnRequested(int *rejected_cc = nullptr);
+        // nullptr, it's set with the rejected concurrency. `priority' is the
+        // priority of the request, see Controller::set_request_priority().
+        bool OnRequested(int *rejected_cc = nullptr, int priority = 0);
 
         // Call this when the method just finished.
         // `error_code' : The error code obtained from the controller. Equal to
@@ -95,9 +96,9 @@ namespace flare::rpc {
         uint64_t _received_us;
     };
 
-    inline bool MethodStatus::OnRequested(int *rejected_cc) {
+    inline bool MethodStatus::OnRequested(int *rejected_cc, int priority) {
         const int cc = _nconcurrency.fetch_add(1, std::memory_order_relaxed) + 1;
-        if (nullptr == _cl || _cl->OnRequested(cc)) {
+        if (nullptr == _cl || _cl->OnRequested(cc, priority)) {
             return true;
         }
         if (rejected_cc) {
@@ -23,6 +23,7 @@
 #include "flare/hash/murmurhash3.h"// fmix32
 #include "flare/fiber/internal/fiber.h"                          // fiber_start_background
 #include "flare/rpc/event_dispatcher.h"
+#include "flare/rpc/details/io_uring_poller.h"
 
 #ifdef FLARE_RPC_SOCKET_HAS_EOF
 #include "flare/rpc/details/has_epollrdhup.h"
@@ -45,13 +46,34 @@ namespace flare::rpc {
     DEFINE_bool(usercode_in_pthread, false,
                 "Call user's callback in pthreads, use fibers otherwise");
 
+    DEFINE_bool(event_dispatcher_use_io_uring, false,
+                "[Experimental] Watch readiness of sockets with io_uring "
+                "instead of epoll, reads and writes are still done by "
+                "readv/writev and it's not faster than epoll. Fall back to "
+                "epoll if the kernel lacks io_uring or multishot poll");
+
+    DEFINE_int32(event_dispatcher_io_uring_entries, 4096,
+                 "Size of submission queue of each io_uring dispatcher");
+
     EventDispatcher::EventDispatcher()
-            : _epfd(-1), _stop(false), _tid(0), _consumer_thread_attr(FIBER_ATTR_NORMAL) {
+            : _epfd(-1), _uring(NULL), _stop(false), _tid(0), _consumer_thread_attr(FIBER_ATTR_NORMAL) {
 #if defined(FLARE_PLATFORM_LINUX)
-        _epfd = epoll_create(1024 * 1024);
-        if (_epfd < 0) {
-            FLARE_PLOG(FATAL) << "Fail to create epoll";
-            return;
+        if (FLAGS_event_dispatcher_use_io_uring) {
+            IoUringPoller *uring = new IoUringPoller;
+            if (uring->Init(FLAGS_event_dispatcher_io_uring_entries) == 0) {
+                _uring = uring;
+            } else {
+                FLARE_PLOG(WARNING) << "Fail to create io_uring, use epoll instead";
+                delete uring;
+            }
+        }
+        if (_uring == NULL) {
+            _epfd = epoll_create(1024 * 1024);
+            if (_epfd < 0) {
+                FLARE_PLOG(FATAL) << "Fail to create epoll";
+                return;
+            }
+            FLARE_CHECK_EQ(0, flare::base::make_close_on_exec(_epfd));
         }
 #elif defined(FLARE_PLATFORM_OSX)
         _epfd = kqueue();
@@ -59,10 +81,10 @@ namespace flare::rpc {
             FLARE_PLOG(FATAL) << "Fail to create kqueue";
             return;
         }
+        FLARE_CHECK_EQ(0, flare::base::make_close_on_exec(_epfd));
 #else
 #error Not implemented
 #endif
-        FLARE_CHECK_EQ(0, flare::base::make_close_on_exec(_epfd));
 
         _wakeup_fds[0] = -1;
         _wakeup_fds[1] = -1;
@@ -75,6 +97,10 @@ namespace flare::rpc {
     EventDispatcher::~EventDispatcher() {
         Stop();
         Join();
+#if defined(FLARE_PLATFORM_LINUX)
+        delete _uring;
+        _uring = NULL;
+#endif
         if (_epfd >= 0) {
             close(_epfd);
             _epfd = -1;
@@ -86,7 +112,7 @@ namespace flare::rpc {
     }
 
     int EventDispatcher::Start(const fiber_attribute *consumer_thread_attr) {
-        if (_epfd < 0) {
+        if (_epfd < 0 && _uring == NULL) {
 #if defined(FLARE_PLATFORM_LINUX)
             FLARE_LOG(FATAL) << "epoll was not created";
 #elif defined(FLARE_PLATFORM_OSX)
@@ -125,12 +151,18 @@ namespace flare::rpc {
     }
 
     bool EventDispatcher::Running() const {
-        return !_stop && _epfd >= 0 && _tid != 0;
+        return !_stop && (_epfd >= 0 || _uring != NULL) && _tid != 0;
     }
 
     void EventDispatcher::Stop() {
         _stop = true;
 
+#if defined(FLARE_PLATFORM_LINUX)
+        if (_uring != NULL) {
+            _uring->Wakeup();
+            return;
+        }
+#endif
         if (_epfd >= 0) {
 #if defined(FLARE_PLATFORM_LINUX)
             epoll_event evt = { EPOLLOUT,  { NULL } };
@@ -152,6 +184,12 @@ namespace flare::rpc {
     }
 
     int EventDispatcher::AddEpollOut(SocketId socket_id, int fd, bool pollin) {
+#if defined(FLARE_PLATFORM_LINUX)
+        if (_uring != NULL) {
+            // EPOLLIN of the fd (if any) is watched by a separate request.
+            return _uring->AddPollOut(socket_id, fd);
+        }
+#endif
         if (_epfd < 0) {
             errno = EINVAL;
             return -1;
@@ -198,6 +236,9 @@ namespace flare::rpc {
     int EventDispatcher::RemoveEpollOut(SocketId socket_id,
                                         int fd, bool pollin) {
 #if defined(FLARE_PLATFORM_LINUX)
+        if (_uring != NULL) {
+            return _uring->RemovePollOut(fd);
+        }
         if (pollin) {
             epoll_event evt;
             evt.data.u64 = socket_id;
@@ -226,6 +267,11 @@ namespace flare::rpc {
     }
 
     int EventDispatcher::AddConsumer(SocketId socket_id, int fd) {
+#if defined(FLARE_PLATFORM_LINUX)
+        if (_uring != NULL) {
+            return _uring->AddConsumer(socket_id, fd);
+        }
+#endif
         if (_epfd < 0) {
             errno = EINVAL;
             return -1;
@@ -259,6 +305,13 @@ namespace flare::rpc {
         // epoll_wait will keep returning events of the fd continuously, making
         // program abnormal.
 #if defined(FLARE_PLATFORM_LINUX)
+        if (_uring != NULL) {
+            if (_uring->RemoveConsumer(fd) < 0) {
+                FLARE_PLOG(WARNING) << "Fail to remove fd=" << fd << " from io_uring";
+                return -1;
+            }
+            return 0;
+        }
         if (epoll_ctl(_epfd, EPOLL_CTL_DEL, fd, NULL) < 0) {
             FLARE_PLOG(WARNING) << "Fail to remove fd=" << fd << " from epfd=" << _epfd;
             return -1;
@@ -282,15 +335,21 @@ namespace flare::rpc {
         while (!_stop) {
 #if defined(FLARE_PLATFORM_LINUX)
             epoll_event e[32];
+            int n;
+            if (_uring != NULL) {
+                // Completions are converted to epoll events.
+                n = _uring->Wait(e, FLARE_ARRAY_SIZE(e));
+            } else {
 #ifdef FLARE_RPC_ADDITIONAL_EPOLL
-            // Performance downgrades in examples.
-            int n = epoll_wait(_epfd, e, FLARE_ARRAY_SIZE(e), 0);
-            if (n == 0) {
-                n = epoll_wait(_epfd, e, FLARE_ARRAY_SIZE(e), -1);
-            }
+                // Performance downgrades in examples.
+                n = epoll_wait(_epfd, e, FLARE_ARRAY_SIZE(e), 0);
+                if (n == 0) {
+                    n = epoll_wait(_epfd, e, FLARE_ARRAY_SIZE(e), -1);
+                }
 #else
-            const int n = epoll_wait(_epfd, e, FLARE_ARRAY_SIZE(e), -1);
+                n = epoll_wait(_epfd, e, FLARE_ARRAY_SIZE(e), -1);
 #endif
+            }
 #elif defined(FLARE_PLATFORM_OSX)
             struct kevent e[32];
             int n = kevent(_epfd, NULL, 0, e, FLARE_ARRAY_SIZE(e), NULL);
@@ -307,7 +366,8 @@ namespace flare::rpc {
                     continue;
                 }
 #if defined(FLARE_PLATFORM_LINUX)
-                    FLARE_PLOG(FATAL) << "Fail to epoll_wait epfd=" << _epfd;
+                FLARE_PLOG(FATAL) << "Fail to " << (_uring ? "wait io_uring" : "epoll_wait")
+                                  << " epfd=" << _epfd;
 #elif defined(FLARE_PLATFORM_OSX)
                 FLARE_PLOG(FATAL) << "Fail to kqueue epfd=" << _epfd;
 #endif
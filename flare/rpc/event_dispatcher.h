@@ -26,6 +26,8 @@
 
 namespace flare::rpc {
 
+class IoUringPoller;
+
 // Dispatch edge-triggered events of file descriptors to consumers
 // running in separate fibers.
 class EventDispatcher {
@@ -85,6 +87,10 @@ private:
     // The epoll to watch events.
     int _epfd;
 
+    // Replaces `_epfd' when -event_dispatcher_use_io_uring is on and the
+    // kernel supports io_uring. NULL otherwise.
+    IoUringPoller* _uring;
+
     // false unless Stop() is called.
     volatile bool _stop;
 
@@ -37,6 +37,7 @@
 #include "flare/rpc/policy/weighted_randomized_load_balancer.h"
 #include "flare/rpc/policy/locality_aware_load_balancer.h"
 #include "flare/rpc/policy/consistent_hashing_load_balancer.h"
+#include "flare/rpc/policy/maglev_load_balancer.h"
 #include "flare/rpc/policy/hasher.h"
 #include "flare/rpc/policy/dynpart_load_balancer.h"
 
@@ -44,6 +45,8 @@
 #include "flare/rpc/compress.h"
 #include "flare/rpc/policy/gzip_compress.h"
 #include "flare/rpc/policy/snappy_compress.h"
+#include "flare/rpc/policy/lz4_compress.h"
+#include "flare/rpc/policy/zstd_compress.h"
 
 // Protocols
 #include "flare/rpc/protocol.h"
@@ -71,6 +74,7 @@
 #include "flare/rpc/concurrency_limiter.h"
 #include "flare/rpc/policy/auto_concurrency_limiter.h"
 #include "flare/rpc/policy/constant_concurrency_limiter.h"
+#include "flare/rpc/policy/gradient_concurrency_limiter.h"
 
 #include "flare/rpc/input_messenger.h"     // get_or_new_client_side_messenger
 #include "flare/rpc/socket_map.h"          // SocketMapList
@@ -99,6 +103,10 @@ namespace flare::rpc {
                  "values <= 0 disables this feature");
     FLARE_RPC_VALIDATE_GFLAG(free_memory_to_system_interval, PassValidate);
 
+    DEFINE_int32(cord_buf_hugepage_pool_mb, 0,
+                 "Carve cord_buf blocks from 2MB huge page slabs, using at most "
+                 "so many MB of memory. Values <= 0 disable this feature");
+
     namespace policy {
         // Defined in http_rpc_protocol.cpp
         void InitCommonStrings();
@@ -111,7 +119,8 @@ namespace flare::rpc {
     struct GlobalExtensions {
         GlobalExtensions()
                 : dns(80), dns_with_ssl(443), ch_mh_lb(CONS_HASH_LB_MURMUR3), ch_md5_lb(CONS_HASH_LB_MD5),
-                  ch_ketama_lb(CONS_HASH_LB_KETAMA), constant_cl(0) {
+                  ch_ketama_lb(CONS_HASH_LB_KETAMA),
+                  maglev_lb(MAGLEV_LB_PERMUTATION), jump_lb(MAGLEV_LB_JUMP), constant_cl(0) {
         }
 
         FileNamingService fns;
@@ -131,10 +140,13 @@ namespace flare::rpc {
         ConsistentHashingLoadBalancer ch_mh_lb;
         ConsistentHashingLoadBalancer ch_md5_lb;
         ConsistentHashingLoadBalancer ch_ketama_lb;
+        MaglevLoadBalancer maglev_lb;
+        MaglevLoadBalancer jump_lb;
         DynPartLoadBalancer dynpart_lb;
 
         AutoConcurrencyLimiter auto_cl;
         ConstantConcurrencyLimiter constant_cl;
+        GradientConcurrencyLimiter gradient_cl;
     };
 
     static pthread_once_t register_extensions_once = PTHREAD_ONCE_INIT;
@@ -183,6 +195,35 @@ namespace flare::rpc {
         return flare::cord_buf::block_memory();
     }
 
+    static size_t GetCordBufHugePageSlabCount(void *) {
+        return flare::cord_buf::get_hugepage_block_stats().slab_count;
+    }
+
+    static size_t GetCordBufHugePageBlockInUse(void *) {
+        return flare::cord_buf::get_hugepage_block_stats().block_in_use;
+    }
+
+    static size_t GetCordBufHugePageBlockCached(void *) {
+        const flare::cord_buf::hugepage_block_stats s =
+                flare::cord_buf::get_hugepage_block_stats();
+        return s.block_thread_cached + s.block_pooled;
+    }
+
+    // Ratio of carved blocks which are free, namely memory held by the
+    // slabs without holding data.
+    static double GetCordBufHugePageFragmentation(void *) {
+        const flare::cord_buf::hugepage_block_stats s =
+                flare::cord_buf::get_hugepage_block_stats();
+        if (s.block_total == 0) {
+            return 0;
+        }
+        return (double) (s.block_thread_cached + s.block_pooled) / s.block_total;
+    }
+
+    static int64_t GetAsyncLogDroppedCount(void *) {
+        return flare::log::async_logging_dropped_count();
+    }
+
 // Defined in server.cpp
     extern flare::static_atomic<int> g_running_server_count;
 
@@ -191,7 +232,18 @@ namespace flare::rpc {
     }
 
 // Update global stuff periodically.
+    static void EnableCordBufHugePageBlocks() {
+        if (FLAGS_cord_buf_hugepage_pool_mb > 0) {
+            flare::cord_buf::enable_hugepage_blocks(
+                    (size_t) FLAGS_cord_buf_hugepage_pool_mb * 1024 * 1024);
+        }
+    }
+
     static void *GlobalUpdate(void *) {
+        // The flag may be set after main() if GlobalInitializeOrDieImpl()
+        // ran before it, blocks allocated so far are still freed correctly.
+        EnableCordBufHugePageBlocks();
+
         // Expose variables.
         flare::status_gauge<size_t> var_iobuf_block_count(
                 "iobuf_block_count", GetCordBufBlockCount, NULL);
@@ -204,6 +256,16 @@ namespace flare::rpc {
                 "iobuf_newbigview_second", &var_iobuf_new_bigview_count);
         flare::status_gauge<size_t> var_iobuf_block_memory(
                 "iobuf_block_memory", GetCordBufBlockMemory, NULL);
+        flare::status_gauge<size_t> var_iobuf_hugepage_slab_count(
+                "iobuf_hugepage_slab_count", GetCordBufHugePageSlabCount, NULL);
+        flare::status_gauge<size_t> var_iobuf_hugepage_block_in_use(
+                "iobuf_hugepage_block_in_use", GetCordBufHugePageBlockInUse, NULL);
+        flare::status_gauge<size_t> var_iobuf_hugepage_block_cached(
+                "iobuf_hugepage_block_cached", GetCordBufHugePageBlockCached, NULL);
+        flare::status_gauge<double> var_iobuf_hugepage_fragmentation(
+                "iobuf_hugepage_fragmentation", GetCordBufHugePageFragmentation, NULL);
+        flare::status_gauge<int64_t> var_log_async_dropped_count(
+                "log_async_dropped_count", GetAsyncLogDroppedCount, NULL);
         flare::status_gauge<int> var_running_server_count(
                 "rpc_server_count", GetRunningServerCount, NULL);
 
@@ -316,6 +378,10 @@ namespace flare::rpc {
         // Make GOOGLE_LOG print to comlog device
         SetLogHandler(&flare_streaming_log_handler);
 
+        // Before any server or channel allocates blocks, so that most
+        // blocks come from the slabs.
+        EnableCordBufHugePageBlocks();
+
         // Setting the variable here does not work, the profiler probably check
         // the variable before main() for only once.
         // setenv("TCMALLOC_SAMPLE_PARAMETER", "524288", 0);
@@ -356,6 +422,8 @@ namespace flare::rpc {
         LoadBalancerExtension()->RegisterOrDie("c_murmurhash", &g_ext->ch_mh_lb);
         LoadBalancerExtension()->RegisterOrDie("c_md5", &g_ext->ch_md5_lb);
         LoadBalancerExtension()->RegisterOrDie("c_ketama", &g_ext->ch_ketama_lb);
+        LoadBalancerExtension()->RegisterOrDie("c_maglev", &g_ext->maglev_lb);
+        LoadBalancerExtension()->RegisterOrDie("c_jump", &g_ext->jump_lb);
         LoadBalancerExtension()->RegisterOrDie("_dynpart", &g_ext->dynpart_lb);
 
         // Compress Handlers
@@ -374,6 +442,20 @@ namespace flare::rpc {
         if (RegisterCompressHandler(COMPRESS_TYPE_SNAPPY, snappy_compress) != 0) {
             exit(1);
         }
+#ifdef FLARE_WITH_LZ4
+        const CompressHandler lz4_compress =
+                {Lz4Compress, Lz4Decompress, "lz4"};
+        if (RegisterCompressHandler(COMPRESS_TYPE_LZ4, lz4_compress) != 0) {
+            exit(1);
+        }
+#endif
+#ifdef FLARE_WITH_ZSTD
+        const CompressHandler zstd_compress =
+                {ZstdCompress, ZstdDecompress, "zstd"};
+        if (RegisterCompressHandler(COMPRESS_TYPE_ZSTD, zstd_compress) != 0) {
+            exit(1);
+        }
+#endif
 
         // Protocols
         Protocol baidu_protocol = {ParseRpcMessage,
@@ -586,6 +668,7 @@ namespace flare::rpc {
         // Concurrency Limiters
         ConcurrencyLimiterExtension()->RegisterOrDie("auto", &g_ext->auto_cl);
         ConcurrencyLimiterExtension()->RegisterOrDie("constant", &g_ext->constant_cl);
+        ConcurrencyLimiterExtension()->RegisterOrDie("gradient", &g_ext->gradient_cl);
 
         if (FLAGS_usercode_in_pthread) {
             // Optional. If channel/server are initialized before main(), this
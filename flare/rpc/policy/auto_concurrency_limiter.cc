@@ -100,7 +100,7 @@ namespace flare::rpc {
                 return;
             }
 
-            const int64_t now_time_us = flare::get_current_time_micros();
+            const int64_t now_time_us = NowUs();
             int64_t last_sampling_time_us =
                     _last_sampling_time_us.load(std::memory_order_relaxed);
 
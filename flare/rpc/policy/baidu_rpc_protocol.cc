@@ -346,6 +346,9 @@ namespace flare::rpc {
             if (request_meta.has_request_id()) {
                 cntl->set_request_id(request_meta.request_id());
             }
+            if (request_meta.has_priority()) {
+                cntl->set_request_priority(request_meta.priority());
+            }
             cntl->set_request_compress_type((CompressType) meta.compress_type());
             accessor.set_server(server)
                     .set_security_mode(security_mode)
@@ -440,7 +443,7 @@ namespace flare::rpc {
                 method_status = mp->status;
                 if (method_status) {
                     int rejected_cc = 0;
-                    if (!method_status->OnRequested(&rejected_cc)) {
+                    if (!method_status->OnRequested(&rejected_cc, cntl->request_priority())) {
                         cntl->SetFailed(ELIMIT, "Rejected by %s's ConcurrencyLimiter, concurrency=%d",
                                         mp->method->full_name().c_str(), rejected_cc);
                         break;
@@ -654,6 +657,9 @@ namespace flare::rpc {
             if (!cntl->request_id().empty()) {
                 request_meta->set_request_id(cntl->request_id());
             }
+            if (cntl->request_priority() != 0) {
+                request_meta->set_priority(cntl->request_priority());
+            }
             meta.set_correlation_id(correlation_id);
             StreamId request_stream_id = accessor.request_stream();
             if (request_stream_id != INVALID_STREAM_ID) {
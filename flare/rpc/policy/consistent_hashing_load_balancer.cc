@@ -18,6 +18,7 @@
 
 #include <algorithm>                                           // std::set_union
 #include <array>
+#include <cmath>
 #include <gflags/gflags.h>
 #include "flare/container/flat_map.h"
 #include "flare/base/errno.h"
@@ -25,7 +26,9 @@
 #include "flare/rpc/policy/consistent_hashing_load_balancer.h"
 #include "flare/rpc/policy/hasher.h"
 #include "flare/strings/numbers.h"
+#include "flare/times/time.h"
 #include "flare/strings/string_splitter.h"
+#include "flare/metrics/gauge.h"
 
 namespace flare::rpc {
     namespace policy {
@@ -143,15 +146,38 @@ namespace flare::rpc {
                 return g_replica_policy->at(type);
             }
 
+            // Total times of spilling to next servers of all bounded-load lbs.
+            flare::gauge<int64_t> &SpillCount() {
+                static flare::gauge<int64_t> *spill_count =
+                        new flare::gauge<int64_t>("rpc_chash_bounded_load_spill_count");
+                return *spill_count;
+            }
+
+            typedef ConsistentHashingLoadBalancer::ServerLoad ServerLoad;
+
+            bool LoadLess(const ServerLoad *a, const ServerLoad *b) {
+                return a->server < b->server;
+            }
+
         } // namespace
 
         ConsistentHashingLoadBalancer::ConsistentHashingLoadBalancer(
                 ConsistentHashingLoadBalancerType type)
-                : _num_replicas(FLAGS_chash_num_replicas), _type(type) {
+                : _num_replicas(FLAGS_chash_num_replicas), _type(type)
+                , _load_factor(0), _total_inflight(0), _num_servers(0) {
             FLARE_CHECK(GetReplicaPolicy(_type))
                             << "Fail to find replica policy for consistency lb type: '" << _type << '\'';
         }
 
+        ConsistentHashingLoadBalancer::~ConsistentHashingLoadBalancer() {
+            flare::container::DoublyBufferedData<std::vector<ServerLoad *> >::ScopedPtr s;
+            if (_db_loads.Read(&s) == 0) {
+                for (size_t i = 0; i < s->size(); ++i) {
+                    delete (*s)[i];
+                }
+            }
+        }
+
         size_t ConsistentHashingLoadBalancer::AddBatch(
                 std::vector<Node> &bg, const std::vector<Node> &fg,
                 const std::vector<Node> &servers, bool *executed) {
@@ -221,6 +247,9 @@ namespace flare::rpc {
         }
 
         bool ConsistentHashingLoadBalancer::AddServer(const ServerId &server) {
+            if (_load_factor > 0) {
+                return AddServersWithLoad(std::vector<ServerId>(1, server)) == 1;
+            }
             std::vector<Node> add_nodes;
             add_nodes.reserve(_num_replicas);
             if (!GetReplicaPolicy(_type)->Build(server, _num_replicas, &add_nodes)) {
@@ -236,6 +265,9 @@ namespace flare::rpc {
 
         size_t ConsistentHashingLoadBalancer::AddServersInBatch(
                 const std::vector<ServerId> &servers) {
+            if (_load_factor > 0) {
+                return AddServersWithLoad(servers);
+            }
             std::vector<Node> add_nodes;
             add_nodes.reserve(servers.size() * _num_replicas);
             std::vector<Node> replicas;
@@ -258,6 +290,9 @@ namespace flare::rpc {
         }
 
         bool ConsistentHashingLoadBalancer::RemoveServer(const ServerId &server) {
+            if (_load_factor > 0) {
+                return RemoveServersWithLoad(std::vector<ServerId>(1, server)) == 1;
+            }
             bool executed = false;
             const size_t ret = _db_hash_ring.ModifyWithForeground(Remove, server, &executed);
             FLARE_CHECK(ret == 0 || ret == _num_replicas);
@@ -266,6 +301,9 @@ namespace flare::rpc {
 
         size_t ConsistentHashingLoadBalancer::RemoveServersInBatch(
                 const std::vector<ServerId> &servers) {
+            if (_load_factor > 0) {
+                return RemoveServersWithLoad(servers);
+            }
             bool executed = false;
             const size_t ret = _db_hash_ring.ModifyWithForeground(RemoveBatch, servers, &executed);
             FLARE_CHECK(ret % _num_replicas == 0);
@@ -276,6 +314,126 @@ namespace flare::rpc {
             return n;
         }
 
+        size_t ConsistentHashingLoadBalancer::AddServersWithLoad(
+                const std::vector<ServerId> &servers) {
+            std::unique_lock<std::mutex> mu(_load_mutex);
+            std::vector<ServerId> ids(servers);
+            std::sort(ids.begin(), ids.end());
+            ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+            std::vector<ServerLoad *> add_loads;
+            std::vector<Node> add_nodes;
+            std::vector<Node> replicas;
+            {
+                flare::container::DoublyBufferedData<std::vector<ServerLoad *> >::ScopedPtr s;
+                if (_db_loads.Read(&s) != 0) {
+                    return 0;
+                }
+                for (size_t i = 0; i < ids.size(); ++i) {
+                    ServerLoad key;
+                    key.server = ids[i];
+                    if (std::binary_search(s->begin(), s->end(), &key, LoadLess)) {
+                        continue;
+                    }
+                    replicas.clear();
+                    if (!GetReplicaPolicy(_type)->Build(ids[i], _num_replicas, &replicas) ||
+                        replicas.empty()) {
+                        continue;
+                    }
+                    ServerLoad *load = new ServerLoad;
+                    load->server = ids[i];
+                    load->addr = replicas[0].server_addr;
+                    for (size_t j = 0; j < replicas.size(); ++j) {
+                        replicas[j].load = load;
+                    }
+                    add_nodes.insert(add_nodes.end(), replicas.begin(), replicas.end());
+                    add_loads.push_back(load);
+                }
+            }
+            if (add_loads.empty()) {
+                return 0;
+            }
+            const int64_t now_us = flare::get_current_time_micros();
+            for (size_t i = 0; i < add_loads.size(); ++i) {
+                add_loads[i]->added_us = now_us;
+            }
+            // Loads go first so that Feedback() of selected nodes always
+            // finds them.
+            bool executed = false;
+            auto add_fn = [](std::vector<ServerLoad *> &bg, const std::vector<ServerLoad *> &fg,
+                             const std::vector<ServerLoad *> &add, bool *executed) -> size_t {
+                if (*executed) {
+                    return fg.size() - bg.size();
+                }
+                *executed = true;
+                bg.resize(fg.size() + add.size());
+                std::merge(fg.begin(), fg.end(), add.begin(), add.end(), bg.begin(), LoadLess);
+                return add.size();
+            };
+            _db_loads.ModifyWithForeground(add_fn, add_loads, &executed);
+
+            std::sort(add_nodes.begin(), add_nodes.end());
+            executed = false;
+            const size_t ret = _db_hash_ring.ModifyWithForeground(AddBatch, add_nodes, &executed);
+            FLARE_CHECK_EQ(ret, add_loads.size() * _num_replicas);
+            _num_servers.fetch_add(add_loads.size(), std::memory_order_relaxed);
+            FLARE_LOG_IF(ERROR, servers.size() > 1 && add_loads.size() != servers.size())
+                            << "Fail to AddServersInBatch, expected " << servers.size()
+                            << " actually " << add_loads.size();
+            return add_loads.size();
+        }
+
+        size_t ConsistentHashingLoadBalancer::RemoveServersWithLoad(
+                const std::vector<ServerId> &servers) {
+            std::unique_lock<std::mutex> mu(_load_mutex);
+            bool executed = false;
+            _db_hash_ring.ModifyWithForeground(RemoveBatch, servers, &executed);
+
+            std::vector<ServerId> ids(servers);
+            std::sort(ids.begin(), ids.end());
+            std::vector<ServerLoad *> removed;
+            auto remove_fn = [&ids, &removed](std::vector<ServerLoad *> &bg,
+                                              const std::vector<ServerLoad *> &fg,
+                                              bool *executed) -> size_t {
+                if (*executed) {
+                    return bg.size() - fg.size();
+                }
+                *executed = true;
+                bg.clear();
+                for (size_t i = 0; i < fg.size(); ++i) {
+                    if (std::binary_search(ids.begin(), ids.end(), fg[i]->server)) {
+                        removed.push_back(fg[i]);
+                    } else {
+                        bg.push_back(fg[i]);
+                    }
+                }
+                return removed.size();
+            };
+            executed = false;
+            _db_loads.ModifyWithForeground(remove_fn, &executed);
+            // Nobody can see the loads now. Feedback() of calls still in
+            // flight won't find them, take their calls out of the total.
+            for (size_t i = 0; i < removed.size(); ++i) {
+                _total_inflight.fetch_sub(removed[i]->inflight.load(std::memory_order_relaxed),
+                                          std::memory_order_relaxed);
+                delete removed[i];
+            }
+            _num_servers.fetch_sub(removed.size(), std::memory_order_relaxed);
+            FLARE_LOG_IF(ERROR, servers.size() > 1 && removed.size() != servers.size())
+                            << "Fail to RemoveServersInBatch, expected " << servers.size()
+                            << " actually " << removed.size();
+            return removed.size();
+        }
+
+        int64_t ConsistentHashingLoadBalancer::LoadCapacity() const {
+            const int64_t n = _num_servers.load(std::memory_order_relaxed);
+            if (n <= 0) {
+                return INT64_MAX;
+            }
+            // Count the call being selected.
+            const int64_t total = _total_inflight.load(std::memory_order_relaxed) + 1;
+            return (int64_t) std::ceil(_load_factor * total / n);
+        }
+
         LoadBalancer *ConsistentHashingLoadBalancer::New(const std::string_view &params) const {
             ConsistentHashingLoadBalancer *lb =
                     new(std::nothrow) ConsistentHashingLoadBalancer(_type);
@@ -312,21 +470,62 @@ namespace flare::rpc {
             if (choice == s->end()) {
                 choice = s->begin();
             }
+            const bool bounded = (_load_factor > 0);
+            const int64_t capacity = (bounded ? LoadCapacity() : 0);
+            const ServerLoad *last_spilled = NULL;
             for (size_t i = 0; i < s->size(); ++i) {
-                if (((i + 1) == s->size() // always take last chance
-                     || !ExcludedServers::IsExcluded(in.excluded, choice->server_sock.id))
-                    && Socket::Address(choice->server_sock.id, out->ptr) == 0
-                    && (*out->ptr)->IsAvailable()) {
-                    return 0;
-                } else {
-                    if (++choice == s->end()) {
-                        choice = s->begin();
+                const bool last_chance = ((i + 1) == s->size());
+                if (bounded && choice->load == last_spilled && !last_chance) {
+                    // Next node of the same overloaded server.
+                } else if ((last_chance
+                            || !ExcludedServers::IsExcluded(in.excluded, choice->server_sock.id))
+                           && Socket::Address(choice->server_sock.id, out->ptr) == 0
+                           && (*out->ptr)->IsAvailable()) {
+                    if (!bounded) {
+                        return 0;
                     }
+                    ServerLoad *load = choice->load;
+                    if (in.begin_time_us < load->added_us) {
+                        // Call begun before the server was added, Feedback()
+                        // can't tell it from calls of a removed entry with the
+                        // same SocketId, so it isn't counted.
+                        return 0;
+                    }
+                    if (load->inflight.load(std::memory_order_relaxed) < capacity || last_chance) {
+                        load->inflight.fetch_add(1, std::memory_order_relaxed);
+                        _total_inflight.fetch_add(1, std::memory_order_relaxed);
+                        out->need_feedback = true;
+                        return 0;
+                    }
+                    // Overloaded, spill to the next server on the ring.
+                    load->nspill.fetch_add(1, std::memory_order_relaxed);
+                    SpillCount() << 1;
+                    last_spilled = load;
+                }
+                if (++choice == s->end()) {
+                    choice = s->begin();
                 }
             }
             return EHOSTDOWN;
         }
 
+        void ConsistentHashingLoadBalancer::Feedback(const CallInfo &info) {
+            flare::container::DoublyBufferedData<std::vector<ServerLoad *> >::ScopedPtr s;
+            if (_db_loads.Read(&s) != 0) {
+                return;
+            }
+            std::vector<ServerLoad *>::const_iterator it = std::lower_bound(
+                    s->begin(), s->end(), info.server_id,
+                    [](const ServerLoad *load, SocketId id) { return load->server.id < id; });
+            // Calls begun before the entry was added were selected from a
+            // removed entry of the same SocketId (or not counted at all).
+            if (it != s->end() && (*it)->server.id == info.server_id &&
+                info.begin_time_us >= (*it)->added_us) {
+                (*it)->inflight.fetch_sub(1, std::memory_order_relaxed);
+                _total_inflight.fetch_sub(1, std::memory_order_relaxed);
+            }
+        }
+
         void ConsistentHashingLoadBalancer::Describe(
                 std::ostream &os, const DescribeOptions &options) {
             if (!options.verbose) {
@@ -354,6 +553,21 @@ namespace flare::rpc {
             os << "deviation: "
                << sqrt(load_sqr_sum * load_map.size() - load_sum * load_sum)
                   / load_map.size();
+            if (_load_factor > 0) {
+                os << "\n  load factor: " << _load_factor << '\n'
+                   << "  in-flight calls: " << _total_inflight.load(std::memory_order_relaxed) << '\n'
+                   << "  in-flight calls and spills of hosts: {\n";
+                flare::container::DoublyBufferedData<std::vector<ServerLoad *> >::ScopedPtr s;
+                if (_db_loads.Read(&s) == 0) {
+                    for (size_t i = 0; i < s->size(); ++i) {
+                        const ServerLoad *load = (*s)[i];
+                        os << "    " << load->addr << ": inflight="
+                           << load->inflight.load(std::memory_order_relaxed)
+                           << " spill=" << load->nspill.load(std::memory_order_relaxed) << '\n';
+                    }
+                }
+                os << "  }\n";
+            }
             os << "}\n";
         }
 
@@ -397,6 +611,15 @@ namespace flare::rpc {
                     _num_replicas = r;
                     continue;
                 }
+                if (sp.key() == "load_factor") {
+                    double c;
+                    if (!flare::simple_atod(sp.value(), &c) || c < 1.0) {
+                        FLARE_LOG(ERROR) << "load_factor must be >= 1, got " << sp.value();
+                        return false;
+                    }
+                    _load_factor = c;
+                    continue;
+                }
                 FLARE_LOG(ERROR) << "Failed to set this unknown parameters " << sp.key_and_value();
             }
             return true;
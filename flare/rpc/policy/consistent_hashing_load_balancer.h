@@ -20,7 +20,9 @@
 #define  FLARE_RPC_CONSISTENT_HASHING_LOAD_BALANCER_H_
 
 #include <stdint.h>                                     // uint32_t
+#include <atomic>
 #include <functional>
+#include <mutex>
 #include <vector>                                       // std::vector
 #include "flare/base/endpoint.h"                              // flare::base::end_point
 #include "flare/container/doubly_buffered_data.h"
@@ -43,10 +45,26 @@ namespace flare::rpc {
 
         class ConsistentHashingLoadBalancer : public LoadBalancer {
         public:
+            // Load of a server shared by all its nodes, only created when
+            // bounded load is enabled.
+            struct ServerLoad {
+                ServerId server;
+                flare::base::end_point addr;
+                // Generation of the entry: realtime when the server was added.
+                // A server removed and added back may get the same SocketId,
+                // calls begun before that (begin_time_us < added_us) belong to
+                // the removed entry and are neither counted nor fed back here.
+                int64_t added_us = 0;
+                std::atomic<int64_t> inflight{0};
+                // Times that the server was skipped for being overloaded.
+                std::atomic<int64_t> nspill{0};
+            };
+
             struct Node {
                 uint32_t hash;
                 ServerId server_sock;
                 flare::base::end_point server_addr;  // To make sorting stable among all clients
+                ServerLoad *load = nullptr;
                 bool operator<(const Node &rhs) const {
                     if (hash < rhs.hash) { return true; }
                     if (hash > rhs.hash) { return false; }
@@ -60,6 +78,8 @@ namespace flare::rpc {
 
             explicit ConsistentHashingLoadBalancer(ConsistentHashingLoadBalancerType type);
 
+            ~ConsistentHashingLoadBalancer();
+
             bool AddServer(const ServerId &server);
 
             bool RemoveServer(const ServerId &server);
@@ -74,11 +94,20 @@ namespace flare::rpc {
 
             int SelectServer(const SelectIn &in, SelectOut *out);
 
+            void Feedback(const CallInfo &info);
+
             void Describe(std::ostream &os, const DescribeOptions &options);
 
         private:
             bool SetParameters(const std::string_view &params);
 
+            size_t AddServersWithLoad(const std::vector<ServerId> &servers);
+
+            size_t RemoveServersWithLoad(const std::vector<ServerId> &servers);
+
+            // Max in-flight calls of a server before spilling to next ones.
+            int64_t LoadCapacity() const;
+
             void GetLoads(std::map<flare::base::end_point, double> *load_map);
 
             static size_t AddBatch(std::vector<Node> &bg, const std::vector<Node> &fg,
@@ -93,6 +122,17 @@ namespace flare::rpc {
             size_t _num_replicas;
             ConsistentHashingLoadBalancerType _type;
             flare::container::DoublyBufferedData<std::vector<Node> > _db_hash_ring;
+
+            // "Consistent Hashing with Bounded Loads", Mirrokni et al. A server
+            // takes at most ceil(_load_factor * average load) calls.
+            // 0 means unbounded.
+            double _load_factor;
+            std::atomic<int64_t> _total_inflight;
+            std::atomic<int64_t> _num_servers;
+            // Serializes adding and removing servers with load.
+            std::mutex _load_mutex;
+            // Sorted by ServerId, to find loads in Feedback().
+            flare::container::DoublyBufferedData<std::vector<ServerLoad *> > _db_loads;
         };
 
     }  // namespace policy
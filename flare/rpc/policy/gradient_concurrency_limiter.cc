@@ -0,0 +1,295 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include <cmath>
+#include <gflags/gflags.h>
+#include "flare/base/fast_rand.h"
+#include "flare/rpc/errno.pb.h"
+#include "flare/times/time.h"
+#include "flare/rpc/policy/gradient_concurrency_limiter.h"
+
+namespace flare::rpc {
+    namespace policy {
+
+        DEFINE_int32(gradient_cl_sample_window_size_ms, 50, "Duration of the sampling window.");
+        DEFINE_int32(gradient_cl_min_sample_count, 20,
+                     "If the number of requests collected in the sampling window is "
+                     "less than this value, the window is extended until it's 20 times "
+                     "as long as gradient_cl_sample_window_size_ms, after which the "
+                     "window is discarded.");
+        DEFINE_int32(gradient_cl_initial_max_concurrency, 40,
+                     "Initial max concurrency for gradient concurrency limiter");
+        DEFINE_int32(gradient_cl_min_concurrency, 1,
+                     "Lower bound of max_concurrency of gradient concurrency limiter");
+        DEFINE_int32(gradient_cl_max_concurrency, 10000,
+                     "Upper bound of max_concurrency of gradient concurrency limiter");
+        DEFINE_double(gradient_cl_latency_tolerance, 1.5,
+                      "max_concurrency is reduced when the latency of a sampling "
+                      "window is larger than the no-load latency multiplied by this "
+                      "value.");
+        DEFINE_double(gradient_cl_alpha_factor_for_ema, 0.1,
+                      "The smoothing coefficient used in the calculation of the "
+                      "no-load latency, the value range is 0-1.");
+        DEFINE_int32(gradient_cl_noload_latency_remeasure_interval_ms, 30000,
+                     "Interval for remeasurement of noload_latency, during which "
+                     "max_concurrency is reduced to the one without queueing.");
+        DEFINE_double(gradient_cl_reduce_ratio_while_remeasure, 0.9,
+                      "This value affects the reduction ratio to max_concurrency "
+                      "during remeasuring noload_latency. The value range is (0-1)");
+        DEFINE_double(gradient_cl_smoothing, 0.2,
+                      "Only this ratio of the increase computed from a sampling window "
+                      "is applied to max_concurrency, decreases are applied fully. "
+                      "The value range is 0-1.");
+        DEFINE_double(gradient_cl_fail_punish_ratio, 1.0,
+                      "Use the failed requests to punish normal requests. The larger "
+                      "the configuration item, the more aggressive the penalty strategy.");
+        DEFINE_double(gradient_cl_priority_ratio, 0.1,
+                      "Requests with priority p (clamped into [-3, 3]) are limited by "
+                      "max_concurrency * (1 + p * gradient_cl_priority_ratio).");
+
+        // Windows with insufficient samples are extended up to this many times.
+        static const int kMaxWindowExtension = 20;
+
+        GradientConcurrencyLimiter::GradientConcurrencyLimiter()
+                : _max_concurrency(0), _min_latency_us(-1), _last_latency_us(0), _last_qps(0),
+                  _last_concurrency_in_window(0), _last_max_concurrency(0), _qps_before_drop(0),
+                  _remeasure_start_us(NextResetTime(flare::get_current_time_micros())),
+                  _reset_latency_us(0), _window_start_us(flare::get_current_time_micros()),
+                  _submitting(false) {
+            SetMaxConcurrency(FLAGS_gradient_cl_initial_max_concurrency);
+        }
+
+        GradientConcurrencyLimiter *GradientConcurrencyLimiter::New(const AdaptiveMaxConcurrency &) const {
+            return new(std::nothrow) GradientConcurrencyLimiter;
+        }
+
+        int64_t GradientConcurrencyLimiter::NextResetTime(int64_t sampling_time_us) {
+            const int interval_ms = FLAGS_gradient_cl_noload_latency_remeasure_interval_ms;
+            return sampling_time_us +
+                   (interval_ms / 2 + flare::base::fast_rand_less_than(interval_ms / 2)) * 1000L;
+        }
+
+        GradientConcurrencyLimiter::SampleShard *
+        GradientConcurrencyLimiter::LocalShard(SampleShard *shards) {
+            static std::atomic<int> next_shard(0);
+            static __thread int tls_shard = -1;
+            if (tls_shard < 0) {
+                tls_shard = next_shard.fetch_add(1, std::memory_order_relaxed) % kShardCount;
+            }
+            return shards + tls_shard;
+        }
+
+        bool GradientConcurrencyLimiter::OnRequested(int current_concurrency) {
+            return OnRequested(current_concurrency, 0);
+        }
+
+        bool GradientConcurrencyLimiter::OnRequested(int current_concurrency, int priority) {
+            SampleShard *shard = LocalShard(_shards);
+            if (current_concurrency > shard->max_concurrency.load(std::memory_order_relaxed)) {
+                shard->max_concurrency.store(current_concurrency, std::memory_order_relaxed);
+            }
+            priority = std::max(-kMaxPriority, std::min(kMaxPriority, priority));
+            return current_concurrency <=
+                   _max_concurrency_of_priority[priority + kMaxPriority].load(std::memory_order_relaxed);
+        }
+
+        void GradientConcurrencyLimiter::OnResponded(int error_code, int64_t latency_us) {
+            if (ELIMIT == error_code) {
+                return;
+            }
+            SampleShard *shard = LocalShard(_shards);
+            if (0 == error_code) {
+                shard->succ_count.fetch_add(1, std::memory_order_relaxed);
+                shard->total_succ_us.fetch_add(latency_us, std::memory_order_relaxed);
+            } else {
+                shard->failed_count.fetch_add(1, std::memory_order_relaxed);
+                shard->total_failed_us.fetch_add(latency_us, std::memory_order_relaxed);
+            }
+
+            const int64_t now_us = NowUs();
+            if (now_us - _window_start_us.load(std::memory_order_relaxed) <
+                FLAGS_gradient_cl_sample_window_size_ms * 1000L) {
+                return;
+            }
+            // Only one thread submits the window, others just go on.
+            if (_submitting.exchange(true, std::memory_order_acquire)) {
+                return;
+            }
+            SubmitSampleWindow(now_us);
+            _submitting.store(false, std::memory_order_release);
+        }
+
+        int GradientConcurrencyLimiter::MaxConcurrency() {
+            return _max_concurrency_of_priority[kMaxPriority].load(std::memory_order_relaxed);
+        }
+
+        void GradientConcurrencyLimiter::SubmitSampleWindow(int64_t now_us) {
+            const int64_t window_us = FLAGS_gradient_cl_sample_window_size_ms * 1000L;
+            const int64_t start_us = _window_start_us.load(std::memory_order_relaxed);
+            if (now_us - start_us < window_us) {
+                // Submitted by another thread.
+                return;
+            }
+            int64_t succ_count = 0;
+            int64_t failed_count = 0;
+            int64_t total_succ_us = 0;
+            int64_t total_failed_us = 0;
+            int64_t snapshot[kShardCount][4];
+            for (int i = 0; i < kShardCount; ++i) {
+                snapshot[i][0] = _shards[i].succ_count.load(std::memory_order_relaxed);
+                snapshot[i][1] = _shards[i].failed_count.load(std::memory_order_relaxed);
+                snapshot[i][2] = _shards[i].total_succ_us.load(std::memory_order_relaxed);
+                snapshot[i][3] = _shards[i].total_failed_us.load(std::memory_order_relaxed);
+                succ_count += snapshot[i][0];
+                failed_count += snapshot[i][1];
+                total_succ_us += snapshot[i][2];
+                total_failed_us += snapshot[i][3];
+            }
+            const bool enough = (succ_count + failed_count >= FLAGS_gradient_cl_min_sample_count);
+            if (!enough && now_us - start_us < window_us * kMaxWindowExtension) {
+                return;
+            }
+            // Samples added after the loads above are kept for the next window.
+            int max_concurrency_in_window = 0;
+            for (int i = 0; i < kShardCount; ++i) {
+                SampleShard &shard = _shards[i];
+                shard.succ_count.fetch_sub(snapshot[i][0], std::memory_order_relaxed);
+                shard.failed_count.fetch_sub(snapshot[i][1], std::memory_order_relaxed);
+                shard.total_succ_us.fetch_sub(snapshot[i][2], std::memory_order_relaxed);
+                shard.total_failed_us.fetch_sub(snapshot[i][3], std::memory_order_relaxed);
+                max_concurrency_in_window = std::max(
+                        max_concurrency_in_window,
+                        shard.max_concurrency.exchange(0, std::memory_order_relaxed));
+            }
+            _window_start_us.store(now_us, std::memory_order_relaxed);
+            if (_reset_latency_us != 0) {
+                // Samples are ignored until requests queued before reducing
+                // max_concurrency are done, after which min_latency is remeasured.
+                if (_reset_latency_us > now_us) {
+                    return;
+                }
+                _min_latency_us = -1;
+                _qps_before_drop = 0;
+                _reset_latency_us = 0;
+                _remeasure_start_us = NextResetTime(now_us);
+                return;
+            }
+            if (!enough) {
+                return;
+            }
+            if (succ_count == 0) {
+                // All requests failed.
+                SetMaxConcurrency(_max_concurrency / 2);
+                return;
+            }
+            const double failed_punish = total_failed_us * FLAGS_gradient_cl_fail_punish_ratio;
+            const int64_t avg_latency_us = std::ceil((failed_punish + total_succ_us) / succ_count);
+            const double qps = succ_count * 1000000.0 / (now_us - start_us);
+            UpdateMaxConcurrency(avg_latency_us, max_concurrency_in_window, qps, now_us);
+        }
+
+        void GradientConcurrencyLimiter::UpdateMaxConcurrency(int64_t avg_latency_us,
+                                                              int max_concurrency_in_window,
+                                                              double qps,
+                                                              int64_t sampling_time_us) {
+            avg_latency_us = std::max<int64_t>(avg_latency_us, 1);
+            const double ema_factor = FLAGS_gradient_cl_alpha_factor_for_ema;
+            if (_min_latency_us <= 0) {
+                _min_latency_us = avg_latency_us;
+            } else if (avg_latency_us < _min_latency_us) {
+                _min_latency_us = avg_latency_us * ema_factor + _min_latency_us * (1 - ema_factor);
+            }
+            if (_remeasure_start_us <= sampling_time_us) {
+                // By Little's law, this max_concurrency keeps the throughput with
+                // no-load latency, which means no queueing.
+                _reset_latency_us = sampling_time_us + avg_latency_us * 2;
+                SetMaxConcurrency(_max_concurrency * _min_latency_us / avg_latency_us *
+                                  FLAGS_gradient_cl_reduce_ratio_while_remeasure);
+                return;
+            }
+            double gradient = std::max(0.5, std::min(
+                    1.0, FLAGS_gradient_cl_latency_tolerance * _min_latency_us / avg_latency_us));
+            if (gradient < 1.0 && qps < _last_qps * 0.8 &&
+                max_concurrency_in_window >= _max_concurrency * 0.9) {
+                // Latency went up while throughput went down at max_concurrency,
+                // the server is slowed down (e.g. by its downstream) rather than
+                // queueing requests. The concurrency it can hold does not change,
+                // keep max_concurrency until throughput settles.
+                if (_qps_before_drop == 0) {
+                    _qps_before_drop = _last_qps;
+                }
+                _last_latency_us = avg_latency_us;
+                _last_qps = qps;
+                _last_concurrency_in_window = max_concurrency_in_window;
+                _last_max_concurrency = _max_concurrency;
+                return;
+            }
+            if (_qps_before_drop != 0) {
+                // By Little's law, the no-load latency grows as much as the
+                // throughput drops. It's underestimated if the throughput
+                // before was not limited by the server.
+                _min_latency_us = std::min<int64_t>(avg_latency_us,
+                                                    _min_latency_us * _qps_before_drop / qps);
+                _qps_before_drop = 0;
+                gradient = std::max(0.5, std::min(
+                        1.0, FLAGS_gradient_cl_latency_tolerance * _min_latency_us / avg_latency_us));
+            } else if (gradient < 1.0 &&
+                       max_concurrency_in_window <= _last_max_concurrency &&
+                       max_concurrency_in_window <= _last_concurrency_in_window * 0.9 &&
+                       avg_latency_us >= _last_latency_us * 0.97) {
+                // Concurrency was cut down within max_concurrency without any
+                // drop of latency, so requests were not queued and the latency
+                // without load has increased, e.g. it was underestimated above.
+                // Relearn min_latency instead of shrinking max_concurrency
+                // further.
+                _min_latency_us = avg_latency_us;
+                gradient = 1.0;
+            }
+            _last_latency_us = avg_latency_us;
+            _last_qps = qps;
+            _last_concurrency_in_window = max_concurrency_in_window;
+            _last_max_concurrency = _max_concurrency;
+
+            double next_max_concurrency = _max_concurrency * gradient + std::sqrt(_max_concurrency);
+            if (next_max_concurrency > _max_concurrency) {
+                if (max_concurrency_in_window < _max_concurrency / 2) {
+                    // Not limited by max_concurrency, don't grow it.
+                    return;
+                }
+                if (avg_latency_us > _min_latency_us) {
+                    // Requests may be queued, grow slowly.
+                    const double smoothing = FLAGS_gradient_cl_smoothing;
+                    next_max_concurrency = _max_concurrency * (1 - smoothing) + next_max_concurrency * smoothing;
+                }
+            }
+            SetMaxConcurrency(next_max_concurrency);
+        }
+
+        void GradientConcurrencyLimiter::SetMaxConcurrency(double max_concurrency) {
+            _max_concurrency = std::max<double>(FLAGS_gradient_cl_min_concurrency,
+                                                std::min<double>(FLAGS_gradient_cl_max_concurrency,
+                                                                 max_concurrency));
+            for (int i = -kMaxPriority; i <= kMaxPriority; ++i) {
+                const double ratio = std::max(0.0, 1.0 + i * FLAGS_gradient_cl_priority_ratio);
+                _max_concurrency_of_priority[i + kMaxPriority].store(
+                        std::max(1, static_cast<int>(_max_concurrency * ratio)), std::memory_order_relaxed);
+            }
+        }
+
+    }  // namespace policy
+}  // namespace flare::rpc
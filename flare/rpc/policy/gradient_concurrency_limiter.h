@@ -0,0 +1,113 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#ifndef FLARE_RPC_POLICY_GRADIENT_CONCURRENCY_LIMITER_H_
+#define FLARE_RPC_POLICY_GRADIENT_CONCURRENCY_LIMITER_H_
+
+#include <atomic>
+#include "flare/base/profile.h"
+#include "flare/rpc/concurrency_limiter.h"
+
+namespace flare::rpc {
+    namespace policy {
+
+        // Adjusts max_concurrency by the gradient of latency: the ratio of the
+        // no-load latency to the latency of the latest sample window, which is
+        // short. max_concurrency shrinks as soon as a window is slower than
+        // tolerated and grows by sqrt(max_concurrency) per window otherwise.
+        // Like the "auto" limiter, the no-load latency is remeasured
+        // periodically with max_concurrency reduced. It's also scaled up when
+        // latency goes up with throughput going down, which means the server
+        // is slowed down rather than overloaded, and relearned when reducing
+        // concurrency does not reduce latency.
+        // Samples are aggregated into per-thread shards without locking.
+        // Requests with priority below 0 are rejected before max_concurrency is
+        // reached, and requests with priority above 0 may exceed it slightly, so
+        // that low priority requests are shed first when overloaded.
+        class GradientConcurrencyLimiter : public ConcurrencyLimiter {
+        public:
+            GradientConcurrencyLimiter();
+
+            bool OnRequested(int current_concurrency) override;
+
+            bool OnRequested(int current_concurrency, int priority) override;
+
+            void OnResponded(int error_code, int64_t latency_us) override;
+
+            int MaxConcurrency() override;
+
+            GradientConcurrencyLimiter *New(const AdaptiveMaxConcurrency &) const override;
+
+        private:
+            // Priorities are clamped into [-kMaxPriority, kMaxPriority].
+            static constexpr int kMaxPriority = 3;
+            static constexpr int kShardCount = 16;
+
+            struct FLARE_CACHELINE_ALIGNMENT SampleShard {
+                SampleShard()
+                        : succ_count(0), failed_count(0), total_succ_us(0), total_failed_us(0),
+                          max_concurrency(0) {}
+
+                std::atomic<int64_t> succ_count;
+                std::atomic<int64_t> failed_count;
+                std::atomic<int64_t> total_succ_us;
+                std::atomic<int64_t> total_failed_us;
+                // Max concurrency seen by OnRequested().
+                std::atomic<int> max_concurrency;
+            };
+
+            static SampleShard *LocalShard(SampleShard *shards);
+
+            // Called by the thread submitting the window.
+            void SubmitSampleWindow(int64_t now_us);
+
+            void UpdateMaxConcurrency(int64_t avg_latency_us, int max_concurrency_in_window,
+                                      double qps, int64_t sampling_time_us);
+
+            int64_t NextResetTime(int64_t sampling_time_us);
+
+            void SetMaxConcurrency(double max_concurrency);
+
+            // modified per sample-window, only by the thread submitting it.
+            double _max_concurrency;
+            int64_t _min_latency_us;
+            // Of the last sample window.
+            int64_t _last_latency_us;
+            double _last_qps;
+            int _last_concurrency_in_window;
+            double _last_max_concurrency;
+            // Throughput before it dropped with latency going up, 0 if not.
+            double _qps_before_drop;
+            int64_t _remeasure_start_us;
+            int64_t _reset_latency_us;
+
+            // modified per sample-window, read per request.
+            std::atomic<int> _max_concurrency_of_priority[2 * kMaxPriority + 1];
+
+            std::atomic<int64_t> FLARE_CACHELINE_ALIGNMENT _window_start_us;
+            std::atomic<bool> _submitting;
+
+            // modified per request.
+            SampleShard _shards[kShardCount];
+        };
+
+    }  // namespace policy
+}  // namespace flare::rpc
+
+
+#endif  // FLARE_RPC_POLICY_GRADIENT_CONCURRENCY_LIMITER_H_
@@ -46,6 +46,10 @@ namespace flare::rpc {
                     "Encode name in HTTP2 headers with huffman encoding");
         DEFINE_bool(h2_hpack_encode_value, false,
                     "Encode value in HTTP2 headers with huffman encoding");
+        DEFINE_int32(h2_write_round_size, 64 * 1024,
+                     "Responses with larger bodies are sent by the write scheduler of "
+                     "the connection in rounds of at most so many bytes, interleaved "
+                     "with other streams");
 
         static bool CheckStreamWindowSize(const char *, int32_t val) {
             return val >= 0;
@@ -352,7 +356,8 @@ namespace flare::rpc {
                 // receving the remote settings.
                 , _remote_window_left(H2Settings::MAX_WINDOW_SIZE), _conn_state(H2_CONNECTION_UNINITIALIZED),
                   _last_received_stream_id(-1), _last_sent_stream_id(1), _goaway_stream_id(-1),
-                  _remote_settings_received(false), _deferred_window_update(0) {
+                  _remote_settings_received(false), _deferred_window_update(0),
+                  _scheduled_data_writing(false) {
             // Stop printing the field which is useless for remote settings.
             _remote_settings.connection_window_size = 0;
             // Maximize the window size to make sending big request possible before
@@ -374,18 +379,22 @@ namespace flare::rpc {
         }
 
         H2Context::~H2Context() {
-            for (StreamMap::iterator it = _pending_streams.begin();
-                 it != _pending_streams.end(); ++it) {
-                delete it->second;
+            std::vector<H2StreamContext *> streams;
+            _pending_streams.erase_greater(0, &streams);
+            for (size_t i = 0; i < streams.size(); ++i) {
+                delete streams[i];
             }
-            _pending_streams.clear();
         }
 
         int H2Context::Init() {
-            if (_pending_streams.init(64, 70) != 0) {
+            if (_pending_streams.init(8) != 0) {
                 FLARE_LOG(ERROR) << "Fail to init _pending_streams";
                 return -1;
             }
+            if (_write_scheduler.Init() != 0) {
+                FLARE_LOG(ERROR) << "Fail to init _write_scheduler";
+                return -1;
+            }
             if (_hpacker.Init(_unack_local_settings.header_table_size) != 0) {
                 FLARE_LOG(ERROR) << "Fail to init _hpacker";
                 return -1;
@@ -394,12 +403,9 @@ namespace flare::rpc {
         }
 
         H2StreamContext *H2Context::RemoveStream(int stream_id) {
-            H2StreamContext *sctx = nullptr;
-            {
-                std::unique_lock<std::mutex> mu(_stream_mutex);
-                if (!_pending_streams.erase(stream_id, &sctx)) {
-                    return nullptr;
-                }
+            H2StreamContext *sctx = _pending_streams.erase(stream_id);
+            if (sctx == nullptr) {
+                return nullptr;
             }
             // The remote stream will not send any more data, sending back the
             // stream-level WINDOW_UPDATE is pointless, just move the value into
@@ -411,51 +417,20 @@ namespace flare::rpc {
         void H2Context::RemoveGoAwayStreams(
                 int goaway_stream_id, std::vector<H2StreamContext *> *out_streams) {
             out_streams->clear();
-            if (goaway_stream_id == 0) {  // quick path
-                StreamMap tmp;
-                {
-                    std::unique_lock<std::mutex> mu(_stream_mutex);
-                    _goaway_stream_id = goaway_stream_id;
-                    _pending_streams.swap(tmp);
-                }
-                for (StreamMap::const_iterator it = tmp.begin(); it != tmp.end(); ++it) {
-                    out_streams->push_back(it->second);
-                }
-            } else {
-                std::unique_lock<std::mutex> mu(_stream_mutex);
-                _goaway_stream_id = goaway_stream_id;
-                for (StreamMap::const_iterator it = _pending_streams.begin();
-                     it != _pending_streams.end(); ++it) {
-                    if (it->first > goaway_stream_id) {
-                        out_streams->push_back(it->second);
-                    }
-                }
-                for (size_t i = 0; i < out_streams->size(); ++i) {
-                    _pending_streams.erase((*out_streams)[i]->stream_id());
-                }
-            }
+            // Streams inserted after each shard is scanned see the new value.
+            _goaway_stream_id.store(goaway_stream_id, std::memory_order_relaxed);
+            _pending_streams.erase_greater(goaway_stream_id, out_streams);
         }
 
         H2StreamContext *H2Context::FindStream(int stream_id) {
-            std::unique_lock<std::mutex> mu(_stream_mutex);
-            H2StreamContext **psctx = _pending_streams.seek(stream_id);
-            if (psctx) {
-                return *psctx;
-            }
-            return nullptr;
+            return _pending_streams.seek(stream_id);
         }
 
         int H2Context::TryToInsertStream(int stream_id, H2StreamContext *ctx) {
-            std::unique_lock<std::mutex> mu(_stream_mutex);
-            if (_goaway_stream_id >= 0 && stream_id > _goaway_stream_id) {
-                return 1;
-            }
-            H2StreamContext *&sctx = _pending_streams[stream_id];
-            if (sctx == nullptr) {
-                sctx = ctx;
-                return 0;
-            }
-            return -1;
+            return _pending_streams.insert(stream_id, ctx, [this, stream_id] {
+                const int goaway_stream_id = _goaway_stream_id.load(std::memory_order_relaxed);
+                return goaway_stream_id >= 0 && stream_id > goaway_stream_id;
+            });
         }
 
         ParseResult H2Context::ConsumeFrameHead(
@@ -587,9 +562,12 @@ namespace flare::rpc {
                 pad_length = LoadUint8(it);
                 --frag_size;
             }
+            int weight = H2_DEFAULT_STREAM_WEIGHT;
             if (has_priority) {
-                // const uint32_t FLARE_ALLOW_UNUSED stream_dep = LoadUint32(it);
-                // const uint32_t FLARE_ALLOW_UNUSED weight = LoadUint8(it);
+                // Dependencies are ignored, weights are used by the write
+                // scheduler of responses.
+                LoadUint32(it);
+                weight = LoadUint8(it) + 1;
                 frag_size -= 5;
             }
             if (frag_size < pad_length) {
@@ -608,6 +586,7 @@ namespace flare::rpc {
                 _last_received_stream_id = frame_head.stream_id;
                 sctx = new H2StreamContext(_socket->is_read_progressive());
                 sctx->Init(this, frame_head.stream_id);
+                sctx->_weight = weight;
                 const int rc = TryToInsertStream(frame_head.stream_id, sctx);
                 if (rc < 0) {
                     delete sctx;
@@ -805,7 +784,10 @@ namespace flare::rpc {
             const H2Error h2_error = static_cast<H2Error>(LoadUint32(it));
             H2StreamContext *sctx = FindStream(frame_head.stream_id);
             if (sctx == nullptr) {
-                RPC_VLOG << "Fail to find stream_id=" << frame_head.stream_id;
+                // Drop the response which is not sent completely.
+                if (!_write_scheduler.Remove(frame_head.stream_id)) {
+                    RPC_VLOG << "Fail to find stream_id=" << frame_head.stream_id;
+                }
                 return MakeH2Message(nullptr);
             }
             return sctx->OnResetStream(h2_error, frame_head);
@@ -858,6 +840,12 @@ namespace flare::rpc {
                 return MakeH2Message(nullptr);
             }
             FLARE_CHECK_EQ(sctx, this);
+            if (!_conn_ctx->is_client_side()) {
+                // WINDOW_UPDATE of the stream may arrive before the response
+                // is sent, which no longer finds this context.
+                _conn_ctx->_write_scheduler.Reserve(
+                        stream_id(), _remote_window_left.load(std::memory_order_relaxed));
+            }
 
             OnMessageComplete();
             return MakeH2Message(sctx);
@@ -915,13 +903,15 @@ namespace flare::rpc {
                 // be changed using WINDOW_UPDATE frames.
                 // https://tools.ietf.org/html/rfc7540#section-6.9.2
                 // TODO(gejun): Has race conditions with AppendAndDestroySelf
-                std::unique_lock<std::mutex> mu(_stream_mutex);
-                for (StreamMap::const_iterator it = _pending_streams.begin();
-                     it != _pending_streams.end(); ++it) {
-                    if (!AddWindowSize(&it->second->_remote_window_left, window_diff)) {
-                        return MakeH2Error(H2_FLOW_CONTROL_ERROR);
-                    }
+                const bool ok = _pending_streams.for_each(
+                        [window_diff](int, H2StreamContext *sctx) {
+                            return AddWindowSize(&sctx->_remote_window_left, window_diff);
+                        });
+                if (!ok) {
+                    return MakeH2Error(H2_FLOW_CONTROL_ERROR);
                 }
+                _write_scheduler.AddWindowToAll(window_diff);
+                ScheduleDataWrite();
             }
             // Respond with ack
             char headbuf[FRAME_HEAD_SIZE];
@@ -1039,11 +1029,22 @@ namespace flare::rpc {
                     FLARE_LOG(ERROR) << "Invalid connection-level window_size_increment=" << inc;
                     return MakeH2Error(H2_FLOW_CONTROL_ERROR);
                 }
+                ScheduleDataWrite();
                 return MakeH2Message(nullptr);
             } else {
                 H2StreamContext *sctx = FindStream(frame_head.stream_id);
                 if (sctx == nullptr) {
-                    RPC_VLOG << "Fail to find stream_id=" << frame_head.stream_id;
+                    // The stream may have a response being sent.
+                    const int rc = _write_scheduler.AddWindow(frame_head.stream_id, inc);
+                    if (rc > 0) {
+                        FLARE_LOG(ERROR) << "Invalid stream-level window_size_increment=" << inc
+                                         << " to stream_id=" << frame_head.stream_id;
+                        return MakeH2Error(H2_FLOW_CONTROL_ERROR, frame_head.stream_id);
+                    } else if (rc == 0) {
+                        ScheduleDataWrite();
+                    } else {
+                        RPC_VLOG << "Fail to find stream_id=" << frame_head.stream_id;
+                    }
                     return MakeH2Message(nullptr);
                 }
                 if (!AddWindowSize(&sctx->_remote_window_left, inc)) {
@@ -1081,7 +1082,8 @@ namespace flare::rpc {
                 abandoned_size = _abandoned_streams.size();
             }
             os << sep << "abandoned_streams=" << abandoned_size
-               << sep << "pending_streams=" << VolatilePendingStreamSize();
+               << sep << "pending_streams=" << VolatilePendingStreamSize()
+               << sep << "scheduled_streams=" << VolatileScheduledStreamSize();
             if (opt.verbose) {
                 os << '\n';
             }
@@ -1184,7 +1186,8 @@ namespace flare::rpc {
 #if defined(FLARE_RPC_H2_STREAM_STATE)
                 , _state(H2_STREAM_IDLE)
 #endif
-                , _stream_id(0), _stream_ended(false), _remote_window_left(0), _deferred_window_update(0),
+                , _stream_id(0), _weight(H2_DEFAULT_STREAM_WEIGHT), _stream_ended(false),
+                  _remote_window_left(0), _deferred_window_update(0),
                   _correlation_id(INVALID_FIBER_TOKEN.value) {
             header().set_version(2, 0);
 #ifndef NDEBUG
@@ -1327,17 +1330,18 @@ namespace flare::rpc {
 
         const CommonStrings *get_common_strings();
 
-        static void PackH2Message(flare::cord_buf *out,
+        // Pack `headers' into a HEADERS frame followed by CONTINUATION frames
+        // if it's larger than max_frame_size of the remote side.
+        static void PackH2Headers(flare::cord_buf *out,
                                   flare::cord_buf &headers,
-                                  flare::cord_buf &trailer_headers,
-                                  const flare::cord_buf &data,
+                                  bool end_stream,
                                   int stream_id,
                                   H2Context *conn_ctx) {
             const H2Settings &remote_settings = conn_ctx->remote_settings();
             char headbuf[FRAME_HEAD_SIZE];
             H2FrameHead headers_head = {
                     (uint32_t) headers.size(), H2_FRAME_HEADERS, 0, stream_id};
-            if (data.empty() && trailer_headers.empty()) {
+            if (end_stream) {
                 headers_head.flags |= H2_FLAGS_END_STREAM;
             }
             if (headers_head.payload_size <= remote_settings.max_frame_size) {
@@ -1364,7 +1368,42 @@ namespace flare::rpc {
                     headers.cutn(out, cont_head.payload_size);
                 }
             }
+        }
+
+        static void PackH2Trailers(flare::cord_buf *out,
+                                   flare::cord_buf &trailer_headers,
+                                   int stream_id) {
+            char headbuf[FRAME_HEAD_SIZE];
+            H2FrameHead headers_head = {
+                    (uint32_t) trailer_headers.size(), H2_FRAME_HEADERS, 0, stream_id};
+            headers_head.flags |= H2_FLAGS_END_STREAM;
+            headers_head.flags |= H2_FLAGS_END_HEADERS;
+            SerializeFrameHead(headbuf, headers_head);
+            out->append(headbuf, sizeof(headbuf));
+            out->append(flare::cord_buf::Movable(trailer_headers));
+        }
+
+        static void PackDeferredWindowUpdate(flare::cord_buf *out, H2Context *conn_ctx) {
+            const int64_t conn_wu = conn_ctx->ReleaseDeferredWindowUpdate();
+            if (conn_wu > 0) {
+                char winbuf[FRAME_HEAD_SIZE + 4];
+                SerializeFrameHead(winbuf, 4, H2_FRAME_WINDOW_UPDATE, 0, 0);
+                SaveUint32(winbuf + FRAME_HEAD_SIZE, conn_wu);
+                out->append(winbuf, sizeof(winbuf));
+            }
+        }
+
+        static void PackH2Message(flare::cord_buf *out,
+                                  flare::cord_buf &headers,
+                                  flare::cord_buf &trailer_headers,
+                                  const flare::cord_buf &data,
+                                  int stream_id,
+                                  H2Context *conn_ctx) {
+            const H2Settings &remote_settings = conn_ctx->remote_settings();
+            PackH2Headers(out, headers, data.empty() && trailer_headers.empty(),
+                          stream_id, conn_ctx);
             if (!data.empty()) {
+                char headbuf[FRAME_HEAD_SIZE];
                 H2FrameHead data_head = {0, H2_FRAME_DATA, 0, stream_id};
                 flare::cord_buf_bytes_iterator it(data);
                 while (it.bytes_left()) {
@@ -1382,20 +1421,81 @@ namespace flare::rpc {
                 }
             }
             if (!trailer_headers.empty()) {
-                H2FrameHead headers_head = {
-                        (uint32_t) trailer_headers.size(), H2_FRAME_HEADERS, 0, stream_id};
-                headers_head.flags |= H2_FLAGS_END_STREAM;
-                headers_head.flags |= H2_FLAGS_END_HEADERS;
-                SerializeFrameHead(headbuf, headers_head);
-                out->append(headbuf, sizeof(headbuf));
-                out->append(flare::cord_buf::Movable(trailer_headers));
+                PackH2Trailers(out, trailer_headers, stream_id);
             }
-            const int64_t conn_wu = conn_ctx->ReleaseDeferredWindowUpdate();
-            if (conn_wu > 0) {
-                char winbuf[FRAME_HEAD_SIZE + 4];
-                SerializeFrameHead(winbuf, 4, H2_FRAME_WINDOW_UPDATE, 0, 0);
-                SaveUint32(winbuf + FRAME_HEAD_SIZE, conn_wu);
-                out->append(winbuf, sizeof(winbuf));
+            PackDeferredWindowUpdate(out, conn_ctx);
+        }
+
+        // Written to the connection to pack the next round of DATA frames from
+        // the write scheduler, after messages written before it.
+        class H2ScheduledDataMessage : public SocketMessage {
+        public:
+            flare::result_status AppendAndDestroySelf(flare::cord_buf *out, Socket *socket) override {
+                std::unique_ptr<H2ScheduledDataMessage> destroy_self(this);
+                if (socket == nullptr) {
+                    return flare::result_status::success();
+                }
+                H2Context *ctx = static_cast<H2Context *>(socket->parsing_context());
+                ctx->_scheduled_data_writing.store(false, std::memory_order_relaxed);
+                ctx->PackScheduledData(out);
+                ctx->ScheduleDataWrite();
+                return flare::result_status::success();
+            }
+        };
+
+        void H2Context::PackScheduledData(flare::cord_buf *out) {
+            std::vector<H2WriteScheduler::Frame> frames;
+            const int64_t n = _write_scheduler.Pop(
+                    _remote_window_left.load(std::memory_order_relaxed),
+                    _remote_settings.max_frame_size, FLAGS_h2_write_round_size, &frames);
+            if (frames.empty()) {
+                return;
+            }
+            // The window is only decreased in the write path.
+            _remote_window_left.fetch_sub(n, std::memory_order_relaxed);
+            HPackOptions options;
+            options.encode_name = FLAGS_h2_hpack_encode_name;
+            options.encode_value = FLAGS_h2_hpack_encode_value;
+            char headbuf[FRAME_HEAD_SIZE];
+            for (size_t i = 0; i < frames.size(); ++i) {
+                H2WriteScheduler::Frame &f = frames[i];
+                H2FrameHead data_head = {
+                        (uint32_t) f.data.size(), H2_FRAME_DATA, 0, f.stream_id};
+                if (f.end_of_stream && f.trailers.empty()) {
+                    data_head.flags |= H2_FLAGS_END_STREAM;
+                }
+                SerializeFrameHead(headbuf, data_head);
+                out->append(headbuf, FRAME_HEAD_SIZE);
+                out->append(flare::cord_buf::Movable(f.data));
+                if (f.end_of_stream && !f.trailers.empty()) {
+                    // Encoded just before being written to keep the order of
+                    // updates to the dynamic table of HPACK.
+                    flare::cord_buf_appender appender;
+                    for (size_t j = 0; j < f.trailers.size(); ++j) {
+                        _hpacker.Encode(&appender, f.trailers[j], options);
+                    }
+                    flare::cord_buf trailer_frag;
+                    appender.move_to(trailer_frag);
+                    PackH2Trailers(out, trailer_frag, f.stream_id);
+                }
+            }
+        }
+
+        void H2Context::ScheduleDataWrite() {
+            if (_remote_window_left.load(std::memory_order_relaxed) <= 0 ||
+                !_write_scheduler.HasSendableStreams()) {
+                return;
+            }
+            if (_scheduled_data_writing.exchange(true, std::memory_order_relaxed)) {
+                return;
+            }
+            SocketMessagePtr<H2ScheduledDataMessage> msg(new H2ScheduledDataMessage);
+            Socket::WriteOptions wopt;
+            wopt.ignore_eovercrowded = true;
+            if (_socket->Write(msg, &wopt) != 0) {
+                // The socket is broken, scheduled data is dropped along with
+                // this context.
+                _scheduled_data_writing.store(false, std::memory_order_relaxed);
             }
         }
 
@@ -1658,7 +1758,8 @@ namespace flare::rpc {
         }
 
         H2UnsentResponse::H2UnsentResponse(Controller *c, int stream_id, bool is_grpc)
-                : _size(0), _stream_id(stream_id), _http_response(c->release_http_response()), _is_grpc(is_grpc) {
+                : _size(0), _stream_id(stream_id), _weight(H2_DEFAULT_STREAM_WEIGHT),
+                  _http_response(c->release_http_response()), _is_grpc(is_grpc) {
             _data.swap(c->response_attachment());
             if (is_grpc) {
                 _grpc_status = ErrorCodeToGrpcStatus(c->ErrorCode());
@@ -1713,21 +1814,6 @@ namespace flare::rpc {
             }
             H2Context *ctx = static_cast<H2Context *>(socket->parsing_context());
 
-            // flow control
-            // NOTE: Currently the stream context is definitely removed and updating
-            // window size is useless, however it's not true when progressive request
-            // is supported.
-            // TODO(zhujiashun): Instead of just returning error to client, a better
-            // solution to handle not enough window size is to wait until WINDOW_UPDATE
-            // is received, and then retry those failed response again.
-            if (!MinusWindowSize(&ctx->_remote_window_left, _data.size())) {
-                char rstbuf[FRAME_HEAD_SIZE + 4];
-                SerializeFrameHead(rstbuf, 4, H2_FRAME_RST_STREAM, 0, _stream_id);
-                SaveUint32(rstbuf + FRAME_HEAD_SIZE, H2_FLOW_CONTROL_ERROR);
-                out->append(rstbuf, sizeof(rstbuf));
-                return flare::result_status::success();
-            }
-
             HPacker &hpacker = ctx->hpacker();
             flare::cord_buf_appender appender;
             HPackOptions options;
@@ -1747,19 +1833,44 @@ namespace flare::rpc {
             flare::cord_buf frag;
             appender.move_to(frag);
 
-            flare::cord_buf trailer_frag;
+            std::vector<HPacker::Header> trailers;
             if (_is_grpc) {
-                HPacker::Header status_header("grpc-status",
-                                              flare::string_printf("%d", _grpc_status));
-                hpacker.Encode(&appender, status_header, options);
+                trailers.push_back(HPacker::Header("grpc-status",
+                                                   flare::string_printf("%d", _grpc_status)));
                 if (!_grpc_message.empty()) {
-                    HPacker::Header msg_header("grpc-message", _grpc_message);
-                    hpacker.Encode(&appender, msg_header, options);
+                    trailers.push_back(HPacker::Header("grpc-message", _grpc_message));
+                }
+            }
+
+            // Small bodies are sent at once if flow control allows.
+            const int64_t data_size = _data.size();
+            if (data_size == 0 ||
+                (data_size <= FLAGS_h2_write_round_size &&
+                 data_size <= (int64_t) ctx->remote_settings().stream_window_size &&
+                 MinusWindowSize(&ctx->_remote_window_left, data_size))) {
+                for (size_t i = 0; i < trailers.size(); ++i) {
+                    hpacker.Encode(&appender, trailers[i], options);
                 }
+                flare::cord_buf trailer_frag;
                 appender.move_to(trailer_frag);
+                PackH2Message(out, frag, trailer_frag, _data, _stream_id, ctx);
+                ctx->_write_scheduler.Remove(_stream_id);
+                return flare::result_status::success();
             }
 
-            PackH2Message(out, frag, trailer_frag, _data, _stream_id, ctx);
+            // Otherwise the body is sent by the write scheduler in rounds
+            // interleaved with other streams, waiting for WINDOW_UPDATE if the
+            // windows are used up.
+            PackH2Headers(out, frag, false, _stream_id, ctx);
+            if (ctx->_write_scheduler.Push(_stream_id, _weight,
+                                           ctx->remote_settings().stream_window_size,
+                                           &_data, &trailers) != 0) {
+                return flare::result_status(EINTERNAL, "Fail to schedule data of existing stream_id={}",
+                                                 _stream_id);
+            }
+            ctx->PackScheduledData(out);
+            ctx->ScheduleDataWrite();
+            PackDeferredWindowUpdate(out, ctx);
             return flare::result_status::success();
         }
 
@@ -24,6 +24,8 @@
 #include "flare/rpc/input_message_base.h"
 #include "flare/rpc/protocol.h"
 #include "flare/rpc/details/hpack.h"
+#include "flare/rpc/details/h2_stream_table.h"
+#include "flare/rpc/details/h2_write_scheduler.h"
 #include "flare/rpc/stream_creator.h"
 #include "flare/rpc/controller.h"
 
@@ -207,6 +209,10 @@ namespace flare::rpc {
 
             void Destroy();
 
+            // Weight of the stream in the write scheduler, set by priority
+            // of the request.
+            void set_weight(int weight) { _weight = weight; }
+
             void Print(std::ostream &os) const;
 
             // @SocketMessage
@@ -232,6 +238,7 @@ namespace flare::rpc {
         private:
             uint32_t _size;
             uint32_t _stream_id;
+            int _weight;
             std::unique_ptr<HttpHeader> _http_response;
             flare::cord_buf _data;
             bool _is_grpc;
@@ -274,6 +281,8 @@ namespace flare::rpc {
 
             int stream_id() const { return _stream_id; }
 
+            int weight() const { return _weight; }
+
             int64_t ReleaseDeferredWindowUpdate() {
                 if (_deferred_window_update.load(std::memory_order_relaxed) == 0) {
                     return 0;
@@ -295,6 +304,7 @@ namespace flare::rpc {
             H2StreamState _state;
 #endif
             int _stream_id;
+            int _weight;
             bool _stream_ended;
             std::atomic<int64_t> _remote_window_left;
             std::atomic<int64_t> _deferred_window_update;
@@ -372,6 +382,8 @@ namespace flare::rpc {
 
             size_t VolatilePendingStreamSize() const { return _pending_streams.size(); }
 
+            size_t VolatileScheduledStreamSize() const { return _write_scheduler.stream_count(); }
+
             HPacker &hpacker() { return _hpacker; }
 
             const H2Settings &remote_settings() const { return _remote_settings; }
@@ -395,6 +407,8 @@ namespace flare::rpc {
 
             friend class H2UnsentResponse;
 
+            friend class H2ScheduledDataMessage;
+
             friend void InitFrameHandlers();
 
             ParseResult ConsumeFrameHead(flare::cord_buf_bytes_iterator &, H2FrameHead *);
@@ -427,6 +441,14 @@ namespace flare::rpc {
 
             void ClearAbandonedStreamsImpl();
 
+            // Pack a round of DATA frames from _write_scheduler into *out.
+            // Called in AppendAndDestroySelf() of messages only.
+            void PackScheduledData(flare::cord_buf *out);
+
+            // Write a message to pack scheduled data later if some stream
+            // is able to send and no such message is being written.
+            void ScheduleDataWrite();
+
             // True if the connection is established by client, otherwise it's
             // accepted by server.
             Socket *_socket;
@@ -434,7 +456,7 @@ namespace flare::rpc {
             H2ConnectionState _conn_state;
             int _last_received_stream_id;
             uint32_t _last_sent_stream_id;
-            int _goaway_stream_id;
+            std::atomic<int> _goaway_stream_id;
             H2Settings _remote_settings;
             bool _remote_settings_received;
             H2Settings _local_settings;
@@ -442,10 +464,10 @@ namespace flare::rpc {
             HPacker _hpacker;
             mutable std::mutex _abandoned_streams_mutex;
             std::vector<uint32_t> _abandoned_streams;
-            typedef flare::container::FlatMap<int, H2StreamContext *> StreamMap;
-            mutable std::mutex _stream_mutex;
-            StreamMap _pending_streams;
+            H2StreamTable<H2StreamContext> _pending_streams;
             std::atomic<int64_t> _deferred_window_update;
+            H2WriteScheduler _write_scheduler;
+            std::atomic<bool> _scheduled_data_writing;
         };
 
         inline int H2Context::AllocateClientStreamId() {
@@ -505,7 +505,7 @@ namespace flare::rpc {
                     opt.enum_option = (FLAGS_pb_enum_as_number
                                        ? json2pb::OUTPUT_ENUM_BY_NUMBER
                                        : json2pb::OUTPUT_ENUM_BY_NAME);
-                    if (!json2pb::ProtoMessageToJson(*pbreq, &wrapper, opt, &err)) {
+                    if (!json2pb::ProtoMessageToJson(*pbreq, &cntl->request_attachment(), opt, &err)) {
                         cntl->request_attachment().clear();
                         return cntl->SetFailed(
                                 EREQUEST, "Fail to convert request to json, %s", err.c_str());
@@ -650,15 +650,17 @@ namespace flare::rpc {
 
         public:
             HttpResponseSender()
-                    : _method_status(NULL), _received_us(0), _h2_stream_id(-1) {}
+                    : _method_status(NULL), _received_us(0), _h2_stream_id(-1),
+                      _h2_stream_weight(H2_DEFAULT_STREAM_WEIGHT) {}
 
             HttpResponseSender(Controller *cntl/*own*/)
-                    : _cntl(cntl), _method_status(NULL), _received_us(0), _h2_stream_id(-1) {}
+                    : _cntl(cntl), _method_status(NULL), _received_us(0), _h2_stream_id(-1),
+                      _h2_stream_weight(H2_DEFAULT_STREAM_WEIGHT) {}
 
             HttpResponseSender(HttpResponseSender &&s)
                     : _cntl(std::move(s._cntl)), _req(std::move(s._req)), _res(std::move(s._res)),
                       _method_status(std::move(s._method_status)), _received_us(s._received_us),
-                      _h2_stream_id(s._h2_stream_id) {
+                      _h2_stream_id(s._h2_stream_id), _h2_stream_weight(s._h2_stream_weight) {
             }
 
             ~HttpResponseSender();
@@ -673,6 +675,8 @@ namespace flare::rpc {
 
             void set_h2_stream_id(int id) { _h2_stream_id = id; }
 
+            void set_h2_stream_weight(int weight) { _h2_stream_weight = weight; }
+
         private:
             std::unique_ptr<Controller, LogErrorTextAndDelete> _cntl;
             std::unique_ptr<google::protobuf::Message> _req;
@@ -680,6 +684,7 @@ namespace flare::rpc {
             MethodStatus *_method_status;
             int64_t _received_us;
             int _h2_stream_id;
+            int _h2_stream_weight;
         };
 
         class HttpResponseSenderAsDone : public google::protobuf::Closure {
@@ -755,7 +760,7 @@ namespace flare::rpc {
                     opt.enum_option = (FLAGS_pb_enum_as_number
                                        ? json2pb::OUTPUT_ENUM_BY_NUMBER
                                        : json2pb::OUTPUT_ENUM_BY_NAME);
-                    if (!json2pb::ProtoMessageToJson(*res, &wrapper, opt, &err)) {
+                    if (!json2pb::ProtoMessageToJson(*res, &cntl->response_attachment(), opt, &err)) {
                         cntl->SetFailed(ERESPONSE, "Fail to convert response to json, %s", err.c_str());
                     }
                 }
@@ -870,6 +875,7 @@ namespace flare::rpc {
                     errno = EINVAL;
                     rc = -1;
                 } else {
+                    h2_response->set_weight(_h2_stream_weight);
                     if (FLAGS_http_verbose) {
                         FLARE_LOG(INFO) << '\n' << *h2_response;
                     }
@@ -1219,6 +1225,7 @@ namespace flare::rpc {
             if (is_http2) {
                 H2StreamContext *h2_sctx = static_cast<H2StreamContext *>(msg);
                 resp_sender.set_h2_stream_id(h2_sctx->stream_id());
+                resp_sender.set_h2_stream_weight(h2_sctx->weight());
             }
 
             ControllerPrivateAccessor accessor(cntl);
@@ -91,6 +91,9 @@ namespace flare::rpc {
                 case COMPRESS_TYPE_LZ4:
                     FLARE_LOG(ERROR) << "Hulu doesn't support LZ4";
                     return HULU_COMPRESS_TYPE_NONE;
+                case COMPRESS_TYPE_ZSTD:
+                    FLARE_LOG(ERROR) << "Hulu doesn't support ZSTD";
+                    return HULU_COMPRESS_TYPE_NONE;
                 default:
                     FLARE_LOG(ERROR) << "Unknown CompressType=" << type;
                     return HULU_COMPRESS_TYPE_NONE;
@@ -0,0 +1,328 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include <gflags/gflags.h>
+#include "flare/rpc/policy/lz4_compress.h"
+
+#ifdef FLARE_WITH_LZ4
+
+#include <pthread.h>
+#include <stdlib.h>                             // malloc
+#include <string.h>                             // memset
+#include <algorithm>
+#include <string>
+#define LZ4F_STATIC_LINKING_ONLY                // LZ4F_CDict
+#include <lz4frame.h>
+#include "flare/files/sequential_read_file.h"
+#include "flare/log/logging.h"
+#include "flare/rpc/protocol.h"
+
+
+namespace flare::rpc {
+    namespace policy {
+
+        DEFINE_int32(lz4_compression_level, 0,
+                     "Compression level of lz4, 0 for the fast mode, 3~12 "
+                     "for the high compression mode");
+
+        DEFINE_string(lz4_dictionary_path, "",
+                      "Path of a dictionary (e.g. trained by `zstd --train'), "
+                      "clients and servers must use the same dictionary");
+
+        // Size of blocks in the frame, also the input buffered inside lz4.
+        static const size_t LZ4_BLOCK_SIZE = 64 * 1024;
+
+        static std::string *g_dict = NULL;
+        static LZ4F_CDict *g_cdict = NULL;
+        static pthread_once_t g_dict_once = PTHREAD_ONCE_INIT;
+
+        static void LoadDictionary() {
+            if (FLAGS_lz4_dictionary_path.empty()) {
+                return;
+            }
+            flare::sequential_read_file file;
+            std::string content;
+            flare::result_status rs = file.open(FLAGS_lz4_dictionary_path);
+            if (rs.is_ok()) {
+                rs = file.read(&content);
+            }
+            if (!rs.is_ok()) {
+                FLARE_LOG(ERROR) << "Fail to read lz4 dictionary from "
+                                 << FLAGS_lz4_dictionary_path << ": " << rs.error_str();
+                return;
+            }
+            g_cdict = LZ4F_createCDict(content.data(), content.size());
+            if (g_cdict == NULL) {
+                FLARE_LOG(ERROR) << "Fail to create lz4 dictionary from "
+                                 << FLAGS_lz4_dictionary_path;
+                return;
+            }
+            // Decompression takes the raw content, which must outlive the calls.
+            g_dict = new std::string(std::move(content));
+        }
+
+        struct Lz4Contexts {
+            LZ4F_cctx *cctx = NULL;
+            LZ4F_dctx *dctx = NULL;
+
+            ~Lz4Contexts() {
+                if (cctx) {
+                    LZ4F_freeCompressionContext(cctx);
+                }
+                if (dctx) {
+                    LZ4F_freeDecompressionContext(dctx);
+                }
+            }
+        };
+
+        // Contexts are reused by all calls in the same thread.
+        static Lz4Contexts *GetLz4Contexts() {
+            pthread_once(&g_dict_once, LoadDictionary);
+            static thread_local Lz4Contexts ctxs;
+            if (ctxs.cctx == NULL &&
+                LZ4F_isError(LZ4F_createCompressionContext(&ctxs.cctx, LZ4F_VERSION))) {
+                ctxs.cctx = NULL;
+                return NULL;
+            }
+            if (ctxs.dctx == NULL &&
+                LZ4F_isError(LZ4F_createDecompressionContext(&ctxs.dctx, LZ4F_VERSION))) {
+                ctxs.dctx = NULL;
+                return NULL;
+            }
+            return &ctxs;
+        }
+
+        // Copy `n' bytes into `wrapper', used for small pieces only.
+        static bool WriteThrough(flare::cord_buf_as_zero_copy_output_stream *wrapper,
+                                 const char *data, size_t n) {
+            while (n > 0) {
+                void *dst = NULL;
+                int dst_size = 0;
+                if (!wrapper->Next(&dst, &dst_size)) {
+                    return false;
+                }
+                const size_t len = std::min(n, (size_t) dst_size);
+                memcpy(dst, data, len);
+                wrapper->BackUp(dst_size - (int) len);
+                data += len;
+                n -= len;
+            }
+            return true;
+        }
+
+        // Call `fn(dst, capacity)' which writes at most `bound' bytes into
+        // `dst' and returns the number of bytes written or a lz4 error. The
+        // output goes into the current block of `wrapper' if there's enough
+        // room, otherwise into a separately allocated block, never copied
+        // except for tiny pieces.
+        template<typename Fn>
+        static size_t Lz4Emit(flare::cord_buf *out,
+                              flare::cord_buf_as_zero_copy_output_stream *wrapper,
+                              size_t bound, Fn &&fn) {
+            void *dst = NULL;
+            int dst_size = 0;
+            if (!wrapper->Next(&dst, &dst_size)) {
+                return (size_t) -1;
+            }
+            if ((size_t) dst_size >= bound) {
+                const size_t n = fn(dst, (size_t) dst_size);
+                wrapper->BackUp(dst_size - (LZ4F_isError(n) ? 0 : (int) n));
+                return n;
+            }
+            wrapper->BackUp(dst_size);
+            char small[64];
+            if (bound <= sizeof(small)) {
+                const size_t n = fn(small, sizeof(small));
+                if (!LZ4F_isError(n) && !WriteThrough(wrapper, small, n)) {
+                    return (size_t) -1;
+                }
+                return n;
+            }
+            char *buf = (char *) malloc(bound);
+            if (buf == NULL) {
+                return (size_t) -1;
+            }
+            const size_t n = fn(buf, bound);
+            if (LZ4F_isError(n) || n == 0) {
+                free(buf);
+                return n;
+            }
+            // Give back the unused space, which is usually done in place.
+            char *shrunk = (char *) realloc(buf, n);
+            if (shrunk != NULL) {
+                buf = shrunk;
+            }
+            if (out->append_user_data(buf, n, free) != 0) {
+                free(buf);
+                return (size_t) -1;
+            }
+            return n;
+        }
+
+        bool Lz4Compress(const flare::cord_buf &in, flare::cord_buf *out) {
+            Lz4Contexts *ctxs = GetLz4Contexts();
+            if (ctxs == NULL) {
+                FLARE_LOG(WARNING) << "Fail to create lz4 contexts";
+                return false;
+            }
+            LZ4F_cctx *const cctx = ctxs->cctx;
+            LZ4F_preferences_t prefs;
+            memset(&prefs, 0, sizeof(prefs));
+            prefs.compressionLevel = FLAGS_lz4_compression_level;
+            prefs.frameInfo.blockSizeID = LZ4F_max64KB;
+            prefs.frameInfo.contentSize = in.size();
+            // LZ4F_compressBound() of `prefs' assumes a full block buffered
+            // inside lz4, while we know exactly how much is buffered.
+            LZ4F_preferences_t flush_prefs = prefs;
+            flush_prefs.autoFlush = 1;
+            const size_t block_bound = LZ4F_compressBound(LZ4_BLOCK_SIZE, &flush_prefs);
+
+            flare::cord_buf_as_zero_copy_output_stream wrapper(out);
+            size_t n = Lz4Emit(out, &wrapper, LZ4F_HEADER_SIZE_MAX, [&](void *dst, size_t cap) {
+                return (g_cdict != NULL)
+                       ? LZ4F_compressBegin_usingCDict(cctx, dst, cap, g_cdict, &prefs)
+                       : LZ4F_compressBegin(cctx, dst, cap, &prefs);
+            });
+            if (LZ4F_isError(n)) {
+                FLARE_LOG(WARNING) << "Fail to LZ4F_compressBegin: " << LZ4F_getErrorName(n);
+                return false;
+            }
+            // Blocks of `in' are fed directly without flattening it. lz4
+            // gathers them into 64KB blocks (unless they're large enough)
+            // and outputs a compressed block when one is full, so we feed up
+            // to the end of current block each time and know which calls
+            // output.
+            size_t buffered = 0;
+            const size_t nblock = in.backing_block_num();
+            for (size_t i = 0; i < nblock; ++i) {
+                const std::string_view block = in.backing_block(i);
+                const char *src = block.data();
+                size_t left = block.size();
+                while (left > 0) {
+                    const size_t len = std::min(left, LZ4_BLOCK_SIZE - buffered);
+                    if (buffered + len < LZ4_BLOCK_SIZE) {
+                        char dummy[16];
+                        n = LZ4F_compressUpdate(cctx, dummy, sizeof(dummy), src, len, NULL);
+                        buffered += len;
+                    } else {
+                        n = Lz4Emit(out, &wrapper, block_bound, [&](void *dst, size_t cap) {
+                            return LZ4F_compressUpdate(cctx, dst, cap, src, len, NULL);
+                        });
+                        buffered = 0;
+                    }
+                    if (LZ4F_isError(n)) {
+                        FLARE_LOG(WARNING) << "Fail to LZ4F_compressUpdate: "
+                                           << LZ4F_getErrorName(n);
+                        return false;
+                    }
+                    src += len;
+                    left -= len;
+                }
+            }
+            n = Lz4Emit(out, &wrapper, LZ4F_compressBound(buffered, &flush_prefs),
+                        [&](void *dst, size_t cap) {
+                            return LZ4F_compressEnd(cctx, dst, cap, NULL);
+                        });
+            if (LZ4F_isError(n)) {
+                FLARE_LOG(WARNING) << "Fail to LZ4F_compressEnd: " << LZ4F_getErrorName(n);
+                return false;
+            }
+            return true;
+        }
+
+        bool Lz4Decompress(const flare::cord_buf &in, flare::cord_buf *out) {
+            Lz4Contexts *ctxs = GetLz4Contexts();
+            if (ctxs == NULL) {
+                FLARE_LOG(WARNING) << "Fail to create lz4 contexts";
+                return false;
+            }
+            LZ4F_resetDecompressionContext(ctxs->dctx);
+            // Decompressed data is written into blocks of `out' directly.
+            flare::cord_buf_as_zero_copy_output_stream wrapper(out);
+            size_t hint = 1;
+            size_t consumed = 0;
+            const size_t nblock = in.backing_block_num();
+            for (size_t i = 0; i < nblock && hint != 0; ++i) {
+                const std::string_view block = in.backing_block(i);
+                const char *src = block.data();
+                size_t left = block.size();
+                bool full = false;
+                while (left > 0 || full) {
+                    void *dst = NULL;
+                    int dst_size = 0;
+                    if (!wrapper.Next(&dst, &dst_size)) {
+                        return false;
+                    }
+                    size_t dst_len = dst_size;
+                    size_t src_len = left;
+                    if (g_dict != NULL) {
+                        hint = LZ4F_decompress_usingDict(ctxs->dctx, dst, &dst_len, src, &src_len,
+                                                         g_dict->data(), g_dict->size(), NULL);
+                    } else {
+                        hint = LZ4F_decompress(ctxs->dctx, dst, &dst_len, src, &src_len, NULL);
+                    }
+                    wrapper.BackUp(dst_size - (int) dst_len);
+                    if (LZ4F_isError(hint)) {
+                        FLARE_LOG(WARNING) << "Fail to LZ4F_decompress: "
+                                           << LZ4F_getErrorName(hint);
+                        return false;
+                    }
+                    src += src_len;
+                    left -= src_len;
+                    consumed += src_len;
+                    full = (dst_len == (size_t) dst_size);
+                    if (hint == 0) {
+                        // End of the frame.
+                        break;
+                    }
+                }
+            }
+            if (hint != 0) {
+                FLARE_LOG(WARNING) << "Truncated lz4 frame, size=" << in.size();
+                return false;
+            }
+            if (consumed != in.size()) {
+                FLARE_LOG(WARNING) << "Trailing " << in.size() - consumed
+                                   << " bytes after lz4 frame, size=" << in.size();
+                return false;
+            }
+            return true;
+        }
+
+        bool Lz4Compress(const google::protobuf::Message &msg, flare::cord_buf *buf) {
+            flare::cord_buf serialized_pb;
+            flare::cord_buf_as_zero_copy_output_stream wrapper(&serialized_pb);
+            if (!msg.SerializeToZeroCopyStream(&wrapper)) {
+                FLARE_LOG(WARNING) << "Fail to serialize input pb=" << &msg;
+                return false;
+            }
+            return Lz4Compress(serialized_pb, buf);
+        }
+
+        bool Lz4Decompress(const flare::cord_buf &data, google::protobuf::Message *msg) {
+            flare::cord_buf binary_pb;
+            if (!Lz4Decompress(data, &binary_pb)) {
+                return false;
+            }
+            return ParsePbFromCordBuf(msg, binary_pb);
+        }
+
+    }  // namespace policy
+} // namespace flare::rpc
+
+#endif  // FLARE_WITH_LZ4
@@ -0,0 +1,336 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include <algorithm>                                           // std::set_union
+#include <gflags/gflags.h>
+#include "flare/container/flat_map.h"
+#include "flare/base/errno.h"
+#include "flare/rpc/socket.h"
+#include "flare/rpc/policy/maglev_load_balancer.h"
+#include "flare/rpc/policy/hasher.h"
+#include "flare/strings/numbers.h"
+#include "flare/strings/string_splitter.h"
+
+namespace flare::rpc {
+    namespace policy {
+
+        DEFINE_int32(maglev_table_size, 65537,
+                     "default number of slots in lookup table of c_maglev and c_jump, "
+                     "rounded up to a prime. Should be much larger than number of "
+                     "servers to keep loads even");
+
+        static const uint32_t EMPTY_SLOT = (uint32_t) -1;
+
+        static bool IsPrime(uint32_t n) {
+            if (n < 2) {
+                return false;
+            }
+            for (uint32_t i = 2; (uint64_t) i * i <= n; ++i) {
+                if (n % i == 0) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        static uint32_t NextPrime(uint32_t n) {
+            while (!IsPrime(n)) {
+                ++n;
+            }
+            return n;
+        }
+
+        // "A Fast, Minimal Memory, Consistent Hash Algorithm", Lamping & Veach.
+        static uint32_t JumpConsistentHash(uint64_t key, uint32_t num_buckets) {
+            int64_t b = -1;
+            int64_t j = 0;
+            while (j < num_buckets) {
+                b = j;
+                key = key * 2862933555777941757ULL + 1;
+                j = (int64_t) ((b + 1) * ((double) (1LL << 31) / (double) ((key >> 33) + 1)));
+            }
+            return (uint32_t) b;
+        }
+
+        // Spread slot indexes which are consecutive.
+        static uint64_t Fmix64(uint64_t k) {
+            k ^= k >> 33;
+            k *= 0xff51afd7ed558ccdULL;
+            k ^= k >> 33;
+            k *= 0xc4ceb9fe1a85ec53ULL;
+            k ^= k >> 33;
+            return k;
+        }
+
+        static bool BuildServer(const ServerId &id, MaglevLoadBalancer::Server *server) {
+            SocketUniquePtr ptr;
+            if (Socket::AddressFailedAsWell(id.id, &ptr) == -1) {
+                return false;
+            }
+            const flare::base::end_point_str addr = endpoint2str(ptr->remote_side());
+            const size_t len = strlen(addr.c_str());
+            server->id = id;
+            server->addr = ptr->remote_side();
+            server->offset_hash = MurmurHash32(addr.c_str(), len);
+            server->skip_hash = MD5Hash32(addr.c_str(), len);
+            return true;
+        }
+
+        MaglevLoadBalancer::MaglevLoadBalancer(MaglevLoadBalancerType type)
+                : _type(type)
+                , _table_size(NextPrime(std::max(FLAGS_maglev_table_size, 2))) {
+        }
+
+        void MaglevLoadBalancer::BuildSlots(Table &t) const {
+            const uint32_t n = t.servers.size();
+            if (n == 0) {
+                t.slots.clear();
+                return;
+            }
+            const uint32_t m = _table_size;
+            t.slots.assign(m, EMPTY_SLOT);
+            if (_type == MAGLEV_LB_JUMP) {
+                for (uint32_t i = 0; i < m; ++i) {
+                    t.slots[i] = JumpConsistentHash(Fmix64(i), n);
+                }
+                return;
+            }
+            // Servers take turns to claim the next free slot in their own
+            // permutations until all slots are claimed, so that every server
+            // owns m/n slots (+1) and a change of one server rarely moves
+            // slots between other servers.
+            std::vector<uint32_t> next(n);
+            std::vector<uint32_t> skip(n);
+            for (uint32_t i = 0; i < n; ++i) {
+                next[i] = t.servers[i].offset_hash % m;
+                skip[i] = t.servers[i].skip_hash % (m - 1) + 1;
+            }
+            uint32_t filled = 0;
+            while (true) {
+                for (uint32_t i = 0; i < n; ++i) {
+                    uint32_t c = next[i];
+                    while (t.slots[c] != EMPTY_SLOT) {
+                        c += skip[i];
+                        if (c >= m) {
+                            c -= m;
+                        }
+                    }
+                    t.slots[c] = i;
+                    c += skip[i];
+                    next[i] = (c >= m ? c - m : c);
+                    if (++filled == m) {
+                        return;
+                    }
+                }
+            }
+        }
+
+        size_t MaglevLoadBalancer::AddBatch(
+                Table &bg, const Table &fg,
+                const std::vector<Server> &servers, bool *executed) const {
+            if (*executed) {
+                // Hack DBD: background is rebuilt from foreground next time,
+                // don't build the table twice.
+                return fg.servers.size() - bg.servers.size();
+            }
+            *executed = true;
+            bg.servers.resize(fg.servers.size() + servers.size());
+            bg.servers.resize(std::set_union(fg.servers.begin(), fg.servers.end(),
+                                             servers.begin(), servers.end(),
+                                             bg.servers.begin())
+                              - bg.servers.begin());
+            const size_t n = bg.servers.size() - fg.servers.size();
+            if (n != 0) {
+                BuildSlots(bg);
+            }
+            return n;
+        }
+
+        size_t MaglevLoadBalancer::RemoveBatch(
+                Table &bg, const Table &fg,
+                const std::vector<ServerId> &servers, bool *executed) const {
+            if (*executed) {
+                return bg.servers.size() - fg.servers.size();
+            }
+            *executed = true;
+            if (servers.empty()) {
+                bg.servers = fg.servers;
+                return 0;
+            }
+            flare::container::FlatSet<ServerId> id_set;
+            FLARE_CHECK_EQ(0, id_set.init(servers.size() * 2));
+            for (size_t i = 0; i < servers.size(); ++i) {
+                FLARE_CHECK(id_set.insert(servers[i]) != NULL)
+                        << "Fail to construct id_set, " << flare_error();
+            }
+            bg.servers.clear();
+            for (size_t i = 0; i < fg.servers.size(); ++i) {
+                if (id_set.seek(fg.servers[i].id) == NULL) {
+                    bg.servers.push_back(fg.servers[i]);
+                }
+            }
+            const size_t n = fg.servers.size() - bg.servers.size();
+            if (n != 0) {
+                BuildSlots(bg);
+            }
+            return n;
+        }
+
+        bool MaglevLoadBalancer::AddServer(const ServerId &id) {
+            return AddServersInBatch(std::vector<ServerId>(1, id)) == 1;
+        }
+
+        size_t MaglevLoadBalancer::AddServersInBatch(
+                const std::vector<ServerId> &servers) {
+            // Hash new servers only, outside DBD.
+            std::vector<Server> add_servers;
+            add_servers.reserve(servers.size());
+            for (size_t i = 0; i < servers.size(); ++i) {
+                Server server;
+                if (BuildServer(servers[i], &server)) {
+                    add_servers.push_back(server);
+                }
+            }
+            std::sort(add_servers.begin(), add_servers.end());
+            bool executed = false;
+            auto fn = [this](Table &bg, const Table &fg,
+                             const std::vector<Server> &add, bool *executed) {
+                return AddBatch(bg, fg, add, executed);
+            };
+            const size_t n = _db_table.ModifyWithForeground(fn, add_servers, &executed);
+            FLARE_LOG_IF(ERROR, servers.size() > 1 && n != servers.size())
+                            << "Fail to AddServersInBatch, expected " << servers.size()
+                            << " actually " << n;
+            return n;
+        }
+
+        bool MaglevLoadBalancer::RemoveServer(const ServerId &id) {
+            return RemoveServersInBatch(std::vector<ServerId>(1, id)) == 1;
+        }
+
+        size_t MaglevLoadBalancer::RemoveServersInBatch(
+                const std::vector<ServerId> &servers) {
+            bool executed = false;
+            auto fn = [this](Table &bg, const Table &fg,
+                             const std::vector<ServerId> &remove, bool *executed) {
+                return RemoveBatch(bg, fg, remove, executed);
+            };
+            const size_t n = _db_table.ModifyWithForeground(fn, servers, &executed);
+            FLARE_LOG_IF(ERROR, servers.size() > 1 && n != servers.size())
+                            << "Fail to RemoveServersInBatch, expected " << servers.size()
+                            << " actually " << n;
+            return n;
+        }
+
+        LoadBalancer *MaglevLoadBalancer::New(const std::string_view &params) const {
+            MaglevLoadBalancer *lb = new(std::nothrow) MaglevLoadBalancer(_type);
+            if (lb && !lb->SetParameters(params)) {
+                delete lb;
+                lb = nullptr;
+            }
+            return lb;
+        }
+
+        void MaglevLoadBalancer::Destroy() {
+            delete this;
+        }
+
+        int MaglevLoadBalancer::SelectServer(const SelectIn &in, SelectOut *out) {
+            if (!in.has_request_code) {
+                FLARE_LOG(ERROR) << "Controller.set_request_code() is required";
+                return EINVAL;
+            }
+            flare::container::DoublyBufferedData<Table>::ScopedPtr s;
+            if (_db_table.Read(&s) != 0) {
+                return ENOMEM;
+            }
+            const size_t n = s->servers.size();
+            if (n == 0) {
+                return ENODATA;
+            }
+            const size_t m = s->slots.size();
+            size_t slot = in.request_code % m;
+            uint32_t last = EMPTY_SLOT;
+            size_t ntried = 0;
+            // Fall back to servers of following slots, which are the same
+            // for all clients.
+            for (size_t i = 0; i < m && ntried < n; ++i) {
+                const uint32_t index = s->slots[slot];
+                if (++slot == m) {
+                    slot = 0;
+                }
+                if (index == last) {
+                    continue;
+                }
+                last = index;
+                ++ntried;
+                const Server &server = s->servers[index];
+                if ((ntried == n // always take last chance
+                     || !ExcludedServers::IsExcluded(in.excluded, server.id.id))
+                    && Socket::Address(server.id.id, out->ptr) == 0
+                    && (*out->ptr)->IsAvailable()) {
+                    return 0;
+                }
+            }
+            return EHOSTDOWN;
+        }
+
+        void MaglevLoadBalancer::Describe(
+                std::ostream &os, const DescribeOptions &options) {
+            if (!options.verbose) {
+                os << (_type == MAGLEV_LB_JUMP ? "c_jump" : "c_maglev");
+                return;
+            }
+            os << "MaglevLoadBalancer {\n"
+               << "  population: " << (_type == MAGLEV_LB_JUMP ? "jump" : "permutation") << '\n'
+               << "  table size: " << _table_size << '\n';
+            flare::container::DoublyBufferedData<Table>::ScopedPtr s;
+            if (_db_table.Read(&s) == 0 && !s->servers.empty()) {
+                std::vector<uint32_t> counts(s->servers.size());
+                for (size_t i = 0; i < s->slots.size(); ++i) {
+                    ++counts[s->slots[i]];
+                }
+                os << "  number of hosts: " << s->servers.size() << '\n'
+                   << "  min slots per host: " << *std::min_element(counts.begin(), counts.end()) << '\n'
+                   << "  max slots per host: " << *std::max_element(counts.begin(), counts.end()) << '\n';
+            }
+            os << "}\n";
+        }
+
+        bool MaglevLoadBalancer::SetParameters(const std::string_view &params) {
+            for (flare::KeyValuePairsSplitter sp(params.begin(), params.end(), ' ', '=');
+                 sp; ++sp) {
+                if (sp.value().empty()) {
+                    FLARE_LOG(ERROR) << "Empty value for " << sp.key() << " in lb parameter";
+                    return false;
+                }
+                if (sp.key() == "table_size") {
+                    int64_t size;
+                    if (!flare::simple_atoi(sp.value(), &size) || size < 2 || size > INT32_MAX) {
+                        return false;
+                    }
+                    _table_size = NextPrime(size);
+                    continue;
+                }
+                FLARE_LOG(ERROR) << "Failed to set this unknown parameters " << sp.key_and_value();
+            }
+            return true;
+        }
+
+    }  // namespace policy
+} // namespace flare::rpc
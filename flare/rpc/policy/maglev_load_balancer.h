@@ -0,0 +1,109 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#ifndef  FLARE_RPC_MAGLEV_LOAD_BALANCER_H_
+#define  FLARE_RPC_MAGLEV_LOAD_BALANCER_H_
+
+#include <stdint.h>                                     // uint32_t
+#include <vector>                                       // std::vector
+#include "flare/base/endpoint.h"                        // flare::base::end_point
+#include "flare/container/doubly_buffered_data.h"
+#include "flare/rpc/load_balancer.h"
+
+
+namespace flare::rpc {
+    namespace policy {
+
+        enum MaglevLoadBalancerType {
+            // Slots are populated by permutations of servers, as described
+            // in "Maglev: A Fast and Reliable Software Network Load Balancer".
+            MAGLEV_LB_PERMUTATION = 0,
+            // Slots are mapped to servers sorted by address with jump
+            // consistent hash. Removing a server in the middle remaps more
+            // keys than MAGLEV_LB_PERMUTATION.
+            MAGLEV_LB_JUMP = 1,
+        };
+
+        // Consistent hashing with a lookup table indexed by request_code, which
+        // makes SelectServer() O(1) regardless of number of servers. The table
+        // is rebuilt in background buffer of DoublyBufferedData when servers
+        // change, from hashes of servers computed when they were added.
+        // The whole table is rebuilt (O(table size), once per batch) instead
+        // of patching the previous one, so that it only depends on the set of
+        // servers and all clients map a key to the same server regardless of
+        // the order they saw the changes in.
+        class MaglevLoadBalancer : public LoadBalancer {
+        public:
+            struct Server {
+                ServerId id;
+                flare::base::end_point addr;
+                uint32_t offset_hash;   // Where the permutation begins
+                uint32_t skip_hash;     // Step of the permutation
+
+                // Sorted by address to make tables same among all clients.
+                bool operator<(const Server &rhs) const {
+                    if (addr < rhs.addr) { return true; }
+                    if (rhs.addr < addr) { return false; }
+                    return id < rhs.id;
+                }
+            };
+
+            struct Table {
+                std::vector<Server> servers;
+                std::vector<uint32_t> slots;    // Index of servers
+            };
+
+            explicit MaglevLoadBalancer(MaglevLoadBalancerType type);
+
+            bool AddServer(const ServerId &server);
+
+            bool RemoveServer(const ServerId &server);
+
+            size_t AddServersInBatch(const std::vector<ServerId> &servers);
+
+            size_t RemoveServersInBatch(const std::vector<ServerId> &servers);
+
+            LoadBalancer *New(const std::string_view &params) const;
+
+            void Destroy();
+
+            int SelectServer(const SelectIn &in, SelectOut *out);
+
+            void Describe(std::ostream &os, const DescribeOptions &options);
+
+        private:
+            bool SetParameters(const std::string_view &params);
+
+            void BuildSlots(Table &t) const;
+
+            size_t AddBatch(Table &bg, const Table &fg,
+                            const std::vector<Server> &servers, bool *executed) const;
+
+            size_t RemoveBatch(Table &bg, const Table &fg,
+                               const std::vector<ServerId> &servers, bool *executed) const;
+
+            MaglevLoadBalancerType _type;
+            uint32_t _table_size;
+            flare::container::DoublyBufferedData<Table> _db_table;
+        };
+
+    }  // namespace policy
+} // namespace flare::rpc
+
+
+#endif  // FLARE_RPC_MAGLEV_LOAD_BALANCER_H_
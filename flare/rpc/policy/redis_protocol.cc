@@ -44,6 +44,10 @@ namespace flare::rpc {
         DEFINE_bool(redis_verbose, false,
                     "[DEBUG] Print EVERY redis request/response");
 
+        DEFINE_int32(redis_bulk_string_ref_min_size, 0,
+                     "Bulk strings in redis replies not shorter than this reference "
+                     "the input buffer instead of being copied, 0 to copy all");
+
         struct InputResponse : public InputMessageBase {
             fiber_token_t id_wait;
             RedisResponse response;
@@ -74,10 +78,17 @@ namespace flare::rpc {
 
             RedisCommandParser parser;
             flare::Arena arena;
+            // Commands parsed from the input, reused between reads.
+            std::vector<std::vector<std::string_view> > commands;
+            // Commands being run by RedisCommandHandler::RunBatch().
+            std::vector<std::vector<std::string_view> > batch;
         };
 
+        // `ch' is the handler of `args', NULL if the command is unknown. It's
+        // not used when a transaction is in progress.
         int ConsumeCommand(RedisConnContext *ctx,
                            const std::vector<std::string_view> &args,
+                           RedisCommandHandler *ch,
                            bool flush_batched,
                            flare::cord_buf_appender *appender) {
             RedisReply output(&ctx->arena);
@@ -91,7 +102,6 @@ namespace flare::rpc {
                     return -1;
                 }
             } else {
-                RedisCommandHandler *ch = ctx->redis_service->FindCommandHandler(args[0]);
                 if (!ch) {
                     char buf[64];
                     snprintf(buf, sizeof(buf), "ERR unknown command `%s`", flare::as_string(args[0]).c_str());
@@ -134,6 +144,75 @@ namespace flare::rpc {
             return 0;
         }
 
+        // Runs first `ncommand' commands of ctx->commands in order. Consecutive
+        // commands of a handler supporting batches are passed to
+        // RedisCommandHandler::RunBatch() together, unless a transaction or
+        // batched commands are in progress. Handler of each command is looked
+        // up once.
+        int ConsumeCommands(RedisConnContext *ctx, size_t ncommand,
+                            flare::cord_buf_appender *appender) {
+            std::vector<std::vector<std::string_view> > &commands = ctx->commands;
+            const RedisService *rs = ctx->redis_service;
+            // Handler of commands[i], valid if has_next_ch is true.
+            RedisCommandHandler *next_ch = NULL;
+            bool has_next_ch = false;
+            size_t i = 0;
+            while (i < ncommand) {
+                if (ctx->transaction_handler) {
+                    // The transaction handler runs the command, the handler of
+                    // the command is not needed.
+                    if (ConsumeCommand(ctx, commands[i], NULL, i + 1 == ncommand/*flush_batched*/,
+                                       appender) != 0) {
+                        return -1;
+                    }
+                    has_next_ch = false;
+                    ++i;
+                    continue;
+                }
+                RedisCommandHandler *ch = (has_next_ch ? next_ch :
+                        rs->FindCommandHandler(commands[i][0]));
+                has_next_ch = false;
+                size_t end = i + 1;
+                if (ch != NULL && ctx->batched_size == 0 && ch->SupportsBatch()) {
+                    for (; end < ncommand; ++end) {
+                        next_ch = rs->FindCommandHandler(commands[end][0]);
+                        if (next_ch != ch) {
+                            has_next_ch = true;
+                            break;
+                        }
+                    }
+                    if (end - i > 1) {
+                        ctx->batch.resize(end - i);
+                        for (size_t j = i; j < end; ++j) {
+                            ctx->batch[j - i].swap(commands[j]);
+                        }
+                        RedisReply output(&ctx->arena);
+                        output.SetArray(end - i);
+                        const bool handled = ch->RunBatch(ctx->batch, &output);
+                        for (size_t j = i; j < end; ++j) {
+                            ctx->batch[j - i].swap(commands[j]);
+                        }
+                        if (handled) {
+                            for (size_t j = 0; j < end - i; ++j) {
+                                output[j].SerializeTo(appender);
+                            }
+                            i = end;
+                            continue;
+                        }
+                    }
+                }
+                for (; i < end; ++i) {
+                    // A transaction may start in the middle of the run, its
+                    // handler takes the following commands in ConsumeCommand.
+                    if (ConsumeCommand(ctx, commands[i], ch, i + 1 == ncommand/*flush_batched*/,
+                                       appender) != 0) {
+                        return -1;
+                    }
+                }
+            }
+            return 0;
+        }
+
         // ========== impl of RedisConnContext ==========
 
         RedisConnContext::~RedisConnContext() {}
@@ -160,27 +239,25 @@ namespace flare::rpc {
                     ctx = new RedisConnContext(rs);
                     socket->reset_parsing_context(ctx);
                 }
-                std::vector<std::string_view> current_args;
-                flare::cord_buf_appender appender;
+                // Parse all commands in `source' first, so that they can be run
+                // in batches and replies are sent in one write.
                 ParseError err = PARSE_OK;
-
-                err = ctx->parser.Consume(*source, &current_args, &ctx->arena);
-                if (err != PARSE_OK) {
-                    return MakeParseError(err);
-                }
+                size_t ncommand = 0;
                 while (true) {
-                    std::vector<std::string_view> next_args;
-                    err = ctx->parser.Consume(*source, &next_args, &ctx->arena);
+                    if (ncommand == ctx->commands.size()) {
+                        ctx->commands.resize(ncommand + 1);
+                    }
+                    err = ctx->parser.Consume(*source, &ctx->commands[ncommand], &ctx->arena);
                     if (err != PARSE_OK) {
                         break;
                     }
-                    if (ConsumeCommand(ctx, current_args, false, &appender) != 0) {
-                        return MakeParseError(PARSE_ERROR_ABSOLUTELY_WRONG);
-                    }
-                    current_args.swap(next_args);
+                    ++ncommand;
                 }
-                if (ConsumeCommand(ctx, current_args,
-                                   true /*must be the last message*/, &appender) != 0) {
+                if (ncommand == 0) {
+                    return MakeParseError(err);
+                }
+                flare::cord_buf_appender appender;
+                if (ConsumeCommands(ctx, ncommand, &appender) != 0) {
                     return MakeParseError(PARSE_ERROR_ABSOLUTELY_WRONG);
                 }
                 flare::cord_buf sendbuf;
@@ -212,6 +289,10 @@ namespace flare::rpc {
                     InputResponse *msg = static_cast<InputResponse *>(socket->parsing_context());
                     if (msg == NULL) {
                         msg = new InputResponse;
+                        if (FLAGS_redis_bulk_string_ref_min_size > 0) {
+                            msg->response.set_bulk_string_ref_min_size(
+                                    FLAGS_redis_bulk_string_ref_min_size);
+                        }
                         socket->reset_parsing_context(msg);
                     }
 
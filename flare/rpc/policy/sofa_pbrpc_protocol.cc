@@ -78,6 +78,9 @@ namespace flare::rpc {
                 case COMPRESS_TYPE_LZ4:
                     FLARE_LOG(ERROR) << "sofa-pbrpc does not support LZ4";
                     return SOFA_COMPRESS_TYPE_NONE;
+                case COMPRESS_TYPE_ZSTD:
+                    FLARE_LOG(ERROR) << "sofa-pbrpc does not support ZSTD";
+                    return SOFA_COMPRESS_TYPE_NONE;
                 default:
                     FLARE_LOG(ERROR) << "Unknown SofaCompressType=" << type;
                     return SOFA_COMPRESS_TYPE_NONE;
@@ -0,0 +1,218 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include <gflags/gflags.h>
+#include "flare/rpc/policy/zstd_compress.h"
+
+#ifdef FLARE_WITH_ZSTD
+
+#include <pthread.h>
+#include <zstd.h>
+#include "flare/files/sequential_read_file.h"
+#include "flare/log/logging.h"
+#include "flare/rpc/protocol.h"
+
+
+namespace flare::rpc {
+    namespace policy {
+
+        DEFINE_int32(zstd_compression_level, 3,
+                     "Compression level of zstd, from 1 (fastest) to 19, "
+                     "negative values for the ultra-fast modes");
+
+        DEFINE_string(zstd_dictionary_path, "",
+                      "Path of a dictionary trained by `zstd --train', "
+                      "clients and servers must use the same dictionary");
+
+        static ZSTD_CDict *g_cdict = NULL;
+        static ZSTD_DDict *g_ddict = NULL;
+        static pthread_once_t g_dict_once = PTHREAD_ONCE_INIT;
+
+        static void LoadDictionary() {
+            if (FLAGS_zstd_dictionary_path.empty()) {
+                return;
+            }
+            flare::sequential_read_file file;
+            std::string content;
+            flare::result_status rs = file.open(FLAGS_zstd_dictionary_path);
+            if (rs.is_ok()) {
+                rs = file.read(&content);
+            }
+            if (!rs.is_ok()) {
+                FLARE_LOG(ERROR) << "Fail to read zstd dictionary from "
+                                 << FLAGS_zstd_dictionary_path << ": " << rs.error_str();
+                return;
+            }
+            g_cdict = ZSTD_createCDict(content.data(), content.size(),
+                                       FLAGS_zstd_compression_level);
+            g_ddict = ZSTD_createDDict(content.data(), content.size());
+            if (g_cdict == NULL || g_ddict == NULL) {
+                FLARE_LOG(ERROR) << "Invalid zstd dictionary " << FLAGS_zstd_dictionary_path;
+                ZSTD_freeCDict(g_cdict);
+                ZSTD_freeDDict(g_ddict);
+                g_cdict = NULL;
+                g_ddict = NULL;
+            }
+        }
+
+        struct ZstdContexts {
+            ZSTD_CCtx *cctx = NULL;
+            ZSTD_DCtx *dctx = NULL;
+
+            ~ZstdContexts() {
+                ZSTD_freeCCtx(cctx);
+                ZSTD_freeDCtx(dctx);
+            }
+        };
+
+        // Contexts are reused by all calls in the same thread.
+        static ZstdContexts *GetZstdContexts() {
+            pthread_once(&g_dict_once, LoadDictionary);
+            static thread_local ZstdContexts ctxs;
+            if (ctxs.cctx == NULL) {
+                ctxs.cctx = ZSTD_createCCtx();
+            }
+            if (ctxs.dctx == NULL) {
+                ctxs.dctx = ZSTD_createDCtx();
+            }
+            if (ctxs.cctx == NULL || ctxs.dctx == NULL) {
+                return NULL;
+            }
+            return &ctxs;
+        }
+
+        bool ZstdCompress(const flare::cord_buf &in, flare::cord_buf *out) {
+            ZstdContexts *ctxs = GetZstdContexts();
+            if (ctxs == NULL) {
+                FLARE_LOG(WARNING) << "Fail to create zstd contexts";
+                return false;
+            }
+            ZSTD_CCtx *cctx = ctxs->cctx;
+            ZSTD_CCtx_reset(cctx, ZSTD_reset_session_only);
+            if (g_cdict) {
+                ZSTD_CCtx_refCDict(cctx, g_cdict);
+            } else {
+                ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel,
+                                       FLAGS_zstd_compression_level);
+            }
+            ZSTD_CCtx_setPledgedSrcSize(cctx, in.size());
+            // Blocks of `in' are fed directly and the output is written into
+            // blocks of `out', nothing is flattened.
+            flare::cord_buf_as_zero_copy_output_stream wrapper(out);
+            const size_t nblock = in.backing_block_num();
+            size_t rc = 0;
+            for (size_t i = 0; i <= nblock; ++i) {
+                // An extra round with empty input ends the frame.
+                const bool last = (i == nblock);
+                const std::string_view block = last ? std::string_view() : in.backing_block(i);
+                ZSTD_inBuffer input = {block.data(), block.size(), 0};
+                do {
+                    void *dst = NULL;
+                    int dst_size = 0;
+                    if (!wrapper.Next(&dst, &dst_size)) {
+                        return false;
+                    }
+                    ZSTD_outBuffer output = {dst, (size_t) dst_size, 0};
+                    rc = ZSTD_compressStream2(cctx, &output, &input,
+                                              last ? ZSTD_e_end : ZSTD_e_continue);
+                    wrapper.BackUp(dst_size - (int) output.pos);
+                    if (ZSTD_isError(rc)) {
+                        FLARE_LOG(WARNING) << "Fail to ZSTD_compressStream2: "
+                                           << ZSTD_getErrorName(rc);
+                        return false;
+                    }
+                } while (input.pos < input.size || (last && rc != 0));
+            }
+            return true;
+        }
+
+        bool ZstdDecompress(const flare::cord_buf &in, flare::cord_buf *out) {
+            ZstdContexts *ctxs = GetZstdContexts();
+            if (ctxs == NULL) {
+                FLARE_LOG(WARNING) << "Fail to create zstd contexts";
+                return false;
+            }
+            ZSTD_DCtx *dctx = ctxs->dctx;
+            ZSTD_DCtx_reset(dctx, ZSTD_reset_session_only);
+            ZSTD_DCtx_refDDict(dctx, g_ddict);
+            flare::cord_buf_as_zero_copy_output_stream wrapper(out);
+            size_t rc = 1;
+            size_t consumed = 0;
+            const size_t nblock = in.backing_block_num();
+            for (size_t i = 0; i < nblock && rc != 0; ++i) {
+                const std::string_view block = in.backing_block(i);
+                ZSTD_inBuffer input = {block.data(), block.size(), 0};
+                bool full = false;
+                while (input.pos < input.size || full) {
+                    void *dst = NULL;
+                    int dst_size = 0;
+                    if (!wrapper.Next(&dst, &dst_size)) {
+                        return false;
+                    }
+                    ZSTD_outBuffer output = {dst, (size_t) dst_size, 0};
+                    rc = ZSTD_decompressStream(dctx, &output, &input);
+                    wrapper.BackUp(dst_size - (int) output.pos);
+                    if (ZSTD_isError(rc)) {
+                        FLARE_LOG(WARNING) << "Fail to ZSTD_decompressStream: "
+                                           << ZSTD_getErrorName(rc);
+                        return false;
+                    }
+                    // More output may be buffered inside zstd.
+                    full = (output.pos == output.size);
+                    if (rc == 0) {
+                        // End of the frame, fully flushed. Following bytes
+                        // would be decoded as another frame otherwise.
+                        break;
+                    }
+                }
+                consumed += input.pos;
+            }
+            if (rc != 0) {
+                FLARE_LOG(WARNING) << "Truncated zstd frame, size=" << in.size();
+                return false;
+            }
+            if (consumed != in.size()) {
+                FLARE_LOG(WARNING) << "Trailing " << in.size() - consumed
+                                   << " bytes after zstd frame, size=" << in.size();
+                return false;
+            }
+            return true;
+        }
+
+        bool ZstdCompress(const google::protobuf::Message &msg, flare::cord_buf *buf) {
+            flare::cord_buf serialized_pb;
+            flare::cord_buf_as_zero_copy_output_stream wrapper(&serialized_pb);
+            if (!msg.SerializeToZeroCopyStream(&wrapper)) {
+                FLARE_LOG(WARNING) << "Fail to serialize input pb=" << &msg;
+                return false;
+            }
+            return ZstdCompress(serialized_pb, buf);
+        }
+
+        bool ZstdDecompress(const flare::cord_buf &data, google::protobuf::Message *msg) {
+            flare::cord_buf binary_pb;
+            if (!ZstdDecompress(data, &binary_pb)) {
+                return false;
+            }
+            return ParsePbFromCordBuf(msg, binary_pb);
+        }
+
+    }  // namespace policy
+} // namespace flare::rpc
+
+#endif  // FLARE_WITH_ZSTD
@@ -283,6 +283,7 @@ namespace flare::rpc {
         _first_reply.Reset();
         _other_replies = nullptr;
         _arena.clear();
+        _bulk_strings.bufs.clear();
         _nreply = 0;
         _cached_size_ = 0;
     }
@@ -370,6 +371,7 @@ namespace flare::rpc {
             _first_reply.Swap(other->_first_reply);
             std::swap(_other_replies, other->_other_replies);
             _arena.swap(other->_arena);
+            _bulk_strings.bufs.swap(other->_bulk_strings.bufs);
             std::swap(_nreply, other->_nreply);
             std::swap(_cached_size_, other->_cached_size_);
         }
@@ -389,9 +391,10 @@ namespace flare::rpc {
 // ===================================================================
 
     ParseError RedisResponse::ConsumePartialCordBuf(flare::cord_buf &buf, int reply_count) {
+        RedisBulkStringRefs *refs = (_bulk_strings.min_size != 0 ? &_bulk_strings : NULL);
         size_t oldsize = buf.size();
         if (reply_size() == 0) {
-            ParseError err = _first_reply.ConsumePartialCordBuf(buf);
+            ParseError err = _first_reply.ConsumePartialCordBuf(buf, refs);
             if (err != PARSE_OK) {
                 return err;
             }
@@ -413,7 +416,7 @@ namespace flare::rpc {
                 }
             }
             for (int i = reply_size(); i < reply_count; ++i) {
-                ParseError err = _other_replies[i - 1].ConsumePartialCordBuf(buf);
+                ParseError err = _other_replies[i - 1].ConsumePartialCordBuf(buf, refs);
                 if (err != PARSE_OK) {
                     return err;
                 }
@@ -463,6 +466,15 @@ namespace flare::rpc {
         return nullptr;
     }
 
+    bool RedisCommandHandler::SupportsBatch() const {
+        return false;
+    }
+
+    bool RedisCommandHandler::RunBatch(const std::vector<std::vector<std::string_view> > &,
+                                       RedisReply *) {
+        return false;
+    }
+
     RedisCommandHandler *RedisCommandHandler::NewTransactionHandler() {
         FLARE_LOG(ERROR) << "NewTransactionHandler is not implemented";
         return nullptr;
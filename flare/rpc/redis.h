@@ -198,6 +198,14 @@ namespace flare::rpc {
         // Returns PARSE_ERROR_ABSOLUTELY_WRONG if the parsing failed.
         ParseError ConsumePartialCordBuf(flare::cord_buf &buf, int reply_count);
 
+        // Bulk strings not shorter than `min_size' in replies parsed afterwards
+        // reference blocks of the input instead of being copied, which saves
+        // copying of large values. Use RedisReply::append_to() to get them
+        // without copying. 0 (the default) copies all strings.
+        void set_bulk_string_ref_min_size(size_t min_size) {
+            _bulk_strings.min_size = min_size;
+        }
+
         // implements Message ----------------------------------------------
 
         RedisResponse *New() const;
@@ -243,6 +251,7 @@ namespace flare::rpc {
         RedisReply _first_reply;
         RedisReply *_other_replies;
         flare::Arena _arena;
+        RedisBulkStringRefs _bulk_strings;
         int _nreply;
         mutable int _cached_size_;
     };
@@ -303,6 +312,23 @@ namespace flare::rpc {
                                               flare::rpc::RedisReply *output,
                                               bool flush_batched) = 0;
 
+        // Returns true to have consecutive commands of this handler passed to
+        // RunBatch(). The default returns false, commands of such a handler are
+        // passed to Run() one by one without being grouped.
+        virtual bool SupportsBatch() const;
+
+        // If SupportsBatch() is true, consecutive commands of this handler which
+        // are received together, e.g. pipelined by a client, are passed to this
+        // method in one call before calling Run(), unless a transaction or
+        // batched commands are in progress. `output' is an array with as many
+        // elements as `commands', set output[i] to the reply of commands[i].
+        // Replies are allocated on an arena cleared after replies of all the
+        // commands received together are sent in one write.
+        // Returns true if the commands are handled, false to call Run() for
+        // each of them, which is what the default implementation does.
+        virtual bool RunBatch(const std::vector<std::vector<std::string_view> > &commands,
+                              flare::rpc::RedisReply *output);
+
         // The Run() returns CONTINUE for "multi", which makes flare call this method to
         // create a transaction_handler to process following commands until transaction_handler
         // returns OK. For example, for command "multi; set k1 v1; set k2 v2; set k3 v3;
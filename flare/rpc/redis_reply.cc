@@ -54,7 +54,7 @@ namespace flare::rpc {
                 if (_length < (int) sizeof(_data.short_str)) {
                     appender->append(_data.short_str, _length);
                 } else {
-                    appender->append(_data.long_str, _length);
+                    appender->append(long_str(), _length);
                 }
                 appender->append("\r\n", 2);
                 return true;
@@ -71,7 +71,7 @@ namespace flare::rpc {
                     if (_length < (int) sizeof(_data.short_str)) {
                         appender->append(_data.short_str, _length);
                     } else {
-                        appender->append(_data.long_str, _length);
+                        appender->append(long_str(), _length);
                     }
                     appender->append("\r\n", 2);
                 }
@@ -97,12 +97,16 @@ namespace flare::rpc {
     }
 
     ParseError RedisReply::ConsumePartialCordBuf(flare::cord_buf &buf) {
+        return ConsumePartialCordBuf(buf, NULL);
+    }
+
+    ParseError RedisReply::ConsumePartialCordBuf(flare::cord_buf &buf, RedisBulkStringRefs *refs) {
         if (_type == REDIS_REPLY_ARRAY && _data.array.last_index >= 0) {
             // The parsing was suspended while parsing sub replies,
             // continue the parsing.
             RedisReply *subs = (RedisReply *) _data.array.replies;
             for (int i = _data.array.last_index; i < _length; ++i) {
-                ParseError err = subs[i].ConsumePartialCordBuf(buf);
+                ParseError err = subs[i].ConsumePartialCordBuf(buf, refs);
                 if (err != PARSE_OK) {
                     return err;
                 }
@@ -149,6 +153,7 @@ namespace flare::rpc {
                 _type = (fc == '-' ? REDIS_REPLY_ERROR : REDIS_REPLY_STATUS);
                 _length = len;
                 _data.long_str = d;
+                _data.ref.buf = NULL;
                 return PARSE_OK;
             }
             case '$':   // Bulk String   "$<length>\r\n<string>\r\n"
@@ -199,6 +204,17 @@ namespace flare::rpc {
                         buf.pop_front(crlf_pos + 2);
                         buf.cutn(_data.short_str, len);
                         _data.short_str[len] = '\0';
+                    } else if (refs != NULL && refs->min_size != 0 &&
+                               (size_t) len >= refs->min_size) {
+                        // Reference blocks of `buf' instead of copying, the
+                        // string is copied when data() or c_str() is called.
+                        buf.pop_front(crlf_pos + 2/*CRLF*/);
+                        refs->bufs.emplace_back();
+                        buf.cutn(&refs->bufs.back(), len);
+                        _type = REDIS_REPLY_STRING;
+                        _length = len;
+                        _data.ref.str = NULL;
+                        _data.ref.buf = &refs->bufs.back();
                     } else {
                         char *d = (char *) _arena->allocate((len / 8 + 1) * 8);
                         if (d == NULL) {
@@ -211,6 +227,7 @@ namespace flare::rpc {
                         _type = REDIS_REPLY_STRING;
                         _length = len;
                         _data.long_str = d;
+                        _data.ref.buf = NULL;
                     }
                     char crlf[2];
                     buf.cutn(crlf, sizeof(crlf));
@@ -259,7 +276,7 @@ namespace flare::rpc {
                     // be continued in next calls by tracking _data.array.last_index.
                     _data.array.last_index = 0;
                     for (int64_t i = 0; i < count; ++i) {
-                        ParseError err = subs[i].ConsumePartialCordBuf(buf);
+                        ParseError err = subs[i].ConsumePartialCordBuf(buf, refs);
                         if (err != PARSE_OK) {
                             return err;
                         }
@@ -329,7 +346,7 @@ namespace flare::rpc {
                 if (_length < (int) sizeof(_data.short_str)) {
                     os << RedisStringPrinter(_data.short_str, _length);
                 } else {
-                    os << RedisStringPrinter(_data.long_str, _length);
+                    os << RedisStringPrinter(long_str(), _length);
                 }
                 os << '"';
                 break;
@@ -356,7 +373,7 @@ namespace flare::rpc {
                 if (_length < (int) sizeof(_data.short_str)) {
                     os << RedisStringPrinter(_data.short_str, _length);
                 } else {
-                    os << RedisStringPrinter(_data.long_str, _length);
+                    os << RedisStringPrinter(long_str(), _length);
                 }
                 break;
             default:
@@ -410,13 +427,50 @@ namespace flare::rpc {
                         FLARE_LOG(FATAL) << "Fail to allocate string[" << _length << "]";
                         return;
                     }
-                    memcpy(d, other._data.long_str, _length + 1);
+                    if (other._data.ref.buf != NULL) {
+                        other._data.ref.buf->copy_to_cstr(d, _length);
+                    } else {
+                        memcpy(d, other._data.long_str, _length + 1);
+                    }
                     _data.long_str = d;
+                    _data.ref.buf = NULL;
                 }
                 break;
         }
     }
 
+    const char *RedisReply::FlattenRef() const {
+        char *d = (char *) _arena->allocate((_length / 8 + 1) * 8);
+        if (d == NULL) {
+            FLARE_LOG(FATAL) << "Fail to allocate string[" << _length << "]";
+            return "";
+        }
+        _data.ref.buf->copy_to_cstr(d, _length);
+        // Flattening does not change the value.
+        RedisReply *self = const_cast<RedisReply *>(this);
+        self->_data.long_str = d;
+        self->_data.ref.buf = NULL;
+        return d;
+    }
+
+    void RedisReply::append_to(flare::cord_buf *out) const {
+        if (!is_string()) {
+            FLARE_CHECK(false) << "The reply is " << RedisReplyTypeToString(_type)
+                               << ", not a string";
+            return;
+        }
+        if (_length == npos) {
+            return;
+        }
+        if (_length < (int) sizeof(_data.short_str)) { // SSO
+            out->append(_data.short_str, _length);
+        } else if (_data.ref.buf != NULL) {
+            out->append(*_data.ref.buf);
+        } else {
+            out->append(_data.long_str, _length);
+        }
+    }
+
     void RedisReply::SetArray(int size) {
         if (_type != REDIS_REPLY_NIL) {
             Reset();
@@ -458,6 +512,7 @@ namespace flare::rpc {
             memcpy(d, str.data(), size);
             d[size] = '\0';
             _data.long_str = d;
+            _data.ref.buf = NULL;
         }
         _type = type;
         _length = size;
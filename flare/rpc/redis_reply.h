@@ -20,6 +20,7 @@
 #define FLARE_RPC_REDIS_REPLY_H_
 
 #include <stdarg.h>
+#include <deque>
 #include "flare/io/cord_buf.h"                  // flare::cord_buf
 #include <string_view>   // std::string_view
 #include "flare/memory/arena.h"                  // flare::Arena
@@ -41,6 +42,16 @@ namespace flare::rpc {
 
     const char *RedisReplyTypeToString(redis_reply_type);
 
+    // Bulk strings which reference blocks of the input instead of being
+    // copied when replies are parsed.
+    struct RedisBulkStringRefs {
+        RedisBulkStringRefs() : min_size(0) {}
+
+        // Bulk strings shorter than this are copied. 0 means all are copied.
+        size_t min_size;
+        std::deque<flare::cord_buf> bufs;
+    };
+
     // A reply from redis-server.
     class RedisReply {
     public:
@@ -103,8 +114,16 @@ namespace flare::rpc {
         // Convert the reply to a StringPiece. If the reply is not a string,
         // call stacks are logged and "" is returned.
         // If you need a std::string, call .data().as_string() (which allocates mem)
+        // A string referencing blocks of the input (see RedisBulkStringRefs) is
+        // copied into the arena by the first call to data() or c_str(), which
+        // must not run concurrently with other calls on the same reply.
         std::string_view data() const;
 
+        // Append the string to `out', which does not copy a string referencing
+        // blocks of the input. If the reply is not a string, call stacks are
+        // logged and nothing is appended.
+        void append_to(flare::cord_buf *out) const;
+
         // Return number of sub replies in the array if this reply is an array, or
         // return the length of string if this reply is a string, otherwise 0 is
         // returned (call stacks are not logged).
@@ -128,6 +147,11 @@ namespace flare::rpc {
         // Returns PARSE_ERROR_ABSOLUTELY_WRONG if the parsing failed.
         ParseError ConsumePartialCordBuf(flare::cord_buf &buf);
 
+        // Same as above, but bulk strings not shorter than refs->min_size are
+        // cut from `buf' without copying and kept in refs->bufs, which must
+        // outlive this reply. `refs' may be NULL.
+        ParseError ConsumePartialCordBuf(flare::cord_buf &buf, RedisBulkStringRefs *refs);
+
         // Serialize to cord_buf appender using redis protocol
         bool SerializeTo(flare::cord_buf_appender *appender);
 
@@ -157,12 +181,24 @@ namespace flare::rpc {
 
         void SetStringImpl(const std::string_view &str, redis_reply_type type);
 
+        // Returns the string which is not short, copying it into the arena if
+        // it references blocks of the input.
+        const char *long_str() const;
+
+        const char *FlattenRef() const;
+
         redis_reply_type _type;
         int _length;  // length of short_str/long_str, count of replies
         union {
             int64_t integer;
             char short_str[16];
             const char *long_str;
+            struct {
+                const char *str;  // overlaps long_str
+                // Non-NULL if the (not short) string references blocks of the
+                // input and is not copied yet.
+                const flare::cord_buf *buf;
+            } ref;
             struct {
                 int32_t last_index;  // >= 0 if previous parsing suspends on replies.
                 RedisReply *replies;
@@ -271,12 +307,19 @@ namespace flare::rpc {
         va_end(ap);
     }
 
+    inline const char *RedisReply::long_str() const {
+        if (_data.ref.buf != NULL) {
+            return FlattenRef();
+        }
+        return _data.long_str;
+    }
+
     inline const char *RedisReply::c_str() const {
         if (is_string()) {
             if (_length < (int) sizeof(_data.short_str)) { // SSO
                 return _data.short_str;
             } else {
-                return _data.long_str;
+                return long_str();
             }
         }
         FLARE_CHECK(false) << "The reply is " << RedisReplyTypeToString(_type)
@@ -289,7 +332,7 @@ namespace flare::rpc {
             if (_length < (int) sizeof(_data.short_str)) { // SSO
                 return std::string_view(_data.short_str, _length);
             } else {
-                return std::string_view(_data.long_str, _length);
+                return std::string_view(long_str(), _length);
             }
         }
         FLARE_CHECK(false) << "The reply is " << RedisReplyTypeToString(_type)
@@ -302,7 +345,7 @@ namespace flare::rpc {
             if (_length < (int) sizeof(_data.short_str)) { // SSO
                 return _data.short_str;
             } else {
-                return _data.long_str;
+                return long_str();
             }
         }
         FLARE_CHECK(false) << "The reply is " << RedisReplyTypeToString(_type)
@@ -919,6 +919,8 @@ namespace flare::rpc {
             }
         }
 
+        IndexMethods();
+
         // Create listening ports
         if (port_range.min_port > port_range.max_port) {
             FLARE_LOG(ERROR) << "Invalid port_range=[" << port_range.min_port << '-'
@@ -1169,6 +1171,8 @@ namespace flare::rpc {
                              << version() << "] which is " << status_str(status());
             return -1;
         }
+        // Entries of _method_map are going to be inserted and moved.
+        ClearMethodIndex();
 
         if (_fullname_service_map.seek(sd->full_name()) != nullptr) {
             FLARE_LOG(ERROR) << "service=" << sd->full_name() << " already exists";
@@ -1418,6 +1422,7 @@ namespace flare::rpc {
     }
 
     void Server::RemoveMethodsOf(google::protobuf::Service *service) {
+        ClearMethodIndex();
         const google::protobuf::ServiceDescriptor *sd = service->GetDescriptor();
         const bool is_idl_support = sd->file()->options().GetExtension(idl_support);
         std::string full_name_wo_ns;
@@ -1536,6 +1541,7 @@ namespace flare::rpc {
             }
             delete it->second.http_url;
         }
+        ClearMethodIndex();
         _fullname_service_map.clear();
         _service_map.clear();
         _method_map.clear();
@@ -1766,14 +1772,43 @@ namespace flare::rpc {
         return g_dummy_server != nullptr;
     }
 
+    void Server::IndexMethods() {
+        ClearMethodIndex();
+        std::vector<std::string> names;
+        names.reserve(_method_map.size());
+        for (MethodMap::const_iterator it = _method_map.begin();
+             it != _method_map.end(); ++it) {
+            names.push_back(it->first);
+            _indexed_methods.push_back(&it->second);
+        }
+        if (_method_index.init(names) != 0) {
+            // Not expected, lookups fall back to _method_map.
+            FLARE_LOG(WARNING) << "Fail to index " << names.size() << " methods";
+            ClearMethodIndex();
+        }
+    }
+
+    void Server::ClearMethodIndex() {
+        _method_index.clear();
+        _indexed_methods.clear();
+    }
+
     const Server::MethodProperty *
     Server::FindMethodPropertyByFullName(const std::string_view &fullname) const {
+        if (!_method_index.empty()) {
+            const int index = _method_index.find(fullname);
+            return index < 0 ? nullptr : _indexed_methods[index];
+        }
         return _method_map.seek(fullname);
     }
 
     const Server::MethodProperty *
     Server::FindMethodPropertyByFullName(const std::string_view &service_name/*full*/,
                                          const std::string_view &method_name) const {
+        if (!_method_index.empty()) {
+            const int index = _method_index.find(service_name, method_name);
+            return index < 0 ? nullptr : _indexed_methods[index];
+        }
         const size_t fullname_len = service_name.size() + 1 + method_name.size();
         if (fullname_len <= 256) {
             // Avoid allocation in most cases.
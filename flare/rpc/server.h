@@ -37,6 +37,7 @@
 #include "flare/rpc/data_factory.h"                 // DataFactory
 #include "flare/rpc/builtin/tabbed.h"
 #include "flare/rpc/details/profiler_linker.h"
+#include "flare/rpc/details/method_index.h"
 #include "flare/rpc/health_reporter.h"
 #include "flare/rpc/adaptive_max_concurrency.h"
 #include "flare/rpc/http2.h"
@@ -585,6 +586,12 @@ namespace flare::rpc {
         // Remove all methods of `service' from internal structures.
         void RemoveMethodsOf(google::protobuf::Service *service);
 
+        // Build _method_index from _method_map, which is not changed until
+        // services are added or removed.
+        void IndexMethods();
+
+        void ClearMethodIndex();
+
         int AddBuiltinServices();
 
         // Initialize internal structure. Initializtion is
@@ -681,6 +688,11 @@ namespace flare::rpc {
         // Use method->full_name() as key
         MethodMap _method_map;
 
+        // Perfect hash of keys in _method_map for dispatching requests,
+        // built when the server starts. Values are indexes of _indexed_methods.
+        MethodIndex _method_index;
+        std::vector<const MethodProperty *> _indexed_methods;
+
         // Use service->full_name() as key
         ServiceMap _fullname_service_map;
 
@@ -49,6 +49,20 @@
 
 #include <sys/event.h>
 
+#elif defined(FLARE_PLATFORM_LINUX)
+
+#include <linux/errqueue.h>                      // sock_extended_err
+
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef SO_EE_ORIGIN_ZEROCOPY
+#define SO_EE_ORIGIN_ZEROCOPY 5
+#endif
+#ifndef SO_EE_CODE_ZEROCOPY_COPIED
+#define SO_EE_CODE_ZEROCOPY_COPIED 1
+#endif
+
 #endif
 
 namespace flare::fiber_internal {
@@ -91,6 +105,27 @@ namespace flare::rpc {
                  "times *continuously*, the error is changed to ENETUNREACH which "
                  "fails the main socket as well when this socket is pooled.");
 
+    DEFINE_bool(socket_zerocopy, false,
+                "Send large messages with MSG_ZEROCOPY on sockets supporting it");
+
+    DEFINE_int64(socket_zerocopy_threshold_bytes, 64 * 1024,
+                 "Writes smaller than this value are copied into the kernel "
+                 "even if -socket_zerocopy is on");
+
+    DEFINE_bool(socket_write_coalescing, false,
+                "Hold small writes into a socket which is written frequently for "
+                "a short while so that following writes go out with them in one "
+                "writev");
+
+    DEFINE_int64(socket_write_coalescing_bytes, 16 * 1024,
+                 "Stop holding writes when so many bytes are pending, writes "
+                 "larger than this value are never held");
+
+    DEFINE_int32(socket_write_coalescing_us, 50,
+                 "Hold writes for at most so many microseconds. Writes are held "
+                 "only when the previous write into the socket was more recent "
+                 "than this");
+
     DECLARE_int32(health_check_timeout_ms);
 
     static bool validate_connect_timeout_as_unreachable(const char *, int32_t v) {
@@ -291,6 +326,23 @@ namespace flare::rpc {
     SocketMessage *const DUMMY_USER_MESSAGE = (SocketMessage *) 0x1;
     const uint32_t MAX_PIPELINED_COUNT = 32768;
 
+    struct Socket::ZeroCopyState {
+        struct Pending {
+            // Notification id assigned by the kernel to the sendmsg.
+            uint32_t seq;
+            bool done;
+            flare::cord_buf pinned;
+        };
+        // Id of next successful sendmsg with MSG_ZEROCOPY, counted by the
+        // kernel from 0 for each socket.
+        uint32_t next_seq = 0;
+        // Writer appends, while both the writer and the input event (the
+        // kernel raises EPOLLERR when notifications are queued) reap.
+        std::mutex mutex;
+        int64_t pinned_bytes = 0;
+        std::deque<Pending> pending;
+    };
+
     struct FLARE_CACHELINE_ALIGNMENT Socket::WriteRequest {
         static WriteRequest *const UNCONNECTED;
 
@@ -424,15 +476,19 @@ namespace flare::rpc {
               _controller_released_socket(false), _overcrowded(false), _fail_me_at_server_stop(false),
               _logoff_flag(false), _recycle_flag(false), _error_code(0), _pipeline_q(nullptr), _last_writetime_us(0),
               _unwritten_bytes(0), _epollout_butex(nullptr), _write_head(nullptr), _stream_set(nullptr),
+              _zerocopy(nullptr), _coalescing_write(false), _coalescing_skips(0),
+              _coalescing_backoff(0), _coalescing_butex(nullptr), _coalescing_waiting(false),
               _ninflight_app_health_check(0) {
         CreateVarsOnce();
         pthread_mutex_init(&_id_wait_list_mutex, nullptr);
         _epollout_butex = flare::fiber_internal::waitable_event_create_checked<std::atomic<int> >();
+        _coalescing_butex = flare::fiber_internal::waitable_event_create_checked<std::atomic<int> >();
     }
 
     Socket::~Socket() {
         pthread_mutex_destroy(&_id_wait_list_mutex);
         flare::fiber_internal::waitable_event_destroy(_epollout_butex);
+        flare::fiber_internal::waitable_event_destroy(_coalescing_butex);
     }
 
     void Socket::ReturnSuccessfulWriteRequest(Socket::WriteRequest *p) {
@@ -538,6 +594,21 @@ namespace flare::rpc {
             }
         }
 
+        // The previous fd, if any, was closed by CloseFileDescriptor().
+        ResetZeroCopy();
+        _coalescing_write = false;
+        _coalescing_skips = 0;
+        _coalescing_backoff = 0;
+#if defined(FLARE_PLATFORM_LINUX)
+        if (FLAGS_socket_zerocopy) {
+            // OK to fail, unix domain sockets and old kernels do not support this.
+            int on = 1;
+            if (setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &on, sizeof(on)) == 0) {
+                _zerocopy = new ZeroCopyState;
+            }
+        }
+#endif
+
         if (_on_edge_triggered_events) {
             if (GetGlobalEventDispatcher(fd).AddConsumer(id(), fd) != 0) {
                 FLARE_PLOG(ERROR) << "Fail to add SocketId=" << id()
@@ -662,7 +733,7 @@ namespace flare::rpc {
             if (_on_edge_triggered_events != nullptr) {
                 GetGlobalEventDispatcher(prev_fd).RemoveConsumer(prev_fd);
             }
-            close(prev_fd);
+            CloseFileDescriptor(prev_fd);
             if (CreatedByConnect()) {
                 g_vars->channel_conn << -1;
             }
@@ -822,6 +893,9 @@ namespace flare::rpc {
                         &_id_wait_list_mutex));
 
                 ResetAllStreams();
+                // Blocks of pending zerocopy writes are kept until the kernel
+                // completes them or the fd is closed in OnRecycle(), the
+                // kernel may still send their pages on this fd.
                 // _app_connect shouldn't be set to nullptr in SetFailed otherwise
                 // HC is always not supported.
                 // FIXME: Design a better interface for AppConnect
@@ -942,7 +1016,7 @@ namespace flare::rpc {
             if (_on_edge_triggered_events != nullptr) {
                 GetGlobalEventDispatcher(prev_fd).RemoveConsumer(prev_fd);
             }
-            close(prev_fd);
+            CloseFileDescriptor(prev_fd);
             if (create_by_connect) {
                 g_vars->channel_conn << -1;
             }
@@ -971,6 +1045,8 @@ namespace flare::rpc {
         delete _stream_set;
         _stream_set = nullptr;
 
+        ResetZeroCopy();
+
         const SocketId asid = _agent_socket_id.load(std::memory_order_relaxed);
         if (asid != INVALID_SOCKET_ID) {
             SocketUniquePtr ptr;
@@ -1473,8 +1549,10 @@ namespace flare::rpc {
 
     int Socket::StartWrite(WriteRequest *req, const WriteOptions &opt) {
         // Release fence makes sure the thread getting request sees *req
+        // Being seq_cst, either this exchange is seen by CoalesceWrites()
+        // before it waits, or _coalescing_waiting set by it is seen below.
         WriteRequest *const prev_head =
-                _write_head.exchange(req, std::memory_order_release);
+                _write_head.exchange(req, std::memory_order_seq_cst);
         if (prev_head != nullptr) {
             // Someone is writing to the fd. The KeepWrite thread may spin
             // until req->next to be non-UNCONNECTED. This process is not
@@ -1482,6 +1560,10 @@ namespace flare::rpc {
             // depending on compiler) that the spin rarely occurs in practice
             // (I've not seen any spin in highly contended tests).
             req->next = prev_head;
+            if (_coalescing_waiting.load(std::memory_order_seq_cst)) {
+                _coalescing_butex->fetch_add(1, std::memory_order_relaxed);
+                flare::fiber_internal::waitable_event_wake(_coalescing_butex);
+            }
             return 0;
         }
 
@@ -1516,11 +1598,20 @@ namespace flare::rpc {
             goto KEEPWRITE_IN_BACKGROUND;
         }
 
+        if (ShouldCoalesceWrite(req)) {
+            // Let KeepWrite wait for more requests instead of the caller.
+            _coalescing_write = true;
+            goto KEEPWRITE_IN_BACKGROUND;
+        }
+
         // Write once in the calling thread. If the write is not complete,
         // continue it in KeepWrite thread.
         if (_conn) {
             flare::cord_buf *data_arr[1] = {&req->data};
             nw = _conn->CutMessageIntoFileDescriptor(fd(), data_arr, 1);
+        } else if (_zerocopy) {
+            flare::cord_buf *data_arr[1] = {&req->data};
+            nw = DoZeroCopyWrite(data_arr, 1);
         } else {
             nw = req->data.cut_into_file_descriptor(fd());
         }
@@ -1535,6 +1626,7 @@ namespace flare::rpc {
                 goto FAIL_TO_WRITE;
             }
         } else {
+            g_vars->write_bytes_per_syscall << nw;
             AddOutputBytes(nw);
         }
         if (IsWriteComplete(req, true, nullptr)) {
@@ -1572,6 +1664,10 @@ namespace flare::rpc {
         // returning directly otherwise _write_head is permantly non-nullptr which
         // makes later Write() abnormal.
         WriteRequest *cur_tail = nullptr;
+        if (s->_coalescing_write) {
+            s->_coalescing_write = false;
+            s->CoalesceWrites(req, &cur_tail);
+        }
         do {
             // req was written, skip it.
             if (req->next != nullptr && req->data.empty()) {
@@ -1589,6 +1685,7 @@ namespace flare::rpc {
                     break;
                 }
             } else {
+                g_vars->write_bytes_per_syscall << nw;
                 s->AddOutputBytes(nw);
             }
             // Release WriteRequest until non-empty data or last request.
@@ -1639,6 +1736,60 @@ namespace flare::rpc {
         return nullptr;
     }
 
+    bool Socket::ShouldCoalesceWrite(const WriteRequest *req) {
+        if (!FLAGS_socket_write_coalescing || _conn != nullptr ||
+            req->data.size() >= (size_t) FLAGS_socket_write_coalescing_bytes) {
+            return false;
+        }
+        if (_coalescing_skips > 0) {
+            --_coalescing_skips;
+            return false;
+        }
+        // A write after a quiet period is likely alone, don't delay it.
+        return flare::get_current_time_micros() -
+               _last_writetime_us.load(std::memory_order_relaxed) <
+               FLAGS_socket_write_coalescing_us;
+    }
+
+    void Socket::CoalesceWrites(WriteRequest *req, WriteRequest **cur_tail) {
+        FLARE_CHECK(req->next == nullptr);
+        const int64_t deadline_us =
+                flare::get_current_time_micros() + FLAGS_socket_write_coalescing_us;
+        const size_t max_bytes = FLAGS_socket_write_coalescing_bytes;
+        size_t nbytes = req->data.size();
+        int64_t ngathered = 0;
+        WriteRequest *tail = req;
+        // IsWriteComplete() never clears _write_head for a tail with data,
+        // it just appends new requests after the tail.
+        while (nbytes < max_bytes && !tail->data.empty() &&
+               flare::get_current_time_micros() < deadline_us) {
+            // Sleep until StartWrite() appends a request or the deadline.
+            const int expected = _coalescing_butex->load(std::memory_order_relaxed);
+            _coalescing_waiting.store(true, std::memory_order_seq_cst);
+            if (_write_head.load(std::memory_order_seq_cst) == tail) {
+                const timespec abstime =
+                        flare::time_point::from_unix_micros(deadline_us).to_timespec();
+                flare::fiber_internal::waitable_event_wait(_coalescing_butex, expected, &abstime);
+            }
+            _coalescing_waiting.store(false, std::memory_order_relaxed);
+            WriteRequest *new_tail = tail;
+            IsWriteComplete(tail, (tail == req), &new_tail);
+            for (WriteRequest *p = tail->next; p != nullptr; p = p->next) {
+                nbytes += p->data.size();
+                ++ngathered;
+            }
+            tail = new_tail;
+        }
+        *cur_tail = tail;
+        if (ngathered == 0) {
+            _coalescing_backoff = std::min(std::max(_coalescing_backoff * 2, 1), 1024);
+            _coalescing_skips = _coalescing_backoff;
+        } else {
+            _coalescing_backoff = 0;
+            g_vars->nwrite_coalesced << ngathered;
+        }
+    }
+
     ssize_t Socket::DoWrite(WriteRequest *req) {
         // Group flare::cord_buf in the list into a batch array.
         flare::cord_buf *data_list[DATA_LIST_MAX];
@@ -1652,6 +1803,8 @@ namespace flare::rpc {
             // Write cord_buf in the batch array into the fd.
             if (_conn) {
                 return _conn->CutMessageIntoFileDescriptor(fd(), data_list, ndata);
+            } else if (_zerocopy) {
+                return DoZeroCopyWrite(data_list, ndata);
             } else {
                 ssize_t nw = flare::cord_buf::cut_multiple_into_file_descriptor(
                         fd(), data_list, ndata);
@@ -1696,6 +1849,120 @@ namespace flare::rpc {
         return nw;
     }
 
+    ssize_t Socket::DoZeroCopyWrite(flare::cord_buf *const *data_list, size_t ndata) {
+        ReapZeroCopyCompletions(fd());
+        size_t total = 0;
+        for (size_t i = 0; i < ndata; ++i) {
+            total += data_list[i]->size();
+        }
+        if (total < (size_t) FLAGS_socket_zerocopy_threshold_bytes) {
+            return flare::cord_buf::cut_multiple_into_file_descriptor(
+                    fd(), data_list, ndata);
+        }
+        flare::cord_buf pinned;
+        const ssize_t nw = flare::cord_buf::cut_multiple_into_file_descriptor_zerocopy(
+                fd(), data_list, ndata, &pinned);
+        if (nw < 0 && errno == ENOBUFS) {
+            // Running out of optmem for notifications, copy this time.
+            g_vars->nzerocopy_fallback << 1;
+            return flare::cord_buf::cut_multiple_into_file_descriptor(
+                    fd(), data_list, ndata);
+        }
+        if (nw > 0) {
+            g_vars->nzerocopy << 1;
+            g_vars->zerocopy_pinned_bytes << nw;
+            std::unique_lock<std::mutex> mu(_zerocopy->mutex);
+            _zerocopy->pinned_bytes += nw;
+            _zerocopy->pending.emplace_back();
+            ZeroCopyState::Pending &p = _zerocopy->pending.back();
+            p.seq = _zerocopy->next_seq++;
+            p.done = false;
+            p.pinned.swap(pinned);
+        }
+        return nw;
+    }
+
+    void Socket::ReapZeroCopyCompletions(int fd) {
+#if defined(FLARE_PLATFORM_LINUX)
+        std::unique_lock<std::mutex> mu(_zerocopy->mutex);
+        if (_zerocopy->pending.empty()) {
+            return;
+        }
+        while (true) {
+            char control[128];
+            struct msghdr msg;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_control = control;
+            msg.msg_controllen = sizeof(control);
+            if (recvmsg(fd, &msg, MSG_ERRQUEUE) < 0) {
+                // EAGAIN: no more completions.
+                break;
+            }
+            for (cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm != nullptr;
+                 cm = CMSG_NXTHDR(&msg, cm)) {
+                if (!((cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) ||
+                      (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR))) {
+                    continue;
+                }
+                const sock_extended_err *serr = (const sock_extended_err *) CMSG_DATA(cm);
+                if (serr->ee_errno != 0 || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+                    continue;
+                }
+                // Writes in [ee_info, ee_data] are completed.
+                const uint32_t lo = serr->ee_info;
+                const uint32_t hi = serr->ee_data;
+                if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                    g_vars->nzerocopy_copied << (hi - lo + 1);
+                }
+                for (ZeroCopyState::Pending &p : _zerocopy->pending) {
+                    if (!p.done && p.seq - lo <= hi - lo) {
+                        p.done = true;
+                    }
+                }
+            }
+        }
+        while (!_zerocopy->pending.empty() && _zerocopy->pending.front().done) {
+            const int64_t n = _zerocopy->pending.front().pinned.size();
+            g_vars->zerocopy_pinned_bytes << -n;
+            _zerocopy->pinned_bytes -= n;
+            _zerocopy->pending.pop_front();
+        }
+#endif
+    }
+
+    void Socket::CloseFileDescriptor(int fd) {
+        if (_zerocopy != nullptr) {
+            ReapZeroCopyCompletions(fd);
+            bool pending = false;
+            {
+                std::unique_lock<std::mutex> mu(_zerocopy->mutex);
+                pending = !_zerocopy->pending.empty();
+            }
+            if (pending) {
+                // The kernel still references pages of the pending writes and
+                // may (re)transmit them. Abort the connection so that its send
+                // queue is purged on close() instead of lingering, after which
+                // the blocks are safe to reuse.
+                struct linger lg = {1, 0};
+                if (setsockopt(fd, SOL_SOCKET, SO_LINGER, &lg, sizeof(lg)) != 0) {
+                    FLARE_PLOG(WARNING) << "Fail to set SO_LINGER of fd=" << fd;
+                }
+                g_vars->nzerocopy_aborted << 1;
+            }
+        }
+        close(fd);
+        ResetZeroCopy();
+    }
+
+    void Socket::ResetZeroCopy() {
+        if (_zerocopy == nullptr) {
+            return;
+        }
+        g_vars->zerocopy_pinned_bytes << -_zerocopy->pinned_bytes;
+        delete _zerocopy;
+        _zerocopy = nullptr;
+    }
+
     int Socket::SSLHandshake(int fd, bool server_mode) {
         if (_ssl_ctx == nullptr) {
             if (server_mode) {
@@ -1908,6 +2175,13 @@ namespace flare::rpc {
 #endif
             return -1;
         }
+#if defined(FLARE_PLATFORM_LINUX)
+        if ((events & EPOLLERR) && s->_zerocopy != nullptr) {
+            // Notifications of zerocopy writes are queued, reap them here so
+            // that blocks are released even if no more writes come.
+            s->ReapZeroCopyCompletions(s->fd());
+        }
+#endif
 
         // if (events & has_epollrdhup) {
         //     s->_eof = 1;
@@ -141,7 +141,15 @@ namespace flare::rpc {
                 : nsocket("rpc_socket_count"), channel_conn("rpc_channel_connection_count"),
                   neventthread_second("rpc_event_thread_second", &neventthread), nhealthcheck("rpc_health_check_count"),
                   nkeepwrite_second("rpc_keepwrite_second", &nkeepwrite), nwaitepollout("rpc_waitepollout_count"),
-                  nwaitepollout_second("rpc_waitepollout_second", &nwaitepollout) {}
+                  nwaitepollout_second("rpc_waitepollout_second", &nwaitepollout),
+                  nzerocopy("rpc_socket_zerocopy_count"),
+                  nzerocopy_copied("rpc_socket_zerocopy_copied_count"),
+                  nzerocopy_fallback("rpc_socket_zerocopy_fallback_count"),
+                  zerocopy_pinned_bytes("rpc_socket_zerocopy_pinned_bytes"),
+                  nzerocopy_aborted("rpc_socket_zerocopy_aborted_count"),
+                  write_bytes_per_syscall_window("rpc_socket_write_bytes_per_syscall",
+                                                 &write_bytes_per_syscall, 10),
+                  nwrite_coalesced("rpc_socket_write_coalesced_count") {}
 
         flare::gauge<int64_t> nsocket;
         flare::gauge<int64_t> channel_conn;
@@ -152,6 +160,23 @@ namespace flare::rpc {
         flare::per_second<flare::gauge<int64_t> > nkeepwrite_second;
         flare::gauge<int64_t> nwaitepollout;
         flare::per_second<flare::gauge<int64_t> > nwaitepollout_second;
+        // Writes sent with MSG_ZEROCOPY.
+        flare::gauge<int64_t> nzerocopy;
+        // Zerocopy writes completed by the kernel with a copy anyway.
+        flare::gauge<int64_t> nzerocopy_copied;
+        // Writes above the threshold that were copied because the kernel
+        // rejected MSG_ZEROCOPY (namely ENOBUFS).
+        flare::gauge<int64_t> nzerocopy_fallback;
+        // Bytes held by zerocopy writes waiting for completions.
+        flare::gauge<int64_t> zerocopy_pinned_bytes;
+        // Connections reset on close since zerocopy writes were pending.
+        flare::gauge<int64_t> nzerocopy_aborted;
+        // Bytes written by each write/writev/sendmsg into sockets.
+        flare::IntRecorder write_bytes_per_syscall;
+        flare::window<flare::IntRecorder> write_bytes_per_syscall_window;
+        // WriteRequests held back by -socket_write_coalescing and written
+        // together with a former one.
+        flare::gauge<int64_t> nwrite_coalesced;
     };
 
     struct PipelinedInfo {
@@ -601,6 +626,35 @@ namespace flare::rpc {
         // success, -1 otherwise and errno is set
         ssize_t DoWrite(WriteRequest *req);
 
+        // Write `data_list' with MSG_ZEROCOPY if it's large enough, with the
+        // normal copying path otherwise. Must be called by the writer owning
+        // _write_head and only when _zerocopy is not NULL.
+        ssize_t DoZeroCopyWrite(flare::cord_buf *const *data_list, size_t ndata);
+
+        // [Called by the writer owning _write_head] Whether `req' should be
+        // held back by -socket_write_coalescing to wait for more requests.
+        bool ShouldCoalesceWrite(const WriteRequest *req);
+
+        // [Called by the writer owning _write_head] Wait for WriteRequests
+        // appended after `req' until -socket_write_coalescing_bytes are
+        // pending or -socket_write_coalescing_us elapses. `req' must be the
+        // only request in its list. The tail of the gathered list is stored
+        // in `cur_tail'.
+        void CoalesceWrites(WriteRequest *req, WriteRequest **cur_tail);
+
+        // Release blocks of zerocopy writes on `fd' completed by the kernel.
+        void ReapZeroCopyCompletions(int fd);
+
+        // Close `fd' of this socket. If zerocopy writes on it are not
+        // completed, the connection is reset with SO_LINGER {1, 0} before
+        // closing, so that the kernel drops their pages before the pinned
+        // blocks are released (and reused by other connections).
+        void CloseFileDescriptor(int fd);
+
+        // Release all pinned blocks and turn off zerocopy. The fd written
+        // with zerocopy must have been closed by CloseFileDescriptor().
+        void ResetZeroCopy();
+
         // Called before returning to pool.
         void OnRecycle();
 
@@ -875,6 +929,23 @@ namespace flare::rpc {
         std::mutex _stream_mutex;
         std::set<StreamId> *_stream_set;
 
+        // Blocks referenced by in-flight MSG_ZEROCOPY writes. NULL unless
+        // -socket_zerocopy is on and the fd supports SO_ZEROCOPY. Only
+        // accessed by the writer owning _write_head.
+        struct ZeroCopyState;
+        ZeroCopyState *_zerocopy;
+
+        // State of -socket_write_coalescing, only accessed by the writer
+        // owning _write_head. A window gathering nothing makes the next
+        // `_coalescing_backoff' writes go out directly, doubling each time.
+        bool _coalescing_write;
+        int _coalescing_skips;
+        int _coalescing_backoff;
+        // Bumped by StartWrite() to wake up the writer waiting in
+        // CoalesceWrites(), only when `_coalescing_waiting' is set.
+        std::atomic<int> *_coalescing_butex;
+        std::atomic<bool> _coalescing_waiting;
+
         std::atomic<int64_t> _ninflight_app_health_check;
     };
 
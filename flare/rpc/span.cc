@@ -16,12 +16,14 @@
 // under the License.
 
 
-#include <netinet/in.h>
+#include <inttypes.h>
+#include <algorithm>
+#include <atomic>
+#include <vector>
 #include <gflags/gflags.h>
-#include <leveldb/db.h>
 #include "flare/files/filesystem.h"
-#include <leveldb/comparator.h>
 #include "flare/fiber/internal/fiber.h"
+#include "flare/fiber/internal/waitable_event.h"
 #include "flare/base/scoped_lock.h"
 #include "flare/thread/thread.h"
 #include "flare/strings/str_format.h"
@@ -31,7 +33,9 @@
 #include "flare/base/fast_rand.h"
 #include "flare/rpc/shared_object.h"
 #include "flare/rpc/reloadable_flags.h"
+#include "flare/json2pb/pb_to_json.h"
 #include "flare/rpc/span.h"
+#include "flare/rpc/span_store.h"
 
 #define FLARE_RPC_SPAN_INFO_SEP "\1"
 
@@ -39,25 +43,51 @@
 namespace flare::rpc {
 
     const int64_t SPAN_DELETE_INTERVAL_US = 10000000L/*10s*/;
+    // Spans are drained when a ring is half full or at this interval.
+    const int64_t SPAN_MAX_DRAIN_INTERVAL_US = 1000000L/*1s*/;
+    // Spans are dropped for this long after failing to write the SpanDB,
+    // doubled after each consecutive failure.
+    const int64_t SPAN_MIN_RETRY_INTERVAL_US = 1000000L/*1s*/;
+    const int64_t SPAN_MAX_RETRY_INTERVAL_US = 300000000L/*5min*/;
+    const int64_t SPAN_SAMPLING_UPDATE_INTERVAL_US = 1000000L/*1s*/;
 
     DEFINE_string(rpcz_database_dir, "./rpc_data/rpcz",
                   "For storing requests/contexts collected by rpcz.");
 
-    // TODO: collected per second is customizable.
-    // const int32_t MAX_RPCZ_MAX_SPAN_PER_SECOND = 10000;
-    // DEFINE_int32(rpcz_max_span_per_second, MAX_RPCZ_MAX_SPAN_PER_SECOND,
-    //              "Index so many spans per second at most");
-    // static bool validate_rpcz_max_span_per_second(const char*, int32_t val) {
-    //     return (val >= 1 && val <= MAX_RPCZ_MAX_SPAN_PER_SECOND);
-    // }
-    // FLARE_RPC_VALIDATE_GFLAG(rpcz_max_span_per_second,
-    //                          validate_rpcz_max_span_per_second);
+    DEFINE_int32(rpcz_max_span_per_second, 1000,
+                 "Index so many spans per second at most, sampling ratio of "
+                 "rpcz is adjusted to meet this value");
+    static bool validate_rpcz_max_span_per_second(const char *, int32_t val) {
+        return (val >= 1 && val <= 1000000);
+    }
+    FLARE_RPC_VALIDATE_GFLAG(rpcz_max_span_per_second,
+                             validate_rpcz_max_span_per_second);
+
+    DEFINE_int32(rpcz_span_ring_size, 4096,
+                 "Buffer so many spans per thread before they're indexed, spans "
+                 "submitted to a full buffer are dropped");
+    FLARE_RPC_VALIDATE_GFLAG(rpcz_span_ring_size, PositiveInteger);
+
+    DEFINE_int32(rpcz_span_segment_size_mb, 64,
+                 "Size of each file storing spans in megabytes");
+    static bool validate_rpcz_span_segment_size_mb(const char *, int32_t val) {
+        // Offsets inside a segment are 32-bit.
+        return (val >= 1 && val < 4096);
+    }
+    FLARE_RPC_VALIDATE_GFLAG(rpcz_span_segment_size_mb,
+                             validate_rpcz_span_segment_size_mb);
+
+    DEFINE_int32(rpcz_max_span_segments, 16,
+                 "Keep so many files of spans at most, the oldest one is "
+                 "removed when a new one is created");
+    FLARE_RPC_VALIDATE_GFLAG(rpcz_max_span_segments, PositiveInteger);
 
     DEFINE_int32(rpcz_keep_span_seconds, 3600,
                  "Keep spans for at most so many seconds");
     FLARE_RPC_VALIDATE_GFLAG(rpcz_keep_span_seconds, PositiveInteger);
 
-    DEFINE_bool(rpcz_keep_span_db, false, "Don't remove DB of rpcz at program's exit");
+    DEFINE_bool(rpcz_keep_span_db, false, "Don't remove DB of rpcz at program's exit, "
+                                           "which can be loaded by LoadSpanDBFromFile()");
 
     struct IdGen {
         bool init;
@@ -99,8 +129,12 @@ namespace flare::rpc {
         return (g->current_random & 0xFFFFFFFFFFFF0000ULL) | g->seq++;
     }
 
+    static int StartIndexingIfNeeded();
+
     Span *Span::CreateClientSpan(const std::string &full_method_name,
                                  int64_t base_real_us) {
+        // Spans are indexed by a fiber, start it along with the first span.
+        StartIndexingIfNeeded();
         Span *span = flare::get_object<Span>(Forbidden());
         if (__builtin_expect(span == NULL, 0)) {
             return NULL;
@@ -150,6 +184,7 @@ namespace flare::rpc {
             const std::string &full_method_name,
             uint64_t trace_id, uint64_t span_id, uint64_t parent_span_id,
             int64_t base_real_us) {
+        StartIndexingIfNeeded();
         Span *span = flare::get_object<Span>(Forbidden());
         if (__builtin_expect(span == NULL, 0)) {
             return NULL;
@@ -303,85 +338,148 @@ namespace flare::rpc {
         va_end(ap);
     }
 
+    // Spans submitted by one thread and not indexed yet. The thread pushes
+    // and Span::DrainSpans pops, neither of them blocks the other.
+    struct SpanRing {
+        explicit SpanRing(size_t capacity2)
+                : capacity(capacity2), spans(new Span *[capacity2]), ndropped(0), orphaned(false),
+                  ndropped_seen(0), head(0), tail(0) {}
+
+        ~SpanRing() { delete[] spans; }
+
+        // Called by the owner thread only.
+        // Returns number of spans in the ring after pushing, 0 if it's full.
+        size_t Push(Span *span) {
+            const uint64_t t = tail.load(std::memory_order_relaxed);
+            const uint64_t n = t - head.load(std::memory_order_acquire);
+            if (n >= capacity) {
+                ndropped.store(ndropped.load(std::memory_order_relaxed) + 1,
+                               std::memory_order_relaxed);
+                return 0;
+            }
+            spans[t & (capacity - 1)] = span;
+            tail.store(t + 1, std::memory_order_release);
+            return n + 1;
+        }
+
+        // Called by the draining fiber only.
+        void PopAll(std::vector<Span *> *out) {
+            const uint64_t h = head.load(std::memory_order_relaxed);
+            const uint64_t t = tail.load(std::memory_order_acquire);
+            for (uint64_t i = h; i != t; ++i) {
+                out->push_back(spans[i & (capacity - 1)]);
+            }
+            head.store(t, std::memory_order_release);
+        }
+
+        const size_t capacity;  // power of 2
+        Span **const spans;
+        std::atomic<int64_t> ndropped;
+        // Set when the owner thread quits.
+        std::atomic<bool> orphaned;
+        // Part of `ndropped' counted by the draining fiber.
+        int64_t ndropped_seen;
+        std::atomic<uint64_t> head FLARE_CACHELINE_ALIGNMENT;
+        std::atomic<uint64_t> tail FLARE_CACHELINE_ALIGNMENT;
+    };
+
     class SpanDB : public SharedObject {
     public:
-        leveldb::DB *id_db;
-        leveldb::DB *time_db;
-        std::string id_db_name;
-        std::string time_db_name;
-
-        SpanDB() : id_db(NULL), time_db(NULL) {}
+        std::string dir_name;
 
+        // Create a directory for spans of this process.
         static SpanDB *Open();
 
-        leveldb::Status Index(const Span *span, std::string *value_buf);
+        // Load segments from a file or directory for queries only.
+        static SpanDB *Load(const char *path);
+
+        // Called by the draining fiber only.
+        // Returns 0 on success, -1 if the DB is not usable anymore.
+        int Index(const Span *span, RpczSpan *buf);
 
-        leveldb::Status RemoveSpansBefore(int64_t tm);
+        // Remove segments only containing spans before `tm'.
+        void RemoveSpansBefore(int64_t tm);
+
+        // Get segments from the newest to the oldest.
+        void ListSegments(std::vector<flare::container::intrusive_ptr<SpanSegment> > *out) const;
 
     private:
-        static void Swap(SpanDB &db1, SpanDB &db2) {
-            std::swap(db1.id_db, db2.id_db);
-            std::swap(db1.id_db_name, db2.id_db_name);
-            std::swap(db1.time_db, db2.time_db);
-            std::swap(db1.time_db_name, db2.time_db_name);
+        SpanDB() : _last_time_key(0), _next_segment_index(0), _writable(false) {
+            pthread_mutex_init(&_mutex, NULL);
         }
 
         ~SpanDB() {
-            if (id_db == NULL && time_db == NULL) {
-                return;
+            const bool keep = (!_writable || FLAGS_rpcz_keep_span_db);
+            {
+                FLARE_SCOPED_LOCK(_mutex);
+                for (size_t i = 0; i < _segments.size(); ++i) {
+                    _segments[i]->set_keep_file(keep);
+                }
+                _segments.clear();
             }
-            delete id_db;
-            delete time_db;
-            if (!FLAGS_rpcz_keep_span_db) {
-                std::string cmd = flare::string_printf("rm -rf %s %s",
-                                                       id_db_name.c_str(),
-                                                       time_db_name.c_str());
-                flare::base::ignore_result(system(cmd.c_str()));
+            _current.reset();
+            if (!keep) {
+                std::error_code ec;
+                flare::remove_all(flare::file_path(dir_name), ec);
             }
+            pthread_mutex_destroy(&_mutex);
         }
+
+        int AddSegment();
+
+        int64_t _last_time_key;
+        uint64_t _next_segment_index;
+        bool _writable;
+        // Being appended, accessed by the draining fiber only.
+        flare::container::intrusive_ptr<SpanSegment> _current;
+        // Segments from the oldest to the newest.
+        mutable pthread_mutex_t _mutex;
+        std::deque<flare::container::intrusive_ptr<SpanSegment> > _segments;
     };
 
     static bool started_span_indexing = false;
     static pthread_once_t start_span_indexing_once = PTHREAD_ONCE_INIT;
-    static int64_t g_last_time_key = 0;
     static int64_t g_last_delete_tm = 0;
 
-// Following variables are monitored by builtin services, thus non-static.
+    // Only protects switching of g_span_db, spans are indexed without it.
     static pthread_mutex_t g_span_db_mutex = PTHREAD_MUTEX_INITIALIZER;
     static bool g_span_ending = false;  // don't open span again if this var is true.
 // Can't use intrusive_ptr which has ctor/dtor issues.
     static SpanDB *g_span_db = NULL;
 
+    // All SpanRing ever created and not deleted yet.
+    static pthread_mutex_t g_span_ring_mutex = PTHREAD_MUTEX_INITIALIZER;
+    static std::vector<SpanRing *> *g_span_rings = NULL;
+    static __thread SpanRing *tls_span_ring = NULL;
+    // Span::DrainSpans sleeps on it, bumped to wake it up.
+    static std::atomic<int> *g_span_drain_butex = NULL;
+
     bool has_span_db() { return !!g_span_db; }
 
-    flare::CollectorSpeedLimit g_span_sl = VARIABLE_COLLECTOR_SPEED_LIMIT_INITIALIZER;
+    // The sampling range is adjusted by Span::DrainSpans rather than
+    // flare::Collector, start with sampling everything.
+    flare::CollectorSpeedLimit g_span_sl = {
+            flare::COLLECTOR_SAMPLING_BASE, true, FLARE_STATIC_ATOMIC_INIT(0), 0};
     static flare::DisplaySamplingRatio s_display_sampling_ratio(
             "rpcz_sampling_ratio", &g_span_sl);
 
-    struct SpanEarlier {
-        bool operator()(flare::Collected *c1, flare::Collected *c2) const {
-            return ((Span *) c1)->GetStartRealTimeUs() < ((Span *) c2)->GetStartRealTimeUs();
-        }
-    };
-
-    class SpanPreprocessor : public flare::CollectorPreprocessor {
-    public:
-        void process(std::vector<flare::Collected *> &list) {
-            // Sort spans by their starting time so that the code on making
-            // time monotonic in Span::Index works better.
-            std::sort(list.begin(), list.end(), SpanEarlier());
-        }
-    };
-
-    static SpanPreprocessor *g_span_prep = NULL;
+    static std::atomic<int64_t> g_span_indexed(0);
+    static std::atomic<int64_t> g_span_dropped(0);
 
-    flare::CollectorSpeedLimit *Span::speed_limit() {
-        return &g_span_sl;
+    static int64_t GetSpanCount(void *arg) {
+        return static_cast<std::atomic<int64_t> *>(arg)->load(std::memory_order_relaxed);
     }
 
-    flare::CollectorPreprocessor *Span::preprocessor() {
-        return g_span_prep;
-    }
+    static flare::status_gauge<int64_t> s_span_indexed(
+            "rpcz_span_indexed", GetSpanCount, &g_span_indexed);
+    static flare::status_gauge<int64_t> s_span_dropped(
+            "rpcz_span_dropped", GetSpanCount, &g_span_dropped);
+
+    struct SpanEarlier {
+        bool operator()(const Span *s1, const Span *s2) const {
+            return s1->GetStartRealTimeUs() < s2->GetStartRealTimeUs();
+        }
+    };
 
     static void ResetSpanDB(SpanDB *db) {
         SpanDB *old_db = NULL;
@@ -398,14 +496,30 @@ namespace flare::rpc {
         }
     }
 
+    static void WakeSpanDrainer() {
+        g_span_drain_butex->fetch_add(1, std::memory_order_release);
+        flare::fiber_internal::waitable_event_wake(g_span_drain_butex);
+    }
+
     static void RemoveSpanDB() {
         g_span_ending = true;
         ResetSpanDB(NULL);
+        WakeSpanDrainer();
     }
 
     static void StartSpanIndexing() {
+        g_span_drain_butex =
+                flare::fiber_internal::waitable_event_create_checked<std::atomic<int> >();
+        if (g_span_drain_butex == NULL) {
+            FLARE_LOG(ERROR) << "Fail to create the butex of indexing spans";
+            return;
+        }
         atexit(RemoveSpanDB);
-        g_span_prep = new SpanPreprocessor;
+        fiber_id_t th;
+        if (fiber_start_background(&th, NULL, Span::DrainSpans, NULL) != 0) {
+            FLARE_LOG(ERROR) << "Fail to start the fiber indexing spans";
+            return;
+        }
         started_span_indexing = true;
     }
 
@@ -425,9 +539,54 @@ namespace flare::rpc {
         return -1;
     }
 
-    void Span::Submit(Span *span, int64_t cpuwide_time_us) {
-        if (span->local_parent() == NULL) {
-            span->submit(cpuwide_time_us);
+    static void OrphanSpanRing(void *arg) {
+        tls_span_ring = NULL;
+        static_cast<SpanRing *>(arg)->orphaned.store(true, std::memory_order_release);
+    }
+
+    static SpanRing *GetOrNewSpanRing() {
+        SpanRing *ring = tls_span_ring;
+        if (ring != NULL) {
+            return ring;
+        }
+        size_t capacity = 1;
+        while (capacity < (size_t) FLAGS_rpcz_span_ring_size) {
+            capacity <<= 1;
+        }
+        ring = new(std::nothrow) SpanRing(capacity);
+        if (ring == NULL) {
+            return NULL;
+        }
+        {
+            FLARE_SCOPED_LOCK(g_span_ring_mutex);
+            if (g_span_rings == NULL) {
+                g_span_rings = new std::vector<SpanRing *>;
+            }
+            g_span_rings->push_back(ring);
+        }
+        flare::thread::atexit(OrphanSpanRing, ring);
+        tls_span_ring = ring;
+        return ring;
+    }
+
+    void Span::Submit(Span *span, int64_t /*cpuwide_time_us*/) {
+        if (span->local_parent() != NULL) {
+            return;
+        }
+        if (g_span_ending || StartIndexingIfNeeded() != 0) {
+            span->destroy();
+            return;
+        }
+        SpanRing *ring = GetOrNewSpanRing();
+        const size_t n = (ring != NULL ? ring->Push(span) : 0);
+        if (n == 0) {
+            // The draining fiber falls behind, drop the span instead of
+            // buffering without bound.
+            span->destroy();
+        } else if (n == ring->capacity / 2 + 1) {
+            // Wake up the draining fiber once per filling of the ring rather
+            // than per span.
+            WakeSpanDrainer();
         }
     }
 
@@ -455,18 +614,7 @@ namespace flare::rpc {
         out->set_error_code(span->error_code());
     }
 
-    inline void ToBigEndian(uint64_t n, uint32_t *buf) {
-        buf[0] = htonl(n >> 32);
-        buf[1] = htonl(n & 0xFFFFFFFFUL);
-    }
-
-    inline uint64_t ToLittleEndian(const uint32_t *buf) {
-        return (((uint64_t) ntohl(buf[0])) << 32) | ntohl(buf[1]);
-    }
-
     SpanDB *SpanDB::Open() {
-        SpanDB local;
-        leveldb::Status st;
         char prefix[64];
         time_t rawtime;
         time(&rawtime);
@@ -476,214 +624,314 @@ namespace flare::rpc {
                                    "/%Y%m%d.%H%M%S", timeinfo);
         const int nw2 = snprintf(prefix + nw, sizeof(prefix) - nw, ".%d",
                                  getpid());
-        leveldb::Options options;
-        options.create_if_missing = true;
-        options.error_if_exists = true;
-
-        local.id_db_name.append(FLAGS_rpcz_database_dir);
-        local.id_db_name.append(prefix, nw + nw2);
-        // Create the dir first otherwise leveldb fails.
+        std::string dir_name = FLAGS_rpcz_database_dir;
+        dir_name.append(prefix, nw + nw2);
         std::error_code ec;
-        const flare::file_path dir(local.id_db_name);
+        const flare::file_path dir(dir_name);
         if (!flare::create_directories(dir, ec)) {
             FLARE_LOG(ERROR) << "Fail to create directory=`" << dir.c_str() << ", "
                              << ec.message();
             return NULL;
         }
-
-        local.id_db_name.append("/id.db");
-        st = leveldb::DB::Open(options, local.id_db_name.c_str(), &local.id_db);
-        if (!st.ok()) {
-            FLARE_LOG(ERROR) << "Fail to open id_db: " << st.ToString();
+        SpanDB *db = new(std::nothrow) SpanDB;
+        if (NULL == db) {
             return NULL;
         }
+        db->dir_name = dir_name;
+        db->_writable = true;
+        FLARE_LOG(INFO) << "Opened " << dir_name;
+        return db;
+    }
 
-        local.time_db_name.append(FLAGS_rpcz_database_dir);
-        local.time_db_name.append(prefix, nw + nw2);
-        local.time_db_name.append("/time.db");
-        st = leveldb::DB::Open(options, local.time_db_name.c_str(), &local.time_db);
-        if (!st.ok()) {
-            FLARE_LOG(ERROR) << "Fail to open time_db: " << st.ToString();
+    SpanDB *SpanDB::Load(const char *path) {
+        std::vector<std::string> files;
+        std::error_code ec;
+        if (flare::is_directory(flare::file_path(path), ec)) {
+            if (flare::exists(flare::file_path(path) / "id.db", ec)) {
+                FLARE_LOG(ERROR) << path << " is stored in leveldb by an older version, "
+                                    "convert it with tools/rpcz_migrate first";
+                return NULL;
+            }
+            for (flare::directory_iterator it(path, ec), end; !ec && it != end; it.increment(ec)) {
+                if (!it->is_directory() && it->file_path().extension() == ".span") {
+                    files.push_back(it->file_path().string());
+                }
+            }
+            // Names of segments are ordered by their creation.
+            std::sort(files.begin(), files.end());
+        } else {
+            files.push_back(path);
+        }
+        if (ec) {
+            FLARE_LOG(ERROR) << "Fail to list " << path << ", " << ec.message();
             return NULL;
         }
         SpanDB *db = new(std::nothrow) SpanDB;
         if (NULL == db) {
             return NULL;
         }
-        FLARE_LOG(INFO) << "Opened " << local.id_db_name << " and "
-                        << local.time_db_name;
-        Swap(local, *db);
+        db->dir_name = path;
+        for (size_t i = 0; i < files.size(); ++i) {
+            SpanSegment *seg = SpanSegment::Open(files[i]);
+            if (seg == NULL) {
+                delete db;
+                return NULL;
+            }
+            db->_segments.push_back(seg);
+        }
         return db;
     }
 
-    leveldb::Status SpanDB::Index(const Span *span, std::string *value_buf) {
-        leveldb::WriteOptions options;
-        options.sync = false;
-
-        leveldb::Status st;
-
-        // NOTE: Writing into time_db before id_db so that if the second write
-        // fails, the entry in time_db will be finally removed when it's out
-        // of time window.
+    int SpanDB::AddSegment() {
+        // In case that the directory was removed while retrying after a
+        // failure.
+        std::error_code ec;
+        flare::create_directories(flare::file_path(dir_name), ec);
+        char name[32];
+        snprintf(name, sizeof(name), "/%06" PRIu64 ".span", _next_segment_index++);
+        const size_t capacity = (size_t) FLAGS_rpcz_span_segment_size_mb * 1024 * 1024;
+        SpanSegment *seg = SpanSegment::Create(dir_name + name, capacity);
+        if (seg == NULL) {
+            return -1;
+        }
+        _current = seg;
+        FLARE_SCOPED_LOCK(_mutex);
+        _segments.push_back(seg);
+        while (_segments.size() > (size_t) FLAGS_rpcz_max_span_segments) {
+            _segments.pop_front();
+        }
+        return 0;
+    }
 
+    int SpanDB::Index(const Span *span, RpczSpan *buf) {
         const int64_t start_time = span->GetStartRealTimeUs();
-        BriefSpan brief;
-        brief.set_trace_id(span->trace_id());
-        brief.set_span_id(span->span_id());
-        brief.set_log_id(span->log_id());
-        brief.set_type(span->type());
-        brief.set_error_code(span->error_code());
-        brief.set_request_size(span->request_size());
-        brief.set_response_size(span->response_size());
-        brief.set_start_real_us(start_time);
-        brief.set_latency_us(span->GetEndRealTimeUs() - start_time);
-        brief.set_full_method_name(span->full_method_name());
-        if (!brief.SerializeToString(value_buf)) {
-            return leveldb::Status::InvalidArgument(
-                    leveldb::Slice("Fail to serialize BriefSpan"));
-        }
-        // We need to make the time monotonic otherwise if older entries are
-        // overwritten by newer ones, entries in id_db associated with the older
-        // entries are not evicted. Surely we can call DB::Get() before Put(), but
-        // that would be too slow due to the storage model of leveldb. One feasible
-        // method is to maintain recent window of keys to time_db, when there's a
-        // conflict before Put(), try key+1us until an unused time is found. The
-        // window could be 5~10s. However this method needs a std::map(slow) or
-        // hashmap+queue(more memory: remember that we're just a framework), and
-        // this method can't guarantee no duplication when real time goes back
-        // significantly.
-        // Since the time to this method is ALMOST in ascending order, we use a
-        // very simple strategy: if the time is not greater than last-time, set
-        // it to be last-time + 1us. This works when time goes back because the
-        // real time is at least 1000000 / FLAGS_rpcz_max_span_per_second times faster
-        // and it will finally catch up with our time key. (provided the flag
-        // is less than 1000000).
+        // We need to make the time monotonic so that the time index of
+        // segments is sorted. Since the spans are sorted by their starting
+        // time before being indexed, the time is ALMOST in ascending order,
+        // we use a very simple strategy: if the time is not greater than
+        // last-time, set it to be last-time + 1us. This works when time goes
+        // back because the real time is at least 1000000 /
+        // FLAGS_rpcz_max_span_per_second times faster and it will finally
+        // catch up with our time key. (provided the flag is less than 1000000).
         int64_t time_key = start_time;
-        if (time_key <= g_last_time_key) {
-            time_key = g_last_time_key + 1;
-        }
-        g_last_time_key = time_key;
-        uint32_t time_data[2];
-        ToBigEndian(time_key, time_data);
-        st = time_db->Put(options,
-                          leveldb::Slice((char *) time_data, sizeof(time_data)),
-                          leveldb::Slice(value_buf->data(), value_buf->size()));
-        if (!st.ok()) {
-            return st;
-        }
-
-        uint32_t key_data[4];
-        ToBigEndian(span->trace_id(), key_data);
-        ToBigEndian(span->span_id(), key_data + 2);
-        leveldb::Slice key((char *) key_data, sizeof(key_data));
-        RpczSpan value_proto;
-        Span2Proto(span, &value_proto);
+        if (time_key <= _last_time_key) {
+            time_key = _last_time_key + 1;
+        }
+        _last_time_key = time_key;
+
+        SpanRecordInfo info;
+        info.trace_id = span->trace_id();
+        info.span_id = span->span_id();
+        info.log_id = span->log_id();
+        info.time_key = time_key;
+        info.start_real_us = start_time;
+        info.latency_us = span->GetEndRealTimeUs() - start_time;
+        info.error_code = span->error_code();
+        info.request_size = span->request_size();
+        info.response_size = span->response_size();
+        info.type = span->type();
+
+        buf->Clear();
+        Span2Proto(span, buf);
+        // Stored in front of the record.
+        buf->clear_full_method_name();
         // client spans should be reversed.
         size_t client_span_count = span->CountClientSpans();
         for (size_t i = 0; i < client_span_count; ++i) {
-            value_proto.add_client_spans();
+            buf->add_client_spans();
         }
         size_t i = 0;
         for (const Span *p = span->_next_client; p; p = p->_next_client, ++i) {
-            Span2Proto(p, value_proto.mutable_client_spans(client_span_count - i - 1));
-        }
-        if (!value_proto.SerializeToString(value_buf)) {
-            return leveldb::Status::InvalidArgument(
-                    leveldb::Slice("Fail to serialize RpczSpan"));
-        }
-        leveldb::Slice value(value_buf->data(), value_buf->size());
-        st = id_db->Put(options, key, value);
-        return st;
-    }
-
-// NOTE: may take more than 100ms
-    leveldb::Status SpanDB::RemoveSpansBefore(int64_t tm) {
-        if (id_db == NULL || time_db == NULL) {
-            return leveldb::Status::InvalidArgument(leveldb::Slice("NULL param"));
-        }
-        leveldb::Status rc;
-        leveldb::WriteOptions options;
-        options.sync = false;
-        leveldb::Iterator *it = time_db->NewIterator(leveldb::ReadOptions());
-        for (it->SeekToFirst(); it->Valid(); it->Next()) {
-            if (it->key().size() != 8) {
-                FLARE_LOG(ERROR) << "Invalid key size: " << it->key().size();
-                continue;
+            Span2Proto(p, buf->mutable_client_spans(client_span_count - i - 1));
+        }
+        if (_current != NULL &&
+            _current->Append(info, span->full_method_name(), *buf)) {
+            return 0;
+        }
+        if (AddSegment() != 0) {
+            return -1;
+        }
+        if (!_current->Append(info, span->full_method_name(), *buf)) {
+            FLARE_LOG(WARNING) << "Span of " << span->full_method_name()
+                               << " is too large to be indexed";
+        }
+        return 0;
+    }
+
+    void SpanDB::RemoveSpansBefore(int64_t tm) {
+        FLARE_SCOPED_LOCK(_mutex);
+        // Never remove the segment being appended.
+        while (_segments.size() > 1 && _segments.front()->max_time_key() < tm) {
+            _segments.pop_front();
+        }
+    }
+
+    void SpanDB::ListSegments(
+            std::vector<flare::container::intrusive_ptr<SpanSegment> > *out) const {
+        out->clear();
+        FLARE_SCOPED_LOCK(_mutex);
+        out->assign(_segments.rbegin(), _segments.rend());
+    }
+
+    static void UpdateSpanSamplingRange(int64_t nsubmit, int64_t interval_us) {
+        // Same as flare::Collector: the spans submitted were sampled with
+        // current sampling_range, scale it to get the expected rate.
+        const size_t old_sampling_range = g_span_sl.sampling_range;
+        size_t new_sampling_range = 0;
+        if (nsubmit == 0) {
+            new_sampling_range = old_sampling_range * 2;
+        } else {
+            // NOTE: the multiplications are unlikely to overflow.
+            new_sampling_range = (size_t) FLAGS_rpcz_max_span_per_second
+                                 * interval_us * old_sampling_range / (1000000L * nsubmit);
+        }
+        if (new_sampling_range == 0) {
+            new_sampling_range = 1;
+        } else if (new_sampling_range > flare::COLLECTOR_SAMPLING_BASE) {
+            new_sampling_range = flare::COLLECTOR_SAMPLING_BASE;
+        }
+        if (new_sampling_range != old_sampling_range) {
+            g_span_sl.sampling_range = new_sampling_range;
+        }
+    }
+
+    void *Span::DrainSpans(void *) {
+        std::vector<SpanRing *> rings;
+        std::vector<Span *> spans;
+        RpczSpan buf;
+        int64_t last_update_us = flare::get_current_time_micros();
+        int64_t nsubmit = 0;
+        // After failing to open or write the SpanDB, e.g. the disk is full,
+        // spans are dropped until `retry_us' instead of retrying for every
+        // batch.
+        int64_t retry_us = 0;
+        int64_t retry_interval_us = SPAN_MIN_RETRY_INTERVAL_US;
+        while (!g_span_ending) {
+            const int expected = g_span_drain_butex->load(std::memory_order_acquire);
+            rings.clear();
+            {
+                FLARE_SCOPED_LOCK(g_span_ring_mutex);
+                if (g_span_rings != NULL) {
+                    rings = *g_span_rings;
+                }
             }
-            const int64_t realtime =
-                    ToLittleEndian((const uint32_t *) it->key().data());
-            if (realtime >= tm) {  // removal is done.
-                break;
+            spans.clear();
+            for (size_t i = 0; i < rings.size(); ++i) {
+                SpanRing *ring = rings[i];
+                // Check before popping, spans pushed before the thread quit
+                // are visible then.
+                const bool orphaned = ring->orphaned.load(std::memory_order_acquire);
+                ring->PopAll(&spans);
+                const int64_t ndropped = ring->ndropped.load(std::memory_order_relaxed);
+                if (ndropped != ring->ndropped_seen) {
+                    g_span_dropped.fetch_add(ndropped - ring->ndropped_seen,
+                                             std::memory_order_relaxed);
+                    nsubmit += ndropped - ring->ndropped_seen;
+                    ring->ndropped_seen = ndropped;
+                }
+                if (orphaned) {
+                    {
+                        FLARE_SCOPED_LOCK(g_span_ring_mutex);
+                        g_span_rings->erase(std::find(g_span_rings->begin(),
+                                                      g_span_rings->end(), ring));
+                    }
+                    delete ring;
+                }
             }
-            BriefSpan brief;
-            if (brief.ParseFromArray(it->value().data(), it->value().size())) {
-                uint32_t key_data[4];
-                ToBigEndian(brief.trace_id(), key_data);
-                ToBigEndian(brief.span_id(), key_data + 2);
-                leveldb::Slice key((char *) key_data, sizeof(key_data));
-                rc = id_db->Delete(options, key);
-                if (!rc.ok()) {
-                    FLARE_LOG(ERROR) << "Fail to delete from id_db";
-                    break;
+            nsubmit += spans.size();
+
+            if (!spans.empty()) {
+                std::sort(spans.begin(), spans.end(), SpanEarlier());
+                flare::container::intrusive_ptr<SpanDB> db;
+                bool failed = false;
+                // Spans are dropped while backing off.
+                if (flare::get_current_time_micros() >= retry_us &&
+                    GetSpanDB(&db) != 0 && !g_span_ending) {
+                    SpanDB *db2 = SpanDB::Open();
+                    if (db2 == NULL) {
+                        FLARE_LOG(WARNING) << "Fail to open SpanDB";
+                        failed = true;
+                    } else {
+                        ResetSpanDB(db2);
+                        db.reset(db2);
+                    }
+                }
+                int64_t nindexed = 0;
+                for (size_t i = 0; i < spans.size(); ++i) {
+                    if (db != NULL) {
+                        if (db->Index(spans[i], &buf) == 0) {
+                            ++nindexed;
+                        } else {
+                            // Keep the SpanDB, the segment is added again in
+                            // the same directory after backing off.
+                            failed = true;
+                            db.reset();
+                        }
+                    }
+                    spans[i]->destroy();
+                }
+                g_span_indexed.fetch_add(nindexed, std::memory_order_relaxed);
+                g_span_dropped.fetch_add(spans.size() - nindexed, std::memory_order_relaxed);
+                if (failed) {
+                    retry_us = flare::get_current_time_micros() + retry_interval_us;
+                    FLARE_LOG(WARNING) << "Drop spans for " << retry_interval_us / 1000000L
+                                       << " seconds after failing to index spans";
+                    retry_interval_us = std::min(retry_interval_us * 2, SPAN_MAX_RETRY_INTERVAL_US);
+                } else if (db != NULL) {
+                    retry_interval_us = SPAN_MIN_RETRY_INTERVAL_US;
+                }
+                // Remove old spans
+                const int64_t now = flare::get_current_time_micros();
+                if (db != NULL && now > g_last_delete_tm + SPAN_DELETE_INTERVAL_US) {
+                    g_last_delete_tm = now;
+                    db->RemoveSpansBefore(now - FLAGS_rpcz_keep_span_seconds * 1000000L);
                 }
-            } else {
-                FLARE_LOG(ERROR) << "Fail to parse from value";
             }
-            rc = time_db->Delete(options, it->key());
-            if (!rc.ok()) {
-                FLARE_LOG(ERROR) << "Fail to delete from time_db";
-                break;
+
+            const int64_t now = flare::get_current_time_micros();
+            if (now >= last_update_us + SPAN_SAMPLING_UPDATE_INTERVAL_US) {
+                UpdateSpanSamplingRange(nsubmit, now - last_update_us);
+                last_update_us = now;
+                nsubmit = 0;
             }
+            // Sleep until a ring is half full or the interval elapses. Wakeups
+            // after loading `expected' make the wait return immediately.
+            const timespec abstime = flare::time_point::from_unix_micros(
+                    now + SPAN_MAX_DRAIN_INTERVAL_US).to_timespec();
+            flare::fiber_internal::waitable_event_wait(g_span_drain_butex, expected, &abstime);
         }
-        delete it;
-        return rc;
+        return NULL;
     }
 
-// Write span into leveldb.
-    void Span::dump_and_destroy(size_t /*round*/) {
-        StartIndexingIfNeeded();
-
-        std::string value_buf;
-
-        flare::container::intrusive_ptr<SpanDB> db;
-        if (GetSpanDB(&db) != 0) {
-            if (g_span_ending) {
-                destroy();
-                return;
+    int FindSpan(SpanDB *db, uint64_t trace_id, uint64_t span_id, RpczSpan *response) {
+        std::vector<flare::container::intrusive_ptr<SpanSegment> > segments;
+        db->ListSegments(&segments);
+        for (size_t i = 0; i < segments.size(); ++i) {
+            if (segments[i]->FindSpan(trace_id, span_id, response) == 0) {
+                return 0;
             }
-            SpanDB *db2 = SpanDB::Open();
-            if (db2 == NULL) {
-                FLARE_LOG(WARNING) << "Fail to open SpanDB";
-                destroy();
-                return;
-            }
-            ResetSpanDB(db2);
-            db.reset(db2);
         }
+        return -1;
+    }
 
-        leveldb::Status st = db->Index(this, &value_buf);
-        destroy();
-        if (!st.ok()) {
-            FLARE_LOG(WARNING) << st.ToString();
-            if (st.IsNotFound() || st.IsIOError() || st.IsCorruption()) {
-                ResetSpanDB(NULL);
-                return;
-            }
+    void FindSpans(SpanDB *db, uint64_t trace_id, std::deque<RpczSpan> *out) {
+        out->clear();
+        std::vector<flare::container::intrusive_ptr<SpanSegment> > segments;
+        db->ListSegments(&segments);
+        for (size_t i = 0; i < segments.size(); ++i) {
+            segments[i]->FindSpans(trace_id, out);
         }
+    }
 
-        // Remove old spans
-        const int64_t now = flare::get_current_time_micros();
-        if (now > g_last_delete_tm + SPAN_DELETE_INTERVAL_US) {
-            g_last_delete_tm = now;
-            leveldb::Status st = db->RemoveSpansBefore(
-                    now - FLAGS_rpcz_keep_span_seconds * 1000000L);
-            if (!st.ok()) {
-                FLARE_LOG(ERROR) << st.ToString();
-                if (st.IsNotFound() || st.IsIOError() || st.IsCorruption()) {
-                    ResetSpanDB(NULL);
-                    return;
-                }
-            }
+    void ListSpans(SpanDB *db, int64_t starting_realtime, size_t max_scan,
+                   std::deque<BriefSpan> *out, SpanFilter *filter) {
+        out->clear();
+        std::vector<flare::container::intrusive_ptr<SpanSegment> > segments;
+        db->ListSegments(&segments);
+        size_t nscan = 0;
+        for (size_t i = 0; i < segments.size() && nscan < max_scan; ++i) {
+            nscan += segments[i]->ListSpans(starting_realtime, max_scan - nscan,
+                                            out, filter);
         }
     }
 
@@ -692,20 +940,7 @@ namespace flare::rpc {
         if (GetSpanDB(&db) != 0) {
             return -1;
         }
-        uint32_t key_data[4];
-        ToBigEndian(trace_id, key_data);
-        ToBigEndian(span_id, key_data + 2);
-        leveldb::Slice key((char *) key_data, sizeof(key_data));
-        std::string value;
-        leveldb::Status st = db->id_db->Get(leveldb::ReadOptions(), key, &value);
-        if (!st.ok()) {
-            return -1;
-        }
-        if (!response->ParseFromString(value)) {
-            FLARE_LOG(ERROR) << "Fail to parse from the value";
-            return -1;
-        }
-        return 0;
+        return FindSpan(db.get(), trace_id, span_id, response);
     }
 
     void FindSpans(uint64_t trace_id, std::deque<RpczSpan> *out) {
@@ -714,29 +949,7 @@ namespace flare::rpc {
         if (GetSpanDB(&db) != 0) {
             return;
         }
-        leveldb::Iterator *it = db->id_db->NewIterator(leveldb::ReadOptions());
-        uint32_t key_data[4];
-        ToBigEndian(trace_id, key_data);
-        ToBigEndian(0, key_data + 2);
-        leveldb::Slice key((char *) key_data, sizeof(key_data));
-        for (it->Seek(key); it->Valid(); it->Next()) {
-            if (it->key().size() != sizeof(key_data)) {
-                FLARE_LOG(ERROR) << "Invalid key size: " << it->key().size();
-                break;
-            }
-            const uint64_t stored_trace_id =
-                    ToLittleEndian((const uint32_t *) it->key().data());
-            if (trace_id != stored_trace_id) {
-                break;
-            }
-            RpczSpan span;
-            if (span.ParseFromArray(it->value().data(), it->value().size())) {
-                out->push_back(span);
-            } else {
-                FLARE_LOG(ERROR) << "Fail to parse from value";
-            }
-        }
-        delete it;
+        FindSpans(db.get(), trace_id, out);
     }
 
     void ListSpans(int64_t starting_realtime, size_t max_scan,
@@ -746,36 +959,7 @@ namespace flare::rpc {
         if (GetSpanDB(&db) != 0) {
             return;
         }
-        leveldb::Iterator *it = db->time_db->NewIterator(leveldb::ReadOptions());
-        uint32_t time_data[2];
-        ToBigEndian(starting_realtime, time_data);
-        leveldb::Slice key((char *) time_data, sizeof(time_data));
-        it->Seek(key);
-        if (!it->Valid()) {
-            it->SeekToLast();
-        }
-        BriefSpan brief;
-        size_t nscan = 0;
-        for (size_t i = 0; nscan < max_scan && it->Valid(); ++i, it->Prev()) {
-            const int64_t key_tm = ToLittleEndian((const uint32_t *) it->key().data());
-            // May have some bigger time at the beginning, because leveldb returns
-            // keys >= starting_realtime.
-            if (key_tm > starting_realtime) {
-                continue;
-            }
-            brief.Clear();
-            if (brief.ParseFromArray(it->value().data(), it->value().size())) {
-                if (NULL == filter || filter->Keep(brief)) {
-                    out->push_back(brief);
-                }
-                // We increase the count no matter filter passed or not to avoid
-                // scaning too many entries.
-                ++nscan;
-            } else {
-                FLARE_LOG(ERROR) << "Fail to parse from value";
-            }
-        }
-        delete it;
+        ListSpans(db.get(), starting_realtime, max_scan, out, filter);
     }
 
     void DescribeSpanDB(std::ostream &os) {
@@ -783,26 +967,65 @@ namespace flare::rpc {
         if (GetSpanDB(&db) != 0) {
             return;
         }
-
-        if (db->id_db != NULL) {
-            std::string val;
-            if (db->id_db->GetProperty(leveldb::Slice("leveldb.stats"), &val)) {
-                os << "[ " << db->id_db_name << " ]\n" << val;
-            }
-            if (db->id_db->GetProperty(leveldb::Slice("leveldb.sstables"), &val)) {
-                os << '\n' << val;
-            }
+        std::vector<flare::container::intrusive_ptr<SpanSegment> > segments;
+        db->ListSegments(&segments);
+        size_t nspan = 0;
+        size_t nbytes = 0;
+        for (size_t i = 0; i < segments.size(); ++i) {
+            nspan += segments[i]->span_count();
+            nbytes += segments[i]->size();
+        }
+        os << "[ " << db->dir_name << " ]\n"
+           << "segments: " << segments.size() << '/' << FLAGS_rpcz_max_span_segments << '\n'
+           << "spans: " << nspan << '\n'
+           << "bytes: " << nbytes << '\n'
+           << "indexed: " << g_span_indexed.load(std::memory_order_relaxed) << '\n'
+           << "dropped: " << g_span_dropped.load(std::memory_order_relaxed) << '\n';
+        for (size_t i = 0; i < segments.size(); ++i) {
+            const SpanSegment *seg = segments[i].get();
+            os << '\n' << seg->path() << " spans=" << seg->span_count()
+               << " size=" << seg->size() << '/' << seg->capacity()
+               << " time=[" << seg->min_time_key() << ',' << seg->max_time_key() << ']';
         }
         os << '\n';
-        if (db->time_db != NULL) {
-            std::string val;
-            if (db->time_db->GetProperty(leveldb::Slice("leveldb.stats"), &val)) {
-                os << "[ " << db->time_db_name << " ]\n" << val;
-            }
-            if (db->time_db->GetProperty(leveldb::Slice("leveldb.sstables"), &val)) {
-                os << '\n' << val;
-            }
+    }
+
+    SpanDB *LoadSpanDBFromFile(const char *filepath) {
+        SpanDB *db = SpanDB::Load(filepath);
+        if (db != NULL) {
+            db->AddRefManually();
+        }
+        return db;
+    }
+
+    void ReleaseSpanDB(SpanDB *db) {
+        if (db != NULL) {
+            db->RemoveRefManually();
+        }
+    }
+
+    size_t ExportSpans(SpanDB *db, std::ostream &os) {
+        std::vector<flare::container::intrusive_ptr<SpanSegment> > segments;
+        db->ListSegments(&segments);
+        size_t n = 0;
+        std::string json;
+        json2pb::Pb2JsonOptions options;
+        // Method names and annotations are text.
+        options.bytes_to_base64 = false;
+        for (size_t i = segments.size(); i > 0; --i) {
+            segments[i - 1]->ForEach([&](const RpczSpan &span) {
+                json.clear();
+                std::string error;
+                if (!json2pb::ProtoMessageToJson(span, &json, options, &error)) {
+                    FLARE_LOG(ERROR) << "Fail to convert span to json, " << error;
+                    return true;
+                }
+                os << json << '\n';
+                ++n;
+                return true;
+            });
         }
+        return n;
     }
 
 } // namespace flare::rpc
@@ -44,7 +44,7 @@ namespace flare::rpc {
 
     // Collect information required by /rpcz and tracing system whose idea is
     // described in http://static.googleusercontent.com/media/research.google.com/en//pubs/archive/36356.pdf
-    class Span : public flare::Collected {
+    class Span {
         friend class SpanDB;
 
         struct Forbidden {
@@ -173,17 +173,15 @@ namespace flare::rpc {
 
         const std::string &info() const { return _info; }
 
+        // Index spans submitted by all threads until the program quits,
+        // started by the first Submit().
+        static void *DrainSpans(void *);
+
     private:
         FLARE_DISALLOW_COPY_AND_ASSIGN(Span);
 
-        void dump_and_destroy(size_t round_index);
-
         void destroy();
 
-        flare::CollectorSpeedLimit *speed_limit();
-
-        flare::CollectorPreprocessor *preprocessor();
-
         void EndAsParent() {
             if (this == (Span *) flare::fiber_internal::tls_bls.rpcz_parent_span) {
                 flare::fiber_internal::tls_bls.rpcz_parent_span = NULL;
@@ -261,8 +259,17 @@ namespace flare::rpc {
 
     void DescribeSpanDB(std::ostream &os);
 
+    // Load spans kept by -rpcz_keep_span_db for offline queries, `filepath'
+    // is either a segment or a directory of segments.
+    // Returns NULL on error, otherwise call ReleaseSpanDB() after use.
     SpanDB *LoadSpanDBFromFile(const char *filepath);
 
+    void ReleaseSpanDB(SpanDB *db);
+
+    // Write spans in `db' into `os' as json from the oldest to the newest,
+    // one span per line. Returns number of spans written.
+    size_t ExportSpans(SpanDB *db, std::ostream &os);
+
     int FindSpan(SpanDB *db, uint64_t trace_id, uint64_t span_id, RpczSpan *span);
 
     void FindSpans(SpanDB *db, uint64_t trace_id, std::deque<RpczSpan> *out);
@@ -0,0 +1,444 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include "flare/log/logging.h"
+#include "flare/times/time.h"
+#include "flare/rpc/span.h"
+#include "flare/rpc/span_store.h"
+#include "flare/base/errno.h"
+
+
+namespace flare::rpc {
+
+    static const char SPAN_SEGMENT_MAGIC[8] = {'F', 'L', 'R', 'P', 'C', 'Z', 'S', 'G'};
+    static const uint32_t SPAN_SEGMENT_VERSION = 1;
+    static const size_t SPAN_SEGMENT_HEADER_SIZE = 4096;
+    // Index the first record of every so many bytes.
+    static const size_t kSpanIndexInterval = 16384;
+    // Must be power of 2.
+    static const uint32_t kSpanBucketCount = 65536;
+    // Offsets are stored in 32 bits.
+    static const size_t kMaxSpanSegmentSize = 0xFFFFFFFFUL;
+    static const size_t kMinSpanSegmentSize = 1024 * 1024;
+
+    struct SpanSegment::Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t bucket_count;
+        uint64_t capacity;
+        uint64_t index_offset;
+        uint64_t index_capacity;
+        uint64_t bucket_offset;
+        uint64_t data_offset;
+        int64_t created_real_us;
+        // Following fields are modified by the writer atomically.
+        // Records in [data_offset, data_end) are complete.
+        uint64_t data_end;
+        uint64_t span_count;
+        uint64_t index_count;
+        int64_t min_time_key;
+        int64_t max_time_key;
+    };
+
+    struct SpanIndexEntry {
+        int64_t time_key;
+        uint64_t offset;
+    };
+
+    // Followed by full_method_name and the serialized RpczSpan.
+    struct SpanSegment::RecordHeader {
+        // Size of the record including this header, aligned to 8 bytes.
+        uint32_t size;
+        // Size of the previous record, 0 for the first record.
+        uint32_t prev_size;
+        // Offset of the previous record in the same bucket, 0 for none.
+        uint32_t next_in_bucket;
+        uint32_t name_size;
+        uint32_t payload_size;
+        int32_t type;
+        uint64_t trace_id;
+        uint64_t span_id;
+        uint64_t log_id;
+        int64_t time_key;
+        int64_t start_real_us;
+        int64_t latency_us;
+        int32_t error_code;
+        int32_t request_size;
+        int32_t response_size;
+        int32_t reserved;
+    };
+
+    static_assert(sizeof(SpanIndexEntry) == 16, "unexpected size");
+
+    inline size_t align_up(size_t n, size_t align) {
+        return (n + align - 1) & ~(align - 1);
+    }
+
+    inline uint32_t span_bucket(uint64_t trace_id, uint32_t bucket_count) {
+        // Lower bits of trace_id are sequence numbers, mix them.
+        trace_id ^= trace_id >> 33;
+        trace_id *= 0xff51afd7ed558ccdULL;
+        trace_id ^= trace_id >> 33;
+        return (uint32_t) trace_id & (bucket_count - 1);
+    }
+
+    SpanSegment::SpanSegment()
+            : _fd(-1), _base(NULL), _capacity(0), _writable(false), _keep_file(false), _last_offset(0),
+              _last_indexed_offset(0) {
+    }
+
+    SpanSegment::~SpanSegment() {
+        if (_base != NULL) {
+            munmap(_base, _capacity);
+            _base = NULL;
+        }
+        if (_fd >= 0) {
+            ::close(_fd);
+            _fd = -1;
+        }
+        if (_writable && !_keep_file) {
+            ::unlink(_path.c_str());
+        }
+    }
+
+    SpanSegment *SpanSegment::Create(const std::string &path, size_t capacity) {
+        if (capacity < kMinSpanSegmentSize || capacity > kMaxSpanSegmentSize) {
+            FLARE_LOG(ERROR) << "Invalid capacity=" << capacity << " of " << path;
+            return NULL;
+        }
+        capacity = align_up(capacity, SPAN_SEGMENT_HEADER_SIZE);
+        const int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            FLARE_PLOG(ERROR) << "Fail to create " << path;
+            return NULL;
+        }
+        // Allocate blocks up-front, writing to a hole of a full disk through
+        // the mapping raises SIGBUS.
+        const int rc = posix_fallocate(fd, 0, capacity);
+        if (rc != 0) {
+            FLARE_LOG(ERROR) << "Fail to allocate " << capacity << " bytes for "
+                             << path << ", " << flare_error(rc);
+            ::close(fd);
+            ::unlink(path.c_str());
+            return NULL;
+        }
+        void *base = mmap(NULL, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (base == MAP_FAILED) {
+            FLARE_PLOG(ERROR) << "Fail to mmap " << path;
+            ::close(fd);
+            ::unlink(path.c_str());
+            return NULL;
+        }
+        SpanSegment *seg = new SpanSegment;
+        seg->_path = path;
+        seg->_fd = fd;
+        seg->_base = (char *) base;
+        seg->_capacity = capacity;
+        seg->_writable = true;
+
+        Header *h = seg->mutable_header();
+        memset(h, 0, sizeof(*h));
+        memcpy(h->magic, SPAN_SEGMENT_MAGIC, sizeof(h->magic));
+        h->version = SPAN_SEGMENT_VERSION;
+        h->bucket_count = kSpanBucketCount;
+        h->capacity = capacity;
+        h->index_offset = SPAN_SEGMENT_HEADER_SIZE;
+        h->index_capacity = capacity / kSpanIndexInterval + 1;
+        h->bucket_offset = align_up(h->index_offset + h->index_capacity * sizeof(SpanIndexEntry),
+                                    SPAN_SEGMENT_HEADER_SIZE);
+        h->data_offset = align_up(h->bucket_offset + h->bucket_count * sizeof(uint32_t),
+                                  SPAN_SEGMENT_HEADER_SIZE);
+        h->created_real_us = flare::get_current_time_micros();
+        h->data_end = h->data_offset;
+        return seg;
+    }
+
+    SpanSegment *SpanSegment::Open(const std::string &path) {
+        const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            FLARE_PLOG(ERROR) << "Fail to open " << path;
+            return NULL;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0 || (size_t) st.st_size < SPAN_SEGMENT_HEADER_SIZE) {
+            FLARE_LOG(ERROR) << path << " is not a span segment";
+            ::close(fd);
+            return NULL;
+        }
+        const size_t file_size = st.st_size;
+        void *base = mmap(NULL, file_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (base == MAP_FAILED) {
+            FLARE_PLOG(ERROR) << "Fail to mmap " << path;
+            ::close(fd);
+            return NULL;
+        }
+        SpanSegment *seg = new SpanSegment;
+        seg->_path = path;
+        seg->_fd = fd;
+        seg->_base = (char *) base;
+        seg->_capacity = file_size;
+
+        const Header *h = seg->header();
+        if (memcmp(h->magic, SPAN_SEGMENT_MAGIC, sizeof(h->magic)) != 0 ||
+            h->version != SPAN_SEGMENT_VERSION ||
+            h->capacity > file_size ||
+            h->bucket_count == 0 ||
+            (h->bucket_count & (h->bucket_count - 1)) != 0 ||
+            h->index_offset + h->index_capacity * sizeof(SpanIndexEntry) > h->bucket_offset ||
+            h->bucket_offset + h->bucket_count * sizeof(uint32_t) > h->data_offset ||
+            h->data_offset > h->data_end ||
+            h->data_end > h->capacity) {
+            FLARE_LOG(ERROR) << path << " is not a valid span segment";
+            delete seg;
+            return NULL;
+        }
+        return seg;
+    }
+
+    uint32_t *SpanSegment::buckets() const {
+        return (uint32_t *) (_base + header()->bucket_offset);
+    }
+
+    size_t SpanSegment::size() const {
+        return __atomic_load_n(&header()->data_end, __ATOMIC_ACQUIRE);
+    }
+
+    size_t SpanSegment::span_count() const {
+        return __atomic_load_n(&header()->span_count, __ATOMIC_RELAXED);
+    }
+
+    int64_t SpanSegment::min_time_key() const {
+        if (size() == header()->data_offset) {
+            return 0;
+        }
+        return header()->min_time_key;
+    }
+
+    int64_t SpanSegment::max_time_key() const {
+        return __atomic_load_n(&header()->max_time_key, __ATOMIC_RELAXED);
+    }
+
+    bool SpanSegment::Append(const SpanRecordInfo &info, const std::string &full_method_name,
+                             const RpczSpan &span) {
+        FLARE_CHECK(_writable);
+        Header *h = mutable_header();
+        const size_t payload_size = span.ByteSizeLong();
+        const size_t record_size = align_up(
+                sizeof(RecordHeader) + full_method_name.size() + payload_size, 8);
+        const uint64_t offset = h->data_end;
+        if (offset + record_size > _capacity) {
+            return false;
+        }
+        uint32_t *head = &buckets()[span_bucket(info.trace_id, h->bucket_count)];
+
+        RecordHeader *rec = (RecordHeader *) (_base + offset);
+        rec->size = record_size;
+        rec->prev_size = (_last_offset ? offset - _last_offset : 0);
+        rec->next_in_bucket = *head;
+        rec->name_size = full_method_name.size();
+        rec->payload_size = payload_size;
+        rec->type = info.type;
+        rec->trace_id = info.trace_id;
+        rec->span_id = info.span_id;
+        rec->log_id = info.log_id;
+        rec->time_key = info.time_key;
+        rec->start_real_us = info.start_real_us;
+        rec->latency_us = info.latency_us;
+        rec->error_code = info.error_code;
+        rec->request_size = info.request_size;
+        rec->response_size = info.response_size;
+        rec->reserved = 0;
+        char *p = (char *) (rec + 1);
+        memcpy(p, full_method_name.data(), full_method_name.size());
+        span.SerializeWithCachedSizesToArray((uint8_t *) p + full_method_name.size());
+
+        if ((h->index_count == 0 || offset >= _last_indexed_offset + kSpanIndexInterval) &&
+            h->index_count < h->index_capacity) {
+            SpanIndexEntry *e = (SpanIndexEntry *) (_base + h->index_offset) + h->index_count;
+            e->time_key = info.time_key;
+            e->offset = offset;
+            __atomic_store_n(&h->index_count, h->index_count + 1, __ATOMIC_RELEASE);
+            _last_indexed_offset = offset;
+        }
+        if (h->span_count == 0) {
+            h->min_time_key = info.time_key;
+        }
+        __atomic_store_n(&h->max_time_key, info.time_key, __ATOMIC_RELAXED);
+        __atomic_store_n(&h->span_count, h->span_count + 1, __ATOMIC_RELAXED);
+        __atomic_store_n(&h->data_end, offset + record_size, __ATOMIC_RELEASE);
+        // Publish to FindSpan() after data_end so that readers seeing the
+        // bucket see the record as complete.
+        __atomic_store_n(head, (uint32_t) offset, __ATOMIC_RELEASE);
+        _last_offset = offset;
+        return true;
+    }
+
+    bool SpanSegment::ParseRecord(const RecordHeader *rec, RpczSpan *span) {
+        if (sizeof(RecordHeader) + rec->name_size + rec->payload_size > rec->size) {
+            FLARE_LOG(ERROR) << "Invalid span record";
+            return false;
+        }
+        const char *p = (const char *) (rec + 1);
+        if (!span->ParsePartialFromArray(p + rec->name_size, rec->payload_size)) {
+            FLARE_LOG(ERROR) << "Fail to parse span record";
+            return false;
+        }
+        span->set_full_method_name(p, rec->name_size);
+        return true;
+    }
+
+    int SpanSegment::FindSpan(uint64_t trace_id, uint64_t span_id, RpczSpan *span) const {
+        const Header *h = header();
+        uint64_t offset = __atomic_load_n(
+                &buckets()[span_bucket(trace_id, h->bucket_count)], __ATOMIC_ACQUIRE);
+        const uint64_t end = size();
+        while (offset >= h->data_offset && offset + sizeof(RecordHeader) <= end) {
+            const RecordHeader *rec = record_at(offset);
+            if (rec->trace_id == trace_id && rec->span_id == span_id) {
+                return ParseRecord(rec, span) ? 0 : -1;
+            }
+            if (rec->next_in_bucket >= offset) {  // corrupted
+                break;
+            }
+            offset = rec->next_in_bucket;
+        }
+        return -1;
+    }
+
+    void SpanSegment::FindSpans(uint64_t trace_id, std::deque<RpczSpan> *out) const {
+        const Header *h = header();
+        uint64_t offset = __atomic_load_n(
+                &buckets()[span_bucket(trace_id, h->bucket_count)], __ATOMIC_ACQUIRE);
+        const uint64_t end = size();
+        while (offset >= h->data_offset && offset + sizeof(RecordHeader) <= end) {
+            const RecordHeader *rec = record_at(offset);
+            if (rec->trace_id == trace_id) {
+                out->push_back(RpczSpan());
+                if (!ParseRecord(rec, &out->back())) {
+                    out->pop_back();
+                }
+            }
+            if (rec->next_in_bucket >= offset) {
+                break;
+            }
+            offset = rec->next_in_bucket;
+        }
+    }
+
+    uint64_t SpanSegment::SeekLastBefore(int64_t tm, uint64_t end) const {
+        const Header *h = header();
+        const SpanIndexEntry *entries = (const SpanIndexEntry *) (_base + h->index_offset);
+        size_t n = std::min<uint64_t>(__atomic_load_n(&h->index_count, __ATOMIC_ACQUIRE),
+                                      h->index_capacity);
+        // Entries added after `end' was read are not usable.
+        while (n > 0 && entries[n - 1].offset >= end) {
+            --n;
+        }
+        if (n == 0 || entries[0].time_key > tm) {
+            return 0;
+        }
+        // Find the last entry whose time_key <= tm.
+        size_t lo = 0;
+        size_t hi = n;
+        while (hi - lo > 1) {
+            const size_t mid = (lo + hi) / 2;
+            if (entries[mid].time_key <= tm) {
+                lo = mid;
+            } else {
+                hi = mid;
+            }
+        }
+        uint64_t offset = entries[lo].offset;
+        if (offset < h->data_offset) {
+            return 0;
+        }
+        while (true) {
+            const uint64_t next = offset + record_at(offset)->size;
+            if (next <= offset || next + sizeof(RecordHeader) > end ||
+                record_at(next)->time_key > tm) {
+                break;
+            }
+            offset = next;
+        }
+        return offset;
+    }
+
+    size_t SpanSegment::ListSpans(int64_t before_this_time, size_t max_scan,
+                                  std::deque<BriefSpan> *out, SpanFilter *filter) const {
+        const Header *h = header();
+        const uint64_t end = size();
+        if (end <= h->data_offset || max_scan == 0) {
+            return 0;
+        }
+        uint64_t offset = SeekLastBefore(before_this_time, end);
+        if (offset == 0) {
+            return 0;
+        }
+        BriefSpan brief;
+        size_t nscan = 0;
+        while (nscan < max_scan) {
+            const RecordHeader *rec = record_at(offset);
+            brief.Clear();
+            brief.set_trace_id(rec->trace_id);
+            brief.set_span_id(rec->span_id);
+            brief.set_log_id(rec->log_id);
+            brief.set_type((SpanType) rec->type);
+            brief.set_error_code(rec->error_code);
+            brief.set_request_size(rec->request_size);
+            brief.set_response_size(rec->response_size);
+            brief.set_start_real_us(rec->start_real_us);
+            brief.set_latency_us(rec->latency_us);
+            brief.set_full_method_name((const char *) (rec + 1), rec->name_size);
+            if (NULL == filter || filter->Keep(brief)) {
+                out->push_back(brief);
+            }
+            // We increase the count no matter filter passed or not to avoid
+            // scaning too many entries.
+            ++nscan;
+            if (rec->prev_size == 0 || offset < h->data_offset + rec->prev_size) {
+                break;
+            }
+            offset -= rec->prev_size;
+        }
+        return nscan;
+    }
+
+    void SpanSegment::ForEach(const std::function<bool(const RpczSpan &)> &fn) const {
+        const uint64_t end = size();
+        RpczSpan span;
+        for (uint64_t offset = header()->data_offset; offset + sizeof(RecordHeader) <= end;) {
+            const RecordHeader *rec = record_at(offset);
+            if (rec->size < sizeof(RecordHeader)) {
+                FLARE_LOG(ERROR) << "Invalid span record at " << offset << " of " << _path;
+                return;
+            }
+            span.Clear();
+            if (ParseRecord(rec, &span) && !fn(span)) {
+                return;
+            }
+            offset += rec->size;
+        }
+    }
+
+} // namespace flare::rpc
@@ -0,0 +1,147 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+// NOTE: RPC users are not supposed to include this file.
+
+#ifndef FLARE_RPC_SPAN_STORE_H_
+#define FLARE_RPC_SPAN_STORE_H_
+
+#include <stdint.h>
+#include <string>
+#include <deque>
+#include <functional>
+#include "flare/base/profile.h"
+#include "flare/rpc/shared_object.h"
+#include "flare/rpc/span.pb.h"
+
+namespace flare::rpc {
+
+    class SpanFilter;
+
+    // Fields of a span stored in front of its serialized RpczSpan, enough
+    // for building a BriefSpan without parsing the payload.
+    struct SpanRecordInfo {
+        uint64_t trace_id;
+        uint64_t span_id;
+        uint64_t log_id;
+        // Monotonic within a SpanDB, used for ordering and the time index.
+        int64_t time_key;
+        int64_t start_real_us;
+        int64_t latency_us;
+        int32_t error_code;
+        int32_t request_size;
+        int32_t response_size;
+        SpanType type;
+    };
+
+    // An append-only file of spans which is mapped into memory.
+    //
+    // Layout:
+    //   [header][time index][trace_id buckets][records ...]
+    // The time index has an entry for the first record of every
+    // kSpanIndexInterval bytes, records with a same trace_id bucket are
+    // chained from newest to oldest, thus a segment is self-contained and
+    // can be copied elsewhere and loaded by LoadSpanDBFromFile() for
+    // offline analysis, even if the writing process crashed.
+    //
+    // Only one thread may Append() while any number of threads query.
+    class SpanSegment : public SharedObject {
+    public:
+        // Create a segment of `capacity' bytes at `path' for appending.
+        // The file is removed when the segment is destroyed unless
+        // set_keep_file(true) is called. Returns NULL on error.
+        static SpanSegment *Create(const std::string &path, size_t capacity);
+
+        // Open an existing segment read-only. Returns NULL on error.
+        static SpanSegment *Open(const std::string &path);
+
+        // Append a span, the full_method_name is stored once in front of
+        // `span' and the one inside `span' (if any) is not needed.
+        // Returns false if the segment does not have enough space left.
+        bool Append(const SpanRecordInfo &info, const std::string &full_method_name,
+                    const RpczSpan &span);
+
+        // Semantics are same as FindSpan/FindSpans/ListSpans in span.h,
+        // except that ListSpans() appends to `out' and returns number of
+        // spans scanned.
+        int FindSpan(uint64_t trace_id, uint64_t span_id, RpczSpan *span) const;
+
+        void FindSpans(uint64_t trace_id, std::deque<RpczSpan> *out) const;
+
+        size_t ListSpans(int64_t before_this_time, size_t max_scan,
+                         std::deque<BriefSpan> *out, SpanFilter *filter) const;
+
+        // Call `fn' with spans from the oldest to the newest until it
+        // returns false.
+        void ForEach(const std::function<bool(const RpczSpan &)> &fn) const;
+
+        const std::string &path() const { return _path; }
+
+        size_t capacity() const { return _capacity; }
+
+        // Bytes used, including the header and the indexes.
+        size_t size() const;
+
+        size_t span_count() const;
+
+        // Time keys of the oldest and newest spans, 0 when empty.
+        int64_t min_time_key() const;
+
+        int64_t max_time_key() const;
+
+        void set_keep_file(bool keep) { _keep_file = keep; }
+
+    private:
+        FLARE_DISALLOW_COPY_AND_ASSIGN(SpanSegment);
+
+        struct Header;
+        struct RecordHeader;
+
+        SpanSegment();
+
+        ~SpanSegment();
+
+        const Header *header() const { return (const Header *) _base; }
+
+        Header *mutable_header() { return (Header *) _base; }
+
+        const RecordHeader *record_at(uint64_t offset) const {
+            return (const RecordHeader *) (_base + offset);
+        }
+
+        uint32_t *buckets() const;
+
+        // Offset of the last record with time_key <= `tm', 0 if none.
+        uint64_t SeekLastBefore(int64_t tm, uint64_t end) const;
+
+        static bool ParseRecord(const RecordHeader *rec, RpczSpan *span);
+
+        std::string _path;
+        int _fd;
+        char *_base;
+        size_t _capacity;
+        bool _writable;
+        bool _keep_file;
+        // Writer-only states.
+        uint64_t _last_offset;
+        uint64_t _last_indexed_offset;
+    };
+
+} // namespace flare::rpc
+
+
+#endif // FLARE_RPC_SPAN_STORE_H_
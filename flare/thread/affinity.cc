@@ -7,7 +7,11 @@
 
 #include <unordered_set>
 #include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <unistd.h>
+#include <errno.h>
 #include <thread>
 #include <algorithm>
 
@@ -34,6 +38,95 @@ namespace flare {
             }
         };
 
+        // NUMA topology read from sysfs once.
+        struct numa_topology {
+            std::vector<std::vector<int>> node_cores;
+            std::vector<int> core_to_node;
+        };
+
+        // Parse cpulist format of sysfs, e.g. "0-3,8-11", also used by the
+        // list of nodes.
+        std::vector<int> parse_cpu_list(const char *s) {
+            std::vector<int> cores;
+            while (*s) {
+                char *end = nullptr;
+                long first = strtol(s, &end, 10);
+                if (end == s) {
+                    break;
+                }
+                long last = first;
+                s = end;
+                if (*s == '-') {
+                    last = strtol(s + 1, &end, 10);
+                    s = end;
+                }
+                for (long i = first; i <= last; ++i) {
+                    cores.push_back(static_cast<int>(i));
+                }
+                if (*s == ',') {
+                    ++s;
+                } else {
+                    break;
+                }
+            }
+            return cores;
+        }
+
+        numa_topology load_numa_topology() {
+            numa_topology topology;
+#if defined(__linux__) && !defined(__ANDROID__)
+            // Node ids may be sparse (e.g. "0,2"), nodes are indexed by id and
+            // the missing ones have no cores.
+            char buf[4096];
+            std::vector<int> nodes;
+            FILE *fp = fopen("/sys/devices/system/node/online", "r");
+            if (fp != nullptr) {
+                if (fgets(buf, sizeof(buf), fp) != nullptr) {
+                    nodes = parse_cpu_list(buf);
+                }
+                fclose(fp);
+            }
+            for (int node : nodes) {
+                char path[64];
+                snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+                fp = fopen(path, "r");
+                if (fp == nullptr) {
+                    continue;
+                }
+                std::vector<int> cores;
+                if (fgets(buf, sizeof(buf), fp) != nullptr) {
+                    cores = parse_cpu_list(buf);
+                }
+                fclose(fp);
+                if (node >= static_cast<int>(topology.node_cores.size())) {
+                    topology.node_cores.resize(node + 1);
+                }
+                topology.node_cores[node] = std::move(cores);
+            }
+#endif
+            if (topology.node_cores.empty()) {
+                std::vector<int> cores;
+                for (unsigned int i = 0; i < core_affinity::num_logical_cores(); ++i) {
+                    cores.push_back(static_cast<int>(i));
+                }
+                topology.node_cores.push_back(std::move(cores));
+            }
+            for (size_t node = 0; node < topology.node_cores.size(); ++node) {
+                for (int core : topology.node_cores[node]) {
+                    if (core >= static_cast<int>(topology.core_to_node.size())) {
+                        topology.core_to_node.resize(core + 1, 0);
+                    }
+                    topology.core_to_node[core] = static_cast<int>(node);
+                }
+            }
+            return topology;
+        }
+
+        const numa_topology &get_numa_topology() {
+            static const numa_topology topology = load_numa_topology();
+            return topology;
+        }
+
     }  // anonymous namespace
 
     core_affinity::core_affinity() : cores() {}
@@ -183,4 +276,50 @@ namespace flare {
         return affinity;
     }
 
+    int core_affinity::numa_node_count() {
+        return static_cast<int>(get_numa_topology().node_cores.size());
+    }
+
+    core_affinity core_affinity::numa_node(int node_id) {
+        auto &topology = get_numa_topology();
+        if (node_id < 0 || node_id >= static_cast<int>(topology.node_cores.size())) {
+            return core_affinity();
+        }
+        return group_cores(node_id, topology.node_cores[node_id]);
+    }
+
+    int core_affinity::current_numa_node() {
+#if defined(__linux__) && !defined(__ANDROID__)
+        auto &topology = get_numa_topology();
+        const int core = sched_getcpu();
+        if (core >= 0 && core < static_cast<int>(topology.core_to_node.size())) {
+            return topology.core_to_node[core];
+        }
+#endif
+        return 0;
+    }
+
+    int core_affinity::bind_current_thread() const {
+        if (cores.empty()) {
+            return EINVAL;
+        }
+#if defined(__linux__) && !defined(__ANDROID__)
+        cpu_set_t cpuset;
+        CPU_ZERO(&cpuset);
+        for (auto &core : cores) {
+            CPU_SET(core.index, &cpuset);
+        }
+        return pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset);
+#elif defined(__FreeBSD__)
+        cpuset_t cpuset;
+        CPU_ZERO(&cpuset);
+        for (auto &core : cores) {
+            CPU_SET(core.index, &cpuset);
+        }
+        return pthread_setaffinity_np(pthread_self(), sizeof(cpuset_t), &cpuset);
+#else
+        return ENOSYS;
+#endif
+    }
+
 }  // namespace flare
@@ -102,6 +102,24 @@ namespace flare {
 
         static core_affinity group_cores(int node_id, const std::vector<int> &cores);
 
+        // numa_node_count() returns one past the largest id of online NUMA nodes
+        // of the system, 1 if the topology is not available on this platform.
+        // Ids may be sparse, numa_node() of a missing id (or of a node with
+        // memory only) has no cores.
+        static int numa_node_count();
+
+        // numa_node() returns an core_affinity with all the cores of NUMA node
+        // `node_id', the group of each core is `node_id'.
+        static core_affinity numa_node(int node_id);
+
+        // current_numa_node() returns the NUMA node of the core that the calling
+        // thread is running on, 0 if unknown.
+        static int current_numa_node();
+
+        // bind_current_thread() restricts the calling thread to run on the cores
+        // of this affinity. Returns 0 on success, errno otherwise.
+        int bind_current_thread() const;
+
     private:
 
         std::vector<core_node> cores;
@@ -0,0 +1,137 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "testing/gtest_wrap.h"
+
+#include <atomic>
+#include <vector>
+#include "flare/fiber/fiber_future.h"
+#include "flare/fiber/this_fiber.h"
+
+namespace {
+
+    TEST(FiberFutureTest, then_runs_in_fiber) {
+        flare::promise<int> p;
+        auto f = p.get_future().then(flare::fiber_executor::instance(), [](int v) {
+            EXPECT_NE(0u, fiber_self());
+            return v + 1;
+        });
+        // Full_filled from a pthread.
+        p.set_value(1);
+        ASSERT_EQ(2, flare::fiber_get(std::move(f)));
+    }
+
+    TEST(FiberFutureTest, async) {
+        auto f = flare::async(flare::fiber_executor::instance(), [] {
+            return fiber_self();
+        });
+        ASSERT_NE(0u, flare::fiber_get(std::move(f)));
+
+        auto g = flare::async(flare::fiber_executor::instance(), []() -> int {
+            throw std::runtime_error("nope");
+        });
+        ASSERT_THROW(flare::fiber_get(std::move(g)), std::runtime_error);
+    }
+
+    TEST(FiberFutureTest, get_multiple_values) {
+        flare::promise<int, void, std::string> p;
+        auto f = p.get_future();
+        p.set_value(1, "x");
+        auto v = flare::fiber_get(std::move(f));
+        ASSERT_EQ(1, std::get<0>(v));
+        ASSERT_EQ("x", std::get<1>(v));
+    }
+
+    TEST(FiberFutureTest, wait) {
+        flare::promise<int> p;
+        auto f = p.get_future();
+        fiber_id_t th;
+        ASSERT_EQ(0, fiber_start_background(&th, NULL, [](void *arg) -> void * {
+            flare::fiber_sleep_for(10000);
+            static_cast<flare::promise<int> *>(arg)->set_value(3);
+            return NULL;
+        }, &p));
+        flare::fiber_wait(f);
+        ASSERT_EQ(0, fiber_join(th, NULL));
+        ASSERT_EQ(4, f.then([](int v) { return v + 1; }).get());
+    }
+
+    struct Waiter {
+        flare::promise<int> p;
+        flare::future<int> f;
+        int index = 0;
+        int value = -1;
+    };
+
+    // Many more waiting fibers than workers, the full_filling fibers can only
+    // run if waiting ones don't block workers.
+    TEST(FiberFutureTest, waiting_does_not_block_workers) {
+        const int N = 256;
+        std::vector<Waiter> waiters(N);
+        std::vector<fiber_id_t> ths;
+        for (int i = 0; i < N; ++i) {
+            Waiter &w = waiters[i];
+            w.index = i;
+            w.f = w.p.get_future();
+            fiber_id_t th;
+            ASSERT_EQ(0, fiber_start_background(&th, NULL, [](void *arg) -> void * {
+                Waiter *w = static_cast<Waiter *>(arg);
+                w->value = flare::fiber_get(std::move(w->f));
+                return NULL;
+            }, &w));
+            ths.push_back(th);
+        }
+        flare::fiber_sleep_for(10000);
+        for (int i = 0; i < N; ++i) {
+            fiber_id_t th;
+            ASSERT_EQ(0, fiber_start_background(&th, NULL, [](void *arg) -> void * {
+                Waiter *w = static_cast<Waiter *>(arg);
+                w->p.set_value(w->index);
+                return NULL;
+            }, &waiters[i]));
+            ths.push_back(th);
+        }
+        for (auto th : ths) {
+            ASSERT_EQ(0, fiber_join(th, NULL));
+        }
+        for (auto &w : waiters) {
+            ASSERT_EQ(w.index, w.value);
+        }
+    }
+
+    TEST(FiberFutureTest, fan_out_fan_in) {
+        const size_t N = 10000;
+        std::vector<flare::future<size_t>> futs;
+        for (size_t i = 0; i < N; ++i) {
+            futs.push_back(flare::async(flare::fiber_executor::instance(), [i] { return i; }));
+        }
+        auto all = flare::fiber_get(flare::when_all(std::move(futs)));
+        ASSERT_EQ(N, all.size());
+        for (size_t i = 0; i < N; ++i) {
+            ASSERT_EQ(i, *all[i]);
+        }
+
+        auto bounded = flare::fiber_get(flare::when_all(N, 64, [](size_t i) {
+            return flare::async(flare::fiber_executor::instance(), [i] { return i * 2; });
+        }));
+        ASSERT_EQ(N, bounded.size());
+        for (size_t i = 0; i < N; ++i) {
+            ASSERT_EQ(i * 2, *bounded[i]);
+        }
+    }
+
+}  // namespace
@@ -0,0 +1,101 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "testing/gtest_wrap.h"
+#include <gflags/gflags.h>
+#include <thread>
+#include "flare/io/cord_buf.h"
+#include "flare/thread/affinity.h"
+#include "flare/metrics/variable_base.h"
+#include "flare/fiber/internal/fiber.h"
+
+DECLARE_bool(fiber_numa_aware);
+
+namespace {
+
+    std::atomic<int> g_ran(0);
+
+    void *append_blocks(void *arg) {
+        // Allocate and free blocks on the worker.
+        flare::cord_buf buf;
+        std::string s(flare::cord_buf::DEFAULT_BLOCK_SIZE * 4, 'x');
+        for (int i = 0; i < 16; ++i) {
+            buf.append(s);
+        }
+        EXPECT_EQ(s.size() * 16, buf.size());
+        buf.clear();
+        // Spawn more to make workers steal.
+        if (arg == NULL) {
+            fiber_id_t th;
+            EXPECT_EQ(0, fiber_start_background(&th, NULL, append_blocks, (void *) 1));
+            fiber_join(th, NULL);
+        }
+        g_ran.fetch_add(1);
+        return NULL;
+    }
+
+    class NumaTest : public ::testing::Test {
+    protected:
+        static void SetUpTestCase() {
+            // Must be set before any fiber starts.
+            FLAGS_fiber_numa_aware = true;
+        }
+    };
+
+    TEST_F(NumaTest, run_fibers) {
+        // Blocks allocated before fiber starts are freed after.
+        flare::cord_buf early;
+        early.append(std::string(100000, 'y'));
+
+        const int N = 200;
+        std::vector<fiber_id_t> ths(N);
+        for (int i = 0; i < N; ++i) {
+            ASSERT_EQ(0, fiber_start_background(&ths[i], NULL, append_blocks, NULL));
+        }
+        for (int i = 0; i < N; ++i) {
+            ASSERT_EQ(0, fiber_join(ths[i], NULL));
+        }
+        ASSERT_EQ(N * 2, g_ran.load());
+        ASSERT_EQ(std::string(100000, 'y'), early.to_string());
+        early.clear();
+
+        // Blocks cached by a thread are given back when it exits, blocks
+        // outliving the thread are freed by another one.
+        flare::cord_buf kept;
+        std::thread th([&kept] {
+            for (int i = 0; i < 4; ++i) {
+                flare::cord_buf buf;
+                buf.append(std::string(flare::cord_buf::DEFAULT_BLOCK_SIZE * 100, 'z'));
+                if (i == 0) {
+                    kept.append(buf);
+                }
+            }
+        });
+        th.join();
+        ASSERT_EQ(std::string(flare::cord_buf::DEFAULT_BLOCK_SIZE * 100, 'z'), kept.to_string());
+        kept.clear();
+
+        ASSERT_FALSE(flare::variable_base::describe_exposed(
+                "fiber_numa_node0_local_steal").empty());
+        ASSERT_FALSE(flare::variable_base::describe_exposed(
+                "fiber_numa_node0_remote_steal").empty());
+        ASSERT_TRUE(flare::variable_base::describe_exposed(
+                "fiber_numa_node" + std::to_string(flare::core_affinity::numa_node_count()) +
+                "_local_steal").empty());
+    }
+
+} // namespace
@@ -0,0 +1,155 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "testing/gtest_wrap.h"
+
+#include <algorithm>                        // std::sort
+#include <atomic>
+#include <vector>
+#include "flare/fiber/internal/types.h"
+#include "flare/fiber/internal/remote_task_queue.h"
+
+namespace {
+    typedef flare::fiber_internal::RemoteTaskQueue Queue;
+    const size_t NPRODUCER = 4;
+    const size_t N = 1024 * 256;            // per producer
+    const size_t CAP = 64;
+    std::atomic<size_t> g_nproducer_done(0);
+
+    struct ProducerArgs {
+        Queue *q;
+        size_t index;
+    };
+
+    void *push_thread(void *arg) {
+        ProducerArgs *args = (ProducerArgs *) arg;
+        for (size_t i = 0; i < N;) {
+            if (args->q->push(args->index * N + i)) {
+                ++i;
+            } else {
+                sched_yield();
+            }
+        }
+        g_nproducer_done.fetch_add(1);
+        return nullptr;
+    }
+
+    // Pops in batch like the owning fiber_worker if `arg' is the queue,
+    // otherwise pops one by one like stealing workers.
+    template<bool kBatch>
+    void *pop_thread(void *arg) {
+        std::vector<fiber_id_t> *popped = new std::vector<fiber_id_t>;
+        Queue *q = (Queue *) arg;
+        fiber_id_t tasks[16];
+        while (true) {
+            const bool done = (g_nproducer_done.load() == NPRODUCER);
+            const size_t n = kBatch ? q->pop_n(tasks, FLARE_ARRAY_SIZE(tasks)) : q->pop(tasks);
+            if (n == 0) {
+                if (done) {
+                    break;
+                }
+                sched_yield();
+            }
+            popped->insert(popped->end(), tasks, tasks + n);
+        }
+        return popped;
+    }
+
+    TEST(RemoteTaskQueueTest, sanity) {
+        Queue q;
+        ASSERT_EQ(0, q.init(CAP - 1));
+        ASSERT_EQ(CAP, q.capacity());
+        ASSERT_TRUE(q.empty());
+        fiber_id_t task;
+        ASSERT_FALSE(q.pop(&task));
+        // Wrap around several times.
+        for (size_t i = 0; i < 3 * CAP; ++i) {
+            ASSERT_TRUE(q.push(i));
+            ASSERT_FALSE(q.empty());
+            ASSERT_TRUE(q.pop(&task));
+            ASSERT_EQ(i, task);
+        }
+        for (size_t i = 0; i < CAP; ++i) {
+            ASSERT_TRUE(q.push(i));
+        }
+        // Full.
+        ASSERT_FALSE(q.push(CAP));
+        fiber_id_t tasks[CAP];
+        ASSERT_EQ(10u, q.pop_n(tasks, 10));
+        for (size_t i = 0; i < 10; ++i) {
+            ASSERT_EQ(i, tasks[i]);
+        }
+        ASSERT_TRUE(q.push(CAP));
+        // Stopped at the end of queue.
+        ASSERT_EQ(CAP - 9, q.pop_n(tasks, CAP));
+        for (size_t i = 0; i < CAP - 9; ++i) {
+            ASSERT_EQ(i + 10, tasks[i]);
+        }
+        ASSERT_EQ(0u, q.pop_n(tasks, CAP));
+        ASSERT_TRUE(q.empty());
+    }
+
+    TEST(RemoteTaskQueueTest, multiple_producers_and_consumers) {
+        Queue q;
+        ASSERT_EQ(0, q.init(CAP));
+        pthread_t producers[NPRODUCER];
+        ProducerArgs args[NPRODUCER];
+        pthread_t batch_th;
+        pthread_t steal_th[4];
+        ASSERT_EQ(0, pthread_create(&batch_th, nullptr, pop_thread<true>, &q));
+        for (size_t i = 0; i < FLARE_ARRAY_SIZE(steal_th); ++i) {
+            ASSERT_EQ(0, pthread_create(&steal_th[i], nullptr, pop_thread<false>, &q));
+        }
+        for (size_t i = 0; i < NPRODUCER; ++i) {
+            args[i].q = &q;
+            args[i].index = i;
+            ASSERT_EQ(0, pthread_create(&producers[i], nullptr, push_thread, &args[i]));
+        }
+        for (size_t i = 0; i < NPRODUCER; ++i) {
+            pthread_join(producers[i], nullptr);
+        }
+
+        std::vector<fiber_id_t> values;
+        std::vector<fiber_id_t> *res = nullptr;
+        pthread_join(batch_th, (void **) &res);
+        const size_t nbatch_popped = res->size();
+        values.insert(values.end(), res->begin(), res->end());
+        // Tasks of one producer are popped in order by one consumer.
+        std::vector<fiber_id_t> last(NPRODUCER, 0);
+        for (size_t j = 0; j < res->size(); ++j) {
+            const fiber_id_t t = (*res)[j];
+            ASSERT_LE(last[t / N], t);
+            last[t / N] = t;
+        }
+        delete res;
+        for (size_t i = 0; i < FLARE_ARRAY_SIZE(steal_th); ++i) {
+            pthread_join(steal_th[i], (void **) &res);
+            values.insert(values.end(), res->begin(), res->end());
+            delete res;
+        }
+        ASSERT_TRUE(q.empty());
+
+        // Every task is popped exactly once.
+        std::sort(values.begin(), values.end());
+        ASSERT_EQ(NPRODUCER * N, values.size());
+        for (size_t i = 0; i < values.size(); ++i) {
+            ASSERT_EQ(i, values[i]);
+        }
+        std::cout << "batch_popped=" << nbatch_popped
+                  << " stolen=" << values.size() - nbatch_popped << std::endl;
+    }
+} // namespace
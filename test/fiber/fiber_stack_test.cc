@@ -0,0 +1,142 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "testing/gtest_wrap.h"
+
+#include <string.h>
+#include <sstream>
+#include <gflags/gflags.h>
+#include "flare/fiber/internal/fiber.h"
+#include "flare/fiber/this_fiber.h"
+#include "flare/fiber/internal/stack.h"
+
+DECLARE_bool(fiber_stack_usage_tracking);
+DECLARE_int32(fiber_stack_keep_size);
+
+namespace {
+
+    std::string stack_usage() {
+        std::ostringstream os;
+        flare::fiber_internal::print_stack_usage(os);
+        return os.str();
+    }
+
+    // Number of samples in the bucket starting with `prefix', e.g. "<=8KB".
+    int64_t bucket_count(const std::string &usage, const std::string &prefix) {
+        const size_t pos = usage.find("\n" + prefix + ": ");
+        if (pos == std::string::npos) {
+            return 0;
+        }
+        return strtoll(usage.c_str() + pos + prefix.size() + 3, NULL, 10);
+    }
+
+    class StackTest : public ::testing::Test {
+    protected:
+        void SetUp() override {
+            FLAGS_fiber_stack_usage_tracking = true;
+        }
+
+        void TearDown() override {
+            FLAGS_fiber_stack_usage_tracking = false;
+        }
+    };
+
+    TEST_F(StackTest, trim_stack_storage) {
+        flare::fiber_internal::fiber_stack_storage s;
+        ASSERT_EQ(0, flare::fiber_internal::allocate_stack_storage(&s, 1024 * 1024, 4096));
+        char *const top = (char *) s.bottom;
+
+        // Used 200KB.
+        memset(top - 200 * 1024, 1, 200 * 1024);
+        std::string before = stack_usage();
+        flare::fiber_internal::trim_stack_storage(&s, top);
+        std::string after = stack_usage();
+        ASSERT_EQ(bucket_count(before, "<=256KB") + 1, bucket_count(after, "<=256KB"))
+                                    << after;
+        ASSERT_NE(std::string::npos, after.find("trimmed ")) << after;
+
+        // Canaries in used pages are repainted, a shallow fiber on the same
+        // stack is sampled from scratch.
+        memset(top - 6 * 1024, 1, 6 * 1024);
+        before = after;
+        flare::fiber_internal::trim_stack_storage(&s, top);
+        after = stack_usage();
+        ASSERT_EQ(bucket_count(before, "<=8KB") + 1, bucket_count(after, "<=8KB")) << after;
+        ASSERT_EQ(bucket_count(before, "<=256KB"), bucket_count(after, "<=256KB")) << after;
+
+        // Pages beneath a gap of untouched pages are not scanned.
+        memset(top - 4096, 1, 4096);
+        memset(top - 64 * 1024, 1, 4096);
+        before = after;
+        flare::fiber_internal::trim_stack_storage(&s, top);
+        after = stack_usage();
+        ASSERT_EQ(bucket_count(before, "<=4KB") + 1, bucket_count(after, "<=4KB")) << after;
+
+        // Frames of a suspended stack above the saved sp are kept as is,
+        // pages beneath are sampled and repainted.
+        const int live = 2 * 4096 + 100;
+        memset(top - live, 2, live);
+        memset(top - 20 * 1024, 1, 20 * 1024 - live);
+        before = after;
+        flare::fiber_internal::trim_stack_storage(&s, top - live);
+        after = stack_usage();
+        ASSERT_EQ(bucket_count(before, "<=32KB") + 1, bucket_count(after, "<=32KB")) << after;
+        for (int i = 1; i <= live; ++i) {
+            ASSERT_EQ(2, top[-i]) << i;
+        }
+        // Out of the stack.
+        before = after;
+        flare::fiber_internal::trim_stack_storage(&s, top + 1);
+        ASSERT_EQ(before, stack_usage());
+
+        flare::fiber_internal::deallocate_stack_storage(&s);
+    }
+
+    FLARE_NO_INLINE int recurse(int depth) {
+        // Touch 1KB per frame.
+        volatile char buf[1024];
+        memset((char *) buf, depth, sizeof(buf));
+        if (depth == 0) {
+            return buf[0];
+        }
+        return recurse(depth - 1) + buf[depth % sizeof(buf)];
+    }
+
+    void *deep_fiber(void *arg) {
+        recurse((int) (intptr_t) arg);
+        return NULL;
+    }
+
+    TEST_F(StackTest, sample_fibers) {
+        const std::string before = stack_usage();
+        const int N = 16;
+        fiber_id_t th[N];
+        for (int i = 0; i < N; ++i) {
+            ASSERT_EQ(0, fiber_start_background(&th[i], NULL, deep_fiber, (void *) 300));
+        }
+        for (int i = 0; i < N; ++i) {
+            ASSERT_EQ(0, fiber_join(th[i], NULL));
+        }
+        // Stacks are returned after the fibers are joined, and may be passed
+        // to the next fiber in the worker directly.
+        flare::fiber_sleep_for(100000);
+        const std::string after = stack_usage();
+        ASSERT_LT(bucket_count(before, "<=512KB"), bucket_count(after, "<=512KB")) << after;
+        std::cout << after;
+    }
+
+} // namespace
@@ -16,11 +16,13 @@
 // under the License.
 
 #include <execinfo.h>
+#include <functional>
 #include "testing/gtest_wrap.h"
 #include "flare/times/time.h"
 #include "flare/log/logging.h"
 #include "flare/base/gperftools_profiler.h"
 #include "flare/fiber/internal/fiber.h"
+#include "flare/fiber/fiber.h"
 #include "flare/fiber/internal/unstable.h"
 #include "flare/fiber/internal/fiber_entity.h"
 #include "flare/fiber/this_fiber.h"
@@ -553,4 +555,106 @@ namespace {
         ASSERT_EQ(0, fiber_join(tid, nullptr));
     }
 
+    // Counts living copies.
+    struct Capture {
+        static std::atomic<int> nalive;
+
+        Capture() { nalive.fetch_add(1); }
+
+        Capture(const Capture &) { nalive.fetch_add(1); }
+
+        ~Capture() { nalive.fetch_sub(1); }
+    };
+
+    std::atomic<int> Capture::nalive(0);
+
+    TEST_F(FiberTest, start_with_inline_and_heap_closures) {
+        std::atomic<int> sum(0);
+        fiber_id_t tids[2];
+        {
+            Capture c;
+            // Stored inline.
+            ASSERT_EQ(0, flare::fiber_internal::start_fiber(&tids[0], nullptr, [c, &sum](void *arg) -> void * {
+                sum.fetch_add((int) (intptr_t) arg);
+                return nullptr;
+            }, (void *) 1, false));
+            // Stored on heap.
+            char padding[flare::fiber_internal::fiber_task::kInlineSize] = {10};
+            ASSERT_EQ(0, flare::fiber_internal::start_fiber(&tids[1], nullptr, [c, padding, &sum](void *) -> void * {
+                sum.fetch_add(padding[0]);
+                return nullptr;
+            }, nullptr, true));
+        }
+        ASSERT_EQ(0, fiber_join(tids[0], nullptr));
+        ASSERT_EQ(0, fiber_join(tids[1], nullptr));
+        ASSERT_EQ(11, sum.load());
+        // Captures are destroyed once the fibers finish.
+        ASSERT_EQ(0, Capture::nalive.load());
+
+        {
+            Capture c;
+            flare::fiber fb(flare::kAttrNormal, [c, &sum](void *) -> void * {
+                sum.fetch_add(100);
+                return nullptr;
+            });
+            fb.join();
+            ASSERT_EQ(111, sum.load());
+        }
+        ASSERT_EQ(0, Capture::nalive.load());
+
+        void *(*null_fn)(void *) = nullptr;
+        ASSERT_EQ(EINVAL, flare::fiber_internal::start_fiber(&tids[0], nullptr, null_fn, nullptr, false));
+        // Empty callables are rejected like NULL pointers.
+        std::function<void *(void *)> empty_fn;
+        ASSERT_EQ(EINVAL, flare::fiber_internal::start_fiber(&tids[0], nullptr, empty_fn, nullptr, false));
+        flare::fiber fb1(flare::kAttrNormal, empty_fn);
+        ASSERT_EQ(EINVAL, fb1.error());
+        flare::fiber fb2(flare::launch_policy::eLazy, std::move(empty_fn));
+        ASSERT_EQ(EINVAL, fb2.error());
+    }
+
+    static void *start_n_from_fiber(void *arg) {
+        std::atomic<int> *sum = static_cast<std::atomic<int> *>(arg);
+        const size_t N = 100;
+        fiber_id_t tids[N];
+        void *args[N];
+        for (size_t i = 0; i < N; ++i) {
+            args[i] = (void *) (intptr_t) (i + 1);
+        }
+        Capture c;
+        EXPECT_EQ(0, fiber_start_background_n(tids, N, nullptr, [c, sum](void *arg) -> void * {
+            sum->fetch_add((int) (intptr_t) arg);
+            return nullptr;
+        }, args));
+        for (size_t i = 0; i < N; ++i) {
+            EXPECT_EQ(0, fiber_join(tids[i], nullptr));
+        }
+        return nullptr;
+    }
+
+    TEST_F(FiberTest, start_background_n) {
+        std::atomic<int> sum(0);
+        // From non-worker.
+        start_n_from_fiber(&sum);
+        ASSERT_EQ(5050, sum.load());
+        // From worker.
+        fiber_id_t tid;
+        ASSERT_EQ(0, fiber_start_background(&tid, nullptr, start_n_from_fiber, &sum));
+        ASSERT_EQ(0, fiber_join(tid, nullptr));
+        ASSERT_EQ(10100, sum.load());
+        ASSERT_EQ(0, Capture::nalive.load());
+
+        fiber_id_t tids[2];
+        ASSERT_EQ(0, fiber_start_background_n(tids, 2, nullptr, [](void *arg) -> void * {
+            return arg;
+        }, nullptr));
+        ASSERT_EQ(0, fiber_join(tids[0], nullptr));
+        ASSERT_EQ(0, fiber_join(tids[1], nullptr));
+
+        std::function<void *(void *)> empty_fn;
+        ASSERT_EQ(EINVAL, fiber_start_background_n(tids, 2, nullptr, empty_fn, nullptr));
+        ASSERT_EQ(INVALID_FIBER_ID, tids[0]);
+        ASSERT_EQ(INVALID_FIBER_ID, tids[1]);
+    }
+
 } // namespace
@@ -16,6 +16,7 @@
 // under the License.
 
 #include "testing/gtest_wrap.h"
+#include <algorithm>
 #include <gflags/gflags.h>
 #include "flare/fiber/internal/sys_futex.h"
 #include "flare/fiber/internal/timer_thread.h"
@@ -102,9 +103,9 @@ namespace {
         std::vector<timespec> _run_times;
     };
 
-    TEST(TimerThreadTest, RunTasks) {
+    void run_tasks(const flare::fiber_internal::TimerThreadOptions *options) {
         flare::fiber_internal::TimerThread timer_thread;
-        ASSERT_EQ(0, timer_thread.start(nullptr));
+        ASSERT_EQ(0, timer_thread.start(options));
 
         timespec _2s_later = flare::time_point::future_unix_seconds(2).to_timespec();
         TimeKeeper keeper1(_2s_later, "keeper1");
@@ -154,6 +155,101 @@ namespace {
         keeper6.expect_first_run(keeper6_addtime);
     }
 
+    TEST(TimerThreadTest, RunTasks) {
+        run_tasks(nullptr);
+    }
+
+    TEST(TimerThreadTest, RunTasksWithTimingWheel) {
+        flare::fiber_internal::TimerThreadOptions options;
+        options.use_timing_wheel = true;
+        run_tasks(&options);
+    }
+
+    struct WheelTask {
+        int64_t run_time;
+        std::atomic<int64_t> ran_at{0};
+        // Order in which the timer thread ran the task, starting from 1.
+        std::atomic<int64_t> seq{0};
+        flare::fiber_internal::TimerThread::TaskId task_id;
+
+        static std::atomic<int64_t> nran;
+
+        static void routine(void *arg) {
+            WheelTask *t = (WheelTask *) arg;
+            t->ran_at.store(flare::get_current_time_micros());
+            t->seq.store(nran.fetch_add(1) + 1);
+        }
+    };
+
+    std::atomic<int64_t> WheelTask::nran{0};
+
+    // A tiny tick makes tasks within 1.5 seconds go through level 1 and 2 of
+    // the wheel and get cascaded down before expiring. Nothing here depends
+    // on how late the timer thread runs, which varies a lot on loaded hosts:
+    // tasks must never run early, unscheduled ones must never run, and the
+    // rest must run in the order of their run times.
+    TEST(TimerThreadTest, timing_wheel_cascade) {
+        flare::fiber_internal::TimerThreadOptions options;
+        options.use_timing_wheel = true;
+        options.wheel_tick_us = 1;
+        flare::fiber_internal::TimerThread timer_thread;
+        ASSERT_EQ(0, timer_thread.start(&options));
+
+        const size_t N = 2000;
+        std::unique_ptr<WheelTask[]> tasks(new WheelTask[N]);
+        const int64_t now = flare::get_current_time_micros();
+        for (size_t i = 0; i < N; ++i) {
+            tasks[i].run_time = now + (int64_t) (i * i) % 1500000;
+            tasks[i].task_id = timer_thread.schedule(
+                    WheelTask::routine, &tasks[i],
+                    flare::time_point::from_unix_micros(tasks[i].run_time).to_timespec());
+            ASSERT_NE(flare::fiber_internal::TimerThread::INVALID_TASK_ID, tasks[i].task_id);
+        }
+        // Unschedule every third task, those still pending must never run.
+        std::vector<bool> removed(N, false);
+        int64_t nexpected = N;
+        for (size_t i = 0; i < N; i += 3) {
+            if (timer_thread.unschedule(tasks[i].task_id) == 0) {
+                removed[i] = true;
+                --nexpected;
+            }
+        }
+        // Tasks due before this point may be seen by the timer thread only
+        // after their ticks passed and run out of order, which is fine.
+        const int64_t ordered_after = flare::get_current_time_micros() + 200000;
+
+        // Generous deadline, only reached if tasks are lost.
+        const int64_t deadline = flare::get_current_time_micros() + 60000000L;
+        while (WheelTask::nran.load() < nexpected &&
+               flare::get_current_time_micros() < deadline) {
+            usleep(10000);
+        }
+        timer_thread.stop_and_join();
+        ASSERT_EQ(nexpected, WheelTask::nran.load());
+
+        std::vector<const WheelTask *> ordered;
+        for (size_t i = 0; i < N; ++i) {
+            const int64_t ran_at = tasks[i].ran_at.load();
+            if (removed[i]) {
+                ASSERT_EQ(0, ran_at) << "i=" << i;
+                continue;
+            }
+            ASSERT_NE(0, ran_at) << "i=" << i;
+            ASSERT_GE(ran_at, tasks[i].run_time) << "i=" << i;
+            if (tasks[i].run_time >= ordered_after) {
+                ordered.push_back(&tasks[i]);
+            }
+        }
+        ASSERT_FALSE(ordered.empty());
+        std::sort(ordered.begin(), ordered.end(), [](const WheelTask *a, const WheelTask *b) {
+            return a->seq.load() < b->seq.load();
+        });
+        for (size_t i = 1; i < ordered.size(); ++i) {
+            ASSERT_LE(ordered[i - 1]->run_time, ordered[i]->run_time)
+                    << "seq=" << ordered[i]->seq.load();
+        }
+    }
+
 // If the scheduled time is before start time, then should run it
 // immediately.
     TEST(TimerThreadTest, start_after_schedule) {
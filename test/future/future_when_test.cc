@@ -0,0 +1,156 @@
+/****************************************************************
+ * Copyright (c) 2022, liyinbin
+ * All rights reserved.
+ * Author by liyinbin (jeff.li) lijippy@163.com
+ *****************************************************************/
+
+
+#include <mutex>
+#include <thread>
+#include "testing/gtest_wrap.h"
+#include "flare/future/future.h"
+
+TEST(future_when, when_any) {
+    std::vector<flare::promise<int>> proms(3);
+    std::vector<flare::future<int>> futs;
+    for (auto &p : proms) {
+        futs.push_back(p.get_future());
+    }
+
+    auto f = flare::when_any(std::move(futs)).then([](std::size_t i, int v) {
+        return i * 100 + v;
+    });
+
+    proms[1].set_value(7);
+    proms[0].set_value(8);
+    proms[2].set_value(9);
+
+    ASSERT_EQ(107u, f.get());
+}
+
+TEST(future_when, when_any_failure) {
+    std::vector<flare::promise<void>> proms(2);
+    std::vector<flare::future<void>> futs;
+    for (auto &p : proms) {
+        futs.push_back(p.get_future());
+    }
+
+    auto f = flare::when_any(std::move(futs)).then([](std::size_t i) { return i; });
+
+    proms[0].set_exception(std::make_exception_ptr(std::runtime_error("nope")));
+    proms[1].set_value();
+
+    ASSERT_THROW(f.get(), std::runtime_error);
+}
+
+TEST(future_when, when_all) {
+    std::vector<flare::promise<int>> proms(4);
+    std::vector<flare::future<int>> futs;
+    for (auto &p : proms) {
+        futs.push_back(p.get_future());
+    }
+
+    auto f = flare::when_all(std::move(futs));
+    ASSERT_TRUE(futs.empty());
+
+    proms[3].set_value(3);
+    proms[1].set_exception(std::make_exception_ptr(std::runtime_error("nope")));
+    proms[0].set_value(0);
+    proms[2].set_value(2);
+
+    auto res = f.get();
+    ASSERT_EQ(4u, res.size());
+    ASSERT_EQ(0, *res[0]);
+    ASSERT_FALSE(res[1].has_value());
+    ASSERT_EQ(2, *res[2]);
+    ASSERT_EQ(3, *res[3]);
+}
+
+TEST(future_when, when_all_empty) {
+    auto f = flare::when_all(std::vector<flare::future<int>>());
+    ASSERT_TRUE(f.get().empty());
+
+    auto g = flare::when_all(0, 4, [](std::size_t) { return flare::future<int>(); });
+    ASSERT_TRUE(g.get().empty());
+}
+
+TEST(future_when, bounded_when_all_ready) {
+    // Futures finished inline don't recurse.
+    const std::size_t n = 100000;
+    std::size_t made = 0;
+    auto f = flare::when_all(n, 16, [&made](std::size_t i) {
+        ++made;
+        flare::promise<std::size_t> p;
+        auto fut = p.get_future();
+        p.set_value(i);
+        return fut;
+    });
+    auto res = f.get();
+    ASSERT_EQ(n, made);
+    ASSERT_EQ(n, res.size());
+    for (std::size_t i = 0; i < n; ++i) {
+        ASSERT_EQ(i, *res[i]);
+    }
+}
+
+TEST(future_when, bounded_when_all_make_throws) {
+    flare::promise<int> first;
+    auto f = flare::when_all(4, 1, [&first](std::size_t i) {
+        if (i == 0) {
+            return first.get_future();
+        }
+        if (i == 2) {
+            throw std::runtime_error("nope");
+        }
+        flare::promise<int> p;
+        auto fut = p.get_future();
+        p.set_value(static_cast<int>(i));
+        return fut;
+    });
+    // The rest are made in the continuation of the first one.
+    first.set_value(0);
+
+    auto res = f.get();
+    ASSERT_EQ(4u, res.size());
+    ASSERT_EQ(0, *res[0]);
+    ASSERT_EQ(1, *res[1]);
+    ASSERT_FALSE(res[2].has_value());
+    ASSERT_EQ(3, *res[3]);
+}
+
+TEST(future_when, bounded_when_all_in_flight) {
+    const std::size_t n = 1000;
+    const std::size_t max_in_flight = 8;
+    std::mutex mu;
+    std::vector<flare::promise<void>> pending;
+    std::size_t max_pending = 0;
+    auto f = flare::when_all(n, max_in_flight, [&](std::size_t) {
+        flare::promise<void> p;
+        auto fut = p.get_future();
+        std::lock_guard<std::mutex> lk(mu);
+        pending.push_back(std::move(p));
+        max_pending = std::max(max_pending, pending.size());
+        return fut;
+    });
+
+    std::thread worker([&] {
+        while (true) {
+            flare::promise<void> p;
+            {
+                std::lock_guard<std::mutex> lk(mu);
+                if (pending.empty()) {
+                    return;
+                }
+                p = std::move(pending.back());
+                pending.pop_back();
+            }
+            // Makes the next future.
+            p.set_value();
+        }
+    });
+    worker.join();
+
+    auto res = f.get();
+    ASSERT_EQ(n, res.size());
+    ASSERT_EQ(max_in_flight, max_pending);
+}
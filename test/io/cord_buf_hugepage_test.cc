@@ -0,0 +1,125 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <thread>
+#include <vector>
+#include "testing/gtest_wrap.h"
+#include "flare/io/cord_buf.h"
+
+// Blocks allocated by enable_hugepage_blocks() can't be mixed with the debug
+// allocators installed in cord_buf_test.cc, thus tested in a separate binary.
+
+namespace {
+
+    const size_t POOL_SIZE = 16 * 1024 * 1024;
+
+    class CordBufHugePageTest : public ::testing::Test {
+    protected:
+        static void SetUpTestCase() {
+            ASSERT_TRUE(flare::cord_buf::enable_hugepage_blocks(POOL_SIZE));
+        }
+    };
+
+    void append_and_check_stats() {
+        const std::string piece(1024, 'a');
+        std::string data;
+        flare::cord_buf buf;
+        for (size_t i = 0; i < 64 * flare::cord_buf::DEFAULT_BLOCK_SIZE / piece.size(); ++i) {
+            buf.append(piece);
+            data.append(piece);
+        }
+        flare::cord_buf::hugepage_block_stats s =
+                flare::cord_buf::get_hugepage_block_stats();
+        ASSERT_EQ(1u, s.slab_count);
+        ASSERT_LE(64u, s.block_in_use);
+        ASSERT_EQ(s.block_total,
+                  s.block_in_use + s.block_thread_cached + s.block_pooled);
+        ASSERT_EQ(data, buf.to_string());
+
+        const size_t in_use = s.block_in_use;
+        buf.clear();
+        s = flare::cord_buf::get_hugepage_block_stats();
+        ASSERT_GT(in_use, s.block_in_use);
+        // Blocks beyond the per-thread limit go back to the pool.
+        ASSERT_LT(0u, s.block_pooled);
+        ASSERT_EQ(s.block_total,
+                  s.block_in_use + s.block_thread_cached + s.block_pooled);
+    }
+
+    TEST_F(CordBufHugePageTest, stats_follow_blocks) {
+        // A new thread has no blocks cached by cord_buf yet.
+        std::thread th(append_and_check_stats);
+        th.join();
+    }
+
+    TEST_F(CordBufHugePageTest, free_in_other_threads) {
+        const int N = 8;
+        const size_t NBLOCK = 16;
+        const std::string data(flare::cord_buf::DEFAULT_BLOCK_SIZE, 'a');
+        std::vector<flare::cord_buf> bufs(N);
+        std::thread producer([&bufs, &data, NBLOCK] {
+            for (int i = 0; i < N; ++i) {
+                for (size_t j = 0; j < NBLOCK; ++j) {
+                    bufs[i].append(data);
+                }
+            }
+        });
+        producer.join();
+        const flare::cord_buf::hugepage_block_stats s0 =
+                flare::cord_buf::get_hugepage_block_stats();
+        std::vector<std::thread> threads;
+        for (int i = 0; i < N; ++i) {
+            threads.emplace_back([&bufs, &data, NBLOCK, i] {
+                ASSERT_EQ(NBLOCK * data.size(), bufs[i].size());
+                bufs[i].clear();
+            });
+        }
+        for (auto &t : threads) {
+            t.join();
+        }
+        // Caches of exited threads are flushed into the pool.
+        const flare::cord_buf::hugepage_block_stats s =
+                flare::cord_buf::get_hugepage_block_stats();
+        ASSERT_EQ(s0.block_total, s.block_total);
+        ASSERT_EQ(s0.block_thread_cached, s.block_thread_cached);
+        ASSERT_LE(s0.block_pooled + N * NBLOCK, s.block_pooled);
+        ASSERT_EQ(s.block_total,
+                  s.block_in_use + s.block_thread_cached + s.block_pooled);
+    }
+
+    void append_until_exhausted() {
+        const size_t nblock = POOL_SIZE / flare::cord_buf::DEFAULT_BLOCK_SIZE;
+        flare::cord_buf buf;
+        std::string data(flare::cord_buf::DEFAULT_BLOCK_SIZE, 'x');
+        for (size_t i = 0; i < nblock + 16; ++i) {
+            buf.append(data);
+        }
+        const flare::cord_buf::hugepage_block_stats s =
+                flare::cord_buf::get_hugepage_block_stats();
+        ASSERT_EQ(POOL_SIZE / (2 * 1024 * 1024), s.slab_count);
+        ASSERT_EQ(nblock, s.block_total);
+        // Blocks beyond the pool come from malloc.
+        ASSERT_EQ((nblock + 16) * flare::cord_buf::DEFAULT_BLOCK_SIZE, buf.size());
+        ASSERT_EQ(std::string(buf.size(), 'x'), buf.to_string());
+    }
+
+    TEST_F(CordBufHugePageTest, fallback_when_exhausted) {
+        std::thread th(append_until_exhausted);
+        th.join();
+    }
+
+}  // namespace
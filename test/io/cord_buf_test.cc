@@ -3,6 +3,7 @@
 
 #include <sys/types.h>
 #include <sys/socket.h>                // socketpair
+#include <netinet/in.h>                // sockaddr_in
 #include <errno.h>                     // errno
 #include <fcntl.h>                     // O_RDONLY
 #include "flare/files/temp_file.h"      // temp_file
@@ -25,9 +26,9 @@
 
 namespace flare {
     namespace iobuf {
-        extern void *(*blockmem_allocate)(size_t);
+        extern std::atomic<void *(*)(size_t)> blockmem_allocate;
 
-        extern void (*blockmem_deallocate)(void *);
+        extern std::atomic<void (*)(void *)> blockmem_deallocate;
 
         extern void reset_blockmem_allocate_and_deallocate();
 
@@ -810,6 +811,55 @@ namespace {
         close(fds[1]);
     }
 
+    TEST_F(CordBufTest, cut_multiple_into_fd_zerocopy) {
+        flare::cord_buf *b1[4];
+        flare::cord_buf pinned;
+        flare::IOPortal b2;
+        std::string ref;
+        for (size_t j = 0; j < FLARE_ARRAY_SIZE(b1); ++j) {
+            std::string s(16 * 1024, 'a' + j);
+            ref.append(s);
+            b1[j] = new flare::cord_buf;
+            b1[j]->append(s);
+        }
+
+        // MSG_ZEROCOPY only works on TCP sockets.
+        flare::base::fd_guard listen_fd(socket(AF_INET, SOCK_STREAM, 0));
+        ASSERT_GE(listen_fd, 0);
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        ASSERT_EQ(0, bind(listen_fd, (sockaddr *) &addr, sizeof(addr)));
+        ASSERT_EQ(0, listen(listen_fd, 1));
+        socklen_t len = sizeof(addr);
+        ASSERT_EQ(0, getsockname(listen_fd, (sockaddr *) &addr, &len));
+        flare::base::fd_guard client_fd(socket(AF_INET, SOCK_STREAM, 0));
+        ASSERT_EQ(0, connect(client_fd, (sockaddr *) &addr, sizeof(addr)));
+        flare::base::fd_guard server_fd(accept(listen_fd, NULL, NULL));
+        ASSERT_GE(server_fd, 0);
+        int on = 1;
+        if (setsockopt(client_fd, SOL_SOCKET, 60/*SO_ZEROCOPY*/, &on, sizeof(on)) != 0) {
+            FLARE_LOG(INFO) << "SO_ZEROCOPY is not supported, skip";
+            return;
+        }
+
+        ASSERT_EQ((ssize_t) ref.length(),
+                  flare::cord_buf::cut_multiple_into_file_descriptor_zerocopy(
+                          client_fd, b1, FLARE_ARRAY_SIZE(b1), &pinned));
+        for (size_t j = 0; j < FLARE_ARRAY_SIZE(b1); ++j) {
+            ASSERT_TRUE(b1[j]->empty());
+            delete b1[j];
+            b1[j] = NULL;
+        }
+        // Sent blocks are kept until the kernel is done with them.
+        ASSERT_EQ(ref, pinned.to_string());
+        while (b2.length() < ref.length()) {
+            ASSERT_GT(b2.append_from_file_descriptor(server_fd, LONG_MAX), 0);
+        }
+        ASSERT_EQ(ref, to_str(b2));
+    }
+
     TEST_F(CordBufTest, cut_into_fd_a_lot_of_data) {
         install_debug_allocator();
 
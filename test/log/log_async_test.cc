@@ -0,0 +1,176 @@
+
+/****************************************************************
+ * Copyright (c) 2022, liyinbin
+ * All rights reserved.
+ * Author by liyinbin (jeff.li) lijippy@163.com
+ *****************************************************************/
+
+#include "flare/log/logging.h"
+
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include "testing/gtest_wrap.h"
+
+namespace {
+
+    class LogAsyncTest : public ::testing::Test {
+    protected:
+        static void SetUpTestCase() {
+            FLAGS_flare_timestamp_in_logfile_name = false;
+            flare::log::init_logging("log_async_test");
+            flare::log::set_log_destination(flare::log::FLARE_TRACE, "");
+            flare::log::set_log_destination(flare::log::FLARE_DEBUG, "");
+        }
+    };
+
+    // Log files are not reopened if the name is unchanged, use a new one.
+    std::string use_new_log_file() {
+        static int seq = 0;
+        const std::string path = "log_async_test.INFO." + std::to_string(seq++);
+        unlink(path.c_str());
+        flare::log::set_log_destination(flare::log::FLARE_INFO, path.c_str());
+        return path;
+    }
+
+    // Returns lines written by log_lines(), indexed by thread.
+    std::vector<std::vector<int>> read_lines(const std::string &path, int nthread) {
+        std::vector<std::vector<int>> lines(nthread);
+        std::ifstream in(path);
+        std::string line;
+        while (std::getline(in, line)) {
+            const size_t pos = line.find("async_line ");
+            if (pos == std::string::npos) {
+                continue;
+            }
+            int t = -1;
+            int i = -1;
+            sscanf(line.c_str() + pos, "async_line %d %d", &t, &i);
+            if (t >= 0 && t < nthread) {
+                lines[t].push_back(i);
+            }
+        }
+        return lines;
+    }
+
+    void log_lines(int nthread, int nline, const std::string &payload) {
+        std::vector<std::thread> threads;
+        for (int t = 0; t < nthread; ++t) {
+            threads.emplace_back([t, nline, &payload] {
+                for (int i = 0; i < nline; ++i) {
+                    FLARE_LOG(INFO) << "async_line " << t << ' ' << i << ' ' << payload;
+                }
+            });
+        }
+        for (auto &th : threads) {
+            th.join();
+        }
+        flare::log::flush_log_files(flare::log::FLARE_INFO);
+    }
+
+    TEST_F(LogAsyncTest, lines_keep_order) {
+        const int NTHREAD = 8;
+        const int NLINE = 1000;
+        const std::string path = use_new_log_file();
+        flare::log::enable_async_logging();
+        const int64_t dropped0 = flare::log::async_logging_dropped_count();
+        log_lines(NTHREAD, NLINE, "x");
+        ASSERT_EQ(dropped0, flare::log::async_logging_dropped_count());
+        std::vector<std::vector<int>> lines = read_lines(path, NTHREAD);
+        for (int t = 0; t < NTHREAD; ++t) {
+            ASSERT_EQ((size_t) NLINE, lines[t].size());
+            for (int i = 0; i < NLINE; ++i) {
+                ASSERT_EQ(i, lines[t][i]);
+            }
+        }
+        flare::log::disable_async_logging();
+    }
+
+    TEST_F(LogAsyncTest, drop_or_block_when_full) {
+        const int NTHREAD = 4;
+        const int NLINE = 2000;
+        const std::string payload(2000, 'y');
+        FLAGS_flare_log_async_buffer_kb = 64;
+        flare::log::enable_async_logging();
+        for (int block = 0; block < 2; ++block) {
+            FLAGS_flare_log_async_block_on_full = block;
+            const std::string path = use_new_log_file();
+            const int64_t dropped0 = flare::log::async_logging_dropped_count();
+            // Buffers are created by new threads with the updated size.
+            log_lines(NTHREAD, NLINE, payload);
+            const int64_t dropped =
+                    flare::log::async_logging_dropped_count() - dropped0;
+            std::vector<std::vector<int>> lines = read_lines(path, NTHREAD);
+            size_t nwritten = 0;
+            for (int t = 0; t < NTHREAD; ++t) {
+                for (size_t i = 1; i < lines[t].size(); ++i) {
+                    ASSERT_LT(lines[t][i - 1], lines[t][i]);
+                }
+                nwritten += lines[t].size();
+            }
+            ASSERT_EQ((size_t) NTHREAD * NLINE, nwritten + dropped);
+            if (block) {
+                ASSERT_EQ(0, dropped);
+            }
+        }
+        flare::log::disable_async_logging();
+        FLAGS_flare_log_async_block_on_full = false;
+        FLAGS_flare_log_async_buffer_kb = 1024;
+    }
+
+    // Records what is written to a log file.
+    class recording_logger : public flare::log::base::inner_logger {
+    public:
+        void write(bool force_flush, time_t, const char *message, int message_len) override {
+            std::unique_lock<std::mutex> l(mutex);
+            writes.emplace_back(force_flush, std::string(message, message_len));
+        }
+
+        void flush() override {}
+
+        uint32_t log_size() override { return 0; }
+
+        std::mutex mutex;
+        std::vector<std::pair<bool, std::string>> writes;
+    };
+
+    TEST_F(LogAsyncTest, set_logger_and_flush_by_severity) {
+        use_new_log_file();
+        flare::log::enable_async_logging();
+        flare::log::base::inner_logger *old_logger =
+                flare::log::base::get_logger(flare::log::FLARE_INFO);
+        recording_logger *logger = new recording_logger;
+        FLARE_LOG(INFO) << "async_before_set_logger";
+        flare::log::base::set_logger(flare::log::FLARE_INFO, logger);
+        FLARE_LOG(INFO) << "async_info_only";
+        flare::log::flush_log_files(flare::log::FLARE_INFO);
+        FLARE_LOG(INFO) << "async_info_then_warning";
+        FLARE_LOG(WARNING) << "async_warning";
+        flare::log::flush_log_files(flare::log::FLARE_INFO);
+        flare::log::base::set_logger(flare::log::FLARE_INFO, old_logger);
+        flare::log::disable_async_logging();
+
+        // Lines logged before set_logger() went to the old logger.
+        bool info_only_seen = false;
+        bool warning_seen = false;
+        for (auto &w : logger->writes) {
+            ASSERT_EQ(std::string::npos, w.second.find("async_before_set_logger"));
+            if (w.second.find("async_info_only") != std::string::npos) {
+                info_only_seen = true;
+                ASSERT_FALSE(w.first);
+            }
+            // Batched into the INFO file and flushed as the WARNING line would be.
+            if (w.second.find("async_warning") != std::string::npos) {
+                warning_seen = true;
+                ASSERT_TRUE(w.first);
+            }
+        }
+        ASSERT_TRUE(info_only_seen);
+        ASSERT_TRUE(warning_seen);
+        delete logger;
+    }
+
+}  // namespace
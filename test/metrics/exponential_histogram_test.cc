@@ -0,0 +1,233 @@
+
+/****************************************************************
+ * Copyright (c) 2022, liyinbin
+ * All rights reserved.
+ * Author by liyinbin (jeff.li) lijippy@163.com
+ *****************************************************************/
+
+#include "flare/metrics/exponential_histogram.h"
+#include "flare/metrics/prometheus_dumper.h"
+#include "flare/base/fast_rand.h"
+#include <cmath>
+#include <limits>
+#include <thread>
+#include <vector>
+#include <google/protobuf/io/coded_stream.h>
+#include "testing/gtest_wrap.h"
+
+namespace {
+
+    using flare::metrics_detail::exponential_bucket_key;
+    using flare::metrics_detail::exponential_bucket_upper_bound;
+
+    TEST(exponential_histogram, bucket_key) {
+        for (int key = flare::metrics_detail::kExpMinKey; key < flare::metrics_detail::kExpMaxKey; ++key) {
+            const double upper = exponential_bucket_upper_bound(key);
+            ASSERT_EQ(key, exponential_bucket_key(upper)) << upper;
+            ASSERT_EQ(key + 1, exponential_bucket_key(std::nextafter(upper, 1e300))) << upper;
+        }
+        for (int i = 0; i < 100000; ++i) {
+            const double v = std::exp2(flare::base::fast_rand_double() * 60 - 12);
+            const int key = exponential_bucket_key(v);
+            ASSERT_LE(v, exponential_bucket_upper_bound(key)) << v;
+            ASSERT_GT(v, exponential_bucket_upper_bound(key - 1)) << v;
+        }
+        ASSERT_EQ(0, exponential_bucket_key(1));
+        ASSERT_EQ(8, exponential_bucket_key(2));
+        ASSERT_EQ(80, exponential_bucket_key(1000));
+        ASSERT_EQ(flare::metrics_detail::kExpMaxKey, exponential_bucket_key(1e300));
+        ASSERT_EQ(flare::metrics_detail::kExpMaxKey,
+                  exponential_bucket_key(std::numeric_limits<double>::infinity()));
+    }
+
+    TEST(exponential_histogram, snapshot) {
+        flare::exponential_histogram_snapshot s;
+        s.add(0);
+        s.add(-1);
+        s.add(std::nan(""));
+        s.add(1e-9);
+        ASSERT_EQ(4u, s.zero_count());
+        s.add(1);
+        s.add(1000);
+        s.add(1000);
+        s.add(1e100);
+        ASSERT_EQ(8u, s.count());
+        ASSERT_EQ(1u, s.bucket_count(0));
+        ASSERT_EQ(2u, s.bucket_count(80));
+        ASSERT_EQ(1u, s.bucket_count(flare::metrics_detail::kExpMaxKey));
+
+        flare::exponential_histogram_snapshot s2;
+        for (int i = 1; i <= 100; ++i) {
+            s2.add(i);
+        }
+        flare::exponential_histogram_snapshot s3 = s2;
+        s3.merge(s2);
+        ASSERT_EQ(200u, s3.count());
+        ASSERT_DOUBLE_EQ(10100, s3.sum());
+        ASSERT_EQ(2 * s2.bucket_count(exponential_bucket_key(50)),
+                  s3.bucket_count(exponential_bucket_key(50)));
+        // Within the width of a bucket.
+        ASSERT_GE(s3.value_at(0.5), 50);
+        ASSERT_LT(s3.value_at(0.5), 50 * 1.1);
+        ASSERT_GE(s3.value_at(0.99), 99);
+        ASSERT_LT(s3.value_at(0.99), 99 * 1.1);
+        ASSERT_EQ(exponential_bucket_upper_bound(exponential_bucket_key(1)), s3.value_at(0));
+
+        s.merge(s3);
+        ASSERT_EQ(208u, s.count());
+        s3 = s;
+        ASSERT_EQ(1u, s3.bucket_count(flare::metrics_detail::kExpMaxKey));
+        s.clear();
+        ASSERT_EQ(0u, s.count());
+        ASSERT_EQ(0u, s.bucket_count(80));
+        ASSERT_EQ(0, s.value_at(0.5));
+    }
+
+    TEST(exponential_histogram, multi_threads) {
+        flare::exponential_histogram h("exp_histogram_threads", "");
+        const int N = 8;
+        const int M = 100000;
+        std::vector<std::thread> threads;
+        for (int i = 0; i < N; ++i) {
+            threads.emplace_back([&h, i] {
+                for (int j = 0; j < M; ++j) {
+                    h << (i + 1) * 10;
+                }
+            });
+        }
+        for (auto &t : threads) {
+            t.join();
+        }
+        auto s = h.snapshot();
+        ASSERT_EQ(static_cast<uint64_t>(N * M), s.count());
+        for (int i = 0; i < N; ++i) {
+            ASSERT_EQ(static_cast<uint64_t>(M), s.bucket_count(exponential_bucket_key((i + 1) * 10)));
+        }
+        // Shards of the exited threads are kept.
+        ASSERT_EQ(static_cast<uint64_t>(N * M), h.reset().count());
+        ASSERT_EQ(0u, h.snapshot().count());
+    }
+
+    TEST(exponential_histogram, text_format) {
+        flare::exponential_histogram h("exp_histogram_text", "latency", {{"method", "echo"}});
+        h << 0 << 1 << 3 << 3 << 1e100;
+        flare::cache_metrics cm;
+        h.collect_metrics(cm);
+        auto str = flare::prometheus_dumper::dump_to_string(cm, nullptr);
+        std::cout << str << std::endl;
+        ASSERT_NE(std::string::npos, str.find("# TYPE exp_histogram_text histogram\n"));
+        ASSERT_NE(std::string::npos, str.find("exp_histogram_text_count{method=\"echo\"} 5\n"));
+        ASSERT_NE(std::string::npos, str.find("exp_histogram_text_bucket{method=\"echo\",le=\"1.000000\"} 2\n"));
+        ASSERT_NE(std::string::npos, str.find("exp_histogram_text_bucket{method=\"echo\",le=\"+Inf\"} 5\n"));
+        ASSERT_EQ(str.find("le=\"+Inf\""), str.rfind("le=\"+Inf\""));
+    }
+
+    TEST(exponential_histogram, protobuf_format) {
+        flare::exponential_histogram h("exp_histogram_pb", "latency");
+        // Buckets 0, 1, 2 and 80.
+        h << 0 << 1 << 1.05 << 1.1 << 1.1 << 1000;
+        flare::cache_metrics cm;
+        h.collect_metrics(cm);
+        auto &hist = cm.histogram;
+        ASSERT_TRUE(hist.native);
+        ASSERT_EQ(2u, hist.positive_spans.size());
+        ASSERT_EQ(0, hist.positive_spans[0].offset);
+        ASSERT_EQ(3u, hist.positive_spans[0].length);
+        ASSERT_EQ(77, hist.positive_spans[1].offset);
+        ASSERT_EQ(1u, hist.positive_spans[1].length);
+        ASSERT_EQ((std::vector<int64_t>{1, 0, 1, -1}), hist.positive_deltas);
+
+        auto str = flare::prometheus_protobuf_dumper::dump_to_string(cm, nullptr);
+        google::protobuf::io::CodedInputStream in(
+                reinterpret_cast<const uint8_t *>(str.data()), static_cast<int>(str.size()));
+        uint32_t size;
+        ASSERT_TRUE(in.ReadVarint32(&size));
+        ASSERT_EQ(str.size(), google::protobuf::io::CodedOutputStream::VarintSize32(size) + size);
+
+        std::string name;
+        std::string metric;
+        uint32_t tag;
+        while ((tag = in.ReadTag()) != 0) {
+            uint32_t v;
+            switch (tag >> 3) {
+                case 1:
+                    ASSERT_TRUE(in.ReadVarint32(&v));
+                    ASSERT_TRUE(in.ReadString(&name, v));
+                    break;
+                case 3:
+                    ASSERT_TRUE(in.ReadVarint32(&v));
+                    ASSERT_EQ(4u, v);  // HISTOGRAM
+                    break;
+                case 4:
+                    ASSERT_TRUE(in.ReadVarint32(&v));
+                    ASSERT_TRUE(in.ReadString(&metric, v));
+                    break;
+                default:
+                    ASSERT_EQ(2u, tag & 7);
+                    ASSERT_TRUE(in.ReadVarint32(&v));
+                    ASSERT_TRUE(in.Skip(v));
+                    break;
+            }
+        }
+        ASSERT_EQ("exp_histogram_pb", name);
+
+        // Metric.histogram
+        google::protobuf::io::CodedInputStream min(
+                reinterpret_cast<const uint8_t *>(metric.data()), static_cast<int>(metric.size()));
+        ASSERT_EQ((7u << 3) | 2, min.ReadTag());
+        uint32_t hsize;
+        ASSERT_TRUE(min.ReadVarint32(&hsize));
+        ASSERT_EQ(metric.size(), 1 + google::protobuf::io::CodedOutputStream::VarintSize32(hsize) + hsize);
+
+        uint64_t sample_count = 0;
+        uint32_t schema = 0;
+        uint64_t zero_count = 0;
+        int spans = 0;
+        std::vector<int64_t> deltas;
+        while ((tag = min.ReadTag()) != 0) {
+            uint32_t v;
+            uint64_t v64;
+            switch (tag >> 3) {
+                case 1:
+                    ASSERT_TRUE(min.ReadVarint64(&sample_count));
+                    break;
+                case 5:
+                    ASSERT_TRUE(min.ReadVarint32(&schema));
+                    break;
+                case 7:
+                    ASSERT_TRUE(min.ReadVarint64(&zero_count));
+                    break;
+                case 12:
+                    ++spans;
+                    ASSERT_TRUE(min.ReadVarint32(&v));
+                    ASSERT_TRUE(min.Skip(v));
+                    break;
+                case 13: {
+                    ASSERT_TRUE(min.ReadVarint32(&v));
+                    auto limit = min.PushLimit(v);
+                    while (min.BytesUntilLimit() > 0) {
+                        ASSERT_TRUE(min.ReadVarint64(&v64));
+                        deltas.push_back(static_cast<int64_t>(v64 >> 1) ^ -static_cast<int64_t>(v64 & 1));
+                    }
+                    min.PopLimit(limit);
+                    break;
+                }
+                default:
+                    if ((tag & 7) == 1) {
+                        ASSERT_TRUE(min.ReadLittleEndian64(&v64));
+                    } else {
+                        ASSERT_EQ(2u, tag & 7);
+                        ASSERT_TRUE(min.ReadVarint32(&v));
+                        ASSERT_TRUE(min.Skip(v));
+                    }
+                    break;
+            }
+        }
+        ASSERT_EQ(6u, sample_count);
+        ASSERT_EQ(6u, schema);  // zigzag(3)
+        ASSERT_EQ(1u, zero_count);
+        ASSERT_EQ(2, spans);
+        ASSERT_EQ(hist.positive_deltas, deltas);
+    }
+
+}  // namespace
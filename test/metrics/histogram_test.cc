@@ -10,6 +10,7 @@
 #include "flare/base/fast_rand.h"
 #include <thread>
 #include <atomic>
+#include <cmath>
 #include <vector>
 #include <sstream>
 #include <iostream>
@@ -51,4 +52,32 @@ TEST(metrics, histogram) {
     std::vector<flare::cache_metrics> cml;
     flare::variable_base::list_metrics(&cml);
     EXPECT_EQ(cml.size(),2ul);
-}
\ No newline at end of file
+}
+TEST(metrics, histogram_overflow) {
+    flare::histogram h("h_overflow", "", flare::bucket_builder::liner_values(10, 10, 3));
+    h << 5 << 30 << 31 << 1000;
+    flare::cache_metrics cm;
+    h.collect_metrics(cm);
+    ASSERT_EQ(4u, cm.histogram.sample_count);
+    ASSERT_DOUBLE_EQ(1066, cm.histogram.sample_sum);
+    ASSERT_EQ(4u, cm.histogram.bucket.size());
+    ASSERT_EQ(2u, cm.histogram.bucket[2].cumulative_count);
+    ASSERT_TRUE(std::isinf(cm.histogram.bucket[3].upper_bound));
+    ASSERT_EQ(4u, cm.histogram.bucket[3].cumulative_count);
+}
+TEST(metrics, histogram_nan) {
+    // Short lists are scanned, long ones binary searched, NaN lands in
+    // the +Inf bucket on both paths.
+    for (size_t n : {3ul, 100ul}) {
+        flare::histogram h("h_nan", "", flare::bucket_builder::liner_values(10, 10, n));
+        h << 5 << std::nan("") << 10 * n + 5;
+        flare::cache_metrics cm;
+        h.collect_metrics(cm);
+        ASSERT_EQ(3u, cm.histogram.sample_count);
+        ASSERT_EQ(n + 1, cm.histogram.bucket.size());
+        ASSERT_EQ(1u, cm.histogram.bucket[0].cumulative_count);
+        ASSERT_EQ(1u, cm.histogram.bucket[n - 1].cumulative_count);
+        ASSERT_TRUE(std::isinf(cm.histogram.bucket[n].upper_bound));
+        ASSERT_EQ(3u, cm.histogram.bucket[n].cumulative_count);
+    }
+}
@@ -762,6 +762,7 @@ TEST_F(BuiltinServiceTest, fibers) {
         service.default_method(&cntl, &req, &res, &done);
         EXPECT_FALSE(cntl.Failed());
         CheckContent(cntl, "Use /fibers/<fiber_id>");
+        CheckContent(cntl, "-fiber_stack_usage_tracking");
     }
     {
         ClosureChecker done;
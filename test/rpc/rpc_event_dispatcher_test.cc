@@ -28,6 +28,7 @@
 #include "flare/base/fd_utility.h"
 #include "flare/rpc/event_dispatcher.h"
 #include "flare/rpc/details/has_epollrdhup.h"
+#include "flare/rpc/details/io_uring_poller.h"
 
 class EventDispatcherTest : public ::testing::Test {
 protected:
@@ -54,6 +55,157 @@ TEST_F(EventDispatcherTest, versioned_ref) {
     ASSERT_EQ(flare::rpc::MakeVRef(1, 1), versioned_ref);
 }
 
+TEST_F(EventDispatcherTest, io_uring_poller) {
+    if (!flare::rpc::IoUringPoller::IsSupported()) {
+        FLARE_LOG(INFO) << "io_uring is not supported, skip";
+        return;
+    }
+    flare::rpc::IoUringPoller poller;
+    ASSERT_EQ(0, poller.Init(64));
+    int fds[2];
+    ASSERT_EQ(0, pipe(fds));
+    ASSERT_EQ(0, poller.AddConsumer(42, fds[0]));
+    ASSERT_EQ(-1, poller.AddConsumer(42, fds[0]));
+
+    epoll_event e[8];
+    ASSERT_EQ(1, write(fds[1], "x", 1));
+    ASSERT_EQ(1, poller.Wait(e, FLARE_ARRAY_SIZE(e)));
+    ASSERT_TRUE(e[0].events & EPOLLIN);
+    ASSERT_EQ(42u, e[0].data.u64);
+    // The consumer keeps being watched after an event.
+    ASSERT_EQ(1, write(fds[1], "x", 1));
+    ASSERT_EQ(1, poller.Wait(e, FLARE_ARRAY_SIZE(e)));
+    ASSERT_TRUE(e[0].events & EPOLLIN);
+
+    ASSERT_EQ(0, poller.AddPollOut(43, fds[1]));
+    ASSERT_EQ(1, poller.Wait(e, FLARE_ARRAY_SIZE(e)));
+    ASSERT_TRUE(e[0].events & EPOLLOUT);
+    ASSERT_EQ(43u, e[0].data.u64);
+    ASSERT_EQ(0, poller.RemovePollOut(fds[1]));
+
+    ASSERT_EQ(0, poller.RemoveConsumer(fds[0]));
+    ASSERT_EQ(-1, poller.RemoveConsumer(fds[0]));
+    ASSERT_EQ(1, write(fds[1], "x", 1));
+    // Removed consumers get no events, Wakeup() makes Wait() return.
+    poller.Wakeup();
+    ASSERT_EQ(0, poller.Wait(e, FLARE_ARRAY_SIZE(e)));
+    close(fds[0]);
+    close(fds[1]);
+}
+
+TEST_F(EventDispatcherTest, io_uring_poller_small_ring) {
+    if (!flare::rpc::IoUringPoller::IsSupported()) {
+        FLARE_LOG(INFO) << "io_uring is not supported, skip";
+        return;
+    }
+    // Many more requests than submission slots, none of them may be lost
+    // when the queue is full.
+    flare::rpc::IoUringPoller poller;
+    ASSERT_EQ(0, poller.Init(4));
+    const int N = 32;
+    int fds[N][2];
+    for (int i = 0; i < N; ++i) {
+        ASSERT_EQ(0, pipe(fds[i]));
+        ASSERT_EQ(0, poller.AddConsumer(i, fds[i][0]));
+    }
+    for (int round = 0; round < 3; ++round) {
+        for (int i = 0; i < N; ++i) {
+            ASSERT_EQ(1, write(fds[i][1], "x", 1));
+        }
+        std::vector<bool> seen(N, false);
+        int nseen = 0;
+        epoll_event e[8];
+        while (nseen < N) {
+            const int n = poller.Wait(e, FLARE_ARRAY_SIZE(e));
+            ASSERT_GE(n, 0);
+            for (int j = 0; j < n; ++j) {
+                if (!seen[e[j].data.u64]) {
+                    seen[e[j].data.u64] = true;
+                    ++nseen;
+                }
+            }
+        }
+        for (int i = 0; i < N; ++i) {
+            char c;
+            ASSERT_EQ(1, read(fds[i][0], &c, 1));
+        }
+    }
+    for (int i = 0; i < N; ++i) {
+        ASSERT_EQ(0, poller.RemoveConsumer(fds[i][0]));
+        close(fds[i][0]);
+        close(fds[i][1]);
+    }
+}
+
+// Ready events per second delivered by `wait', with `nready' of `N' pipes
+// written before each wait. Reads and writes are the same for both pollers.
+template<typename WaitFn>
+double poller_events_per_second(int (*fds)[2], int N, int nready, WaitFn &&wait) {
+    const int ROUNDS = 20000;
+    epoll_event e[64];
+    int64_t nevents = 0;
+    const int64_t start_time = flare::get_current_time_micros();
+    for (int round = 0; round < ROUNDS; ++round) {
+        for (int i = 0; i < nready; ++i) {
+            EXPECT_EQ(1, write(fds[(round + i * 7) % N][1], "x", 1));
+        }
+        for (int got = 0; got < nready;) {
+            const int n = wait(e, nready - got);
+            EXPECT_GT(n, 0);
+            for (int j = 0; j < n; ++j) {
+                char c;
+                EXPECT_EQ(1, read(fds[e[j].data.u64][0], &c, 1));
+            }
+            got += n;
+        }
+        nevents += nready;
+    }
+    return nevents * 1000000.0 / (flare::get_current_time_micros() - start_time);
+}
+
+TEST_F(EventDispatcherTest, io_uring_poller_vs_epoll_perf) {
+    if (!flare::rpc::IoUringPoller::IsSupported()) {
+        FLARE_LOG(INFO) << "io_uring is not supported, skip";
+        return;
+    }
+    const int N = 64;
+    int fds[N][2];
+    flare::rpc::IoUringPoller poller;
+    ASSERT_EQ(0, poller.Init(256));
+    const int epfd = epoll_create(1024);
+    ASSERT_GE(epfd, 0);
+    for (int i = 0; i < N; ++i) {
+        ASSERT_EQ(0, pipe(fds[i]));
+        flare::base::make_non_blocking(fds[i][0]);
+        ASSERT_EQ(0, poller.AddConsumer(i, fds[i][0]));
+    }
+    const int nreadys[] = {1, 8, 32};
+    for (int nready : nreadys) {
+        const double uring_qps = poller_events_per_second(
+                fds, N, nready, [&](epoll_event *e, int n) { return poller.Wait(e, n); });
+        for (int i = 0; i < N; ++i) {
+            poller.RemoveConsumer(fds[i][0]);
+            epoll_event evt = {EPOLLIN | EPOLLET, {0}};
+            evt.data.u64 = i;
+            ASSERT_EQ(0, epoll_ctl(epfd, EPOLL_CTL_ADD, fds[i][0], &evt));
+        }
+        const double epoll_qps = poller_events_per_second(
+                fds, N, nready, [&](epoll_event *e, int n) { return epoll_wait(epfd, e, n, -1); });
+        for (int i = 0; i < N; ++i) {
+            ASSERT_EQ(0, epoll_ctl(epfd, EPOLL_CTL_DEL, fds[i][0], NULL));
+            ASSERT_EQ(0, poller.AddConsumer(i, fds[i][0]));
+        }
+        printf("%d of %d ready: io_uring=%.0f epoll=%.0f events/s\n",
+               nready, N, uring_qps, epoll_qps);
+    }
+    for (int i = 0; i < N; ++i) {
+        poller.RemoveConsumer(fds[i][0]);
+        close(fds[i][0]);
+        close(fds[i][1]);
+    }
+    close(epfd);
+}
+
 std::vector<int> err_fd;
 pthread_mutex_t err_fd_mutex = PTHREAD_MUTEX_INITIALIZER;
 
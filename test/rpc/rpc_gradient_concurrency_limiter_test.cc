@@ -0,0 +1,219 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include <algorithm>
+#include <memory>
+#include <queue>
+#include <vector>
+#include "testing/gtest_wrap.h"
+#include "flare/times/time.h"
+#include "flare/rpc/errno.pb.h"
+#include "flare/rpc/policy/auto_concurrency_limiter.h"
+#include "flare/rpc/policy/gradient_concurrency_limiter.h"
+
+namespace {
+
+    using flare::rpc::ConcurrencyLimiter;
+
+    // Simulates a server with kWorkers workers each taking kServiceUs (or
+    // Phase.service_us) to process a request in FIFO order. Requests arrive
+    // at a fixed rate and the ones responded within kTimeoutUs are good, the
+    // others time out at client side. Time is simulated, limiters see it
+    // through SimulatedClock.
+    const int kWorkers = 32;
+    const int64_t kServiceUs = 5000;
+    const int64_t kTimeoutUs = 100000;
+    const int kCapacityQps = kWorkers * 1000000 / kServiceUs;
+
+    struct Phase {
+        int qps;
+        int64_t duration_us;
+        bool measured;
+        int64_t service_us;
+    };
+
+    struct Stats {
+        Stats() : good(0), timedout(0), rejected(0) {}
+
+        int64_t good;
+        int64_t timedout;
+        int64_t rejected;
+    };
+
+    struct Pending {
+        int64_t finish_us;
+        int64_t latency_us;
+        bool measured;
+        int priority;
+
+        bool operator<(const Pending &rhs) const { return finish_us > rhs.finish_us; }
+    };
+
+    // Limiter sampling at the simulated time *now_us.
+    template<typename Limiter>
+    class SimulatedClock : public Limiter {
+    public:
+        explicit SimulatedClock(const int64_t *now_us) : _now_us(now_us) {}
+
+    protected:
+        int64_t NowUs() const override { return *_now_us; }
+
+    private:
+        const int64_t *_now_us;
+    };
+
+    // `priorities' are assigned to requests round-robin, stats are kept for
+    // each of them. *now_us is advanced from its current value.
+    std::vector<Stats> Simulate(ConcurrencyLimiter *cl, int64_t *now_us,
+                                const std::vector<Phase> &phases,
+                                const std::vector<int> &priorities) {
+        std::vector<Stats> stats(priorities.size());
+        std::vector<int64_t> worker_free_us(kWorkers, *now_us);
+        std::priority_queue<Pending> pending;
+        int concurrency = 0;
+        int64_t nrequest = 0;
+        // Responds requests finished no later than `until_us'.
+        auto respond = [&](int64_t until_us) {
+            while (!pending.empty() && pending.top().finish_us <= until_us) {
+                const Pending done = pending.top();
+                pending.pop();
+                *now_us = done.finish_us;
+                --concurrency;
+                cl->OnResponded(0, done.latency_us);
+                if (done.measured) {
+                    Stats &s = stats[done.priority];
+                    ++(done.latency_us <= kTimeoutUs ? s.good : s.timedout);
+                }
+            }
+        };
+        int64_t phase_start_us = *now_us;
+        for (const Phase &phase : phases) {
+            const int64_t interval_us = 1000000 / phase.qps;
+            const int64_t end_us = phase_start_us + phase.duration_us;
+            for (int64_t arrival_us = phase_start_us; arrival_us < end_us;
+                 arrival_us += interval_us) {
+                respond(arrival_us);
+                *now_us = arrival_us;
+                const int index = nrequest++ % priorities.size();
+                const int cc = ++concurrency;
+                if (!cl->OnRequested(cc, priorities[index])) {
+                    --concurrency;
+                    cl->OnResponded(flare::rpc::ELIMIT, 0);
+                    if (phase.measured) {
+                        ++stats[index].rejected;
+                    }
+                    continue;
+                }
+                std::vector<int64_t>::iterator worker =
+                        std::min_element(worker_free_us.begin(), worker_free_us.end());
+                const int64_t finish_us = std::max(*worker, arrival_us) + phase.service_us;
+                *worker = finish_us;
+                Pending p = {finish_us, finish_us - arrival_us, phase.measured, index};
+                pending.push(p);
+            }
+            phase_start_us = end_us;
+        }
+        respond(phase_start_us);
+        *now_us = phase_start_us;
+        return stats;
+    }
+
+    // Does not limit anything.
+    class UnlimitedConcurrencyLimiter : public ConcurrencyLimiter {
+    public:
+        bool OnRequested(int) override { return true; }
+
+        void OnResponded(int, int64_t) override {}
+
+        int MaxConcurrency() override { return 0; }
+
+        ConcurrencyLimiter *New(const flare::rpc::AdaptiveMaxConcurrency &) const override {
+            return new UnlimitedConcurrencyLimiter;
+        }
+    };
+
+    // Light load to learn the latency without load, then 3 times of the
+    // capacity.
+    const std::vector<Phase> kOverload = {
+            {kCapacityQps / 2, 500000, false, kServiceUs},
+            {kCapacityQps * 3, 2000000, true, kServiceUs},
+    };
+
+    // Near the capacity, then processing becomes 3 times slower, e.g. a
+    // downstream server is in trouble.
+    const std::vector<Phase> kLatencySpike = {
+            {kCapacityQps * 9 / 10, 1000000, false, kServiceUs},
+            {kCapacityQps * 9 / 10, 2000000, true, kServiceUs * 3},
+    };
+
+    // Returns goodput of the gradient limiter divided by the one of the auto
+    // limiter.
+    double CompareGoodput(const std::vector<Phase> &phases, double capacity) {
+        // Limiters are created at the start of simulated time.
+        int64_t now_us = flare::get_current_time_micros();
+        UnlimitedConcurrencyLimiter unlimited;
+        const Stats none = Simulate(&unlimited, &now_us, phases, {0})[0];
+        now_us = flare::get_current_time_micros();
+        SimulatedClock<flare::rpc::policy::AutoConcurrencyLimiter> auto_cl(&now_us);
+        const Stats autos = Simulate(&auto_cl, &now_us, phases, {0})[0];
+        now_us = flare::get_current_time_micros();
+        SimulatedClock<flare::rpc::policy::GradientConcurrencyLimiter> gradient_cl(&now_us);
+        const Stats gradient = Simulate(&gradient_cl, &now_us, phases, {0})[0];
+        std::cout << "goodput/capacity unlimited=" << none.good / capacity
+                  << " auto=" << autos.good / capacity
+                  << " gradient=" << gradient.good / capacity << std::endl;
+        std::cout << "timedout unlimited=" << none.timedout << " auto=" << autos.timedout
+                  << " gradient=" << gradient.timedout << std::endl;
+        EXPECT_GT(gradient.good, capacity * 0.8);
+        EXPECT_GT(gradient.good, none.good * 2);
+        return (double) gradient.good / autos.good;
+    }
+
+    TEST(GradientConcurrencyLimiterTest, goodput_under_overload) {
+        // Requests can be processed in the measured 2s.
+        ASSERT_GT(CompareGoodput(kOverload, kCapacityQps * 2.0), 0.95);
+    }
+
+    TEST(GradientConcurrencyLimiterTest, goodput_under_latency_spike) {
+        ASSERT_GT(CompareGoodput(kLatencySpike, kCapacityQps / 3 * 2.0), 0.98);
+    }
+
+    TEST(GradientConcurrencyLimiterTest, shed_low_priority_first) {
+        int64_t now_us = flare::get_current_time_micros();
+        SimulatedClock<flare::rpc::policy::GradientConcurrencyLimiter> cl(&now_us);
+        const std::vector<Stats> stats = Simulate(&cl, &now_us, kOverload, {-2, 0, 2});
+        std::cout << "good of priority -2/0/2: " << stats[0].good << '/'
+                  << stats[1].good << '/' << stats[2].good << std::endl;
+        ASSERT_LT(stats[0].good, stats[1].good);
+        ASSERT_LT(stats[1].good, stats[2].good);
+        ASSERT_LT(stats[2].rejected, stats[0].rejected);
+    }
+
+    TEST(GradientConcurrencyLimiterTest, default_priority) {
+        flare::rpc::policy::GradientConcurrencyLimiter cl;
+        const int max_concurrency = cl.MaxConcurrency();
+        ASSERT_GT(max_concurrency, 0);
+        ASSERT_TRUE(cl.OnRequested(max_concurrency));
+        ASSERT_FALSE(cl.OnRequested(max_concurrency + 1));
+        ASSERT_TRUE(cl.OnRequested(max_concurrency + 1, 1));
+        ASSERT_FALSE(cl.OnRequested(max_concurrency, -1));
+        // Priorities are clamped.
+        ASSERT_EQ(cl.OnRequested(max_concurrency * 2, 100), cl.OnRequested(max_concurrency * 2, 3));
+    }
+
+}  // namespace
@@ -0,0 +1,223 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include <map>
+#include <thread>
+#include "testing/gtest_wrap.h"
+#include "flare/rpc/details/h2_stream_table.h"
+#include "flare/rpc/details/h2_write_scheduler.h"
+
+namespace {
+
+    using flare::rpc::H2WriteScheduler;
+
+    const int64_t BIG_WINDOW = 0x7FFFFFFF;
+    const uint32_t FRAME_SIZE = 16384;
+
+    void push(H2WriteScheduler *s, int stream_id, int weight, int64_t window,
+              size_t size, bool trailer = false) {
+        flare::cord_buf data;
+        data.append(std::string(size, 'a' + stream_id % 26));
+        std::vector<flare::rpc::HPacker::Header> trailers;
+        if (trailer) {
+            trailers.push_back(flare::rpc::HPacker::Header("grpc-status", "0"));
+        }
+        ASSERT_EQ(0, s->Push(stream_id, weight, window, &data, &trailers));
+        ASSERT_TRUE(data.empty());
+    }
+
+    TEST(H2WriteSchedulerTest, small_streams_are_not_blocked) {
+        H2WriteScheduler s;
+        ASSERT_EQ(0, s.Init());
+        push(&s, 1, 16, BIG_WINDOW, 16 * 1024 * 1024);
+        for (int i = 0; i < 10; ++i) {
+            push(&s, 3 + i * 2, 16, BIG_WINDOW, 4096, true);
+        }
+        std::vector<H2WriteScheduler::Frame> frames;
+        // One round of 64KB is enough for all small streams.
+        const int64_t n = s.Pop(BIG_WINDOW, FRAME_SIZE, 64 * 1024, &frames);
+        ASSERT_LE(64 * 1024, n);
+        size_t nended = 0;
+        for (size_t i = 0; i < frames.size(); ++i) {
+            ASSERT_LE(frames[i].data.size(), FRAME_SIZE);
+            if (frames[i].end_of_stream) {
+                ASSERT_NE(1, frames[i].stream_id);
+                ASSERT_EQ(4096u, frames[i].data.size());
+                ASSERT_EQ(1u, frames[i].trailers.size());
+                ++nended;
+            }
+        }
+        ASSERT_EQ(10u, nended);
+        ASSERT_EQ(1u, s.stream_count());
+        ASSERT_TRUE(s.HasSendableStreams());
+    }
+
+    TEST(H2WriteSchedulerTest, weighted) {
+        H2WriteScheduler s;
+        ASSERT_EQ(0, s.Init());
+        push(&s, 1, 32, BIG_WINDOW, 8 * 1024 * 1024);
+        push(&s, 3, 16, BIG_WINDOW, 8 * 1024 * 1024);
+        std::map<int, size_t> sent;
+        for (int i = 0; i < 100; ++i) {
+            std::vector<H2WriteScheduler::Frame> frames;
+            s.Pop(BIG_WINDOW, FRAME_SIZE, 64 * 1024, &frames);
+            for (size_t j = 0; j < frames.size(); ++j) {
+                sent[frames[j].stream_id] += frames[j].data.size();
+            }
+        }
+        const double ratio = (double) sent[1] / sent[3];
+        ASSERT_LT(1.9, ratio);
+        ASSERT_GT(2.1, ratio);
+    }
+
+    TEST(H2WriteSchedulerTest, flow_control) {
+        H2WriteScheduler s;
+        ASSERT_EQ(0, s.Init());
+        push(&s, 1, 16, 10000, 100000);
+        push(&s, 3, 16, BIG_WINDOW, 100000);
+        std::vector<H2WriteScheduler::Frame> frames;
+        // Limited by the connection window.
+        ASSERT_EQ(5000, s.Pop(5000, FRAME_SIZE, 1000000, &frames));
+        frames.clear();
+        ASSERT_EQ(5000 + 100000, s.Pop(BIG_WINDOW, FRAME_SIZE, 1000000, &frames));
+        ASSERT_TRUE(frames.back().end_of_stream);
+        ASSERT_EQ(3, frames.back().stream_id);
+        // Stream 1 waits for WINDOW_UPDATE.
+        ASSERT_FALSE(s.HasSendableStreams());
+        ASSERT_EQ(1u, s.stream_count());
+        frames.clear();
+        ASSERT_EQ(0, s.Pop(BIG_WINDOW, FRAME_SIZE, 1000000, &frames));
+        ASSERT_TRUE(frames.empty());
+
+        ASSERT_EQ(-1, s.AddWindow(3, 100));
+        ASSERT_EQ(0, s.AddWindow(1, 20000));
+        ASSERT_TRUE(s.HasSendableStreams());
+        ASSERT_EQ(20000, s.Pop(BIG_WINDOW, FRAME_SIZE, 1000000, &frames));
+
+        // Shrinking initial window size makes windows negative.
+        s.AddWindowToAll(-30000);
+        ASSERT_FALSE(s.HasSendableStreams());
+        s.AddWindowToAll(100000);
+        frames.clear();
+        ASSERT_EQ(70000, s.Pop(BIG_WINDOW, FRAME_SIZE, 1000000, &frames));
+        ASSERT_TRUE(frames.back().end_of_stream);
+        ASSERT_EQ(0u, s.stream_count());
+    }
+
+    TEST(H2WriteSchedulerTest, remove_and_overflow) {
+        H2WriteScheduler s;
+        ASSERT_EQ(0, s.Init());
+        push(&s, 1, 16, 100, 1000);
+        push(&s, 3, 16, 100, 1000);
+        flare::cord_buf data;
+        data.append("x");
+        ASSERT_EQ(-1, s.Push(1, 16, 100, &data, nullptr));
+        ASSERT_EQ(1, s.AddWindow(1, BIG_WINDOW));
+        ASSERT_TRUE(s.Remove(3));
+        ASSERT_FALSE(s.Remove(3));
+        ASSERT_EQ(0u, s.stream_count());
+        std::vector<H2WriteScheduler::Frame> frames;
+        ASSERT_EQ(0, s.Pop(BIG_WINDOW, FRAME_SIZE, 1000000, &frames));
+    }
+
+    TEST(H2WriteSchedulerTest, window_update_before_push) {
+        H2WriteScheduler s;
+        ASSERT_EQ(0, s.Init());
+        // The request stream is closed, the response is not pushed yet.
+        ASSERT_EQ(0, s.Reserve(1, 10000));
+        ASSERT_EQ(-1, s.Reserve(1, 10000));
+        ASSERT_EQ(0, s.Reserve(3, 10000));
+        ASSERT_FALSE(s.HasSendableStreams());
+        ASSERT_EQ(0u, s.stream_count());
+        ASSERT_EQ(0, s.AddWindow(1, 50000));
+        s.AddWindowToAll(-5000);
+        std::vector<H2WriteScheduler::Frame> frames;
+        ASSERT_EQ(0, s.Pop(BIG_WINDOW, FRAME_SIZE, 1000000, &frames));
+
+        // The window passed to Push() is the initial one, which is stale.
+        push(&s, 1, 16, 10000, 100000);
+        ASSERT_EQ(55000, s.Pop(BIG_WINDOW, FRAME_SIZE, 1000000, &frames));
+        ASSERT_FALSE(s.HasSendableStreams());
+        ASSERT_EQ(0, s.AddWindow(1, 45000));
+        frames.clear();
+        ASSERT_EQ(45000, s.Pop(BIG_WINDOW, FRAME_SIZE, 1000000, &frames));
+        ASSERT_TRUE(frames.back().end_of_stream);
+        ASSERT_EQ(0u, s.stream_count());
+        ASSERT_EQ(-1, s.AddWindow(1, 100));
+
+        // Sent without the scheduler or reset.
+        ASSERT_TRUE(s.Remove(3));
+        ASSERT_FALSE(s.Remove(3));
+        ASSERT_EQ(-1, s.AddWindow(3, 100));
+        ASSERT_EQ(0, s.Reserve(5, 100));
+        ASSERT_EQ(1, s.AddWindow(5, BIG_WINDOW));
+        ASSERT_EQ(-1, s.AddWindow(5, 100));
+    }
+
+    TEST(H2StreamTableTest, insert_and_goaway) {
+        flare::rpc::H2StreamTable<int> table;
+        ASSERT_EQ(0, table.init(8));
+        std::vector<int> values(1000);
+        for (int i = 0; i < 1000; ++i) {
+            ASSERT_EQ(0, table.insert(i * 2 + 1, &values[i]));
+        }
+        ASSERT_EQ(-1, table.insert(1, &values[0]));
+        ASSERT_EQ(1, table.insert(2001, &values[0], [] { return true; }));
+        ASSERT_EQ(1000u, table.size());
+        ASSERT_EQ(&values[10], table.seek(21));
+        ASSERT_EQ(nullptr, table.seek(2001));
+        ASSERT_EQ(&values[10], table.erase(21));
+        ASSERT_EQ(nullptr, table.erase(21));
+        std::vector<int *> removed;
+        table.erase_greater(1001, &removed);
+        ASSERT_EQ(499u, removed.size());
+        ASSERT_EQ(500u, table.size());
+        size_t n = 0;
+        ASSERT_TRUE(table.for_each([&n](int id, int *) {
+            ++n;
+            return id <= 1001;
+        }));
+        ASSERT_EQ(500u, n);
+    }
+
+    TEST(H2StreamTableTest, concurrent) {
+        flare::rpc::H2StreamTable<int> table;
+        ASSERT_EQ(0, table.init(8));
+        const int NTHREAD = 8;
+        const int NSTREAM = 10000;
+        int value = 0;
+        std::vector<std::thread> threads;
+        for (int t = 0; t < NTHREAD; ++t) {
+            threads.emplace_back([&table, &value, t] {
+                for (int i = t; i < NSTREAM; i += NTHREAD) {
+                    const int id = i * 2 + 1;
+                    ASSERT_EQ(0, table.insert(id, &value));
+                    ASSERT_EQ(&value, table.seek(id));
+                    if (i % 2) {
+                        ASSERT_EQ(&value, table.erase(id));
+                    }
+                }
+            });
+        }
+        for (auto &th : threads) {
+            th.join();
+        }
+        ASSERT_EQ((size_t) NSTREAM / 2, table.size());
+    }
+
+}  // namespace
@@ -548,3 +548,59 @@ TEST_F(HPackTest, responses_with_huffman) {
     }
     ASSERT_TRUE(buf.buf().empty());
 }
+
+TEST_F(HPackTest, huffman_round_trip) {
+    flare::rpc::HPacker p1;
+    ASSERT_EQ(0, p1.Init(4096));
+    flare::rpc::HPacker p2;
+    ASSERT_EQ(0, p2.Init(4096));
+    flare::rpc::HPackOptions options;
+    options.index_policy = flare::rpc::HPACK_NOT_INDEX_HEADER;
+    options.encode_name = true;
+    options.encode_value = true;
+    // Values longer than the chunks fed to the decoder and containing codes
+    // of all lengths.
+    for (size_t len = 0; len < 2000; len = len * 2 + 1) {
+        flare::rpc::HPacker::Header h;
+        h.name = "x-binary";
+        for (size_t i = 0; i < len; ++i) {
+            h.value.push_back((char) (i * 7 + len));
+        }
+        flare::cord_buf_appender buf;
+        p1.Encode(&buf, h, options);
+        const ssize_t nwrite = buf.buf().size();
+        flare::rpc::HPacker::Header h2;
+        ASSERT_EQ(nwrite, p2.Decode(&buf.buf(), &h2));
+        ASSERT_EQ(h.name, h2.name);
+        ASSERT_EQ(h.value, h2.value);
+    }
+}
+
+TEST_F(HPackTest, huffman_invalid_padding) {
+    // Literal header without indexing, new name "a", value is `code'.
+    struct {
+        const char *code;
+        size_t size;
+        bool valid;
+    } cases[] = {
+            {"\x81\x07", 2, true},                  // '0' padded with 111
+            {"\x81\x00", 2, false},                 // padded with 0s
+            {"\x82\x07\xff", 3, false},             // padding longer than 7 bits
+            {"\x84\xff\xff\xff\xff", 5, false},     // contains EOS
+    };
+    for (size_t i = 0; i < FLARE_ARRAY_SIZE(cases); ++i) {
+        flare::rpc::HPacker p;
+        ASSERT_EQ(0, p.Init(4096));
+        flare::cord_buf buf;
+        buf.append("\x00\x01" "a", 3);
+        buf.append(cases[i].code, cases[i].size);
+        flare::rpc::HPacker::Header h;
+        if (cases[i].valid) {
+            ASSERT_EQ((ssize_t) (3 + cases[i].size), p.Decode(&buf, &h));
+            ASSERT_EQ("a", h.name);
+            ASSERT_EQ("0", h.value);
+        } else {
+            ASSERT_EQ(-1, p.Decode(&buf, &h));
+        }
+    }
+}
@@ -17,6 +17,8 @@
 
 #include "testing/gtest_wrap.h"
 #include <iostream>
+#include <random>
+#include <vector>
 
 #include "flare/times/time.h"
 #include "flare/log/logging.h"
@@ -110,6 +112,190 @@ TEST_F(HttpParserTest, http_example) {
     FLARE_LOG(INFO) << http_parser_execute(&parser, &settings, http_request, strlen(http_request));
 }
 
+// Records all callbacks, adjacent data of the same kind are merged since
+// the parser may split them at boundaries of input.
+struct ParseRecord {
+    std::vector<std::pair<char, std::string> > events;
+
+    void add(char kind, const char *at, size_t length) {
+        if (!events.empty() && events.back().first == kind) {
+            events.back().second.append(at, length);
+        } else {
+            events.emplace_back(kind, std::string(at, length));
+        }
+    }
+};
+
+#define DEFINE_RECORD_DATA(name, kind)                                  \
+    int record_##name(http_parser *p, const char *at, const size_t length) { \
+        static_cast<ParseRecord *>(p->data)->add(kind, at, length);     \
+        return 0;                                                       \
+    }
+DEFINE_RECORD_DATA(url, 'u')
+DEFINE_RECORD_DATA(header_field, 'f')
+DEFINE_RECORD_DATA(header_value, 'v')
+DEFINE_RECORD_DATA(body, 'b')
+#undef DEFINE_RECORD_DATA
+
+int record_headers_complete(http_parser *p) {
+    static_cast<ParseRecord *>(p->data)->add('h', "", 0);
+    return 0;
+}
+
+int record_message_complete(http_parser *p) {
+    static_cast<ParseRecord *>(p->data)->add('m', "", 0);
+    return 0;
+}
+
+// Parses `input' in pieces of `piece_size' bytes, `nparsed' (if not NULL)
+// is set to the number of bytes consumed.
+static ParseRecord parse_in_pieces(const std::string &input, size_t piece_size,
+                                   int *http_errno, size_t *nparsed = NULL) {
+    ParseRecord record;
+    http_parser parser;
+    http_parser_init(&parser, flare::rpc::HTTP_REQUEST);
+    parser.data = &record;
+    http_parser_settings settings;
+    memset(&settings, 0, sizeof(settings));
+    settings.on_url = record_url;
+    settings.on_header_field = record_header_field;
+    settings.on_header_value = record_header_value;
+    settings.on_headers_complete = record_headers_complete;
+    settings.on_body = record_body;
+    settings.on_message_complete = record_message_complete;
+    size_t total = 0;
+    for (size_t i = 0; i < input.size(); i += piece_size) {
+        const size_t n = std::min(piece_size, input.size() - i);
+        const size_t nr = http_parser_execute(&parser, &settings, input.data() + i, n);
+        total += nr;
+        if (nr != n) {
+            break;
+        }
+    }
+    *http_errno = parser.http_errno;
+    if (nparsed) {
+        *nparsed = total;
+    }
+    return record;
+}
+
+TEST_F(HttpParserTest, simd_matches_bytewise) {
+    const std::string long_value(300, 'x');
+    const std::string inputs[] = {
+        "POST /rpc/EchoService/Echo?a=b HTTP/1.1\r\n"
+        "Host: gateway.example.com:8080\r\n"
+        "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 "
+        "(KHTML, like Gecko) Chrome/90.0.4430.93 Safari/537.36\r\n"
+        "Accept: application/json, text/plain, */*\r\n"
+        "Accept-Encoding: gzip, deflate, br\r\n"
+        "X-Request-Id-With-A-Very-Long-Name-Indeed: 8f14e45fceea167a5a36dedd4bea2543\r\n"
+        "Cookie: " + long_value + "\r\n"
+        "Content-Type: application/json\r\n"
+        "Connection: keep-alive\r\n"
+        "Content-Length: 16\r\n"
+        "\r\n"
+        "{\"message\":\"hi\"}",
+        // Folded value, LF-only line endings and '|' '~' in names.
+        "GET / HTTP/1.1\n"
+        "X-Folded-Header-Value: first line of the value\r\n"
+        "  continued on the second line\r\n"
+        "X|Pipe~Tilde-Name: v\n"
+        "Transfer-Encoding: chunked\r\n"
+        "\r\n"
+        "5\r\nhello\r\n0\r\n\r\n",
+        // Invalid byte in the middle of a long header name.
+        "GET / HTTP/1.1\r\n"
+        "X-A-Long-Header-Name-With\"Quote-Inside: v\r\n"
+        "\r\n",
+    };
+    for (const std::string &input : inputs) {
+        for (size_t piece_size : {input.size(), (size_t) 1, (size_t) 7, (size_t) 33}) {
+            int bytewise_errno = 0;
+            int simd_errno = 0;
+            const bool old = flare::rpc::http_parser_enable_simd(false);
+            const ParseRecord bytewise = parse_in_pieces(input, piece_size, &bytewise_errno);
+            flare::rpc::http_parser_enable_simd(true);
+            const ParseRecord simd = parse_in_pieces(input, piece_size, &simd_errno);
+            flare::rpc::http_parser_enable_simd(old);
+            ASSERT_EQ(bytewise_errno, simd_errno);
+            ASSERT_EQ(bytewise.events, simd.events) << "piece_size=" << piece_size;
+        }
+    }
+}
+
+// Bytes which may appear in header names and values without stopping the
+// fast scanners.
+static const std::string kTokenChars =
+    "0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ!#$%&'*+-.^_`";
+
+static std::string random_bytes(std::mt19937 *rng, size_t n, bool value) {
+    std::string s;
+    for (size_t i = 0; i < n; ++i) {
+        if (value) {
+            // Printable, tab and non-ASCII bytes.
+            unsigned c = (*rng)() % 224;
+            c = (c < 95 ? c + 0x20 : (c == 95 ? '\t' : c + 0x80 - 96));
+            s.push_back((char) c);
+        } else {
+            s.push_back(kTokenChars[(*rng)() % kTokenChars.size()]);
+        }
+    }
+    return s;
+}
+
+TEST_F(HttpParserTest, simd_matches_bytewise_at_every_offset) {
+    // Every byte value is put at every offset of 16- and 32-byte blocks of
+    // a header name and a header value, surrounded by random bytes. Inputs
+    // are parsed as a whole and split at a random point.
+    std::mt19937 rng(20260925);
+    const bool old = flare::rpc::http_parser_enable_simd(false);
+    for (int in_value = 0; in_value < 2; ++in_value) {
+        for (int stop = 0; stop < 256; ++stop) {
+            for (size_t offset = 0; offset < 65; ++offset) {
+                std::string input = "GET /index.html HTTP/1.1\r\n";
+                const std::string before = random_bytes(&rng, offset, in_value);
+                const std::string after = random_bytes(&rng, 1 + rng() % 40, in_value);
+                if (in_value) {
+                    input += "X-Name: " + before + (char) stop + after + "\r\n";
+                } else {
+                    input += "X" + before + (char) stop + after + ": value\r\n";
+                }
+                input += "Host: example.com\r\n\r\n";
+                for (size_t piece_size : {input.size(), 1 + rng() % input.size()}) {
+                    int bytewise_errno = 0;
+                    int simd_errno = 0;
+                    size_t bytewise_nparsed = 0;
+                    size_t simd_nparsed = 0;
+                    flare::rpc::http_parser_enable_simd(false);
+                    const ParseRecord bytewise =
+                        parse_in_pieces(input, piece_size, &bytewise_errno, &bytewise_nparsed);
+                    flare::rpc::http_parser_enable_simd(true);
+                    const ParseRecord simd =
+                        parse_in_pieces(input, piece_size, &simd_errno, &simd_nparsed);
+                    ASSERT_EQ(bytewise_errno, simd_errno)
+                        << "in_value=" << in_value << " stop=" << stop << " offset=" << offset;
+                    ASSERT_EQ(bytewise_nparsed, simd_nparsed)
+                        << "in_value=" << in_value << " stop=" << stop << " offset=" << offset;
+                    ASSERT_EQ(bytewise.events, simd.events)
+                        << "in_value=" << in_value << " stop=" << stop << " offset=" << offset
+                        << " piece_size=" << piece_size;
+                }
+            }
+        }
+    }
+    flare::rpc::http_parser_enable_simd(old);
+}
+
+TEST_F(HttpParserTest, simd_header_overflow) {
+    // Bytes skipped by the fast scanners still count into the header size.
+    std::string input = "GET / HTTP/1.1\r\nX-Large: ";
+    input.append(FLARE_RPC_HTTP_MAX_HEADER_SIZE, 'v');
+    input.append("\r\n\r\n");
+    int http_errno = 0;
+    parse_in_pieces(input, input.size(), &http_errno);
+    ASSERT_EQ(flare::rpc::HPE_HEADER_OVERFLOW, http_errno);
+}
+
 TEST_F(HttpParserTest, append_filename) {
     std::string dir;
 
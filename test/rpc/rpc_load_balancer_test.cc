@@ -40,6 +40,7 @@
 #include "flare/rpc/policy/randomized_load_balancer.h"
 #include "flare/rpc/policy/locality_aware_load_balancer.h"
 #include "flare/rpc/policy/consistent_hashing_load_balancer.h"
+#include "flare/rpc/policy/maglev_load_balancer.h"
 #include "flare/rpc/policy/hasher.h"
 #include "flare/rpc/errno.pb.h"
 #include "echo.pb.h"
@@ -637,6 +638,264 @@ namespace {
         }
     }
 
+    TEST_F(LoadBalancerTest, consistent_hashing_bounded_load) {
+        flare::rpc::policy::ConsistentHashingLoadBalancer prototype(
+                flare::rpc::policy::CONS_HASH_LB_MURMUR3);
+        ASSERT_EQ(NULL, prototype.New("load_factor=0.5"));
+        flare::rpc::policy::ConsistentHashingLoadBalancer *lb =
+                static_cast<flare::rpc::policy::ConsistentHashingLoadBalancer *>(
+                        prototype.New("load_factor=1.25"));
+        ASSERT_TRUE(lb != NULL);
+        const size_t NSERVER = 8;
+        std::vector<flare::rpc::ServerId> ids;
+        for (size_t i = 0; i < NSERVER; ++i) {
+            char addr[32];
+            snprintf(addr, sizeof(addr), "192.168.1.%lu:8080", i);
+            flare::rpc::ServerId id(8888);
+            flare::rpc::SocketOptions options;
+            ASSERT_EQ(0, str2endpoint(addr, &options.remote_side));
+            options.user = new SaveRecycle;
+            ASSERT_EQ(0, flare::rpc::Socket::Create(options, &id.id));
+            ids.push_back(id);
+        }
+        ASSERT_EQ(NSERVER, lb->AddServersInBatch(ids));
+        ASSERT_FALSE(lb->AddServer(ids[0]));
+
+        // All calls of a hot key spread over servers once the first one
+        // holds more than 1.25x of average in-flight calls.
+        const size_t NCALL = 800;
+        flare::rpc::SocketUniquePtr ptr;
+        const int64_t begin_us = flare::get_current_time_micros();
+        flare::rpc::LoadBalancer::SelectIn in = {begin_us, false, true, 12345, NULL};
+        flare::rpc::LoadBalancer::SelectOut out(&ptr);
+        std::vector<flare::rpc::SocketId> selected;
+        std::map<flare::rpc::SocketId, size_t> inflight;
+        for (size_t i = 0; i < NCALL; ++i) {
+            ASSERT_EQ(0, lb->SelectServer(in, &out));
+            ASSERT_TRUE(out.need_feedback);
+            selected.push_back(ptr->id());
+            ++inflight[ptr->id()];
+        }
+        // No server takes more than 125 calls.
+        ASSERT_LE(NSERVER - 1, inflight.size());
+        for (auto &kv : inflight) {
+            ASSERT_LE(kv.second, (size_t) ceil(1.25 * NCALL / NSERVER));
+        }
+        ASSERT_EQ((int64_t) NCALL, lb->_total_inflight.load());
+        std::cout << *lb;
+
+        // Affinity comes back when calls finish.
+        for (size_t i = 0; i < NCALL; ++i) {
+            flare::rpc::LoadBalancer::CallInfo info = {begin_us, selected[i], 0, NULL};
+            lb->Feedback(info);
+        }
+        ASSERT_EQ(0, lb->_total_inflight.load());
+        ASSERT_EQ(0, lb->SelectServer(in, &out));
+        ASSERT_EQ(selected[0], ptr->id());
+
+        // Calls begun before the servers were added aren't counted.
+        flare::rpc::LoadBalancer::SelectIn early_in = {begin_us - 1000000, false, true, 12345, NULL};
+        out.need_feedback = false;
+        ASSERT_EQ(0, lb->SelectServer(early_in, &out));
+        ASSERT_FALSE(out.need_feedback);
+        ASSERT_EQ(1, lb->_total_inflight.load());
+
+        // In-flight calls of removed servers don't count.
+        ASSERT_TRUE(lb->RemoveServer(ids[0]));
+        ASSERT_FALSE(lb->RemoveServer(ids[0]));
+        const int64_t expected = (selected[0] == ids[0].id ? 0 : 1);
+        ASSERT_EQ(expected, lb->_total_inflight.load());
+        ASSERT_EQ(NSERVER - 1, lb->RemoveServersInBatch(ids));
+        ASSERT_EQ(0, lb->_total_inflight.load());
+        lb->Destroy();
+        for (size_t i = 0; i < ids.size(); ++i) {
+            flare::rpc::Socket::SetFailed(ids[i].id);
+        }
+    }
+
+    TEST_F(LoadBalancerTest, consistent_hashing_bounded_load_readded_server) {
+        flare::rpc::policy::ConsistentHashingLoadBalancer prototype(
+                flare::rpc::policy::CONS_HASH_LB_MURMUR3);
+        flare::rpc::policy::ConsistentHashingLoadBalancer *lb =
+                static_cast<flare::rpc::policy::ConsistentHashingLoadBalancer *>(
+                        prototype.New("load_factor=1.25"));
+        ASSERT_TRUE(lb != NULL);
+        const size_t NSERVER = 4;
+        std::vector<flare::rpc::ServerId> ids;
+        for (size_t i = 0; i < NSERVER; ++i) {
+            char addr[32];
+            snprintf(addr, sizeof(addr), "192.168.2.%lu:8080", i);
+            flare::rpc::ServerId id(8888);
+            flare::rpc::SocketOptions options;
+            ASSERT_EQ(0, str2endpoint(addr, &options.remote_side));
+            options.user = new SaveRecycle;
+            ASSERT_EQ(0, flare::rpc::Socket::Create(options, &id.id));
+            ids.push_back(id);
+        }
+        ASSERT_EQ(NSERVER, lb->AddServersInBatch(ids));
+
+        const size_t NCALL = 40;
+        flare::rpc::SocketUniquePtr ptr;
+        const int64_t old_begin_us = flare::get_current_time_micros();
+        flare::rpc::LoadBalancer::SelectIn in = {old_begin_us, false, true, 12345, NULL};
+        flare::rpc::LoadBalancer::SelectOut out(&ptr);
+        std::vector<flare::rpc::SocketId> selected;
+        for (size_t i = 0; i < NCALL; ++i) {
+            ASSERT_EQ(0, lb->SelectServer(in, &out));
+            ASSERT_TRUE(out.need_feedback);
+            selected.push_back(ptr->id());
+        }
+        const flare::rpc::SocketId hot = selected[0];
+        const int64_t nhot = std::count(selected.begin(), selected.end(), hot);
+
+        // The hot server goes away and comes back with the same SocketId
+        // while its calls are still in flight.
+        flare::rpc::ServerId hot_id(hot);
+        ASSERT_TRUE(lb->RemoveServer(hot_id));
+        ::usleep(10);
+        ASSERT_TRUE(lb->AddServer(hot_id));
+        ASSERT_EQ((int64_t) NCALL - nhot, lb->_total_inflight.load());
+
+        // Completions of the old calls don't touch the new entry.
+        for (size_t i = 0; i < NCALL; ++i) {
+            flare::rpc::LoadBalancer::CallInfo info = {old_begin_us, selected[i], 0, NULL};
+            lb->Feedback(info);
+        }
+        {
+            flare::container::DoublyBufferedData<std::vector<
+                    flare::rpc::policy::ConsistentHashingLoadBalancer::ServerLoad *> >::ScopedPtr s;
+            ASSERT_EQ(0, lb->_db_loads.Read(&s));
+            for (size_t i = 0; i < s->size(); ++i) {
+                ASSERT_EQ(0, (*s)[i]->inflight.load()) << (*s)[i]->addr;
+            }
+        }
+        ASSERT_EQ(0, lb->_total_inflight.load());
+
+        // The bound still applies to the re-added server.
+        const int64_t new_begin_us = flare::get_current_time_micros();
+        in.begin_time_us = new_begin_us;
+        std::map<flare::rpc::SocketId, size_t> inflight;
+        std::vector<flare::rpc::SocketId> new_selected;
+        for (size_t i = 0; i < NCALL; ++i) {
+            ASSERT_EQ(0, lb->SelectServer(in, &out));
+            ASSERT_TRUE(out.need_feedback);
+            new_selected.push_back(ptr->id());
+            ++inflight[ptr->id()];
+        }
+        ASSERT_LE(inflight[hot], (size_t) ceil(1.25 * NCALL / NSERVER));
+        for (size_t i = 0; i < NCALL; ++i) {
+            flare::rpc::LoadBalancer::CallInfo info = {new_begin_us, new_selected[i], 0, NULL};
+            lb->Feedback(info);
+        }
+        ASSERT_EQ(NSERVER, lb->RemoveServersInBatch(ids));
+        lb->Destroy();
+        for (size_t i = 0; i < ids.size(); ++i) {
+            flare::rpc::Socket::SetFailed(ids[i].id);
+        }
+    }
+
+    TEST_F(LoadBalancerTest, maglev_hashing) {
+        const flare::rpc::policy::MaglevLoadBalancerType types[] = {
+                flare::rpc::policy::MAGLEV_LB_PERMUTATION,
+                flare::rpc::policy::MAGLEV_LB_JUMP
+        };
+        const size_t NSERVER = 16;
+        const size_t NKEY = 100000;
+        for (size_t round = 0; round < FLARE_ARRAY_SIZE(types); ++round) {
+            flare::rpc::policy::MaglevLoadBalancer lb(types[round]);
+            flare::rpc::SocketUniquePtr ptr;
+            flare::rpc::LoadBalancer::SelectIn in = {0, false, false, 0u, NULL};
+            flare::rpc::LoadBalancer::SelectOut out(&ptr);
+            ASSERT_EQ(EINVAL, lb.SelectServer(in, &out));
+            in.has_request_code = true;
+            ASSERT_EQ(ENODATA, lb.SelectServer(in, &out));
+
+            std::vector<flare::rpc::ServerId> ids;
+            for (size_t i = 0; i < NSERVER; ++i) {
+                char addr[32];
+                snprintf(addr, sizeof(addr), "10.92.115.%lu:8833", i);
+                flare::rpc::ServerId id(8888);
+                flare::rpc::SocketOptions options;
+                ASSERT_EQ(0, str2endpoint(addr, &options.remote_side));
+                options.user = new SaveRecycle;
+                ASSERT_EQ(0, flare::rpc::Socket::Create(options, &id.id));
+                ids.push_back(id);
+            }
+            ASSERT_TRUE(lb.AddServer(ids[0]));
+            ASSERT_FALSE(lb.AddServer(ids[0]));
+            ASSERT_EQ(NSERVER - 1, lb.AddServersInBatch(
+                    std::vector<flare::rpc::ServerId>(ids.begin() + 1, ids.end())));
+            std::cout << lb;
+
+            std::vector<flare::rpc::SocketId> before(NKEY);
+            std::map<flare::rpc::SocketId, size_t> times;
+            for (uint64_t i = 0; i < NKEY; ++i) {
+                in.request_code = flare::rpc::policy::MurmurHash32(&i, sizeof(i));
+                ASSERT_EQ(0, lb.SelectServer(in, &out));
+                before[i] = ptr->id();
+                ++times[ptr->id()];
+            }
+            ASSERT_EQ(NSERVER, times.size());
+            for (auto &kv : times) {
+                ASSERT_NEAR(NKEY / NSERVER, kv.second, NKEY / NSERVER / 5);
+            }
+
+            // Returns number of keys not owned by `changed' before or after
+            // the change but moved anyway.
+            auto count_moved = [&](flare::rpc::SocketId changed) {
+                size_t moved = 0;
+                for (uint64_t i = 0; i < NKEY; ++i) {
+                    in.request_code = flare::rpc::policy::MurmurHash32(&i, sizeof(i));
+                    EXPECT_EQ(0, lb.SelectServer(in, &out));
+                    if (before[i] != changed && ptr->id() != changed &&
+                        before[i] != ptr->id()) {
+                        ++moved;
+                    }
+                    before[i] = ptr->id();
+                }
+                return moved;
+            };
+
+            // Keys of the removed server move, others mostly stay, except
+            // that jump hash remaps servers after the removed one.
+            const flare::rpc::ServerId removed =
+                    (round == 0 ? ids[NSERVER / 2] : ids[NSERVER - 1]);
+            ASSERT_TRUE(lb.RemoveServer(removed));
+            ASSERT_FALSE(lb.RemoveServer(removed));
+            ASSERT_LT(count_moved(removed.id), NKEY / 100);
+            for (uint64_t i = 0; i < NKEY; ++i) {
+                ASSERT_NE(removed.id, before[i]);
+            }
+
+            // Only keys taken by the new server move. Jump hash appends the
+            // server since it sorts last.
+            flare::rpc::ServerId added(8888);
+            flare::rpc::SocketOptions options;
+            ASSERT_EQ(0, str2endpoint("10.92.115.200:8833", &options.remote_side));
+            options.user = new SaveRecycle;
+            ASSERT_EQ(0, flare::rpc::Socket::Create(options, &added.id));
+            ids.push_back(added);
+            ASSERT_TRUE(lb.AddServer(added));
+            ASSERT_LT(count_moved(added.id), NKEY / 100);
+            size_t nadded = 0;
+            for (uint64_t i = 0; i < NKEY; ++i) {
+                nadded += (before[i] == added.id);
+            }
+            ASSERT_NEAR(NKEY / NSERVER, nadded, NKEY / NSERVER / 5);
+
+            // Unavailable servers are skipped.
+            ASSERT_EQ(0, flare::rpc::Socket::SetFailed(before[0]));
+            for (uint64_t i = 0; i < 1000; ++i) {
+                in.request_code = flare::rpc::policy::MurmurHash32(&i, sizeof(i));
+                ASSERT_EQ(0, lb.SelectServer(in, &out));
+                ASSERT_NE(before[0], ptr->id());
+            }
+            for (size_t i = 0; i < ids.size(); ++i) {
+                flare::rpc::Socket::SetFailed(ids[i].id);
+            }
+        }
+    }
+
     TEST_F(LoadBalancerTest, weighted_round_robin) {
         const char *servers[] = {
                 "10.92.115.19:8831",
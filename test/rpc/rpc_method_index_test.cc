@@ -0,0 +1,97 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include <string>
+#include <vector>
+#include "testing/gtest_wrap.h"
+#include "flare/rpc/details/method_index.h"
+
+namespace {
+
+    using flare::rpc::MethodIndex;
+
+    std::vector<std::string> make_names(int nservice, int nmethod) {
+        std::vector<std::string> names;
+        for (int i = 0; i < nservice; ++i) {
+            for (int j = 0; j < nmethod; ++j) {
+                names.push_back("example.pkg.Service" + std::to_string(i) +
+                                ".Method" + std::to_string(j));
+            }
+        }
+        return names;
+    }
+
+    TEST(MethodIndexTest, find) {
+        for (int n : {1, 2, 3, 17, 100, 5000}) {
+            std::vector<std::string> names = make_names(n, 5);
+            MethodIndex index;
+            ASSERT_EQ(0, index.init(names));
+            ASSERT_EQ(names.size(), index.size());
+            for (size_t i = 0; i < names.size(); ++i) {
+                ASSERT_EQ((int) i, index.find(names[i]));
+                const size_t pos = names[i].rfind('.');
+                ASSERT_EQ((int) i, index.find(names[i].substr(0, pos),
+                                              names[i].substr(pos + 1)));
+            }
+            ASSERT_EQ(-1, index.find("example.pkg.Service0.Method5"));
+            ASSERT_EQ(-1, index.find("example.pkg.Service0.Method"));
+            ASSERT_EQ(-1, index.find("pkg.Service0.Method0"));
+            ASSERT_EQ(-1, index.find("example.pkg", "Service0.Method0"));
+            ASSERT_EQ(-1, index.find("example"));
+            ASSERT_EQ(-1, index.find(""));
+        }
+    }
+
+    TEST(MethodIndexTest, same_heads_and_tails) {
+        // Names differ only in the middle and are told apart by hashing all bytes.
+        std::vector<std::string> names;
+        for (int i = 100; i < 400; ++i) {
+            names.push_back("example.Svc" + std::to_string(i) + "_service_v1.Method");
+        }
+        MethodIndex index;
+        ASSERT_EQ(0, index.init(names));
+        for (size_t i = 0; i < names.size(); ++i) {
+            ASSERT_EQ((int) i, index.find(names[i]));
+        }
+        ASSERT_EQ(-1, index.find("example.Svc400_service_v1.Method"));
+    }
+
+    TEST(MethodIndexTest, invalid_names) {
+        MethodIndex index;
+        ASSERT_TRUE(index.empty());
+        ASSERT_EQ(0, index.init(std::vector<std::string>()));
+        ASSERT_TRUE(index.empty());
+        ASSERT_EQ(-1, index.find("a.b"));
+
+        std::vector<std::string> names = make_names(10, 10);
+        names.push_back(names[3]);
+        ASSERT_EQ(-1, index.init(names));
+        ASSERT_TRUE(index.empty());
+        names.pop_back();
+        names.push_back("no_dot");
+        ASSERT_EQ(-1, index.init(names));
+        ASSERT_TRUE(index.empty());
+        names.pop_back();
+        ASSERT_EQ(0, index.init(names));
+        ASSERT_EQ(names.size(), index.size());
+        index.clear();
+        ASSERT_TRUE(index.empty());
+        ASSERT_EQ(-1, index.find(names[0]));
+    }
+
+}  // namespace
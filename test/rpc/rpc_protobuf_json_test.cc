@@ -20,7 +20,10 @@
 #include <iostream>
 #include <fstream>
 #include <string>
+#include <google/protobuf/descriptor.pb.h>
+#include <google/protobuf/dynamic_message.h>
 #include <google/protobuf/text_format.h>
+#include <google/protobuf/io/zero_copy_stream_impl_lite.h>
 #include "flare/io/cord_buf.h"
 #include "flare/rapidjson/rapidjson.h"
 #include "flare/times/time.h"
@@ -1450,6 +1453,123 @@ TEST_F(ProtobufJsonTest, zero_copy_stream_to_json_normal_case) {
     ASSERT_EQ(1, person.datafloat());
 }
 
+TEST_F(ProtobufJsonTest, json_to_pb_member_order_case) {
+    // Unknown members are skipped with their nested values, the first one
+    // of duplicated members is converted.
+    std::string json = "{\"unknown\":{\"judge\":[true,{\"a\":[]}]},\"spur\":1,"
+                       "\"content\":[{\"distance\":1,\"uid\":\"a\",\"uid\":2}],"
+                       "\"judge\":true,\"spur\":\"x\",\"data\":[1],\"data\":[2,3]}";
+    std::string error;
+    JsonContextBody data;
+    ASSERT_TRUE(json2pb::JsonToProtoMessage(json, &data, &error)) << error;
+    ASSERT_TRUE(error.empty());
+    ASSERT_TRUE(data.judge());
+    ASSERT_EQ(1, data.spur());
+    ASSERT_EQ(1, data.data_size());
+    ASSERT_EQ(1, data.data(0));
+    ASSERT_EQ(1, data.content_size());
+    ASSERT_EQ("a", data.content(0).uid());
+
+    // Errors are in the order of fields rather than members, and end at
+    // the first one failing the conversion.
+    json = "{\"content\":[{\"distance\":1,\"uid\":3,\"ext\":{\"age\":1}}],"
+           "\"type\":[],\"spur\":\"NaNa\",\"judge\":true}";
+    error.clear();
+    JsonContextBody data2;
+    ASSERT_FALSE(json2pb::JsonToProtoMessage(json, &data2, &error));
+    ASSERT_EQ("Invalid value `array' for optional field `JsonContextBody.type' "
+              "which SHOULD be INT64, Invalid value `\"NaNa\"' for field "
+              "`JsonContextBody.spur' which SHOULD be d", error);
+}
+
+TEST_F(ProtobufJsonTest, zero_copy_stream_to_pb_blocks_case) {
+    Person person;
+    person.set_name(std::string(1000, 'n'));
+    person.set_id(9);
+    person.set_datadouble(2.2);
+    person.set_datafloat(1);
+    person.add_phone()->set_number("123456");
+    std::string json;
+    ASSERT_TRUE(json2pb::ProtoMessageToJson(person, &json));
+    // Strings, numbers and names span blocks of the stream.
+    for (int block_size = 1; block_size < 8; ++block_size) {
+        google::protobuf::io::ArrayInputStream stream(json.data(), json.size(), block_size);
+        Person person2;
+        std::string error;
+        ASSERT_TRUE(json2pb::JsonToProtoMessage(&stream, &person2, &error)) << error;
+        ASSERT_EQ(person.SerializeAsString(), person2.SerializeAsString());
+    }
+    google::protobuf::io::ArrayInputStream stream(json.data(), json.size() - 1, 3);
+    Person person3;
+    std::string error;
+    ASSERT_FALSE(json2pb::JsonToProtoMessage(&stream, &person3, &error));
+    ASSERT_EQ("Invalid json format", error);
+}
+
+TEST_F(ProtobufJsonTest, pb_to_cord_buf_case) {
+    // Output to cord_buf is the same as to std::string.
+    Person person;
+    person.set_name(std::string("he\"llo\\\n\x01\x1f/", 11) + std::string(10000, 'n'));
+    person.set_id(-9);
+    person.set_data(-1234567890123LL);
+    person.set_datau64(18000000000000000000ULL);
+    person.set_datadouble(2.2);
+    person.set_datafloat(1);
+    person.set_databyte("\x01\x02welcome");
+    person.add_phone()->set_number("123456");
+    person.add_phone()->set_type(Person::WORK);
+    person.mutable_phone(1)->set_number("");
+    person.SetExtension(addressbook::hobby, "coding");
+
+    AddressComplex address;
+    address.set_addr("baidu.com");
+    AddressComplex::FriendEntry* entry = address.add_friends();
+    entry->set_key("Jo\"hn");
+    entry->add_value()->set_school("SJTU");
+    entry->mutable_value(0)->set_year(2007);
+    address.add_friends()->set_key("Amy");
+
+    std::ifstream in("jsonout", std::ios::in);
+    std::ostringstream tmp;
+    tmp << in.rdbuf();
+    gss::message::gss_us_res_t data;
+    json2pb::Json2PbOptions json2pb_options;
+    json2pb_options.base64_to_bytes = false;
+    ASSERT_TRUE(json2pb::JsonToProtoMessage(tmp.str(), &data, json2pb_options));
+
+    const google::protobuf::Message* messages[] = { &person, &address, &data };
+    for (size_t i = 0; i < sizeof(messages) / sizeof(messages[0]); ++i) {
+        for (int opt = 0; opt < 32; ++opt) {
+            json2pb::Pb2JsonOptions options;
+            options.enum_option = (opt & 1) ? json2pb::OUTPUT_ENUM_BY_NUMBER
+                                            : json2pb::OUTPUT_ENUM_BY_NAME;
+            options.enable_protobuf_map = !(opt & 2);
+            options.bytes_to_base64 = !(opt & 4);
+            options.jsonify_empty_array = (opt & 8);
+            options.always_print_primitive_fields = (opt & 16);
+            std::string expected;
+            std::string error;
+            ASSERT_TRUE(json2pb::ProtoMessageToJson(*messages[i], &expected, options, &error))
+                << error;
+            flare::cord_buf buf;
+            buf.append("[");
+            ASSERT_TRUE(json2pb::ProtoMessageToJson(*messages[i], &buf, options, &error))
+                << error;
+            ASSERT_EQ("[" + expected, buf.to_string());
+        }
+    }
+
+    // `json' is not changed on failure.
+    Person person2;
+    person2.set_name("hello");
+    flare::cord_buf buf;
+    buf.append("[");
+    std::string error;
+    ASSERT_FALSE(json2pb::ProtoMessageToJson(person2, &buf, &error));
+    ASSERT_EQ("Missing required field: addressbook.Person.id", error);
+    ASSERT_EQ("[", buf.to_string());
+}
+
 TEST_F(ProtobufJsonTest, extension_case) {
     std::string json = "{\"name\":\"hello\",\"id\":9,\"datadouble\":2.2,\"datafloat\":1.0,\"hobby\":\"coding\"}";
     Person person;
@@ -1471,4 +1591,42 @@ TEST_F(ProtobufJsonTest, string_to_int64) {
     ASSERT_EQ(person.data(), 1234567);
 }
 
+TEST_F(ProtobufJsonTest, dynamic_message_case) {
+    // Types of pools built at runtime are not cached by descriptors, which
+    // may be freed and have their addresses reused by other types.
+    const char* const names[] = {"alpha", "beta"};
+    for (const char* name : names) {
+        google::protobuf::FileDescriptorProto file;
+        file.set_name("dynamic.proto");
+        google::protobuf::DescriptorProto* outer = file.add_message_type();
+        outer->set_name("Outer");
+        google::protobuf::FieldDescriptorProto* f = outer->add_field();
+        f->set_name(name);
+        f->set_number(1);
+        f->set_label(google::protobuf::FieldDescriptorProto::LABEL_OPTIONAL);
+        f->set_type(google::protobuf::FieldDescriptorProto::TYPE_INT32);
+        f = outer->add_field();
+        f->set_name("inner");
+        f->set_number(2);
+        f->set_label(google::protobuf::FieldDescriptorProto::LABEL_OPTIONAL);
+        f->set_type(google::protobuf::FieldDescriptorProto::TYPE_MESSAGE);
+        f->set_type_name("Outer");
+
+        google::protobuf::DescriptorPool pool;
+        const google::protobuf::FileDescriptor* fd = pool.BuildFile(file);
+        ASSERT_TRUE(fd != NULL);
+        google::protobuf::DynamicMessageFactory factory(&pool);
+        std::unique_ptr<google::protobuf::Message> msg(
+            factory.GetPrototype(fd->message_type(0))->New());
+
+        const std::string json = std::string("{\"") + name + "\":1,\"inner\":{\""
+                                 + name + "\":2}}";
+        std::string err;
+        ASSERT_TRUE(json2pb::JsonToProtoMessage(json, msg.get(), &err)) << err;
+        std::string output;
+        ASSERT_TRUE(json2pb::ProtoMessageToJson(*msg, &output, &err)) << err;
+        ASSERT_EQ(json, output);
+    }
+}
+
 }
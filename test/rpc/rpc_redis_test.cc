@@ -801,6 +801,75 @@ namespace {
         }
     }
 
+    TEST_F(RedisTest, redis_reply_bulk_string_refs) {
+        flare::Arena arena;
+        flare::rpc::RedisBulkStringRefs refs;
+        refs.min_size = 32;
+        std::string large(100 * 1024, 'x');
+        for (size_t i = 0; i < large.size(); ++i) {
+            large[i] = 'a' + i % 26;
+        }
+        const std::string wire = "*3\r\n$21\r\nshorter than min_size\r\n$" +
+                                 std::to_string(large.size()) + "\r\n" + large + "\r\n:42\r\n";
+        flare::cord_buf buf;
+        buf.append(wire.substr(0, wire.size() - large.size() / 2));
+        // The large string is in blocks of different inputs.
+        flare::cord_buf other;
+        other.append(wire.substr(wire.size() - large.size() / 2));
+        buf.append(other);
+
+        flare::rpc::RedisReply r(&arena);
+        // Parsing is suspended before the last sub reply.
+        flare::cord_buf partial;
+        buf.cutn(&partial, buf.size() - 3);
+        ASSERT_EQ(flare::rpc::PARSE_ERROR_NOT_ENOUGH_DATA, r.ConsumePartialCordBuf(partial, &refs));
+        buf.cutn(&partial, buf.size());
+        ASSERT_EQ(flare::rpc::PARSE_OK, r.ConsumePartialCordBuf(partial, &refs));
+        ASSERT_TRUE(partial.empty());
+        ASSERT_EQ(3u, r.size());
+        ASSERT_EQ(1u, refs.bufs.size());
+        ASSERT_EQ("shorter than min_size", r[0].data());
+        ASSERT_TRUE(r[1].is_string());
+        ASSERT_EQ(large.size(), r[1].size());
+        ASSERT_EQ(42, r[2].integer());
+
+        flare::cord_buf out;
+        r[1].append_to(&out);
+        ASSERT_EQ(large, out.to_string());
+
+        // Copies do not reference `refs'.
+        flare::Arena arena2;
+        flare::rpc::RedisReply r2(&arena2);
+        r2.CopyFromDifferentArena(r);
+        refs.bufs.clear();
+        ASSERT_EQ(large, r2[1].data());
+        flare::cord_buf_appender appender;
+        ASSERT_TRUE(r2.SerializeTo(&appender));
+        out.clear();
+        appender.move_to(out);
+        ASSERT_EQ(wire, out.to_string());
+
+        flare::rpc::RedisResponse response;
+        response.set_bulk_string_ref_min_size(32);
+        buf.append(wire);
+        ASSERT_EQ(flare::rpc::PARSE_OK, response.ConsumePartialCordBuf(buf, 1));
+        ASSERT_EQ(large, response.reply(0)[1].data());
+        ASSERT_EQ(large.size(), strlen(response.reply(0)[1].c_str()));
+        out.clear();
+        response.reply(0)[1].append_to(&out);
+        ASSERT_EQ(large, out.to_string());
+
+        buf.append(wire);
+        response.Clear();
+        ASSERT_EQ(flare::rpc::PARSE_OK, response.ConsumePartialCordBuf(buf, 1));
+        flare::rpc::RedisResponse response2;
+        response2.Swap(&response);
+        response.Clear();
+        std::ostringstream os;
+        os << response2;
+        ASSERT_EQ("[\"shorter than min_size\", \"" + large + "\", (integer) 42]", os.str());
+    }
+
     std::mutex s_mutex;
     std::unordered_map<std::string, std::string> m;
     std::unordered_map<std::string, int64_t> int_map;
@@ -1231,4 +1300,167 @@ namespace {
         ASSERT_STREQ(response.reply(7).c_str(), "world");
     }
 
+    class BatchIncrCommandHandler : public flare::rpc::RedisCommandHandler {
+    public:
+        explicit BatchIncrCommandHandler(bool supports_batch = true)
+                : batch_count(0), batched_commands(0), _supports_batch(supports_batch) {}
+
+        bool SupportsBatch() const {
+            return _supports_batch;
+        }
+
+        flare::rpc::RedisCommandHandlerResult Run(const std::vector<std::string_view> &args,
+                                                  flare::rpc::RedisReply *output,
+                                                  bool flush_batched) {
+            std::unique_lock<std::mutex> lock(s_mutex);
+            Incr(args, output);
+            return flare::rpc::REDIS_CMD_HANDLED;
+        }
+
+        bool RunBatch(const std::vector<std::vector<std::string_view> > &commands,
+                      flare::rpc::RedisReply *output) {
+            std::unique_lock<std::mutex> lock(s_mutex);
+            ++batch_count;
+            batched_commands += commands.size();
+            for (size_t i = 0; i < commands.size(); ++i) {
+                Incr(commands[i], &(*output)[i]);
+            }
+            return true;
+        }
+
+        int batch_count;
+        int batched_commands;
+
+    private:
+        void Incr(const std::vector<std::string_view> &args, flare::rpc::RedisReply *output) {
+            if (args.size() < 2) {
+                output->SetError("ERR wrong number of arguments for 'incr' command");
+                return;
+            }
+            output->SetInteger(++int_map[flare::as_string(args[1])]);
+        }
+
+        bool _supports_batch;
+    };
+
+    TEST_F(RedisTest, server_run_batch) {
+        flare::rpc::Server server;
+        flare::rpc::ServerOptions server_options;
+        RedisServiceImpl *rsimpl = new RedisServiceImpl;
+        BatchIncrCommandHandler *ih = new BatchIncrCommandHandler;
+        rsimpl->AddCommandHandler("get", new GetCommandHandler(rsimpl));
+        rsimpl->AddCommandHandler("incr", ih);
+        server_options.redis_service = rsimpl;
+        flare::rpc::PortRange pr(8081, 8900);
+        ASSERT_EQ(0, server.Start("127.0.0.1", pr, &server_options));
+
+        flare::rpc::ChannelOptions options;
+        options.protocol = flare::rpc::PROTOCOL_REDIS;
+        flare::rpc::Channel channel;
+        ASSERT_EQ(0, channel.Init("127.0.0.1", server.listen_address().port, &options));
+
+        flare::rpc::RedisRequest request;
+        flare::rpc::RedisResponse response;
+        flare::rpc::Controller cntl;
+        ASSERT_TRUE(request.AddCommand("incr batch1"));
+        ASSERT_TRUE(request.AddCommand("incr batch1"));
+        ASSERT_TRUE(request.AddCommand("incr batch2"));
+        ASSERT_TRUE(request.AddCommand("get hello"));
+        ASSERT_TRUE(request.AddCommand("incr batch1"));
+        ASSERT_TRUE(request.AddCommand("get hello"));
+        ASSERT_TRUE(request.AddCommand("incr"));
+        ASSERT_TRUE(request.AddCommand("incr batch2"));
+        channel.CallMethod(NULL, &cntl, &request, &response, NULL);
+        ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+        ASSERT_EQ(8, response.reply_size());
+        // The single incr between gets is run by Run().
+        ASSERT_EQ(2, ih->batch_count);
+        ASSERT_EQ(5, ih->batched_commands);
+        ASSERT_EQ(1, response.reply(0).integer());
+        ASSERT_EQ(2, response.reply(1).integer());
+        ASSERT_EQ(1, response.reply(2).integer());
+        ASSERT_EQ(flare::rpc::REDIS_REPLY_NIL, response.reply(3).type());
+        ASSERT_EQ(3, response.reply(4).integer());
+        ASSERT_EQ(flare::rpc::REDIS_REPLY_NIL, response.reply(5).type());
+        ASSERT_TRUE(response.reply(6).is_error());
+        ASSERT_EQ(2, response.reply(7).integer());
+    }
+
+    TEST_F(RedisTest, server_run_batch_opt_in) {
+        flare::rpc::Server server;
+        flare::rpc::ServerOptions server_options;
+        RedisServiceImpl *rsimpl = new RedisServiceImpl;
+        // RunBatch() is implemented but not enabled by SupportsBatch().
+        BatchIncrCommandHandler *ih = new BatchIncrCommandHandler(false);
+        rsimpl->AddCommandHandler("incr", ih);
+        server_options.redis_service = rsimpl;
+        flare::rpc::PortRange pr(8081, 8900);
+        ASSERT_EQ(0, server.Start("127.0.0.1", pr, &server_options));
+
+        flare::rpc::ChannelOptions options;
+        options.protocol = flare::rpc::PROTOCOL_REDIS;
+        flare::rpc::Channel channel;
+        ASSERT_EQ(0, channel.Init("127.0.0.1", server.listen_address().port, &options));
+
+        flare::rpc::RedisRequest request;
+        flare::rpc::RedisResponse response;
+        flare::rpc::Controller cntl;
+        ASSERT_TRUE(request.AddCommand("incr opt_in"));
+        ASSERT_TRUE(request.AddCommand("incr opt_in"));
+        ASSERT_TRUE(request.AddCommand("incr opt_in"));
+        channel.CallMethod(NULL, &cntl, &request, &response, NULL);
+        ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+        ASSERT_EQ(3, response.reply_size());
+        ASSERT_EQ(0, ih->batch_count);
+        for (int i = 0; i < 3; ++i) {
+            ASSERT_EQ(i + 1, response.reply(i).integer());
+        }
+    }
+
+    // Pipelined commands of handlers which run commands one by one, check
+    // that grouping commands for RunBatch() costs nothing for them.
+    TEST_F(RedisTest, server_pipeline_perf) {
+        flare::rpc::Server server;
+        flare::rpc::ServerOptions server_options;
+        RedisServiceImpl *rsimpl = new RedisServiceImpl;
+        rsimpl->AddCommandHandler("get", new GetCommandHandler(rsimpl));
+        rsimpl->AddCommandHandler("incr", new IncrCommandHandler);
+        rsimpl->AddCommandHandler("batch_incr", new BatchIncrCommandHandler);
+        server_options.redis_service = rsimpl;
+        flare::rpc::PortRange pr(8081, 8900);
+        ASSERT_EQ(0, server.Start("127.0.0.1", pr, &server_options));
+
+        flare::rpc::ChannelOptions options;
+        options.protocol = flare::rpc::PROTOCOL_REDIS;
+        flare::rpc::Channel channel;
+        ASSERT_EQ(0, channel.Init("127.0.0.1", server.listen_address().port, &options));
+
+        const int kPipeline = 100;
+        const int kRounds = 2000;
+        const char *const kCommands[][2] = {
+                {"incr", "incr"},        // runs of one handler
+                {"incr", "get"},         // handlers alternate
+                {"batch_incr", "batch_incr"},
+        };
+        for (size_t c = 0; c < FLARE_ARRAY_SIZE(kCommands); ++c) {
+            flare::rpc::RedisRequest request;
+            for (int i = 0; i < kPipeline; ++i) {
+                ASSERT_TRUE(request.AddCommand("%s pipeline_perf", kCommands[c][i % 2]));
+            }
+            flare::stop_watcher tm;
+            tm.start();
+            for (int r = 0; r < kRounds; ++r) {
+                flare::rpc::RedisResponse response;
+                flare::rpc::Controller cntl;
+                channel.CallMethod(NULL, &cntl, &request, &response, NULL);
+                ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+                ASSERT_EQ(kPipeline, response.reply_size());
+            }
+            tm.stop();
+            std::cout << kCommands[c][0] << "/" << kCommands[c][1] << ": "
+                      << kPipeline * kRounds * 1000000L / tm.u_elapsed()
+                      << " commands/s" << std::endl;
+        }
+    }
+
 } //namespace
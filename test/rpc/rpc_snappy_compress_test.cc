@@ -27,6 +27,8 @@
 #include "snappy_message.pb.h"
 #include "flare/rpc/policy/snappy_compress.h"
 #include "flare/rpc/policy/gzip_compress.h"
+#include "flare/rpc/policy/lz4_compress.h"
+#include "flare/rpc/policy/zstd_compress.h"
 #include "flare/base/profile.h"
 
 typedef bool (*Compress)(const google::protobuf::Message &, flare::cord_buf *);
@@ -196,6 +198,16 @@ TEST_F(test_compress_method, throughput_compare) {
         CompressMessage("Zlib", k, old_msg, len,
                         flare::rpc::policy::ZlibCompress,
                         flare::rpc::policy::ZlibDecompress);
+#ifdef FLARE_WITH_LZ4
+        CompressMessage("Lz4", k, old_msg, len,
+                        flare::rpc::policy::Lz4Compress,
+                        flare::rpc::policy::Lz4Decompress);
+#endif
+#ifdef FLARE_WITH_ZSTD
+        CompressMessage("Zstd", k, old_msg, len,
+                        flare::rpc::policy::ZstdCompress,
+                        flare::rpc::policy::ZstdDecompress);
+#endif
         printf("\n");
         delete[] text;
     }
@@ -230,6 +242,16 @@ TEST_F(test_compress_method, throughput_compare_complete_random) {
         CompressMessage("Zlib", k, old_msg, len,
                         flare::rpc::policy::ZlibCompress,
                         flare::rpc::policy::ZlibDecompress);
+#ifdef FLARE_WITH_LZ4
+        CompressMessage("Lz4", k, old_msg, len,
+                        flare::rpc::policy::Lz4Compress,
+                        flare::rpc::policy::Lz4Decompress);
+#endif
+#ifdef FLARE_WITH_ZSTD
+        CompressMessage("Zstd", k, old_msg, len,
+                        flare::rpc::policy::ZstdCompress,
+                        flare::rpc::policy::ZstdDecompress);
+#endif
         printf("\n");
         delete[] text;
     }
@@ -255,3 +277,125 @@ TEST_F(test_compress_method, mass_snappy_iobuf) {
     ASSERT_TRUE(strcmp(check_str.c_str(), text) == 0);
     delete[] text;
 }
+
+// Build a cord_buf spanning many blocks with partially compressible content.
+static void MakeMultiBlockCordBuf(size_t len, flare::cord_buf *buf, std::string *expected) {
+    char piece[1000];
+    while (expected->size() < len) {
+        const size_t n = std::min(sizeof(piece), len - expected->size());
+        for (size_t i = 0; i < n; ++i) {
+            piece[i] = (i % 7 == 0) ? (char) (rand() % 256) : (char) ('a' + i % 26);
+        }
+        buf->append(piece, n);
+        expected->append(piece, n);
+    }
+}
+
+#ifdef FLARE_WITH_LZ4
+TEST_F(test_compress_method, lz4) {
+    snappy_message::SnappyMessageProto old_msg;
+    old_msg.set_text("Hello World!");
+    old_msg.add_numbers(2);
+    old_msg.add_numbers(7);
+    old_msg.add_numbers(45);
+    flare::cord_buf buf;
+    ASSERT_TRUE(flare::rpc::policy::Lz4Compress(old_msg, &buf));
+    snappy_message::SnappyMessageProto new_msg;
+    ASSERT_TRUE(flare::rpc::policy::Lz4Decompress(buf, &new_msg));
+    ASSERT_EQ("Hello World!", new_msg.text());
+    ASSERT_EQ(3, new_msg.numbers_size());
+    ASSERT_EQ(45, new_msg.numbers(2));
+}
+
+TEST_F(test_compress_method, lz4_multi_block_iobuf) {
+    flare::cord_buf buf, output_buf, check_buf;
+    std::string expected;
+    MakeMultiBlockCordBuf(1024 * 1024 + 17, &buf, &expected);
+    ASSERT_GT(buf.backing_block_num(), 1u);
+    ASSERT_TRUE(flare::rpc::policy::Lz4Compress(buf, &output_buf));
+    ASSERT_LT(output_buf.size(), buf.size());
+    ASSERT_TRUE(flare::rpc::policy::Lz4Decompress(output_buf, &check_buf));
+    ASSERT_EQ(expected, check_buf.to_string());
+
+    // Anything after the frame must be rejected, even another frame.
+    flare::cord_buf trailing(output_buf);
+    trailing.append("x");
+    check_buf.clear();
+    ASSERT_FALSE(flare::rpc::policy::Lz4Decompress(trailing, &check_buf));
+    trailing = output_buf;
+    trailing.append(output_buf);
+    check_buf.clear();
+    ASSERT_FALSE(flare::rpc::policy::Lz4Decompress(trailing, &check_buf));
+
+    // Truncated frames must be rejected.
+    flare::cord_buf truncated;
+    output_buf.cutn(&truncated, output_buf.size() / 2);
+    check_buf.clear();
+    ASSERT_FALSE(flare::rpc::policy::Lz4Decompress(truncated, &check_buf));
+}
+
+TEST_F(test_compress_method, lz4_append_to_nonempty_iobuf) {
+    // Output starts in the middle of a block, which is either large enough
+    // for compressed blocks or not.
+    const size_t prefix_lens[] = {0, 100, 8000, 8180};
+    const size_t lens[] = {1, 782, 8193, 70000};
+    for (size_t prefix_len : prefix_lens) {
+        for (size_t len : lens) {
+            flare::cord_buf buf, output_buf, check_buf;
+            std::string expected;
+            MakeMultiBlockCordBuf(len, &buf, &expected);
+            const std::string prefix(prefix_len, 'x');
+            output_buf.append(prefix);
+            ASSERT_TRUE(flare::rpc::policy::Lz4Compress(buf, &output_buf));
+            flare::cord_buf prefix_buf;
+            output_buf.cutn(&prefix_buf, prefix_len);
+            ASSERT_EQ(prefix, prefix_buf.to_string());
+            ASSERT_TRUE(flare::rpc::policy::Lz4Decompress(output_buf, &check_buf));
+            ASSERT_EQ(expected, check_buf.to_string()) << prefix_len << " " << len;
+        }
+    }
+}
+#endif  // FLARE_WITH_LZ4
+
+#ifdef FLARE_WITH_ZSTD
+TEST_F(test_compress_method, zstd) {
+    snappy_message::SnappyMessageProto old_msg;
+    old_msg.set_text("Hello World!");
+    old_msg.add_numbers(2);
+    old_msg.add_numbers(7);
+    old_msg.add_numbers(45);
+    flare::cord_buf buf;
+    ASSERT_TRUE(flare::rpc::policy::ZstdCompress(old_msg, &buf));
+    snappy_message::SnappyMessageProto new_msg;
+    ASSERT_TRUE(flare::rpc::policy::ZstdDecompress(buf, &new_msg));
+    ASSERT_EQ("Hello World!", new_msg.text());
+    ASSERT_EQ(3, new_msg.numbers_size());
+    ASSERT_EQ(45, new_msg.numbers(2));
+}
+
+TEST_F(test_compress_method, zstd_multi_block_iobuf) {
+    flare::cord_buf buf, output_buf, check_buf;
+    std::string expected;
+    MakeMultiBlockCordBuf(1024 * 1024 + 17, &buf, &expected);
+    ASSERT_GT(buf.backing_block_num(), 1u);
+    ASSERT_TRUE(flare::rpc::policy::ZstdCompress(buf, &output_buf));
+    ASSERT_LT(output_buf.size(), buf.size());
+    ASSERT_TRUE(flare::rpc::policy::ZstdDecompress(output_buf, &check_buf));
+    ASSERT_EQ(expected, check_buf.to_string());
+
+    // Anything after the frame must be rejected, even another frame.
+    flare::cord_buf trailing(output_buf);
+    trailing.append("x");
+    check_buf.clear();
+    ASSERT_FALSE(flare::rpc::policy::ZstdDecompress(trailing, &check_buf));
+    trailing = output_buf;
+    trailing.append(output_buf);
+    check_buf.clear();
+    ASSERT_FALSE(flare::rpc::policy::ZstdDecompress(trailing, &check_buf));
+
+    flare::cord_buf truncated;
+    output_buf.cutn(&truncated, output_buf.size() / 2);
+    check_buf.clear();
+    ASSERT_FALSE(flare::rpc::policy::ZstdDecompress(truncated, &check_buf));
+}
+#endif  // FLARE_WITH_ZSTD
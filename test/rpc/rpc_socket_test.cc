@@ -27,6 +27,7 @@
 #include "flare/base/gperftools_profiler.h"
 #include "flare/times/time.h"
 #include "flare/base/fd_utility.h"
+#include "flare/base/fd_guard.h"
 #include "flare/strings/starts_with.h"
 #include "flare/fiber/internal/unstable.h"
 #include "flare/fiber/internal/schedule_group.h"
@@ -57,6 +58,9 @@ namespace flare::fiber_internal {
 
 namespace flare::rpc {
     DECLARE_int32(health_check_interval);
+    DECLARE_bool(socket_write_coalescing);
+    DECLARE_bool(socket_zerocopy);
+    extern SocketVarsCollector *g_vars;
 }
 
 void EchoProcessHuluRequest(flare::rpc::InputMessageBase *msg_base);
@@ -830,8 +834,12 @@ void *Writer(void *void_arg) {
 TEST_F(SocketTest, multi_threaded_write) {
     const size_t REP = 20000;
     int fds[2];
-    for (int k = 0; k < 2; ++k) {
+    // The third round holds small writes to coalesce them.
+    for (int k = 0; k < 3; ++k) {
         printf("Round %d\n", k + 1);
+        flare::rpc::FLAGS_socket_write_coalescing = (k == 2);
+        const int64_t coalesced_before = (flare::rpc::g_vars
+                                          ? flare::rpc::g_vars->nwrite_coalesced.get_value() : 0);
         ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
         pthread_t th[8];
         WriterArg args[FLARE_ARRAY_SIZE(th)];
@@ -912,12 +920,78 @@ TEST_F(SocketTest, multi_threaded_write) {
         ASSERT_EQ(REP * FLARE_ARRAY_SIZE(th), result.size());
         ASSERT_EQ(0UL, *result.begin());
         ASSERT_EQ(REP * FLARE_ARRAY_SIZE(th) - 1, *(result.end() - 1));
+        if (k == 2) {
+            // Small writes from 8 threads must have been gathered.
+            ASSERT_GT(flare::rpc::g_vars->nwrite_coalesced.get_value(), coalesced_before);
+        }
 
         ASSERT_EQ(0, s->SetFailed());
         s.release()->Dereference();
         ASSERT_EQ((flare::rpc::Socket *) NULL, global_sock);
         close(fds[0]);
     }
+    flare::rpc::FLAGS_socket_write_coalescing = false;
+}
+
+TEST_F(SocketTest, fail_with_pending_zerocopy_writes) {
+    flare::base::end_point point(flare::base::IP_ANY, 7879);
+    flare::base::fd_guard listening_fd(tcp_listen(point));
+    ASSERT_GT(listening_fd, 0);
+    // Keep most of the data in the send queue of the client.
+    int rcvbuf = 4096;
+    ASSERT_EQ(0, setsockopt(listening_fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf)));
+    const int client_fd = tcp_connect(point, NULL);
+    ASSERT_GT(client_fd, 0);
+    flare::base::fd_guard peer_fd(accept(listening_fd, NULL, NULL));
+    ASSERT_GT(peer_fd, 0);
+
+    flare::rpc::FLAGS_socket_zerocopy = true;
+    flare::rpc::SocketOptions options;
+    options.fd = client_fd;
+    flare::rpc::SocketId id = 8888;
+    ASSERT_EQ(0, flare::rpc::Socket::Create(options, &id));
+    flare::rpc::FLAGS_socket_zerocopy = false;
+    const int64_t nzerocopy_before = flare::rpc::g_vars->nzerocopy.get_value();
+    const int64_t pinned_before = flare::rpc::g_vars->zerocopy_pinned_bytes.get_value();
+    const int64_t aborted_before = flare::rpc::g_vars->nzerocopy_aborted.get_value();
+    {
+        flare::rpc::SocketUniquePtr s;
+        ASSERT_EQ(0, flare::rpc::Socket::Address(id, &s));
+        flare::cord_buf src;
+        src.append(std::string(4 * 1024 * 1024, 'z'));
+        ASSERT_EQ(0, s->Write(&src));
+        const int64_t start_time = flare::get_current_time_micros();
+        while (flare::rpc::g_vars->nzerocopy.get_value() == nzerocopy_before) {
+            ASSERT_LT(flare::get_current_time_micros(), start_time + 1000000L) << "Too long!";
+            flare::fiber_sleep_for(1000);
+        }
+        if (flare::rpc::g_vars->zerocopy_pinned_bytes.get_value() == pinned_before) {
+            // Kernel copied the data, e.g. SO_ZEROCOPY is a no-op here.
+            FLARE_LOG(INFO) << "No zerocopy write is pending, skip";
+            ASSERT_EQ(0, s->SetFailed());
+            return;
+        }
+        ASSERT_EQ(0, s->SetFailed());
+        // The kernel may still send pages of the pending writes on the fd,
+        // which is open until the socket is recycled.
+        ASSERT_GT(flare::rpc::g_vars->zerocopy_pinned_bytes.get_value(), pinned_before);
+        ASSERT_EQ(aborted_before, flare::rpc::g_vars->nzerocopy_aborted.get_value());
+    }
+    const int64_t start_time = flare::get_current_time_micros();
+    // Released once the socket is recycled, the connection is reset on close
+    // so that the kernel is done with the pages.
+    while (flare::rpc::g_vars->zerocopy_pinned_bytes.get_value() != pinned_before) {
+        ASSERT_LT(flare::get_current_time_micros(), start_time + 1000000L) << "Too long!";
+        flare::fiber_sleep_for(1000);
+    }
+    ASSERT_EQ(-1, flare::rpc::Socket::Status(id));
+    ASSERT_EQ(aborted_before + 1, flare::rpc::g_vars->nzerocopy_aborted.get_value());
+    char buf[65536];
+    ssize_t nr;
+    while ((nr = read(peer_fd, buf, sizeof(buf))) > 0) {
+    }
+    ASSERT_EQ(-1, nr);
+    ASSERT_EQ(ECONNRESET, errno);
 }
 
 void *FastWriter(void *void_arg) {
@@ -0,0 +1,367 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include <unistd.h>
+#include <sstream>
+#include <thread>
+#include <vector>
+#include "testing/gtest_wrap.h"
+#include "flare/files/filesystem.h"
+#include "flare/metrics/variable_base.h"
+#include "flare/times/time.h"
+#include "flare/rpc/span.h"
+#include "flare/rpc/span_store.h"
+
+namespace flare::rpc {
+    DECLARE_string(rpcz_database_dir);
+    DECLARE_bool(rpcz_keep_span_db);
+    DECLARE_int32(rpcz_max_span_per_second);
+    DECLARE_int32(rpcz_span_ring_size);
+}
+
+namespace {
+
+    const char *const kTestDir = "./rpcz_span_test";
+
+    class SpanTest : public testing::Test {
+    protected:
+        void SetUp() override {
+            std::error_code ec;
+            flare::remove_all(flare::file_path(kTestDir), ec);
+            flare::create_directories(flare::file_path(kTestDir), ec);
+        }
+
+        void TearDown() override {
+            std::error_code ec;
+            flare::remove_all(flare::file_path(kTestDir), ec);
+        }
+    };
+
+    flare::rpc::SpanRecordInfo MakeInfo(uint64_t trace_id, uint64_t span_id, int64_t tm) {
+        flare::rpc::SpanRecordInfo info;
+        info.trace_id = trace_id;
+        info.span_id = span_id;
+        info.log_id = span_id * 10;
+        info.time_key = tm;
+        info.start_real_us = tm;
+        info.latency_us = span_id % 100;
+        info.error_code = 0;
+        info.request_size = span_id;
+        info.response_size = 2 * span_id;
+        info.type = flare::rpc::SPAN_TYPE_SERVER;
+        return info;
+    }
+
+    flare::rpc::RpczSpan MakeSpan(uint64_t trace_id, uint64_t span_id) {
+        flare::rpc::RpczSpan span;
+        span.set_trace_id(trace_id);
+        span.set_span_id(span_id);
+        span.set_log_id(span_id * 10);
+        span.set_info("\1" "1 annotation");
+        span.add_client_spans()->set_span_id(span_id + 1);
+        return span;
+    }
+
+    class LatencyFilter : public flare::rpc::SpanFilter {
+    public:
+        bool Keep(const flare::rpc::BriefSpan &span) override {
+            return span.latency_us() >= 50;
+        }
+    };
+
+    void ExpectSegment(const flare::rpc::SpanSegment *seg, int n) {
+        ASSERT_EQ((size_t) n, seg->span_count());
+        ASSERT_EQ(1000, seg->min_time_key());
+        ASSERT_EQ(1000 + n - 1, seg->max_time_key());
+
+        // All spans of trace 7 are chained in a same bucket.
+        std::deque<flare::rpc::RpczSpan> spans;
+        seg->FindSpans(7, &spans);
+        ASSERT_EQ((size_t) (n + 9) / 10, spans.size());
+        for (size_t i = 0; i < spans.size(); ++i) {
+            ASSERT_EQ(7u, spans[i].trace_id());
+            ASSERT_EQ("method", spans[i].full_method_name());
+        }
+
+        flare::rpc::RpczSpan span;
+        ASSERT_EQ(0, seg->FindSpan(7, 10, &span));
+        ASSERT_EQ(10u, span.span_id());
+        ASSERT_EQ(100u, span.log_id());
+        ASSERT_EQ(1, span.client_spans_size());
+        ASSERT_EQ(11u, span.client_spans(0).span_id());
+        ASSERT_EQ(-1, seg->FindSpan(7, 11, &span));
+        ASSERT_EQ(-1, seg->FindSpan(8, 10, &span));
+
+        // Newest first, starting from the given time.
+        std::deque<flare::rpc::BriefSpan> briefs;
+        ASSERT_EQ(10u, seg->ListSpans(1000 + 500, 10, &briefs, NULL));
+        ASSERT_EQ(10u, briefs.size());
+        for (size_t i = 0; i < briefs.size(); ++i) {
+            ASSERT_EQ(1000 + 500 - (int64_t) i, briefs[i].start_real_us());
+            ASSERT_EQ(500 - i, briefs[i].span_id());
+            ASSERT_EQ("method", briefs[i].full_method_name());
+        }
+        briefs.clear();
+        ASSERT_EQ(5u, seg->ListSpans(1004, 100, &briefs, NULL));
+        briefs.clear();
+        ASSERT_EQ(0u, seg->ListSpans(999, 100, &briefs, NULL));
+        ASSERT_EQ((size_t) n, seg->ListSpans(1 << 30, n + 100, &briefs, NULL));
+        ASSERT_EQ((size_t) n, briefs.size());
+        briefs.clear();
+        LatencyFilter filter;
+        ASSERT_EQ(100u, seg->ListSpans(1099, 100, &briefs, &filter));
+        ASSERT_EQ(50u, briefs.size());
+
+        int count = 0;
+        seg->ForEach([&count](const flare::rpc::RpczSpan &s) {
+            EXPECT_EQ((uint64_t) count, s.span_id());
+            return ++count < 100;
+        });
+        ASSERT_EQ(100, count);
+    }
+
+    TEST_F(SpanTest, segment) {
+        const std::string path = std::string(kTestDir) + "/0.span";
+        flare::rpc::SpanSegment *seg = flare::rpc::SpanSegment::Create(path, 1024 * 1024);
+        ASSERT_TRUE(seg != NULL);
+        flare::container::intrusive_ptr<flare::rpc::SpanSegment> seg_ptr(seg);
+        const int N = 1000;
+        for (int i = 0; i < N; ++i) {
+            ASSERT_TRUE(seg->Append(MakeInfo(i % 10 == 0 ? 7 : 1000 + i, i, 1000 + i),
+                                    "method", MakeSpan(i % 10 == 0 ? 7 : 1000 + i, i)));
+        }
+        ExpectSegment(seg, N);
+
+        // Read by another process after the writer is gone.
+        seg->set_keep_file(true);
+        seg_ptr.reset();
+        flare::rpc::SpanSegment *seg2 = flare::rpc::SpanSegment::Open(path);
+        ASSERT_TRUE(seg2 != NULL);
+        flare::container::intrusive_ptr<flare::rpc::SpanSegment> seg2_ptr(seg2);
+        ExpectSegment(seg2, N);
+        ASSERT_EQ(0, access(path.c_str(), F_OK));
+        seg2_ptr.reset();
+        ASSERT_EQ(0, access(path.c_str(), F_OK));
+
+        ASSERT_TRUE(flare::rpc::SpanSegment::Open(std::string(kTestDir) + "/none.span") == NULL);
+    }
+
+    TEST_F(SpanTest, segment_full) {
+        const std::string path = std::string(kTestDir) + "/0.span";
+        flare::rpc::SpanSegment *seg = flare::rpc::SpanSegment::Create(path, 1024 * 1024);
+        ASSERT_TRUE(seg != NULL);
+        flare::container::intrusive_ptr<flare::rpc::SpanSegment> seg_ptr(seg);
+        int n = 0;
+        while (seg->Append(MakeInfo(n, n, 1000 + n), "method", MakeSpan(n, n))) {
+            ++n;
+        }
+        ASSERT_GT(n, 1000);
+        ASSERT_LE(seg->size(), seg->capacity());
+        ASSERT_EQ((size_t) n, seg->span_count());
+        std::deque<flare::rpc::BriefSpan> briefs;
+        ASSERT_EQ(3u, seg->ListSpans(1 << 30, 3, &briefs, NULL));
+        ASSERT_EQ((uint64_t) n - 1, briefs[0].span_id());
+        // The file is removed along with the segment.
+        seg_ptr.reset();
+        ASSERT_NE(0, access(path.c_str(), F_OK));
+    }
+
+    TEST_F(SpanTest, query_during_appending) {
+        const std::string path = std::string(kTestDir) + "/0.span";
+        flare::rpc::SpanSegment *seg = flare::rpc::SpanSegment::Create(path, 16 * 1024 * 1024);
+        ASSERT_TRUE(seg != NULL);
+        flare::container::intrusive_ptr<flare::rpc::SpanSegment> seg_ptr(seg);
+        const int N = 50000;
+        std::atomic<bool> stop(false);
+        std::thread reader([&] {
+            std::deque<flare::rpc::BriefSpan> briefs;
+            flare::rpc::RpczSpan span;
+            while (!stop.load()) {
+                briefs.clear();
+                seg->ListSpans(1 << 30, 100, &briefs, NULL);
+                for (size_t i = 1; i < briefs.size(); ++i) {
+                    ASSERT_EQ(briefs[i - 1].span_id(), briefs[i].span_id() + 1);
+                }
+                if (!briefs.empty()) {
+                    ASSERT_EQ(0, seg->FindSpan(briefs[0].trace_id(), briefs[0].span_id(), &span));
+                    ASSERT_EQ(briefs[0].span_id(), span.span_id());
+                }
+            }
+        });
+        for (int i = 0; i < N; ++i) {
+            ASSERT_TRUE(seg->Append(MakeInfo(i, i, 1000 + i), "method", MakeSpan(i, i)));
+        }
+        stop = true;
+        reader.join();
+    }
+
+    void SubmitSpans(int count) {
+        std::thread th([count] {
+            for (int i = 0; i < count; ++i) {
+                const int64_t base = flare::get_current_time_micros();
+                flare::rpc::Span *span = flare::rpc::Span::CreateServerSpan(
+                        "test.Echo", 0, 0, 0, 0);
+                span->set_received_us(base);
+                span->set_sent_us(base + 1);
+                flare::rpc::Span::Submit(span, base);
+            }
+        });
+        th.join();
+    }
+
+    int64_t GetSpanCount(const char *name) {
+        return std::stoll(flare::variable_base::describe_exposed(name));
+    }
+
+    bool WaitSpanCount(const char *name, int64_t expected) {
+        for (int i = 0; i < 500 && GetSpanCount(name) < expected; ++i) {
+            usleep(10000);
+        }
+        return GetSpanCount(name) == expected;
+    }
+
+    size_t CountDirectories(const char *path) {
+        size_t n = 0;
+        std::error_code ec;
+        for (flare::directory_iterator it(path, ec), end; !ec && it != end; it.increment(ec)) {
+            n += it->is_directory();
+        }
+        return n;
+    }
+
+#define SPAN_CHECK(cond)                                                  \
+    if (!(cond)) {                                                        \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+        exit(1);                                                          \
+    }
+
+    // Spans are dropped for a while after failing to open the SpanDB, rather
+    // than retried (and a directory created) for every batch.
+    void IndexFailureBackoff() {
+        const std::string file = std::string(kTestDir) + "/file";
+        FILE *fp = fopen(file.c_str(), "w");
+        SPAN_CHECK(fp != NULL);
+        fclose(fp);
+        // A directory can't be created under a regular file.
+        flare::rpc::FLAGS_rpcz_database_dir = file + "/rpcz";
+        flare::rpc::FLAGS_rpcz_max_span_per_second = 1000000;
+        // Spans of a half full ring are drained at once instead of waiting
+        // for the interval.
+        flare::rpc::FLAGS_rpcz_span_ring_size = 16;
+        SubmitSpans(9);
+        SPAN_CHECK(WaitSpanCount("rpcz_span_dropped", 9));
+
+        // Still backing off, the drain is woken up by the ring and runs
+        // well within the 1 second of backoff.
+        flare::rpc::FLAGS_rpcz_database_dir = kTestDir;
+        SubmitSpans(9);
+        SPAN_CHECK(WaitSpanCount("rpcz_span_dropped", 18));
+        SPAN_CHECK(0 == GetSpanCount("rpcz_span_indexed"));
+        SPAN_CHECK(0 == CountDirectories(kTestDir));
+
+        // Indexed again after the backoff.
+        for (int i = 0; i < 50 && GetSpanCount("rpcz_span_indexed") == 0; ++i) {
+            SubmitSpans(9);
+            usleep(100000);
+        }
+        SPAN_CHECK(GetSpanCount("rpcz_span_indexed") > 0);
+        SPAN_CHECK(1 == CountDirectories(kTestDir));
+        exit(0);
+    }
+
+#if GTEST_HAS_DEATH_TEST
+    TEST_F(SpanTest, index_failure_backoff) {
+        // Indexing of spans is process-wide, run the test in a new process.
+        testing::FLAGS_gtest_death_test_style = "threadsafe";
+        EXPECT_EXIT(IndexFailureBackoff(), testing::ExitedWithCode(0), "");
+    }
+#endif
+
+    TEST_F(SpanTest, submit_and_load) {
+        flare::rpc::FLAGS_rpcz_database_dir = kTestDir;
+        flare::rpc::FLAGS_rpcz_keep_span_db = true;
+        flare::rpc::FLAGS_rpcz_max_span_per_second = 1000000;
+        const int kThreads = 4;
+        const int kSpansPerThread = 1000;
+        std::vector<std::thread> threads;
+        std::vector<uint64_t> trace_ids(kThreads);
+        for (int t = 0; t < kThreads; ++t) {
+            threads.emplace_back([t, &trace_ids] {
+                for (int i = 0; i < kSpansPerThread; ++i) {
+                    const int64_t base = flare::get_current_time_micros();
+                    flare::rpc::Span *span = flare::rpc::Span::CreateServerSpan(
+                            "test.Echo", 0, 0, 0, 0);
+                    ASSERT_TRUE(span != NULL);
+                    span->set_received_us(base);
+                    span->set_sent_us(base + i);
+                    span->Annotate("thread %d", t);
+                    if (i == 0) {
+                        trace_ids[t] = span->trace_id();
+                    }
+                    flare::rpc::Span::Submit(span, base);
+                }
+            });
+        }
+        for (size_t i = 0; i < threads.size(); ++i) {
+            threads[i].join();
+        }
+
+        std::deque<flare::rpc::BriefSpan> briefs;
+        for (int i = 0; i < 500; ++i) {
+            flare::rpc::ListSpans(INT64_MAX, kThreads * kSpansPerThread * 2, &briefs, NULL);
+            if (briefs.size() == (size_t) kThreads * kSpansPerThread) {
+                break;
+            }
+            usleep(10000);
+        }
+        ASSERT_EQ((size_t) kThreads * kSpansPerThread, briefs.size());
+        for (int t = 0; t < kThreads; ++t) {
+            std::deque<flare::rpc::RpczSpan> spans;
+            flare::rpc::FindSpans(trace_ids[t], &spans);
+            ASSERT_EQ(1u, spans.size());
+            ASSERT_EQ("test.Echo", spans[0].full_method_name());
+            flare::rpc::SpanInfoExtractor extr(spans[0].info().c_str());
+            int64_t tm = 0;
+            std::string anno;
+            ASSERT_TRUE(extr.PopAnnotation(INT64_MAX, &tm, &anno));
+            ASSERT_EQ("thread " + std::to_string(t), anno);
+        }
+        std::ostringstream stats;
+        flare::rpc::DescribeSpanDB(stats);
+        ASSERT_NE(std::string::npos, stats.str().find("spans: 4000")) << stats.str();
+
+        // Segments written so far can be loaded and exported offline.
+        std::string dir;
+        std::error_code ec;
+        for (flare::directory_iterator it(kTestDir, ec), end; it != end; ++it) {
+            dir = it->file_path().string();
+        }
+        flare::rpc::SpanDB *db = flare::rpc::LoadSpanDBFromFile(dir.c_str());
+        ASSERT_TRUE(db != NULL);
+        std::deque<flare::rpc::BriefSpan> loaded;
+        flare::rpc::ListSpans(db, INT64_MAX, kThreads * kSpansPerThread * 2, &loaded, NULL);
+        ASSERT_EQ(briefs.size(), loaded.size());
+        flare::rpc::RpczSpan span;
+        ASSERT_EQ(0, flare::rpc::FindSpan(db, loaded[0].trace_id(), loaded[0].span_id(), &span));
+        std::ostringstream os;
+        ASSERT_EQ(briefs.size(), flare::rpc::ExportSpans(db, os));
+        ASSERT_NE(std::string::npos, os.str().find("test.Echo"));
+        flare::rpc::ReleaseSpanDB(db);
+    }
+
+} // namespace
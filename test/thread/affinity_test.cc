@@ -0,0 +1,50 @@
+/****************************************************************
+ * Copyright (c) 2022, liyinbin
+ * All rights reserved.
+ * Author by liyinbin (jeff.li) lijippy@163.com
+ *****************************************************************/
+
+#include "flare/thread/affinity.h"
+
+#include <sched.h>
+#include <thread>
+
+#include "testing/gtest_wrap.h"
+
+TEST(core_affinity, numa_node) {
+    const int nnode = flare::core_affinity::numa_node_count();
+    ASSERT_GE(nnode, 1);
+    size_t ncore = 0;
+    for (int i = 0; i < nnode; ++i) {
+        auto cores = flare::core_affinity::numa_node(i);
+        for (size_t j = 0; j < cores.count(); ++j) {
+            EXPECT_EQ(i, cores[j].group);
+        }
+        ncore += cores.count();
+    }
+    EXPECT_GE(ncore, 1u);
+    EXPECT_EQ(0u, flare::core_affinity::numa_node(nnode).count());
+    EXPECT_EQ(0u, flare::core_affinity::numa_node(-1).count());
+
+    const int current = flare::core_affinity::current_numa_node();
+    EXPECT_GE(current, 0);
+    EXPECT_LT(current, nnode);
+}
+
+#if defined(__linux__)
+TEST(core_affinity, bind_current_thread) {
+    auto node = flare::core_affinity::numa_node(flare::core_affinity::current_numa_node());
+    ASSERT_GT(node.count(), 0u);
+    const int core = node[node.count() - 1].index;
+    std::thread th([core] {
+        ASSERT_EQ(0, flare::core_affinity({[core] {
+            flare::core_node n;
+            n.index = core;
+            return n;
+        }()}).bind_current_thread());
+        EXPECT_EQ(core, sched_getcpu());
+    });
+    th.join();
+    EXPECT_NE(0, flare::core_affinity().bind_current_thread());
+}
+#endif  // __linux__
@@ -0,0 +1,167 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+// Convert a database of rpcz written by versions storing spans in leveldb
+// (a directory with id.db and time.db inside) into segments which can be
+// loaded by flare::rpc::LoadSpanDBFromFile(), e.g.
+//   rpcz_migrate -from=./rpc_data/rpcz/20200101.120000.1234 -to=./migrated
+
+#include <arpa/inet.h>
+#include <inttypes.h>
+#include <memory>
+#include <gflags/gflags.h>
+#include <leveldb/db.h>
+#include "flare/container/intrusive_ptr.h"
+#include "flare/files/filesystem.h"
+#include "flare/log/logging.h"
+#include "flare/rpc/span_store.h"
+
+namespace flare::rpc {
+    DECLARE_int32(rpcz_span_segment_size_mb);
+}
+
+DEFINE_string(from, "", "Directory of the leveldb database, containing id.db and time.db");
+DEFINE_string(to, "", "Directory to write segments into, created if it does not exist");
+
+// Keys of the leveldb database are big-endian 32-bit halves of 64-bit numbers.
+static void ToBigEndian(uint64_t n, uint32_t *buf) {
+    buf[0] = htonl(n >> 32);
+    buf[1] = htonl(n & 0xFFFFFFFFUL);
+}
+
+static uint64_t ToLittleEndian(const uint32_t *buf) {
+    return (((uint64_t) ntohl(buf[0])) << 32) | ntohl(buf[1]);
+}
+
+static leveldb::DB *OpenDB(const std::string &name) {
+    leveldb::Options options;
+    options.create_if_missing = false;
+    leveldb::DB *db = NULL;
+    leveldb::Status st = leveldb::DB::Open(options, name, &db);
+    if (!st.ok()) {
+        FLARE_LOG(ERROR) << "Fail to open " << name << ": " << st.ToString();
+        return NULL;
+    }
+    return db;
+}
+
+class SegmentWriter {
+public:
+    explicit SegmentWriter(const std::string &dir) : _dir(dir), _next_index(0), _nsegment(0) {}
+
+    bool Append(const flare::rpc::SpanRecordInfo &info,
+                const std::string &full_method_name,
+                const flare::rpc::RpczSpan &span) {
+        if (_current != NULL && _current->Append(info, full_method_name, span)) {
+            return true;
+        }
+        char name[32];
+        snprintf(name, sizeof(name), "/%06" PRIu64 ".span", _next_index++);
+        const size_t capacity = (size_t) flare::rpc::FLAGS_rpcz_span_segment_size_mb * 1024 * 1024;
+        flare::rpc::SpanSegment *seg = flare::rpc::SpanSegment::Create(_dir + name, capacity);
+        if (seg == NULL) {
+            return false;
+        }
+        seg->set_keep_file(true);
+        _current.reset(seg);
+        ++_nsegment;
+        if (!_current->Append(info, full_method_name, span)) {
+            FLARE_LOG(WARNING) << "Span of " << full_method_name
+                               << " is too large to be converted";
+        }
+        return true;
+    }
+
+    size_t segment_count() const { return _nsegment; }
+
+private:
+    std::string _dir;
+    uint64_t _next_index;
+    size_t _nsegment;
+    flare::container::intrusive_ptr<flare::rpc::SpanSegment> _current;
+};
+
+int main(int argc, char *argv[]) {
+    google::ParseCommandLineFlags(&argc, &argv, true);
+    if (FLAGS_from.empty() || FLAGS_to.empty()) {
+        FLARE_LOG(ERROR) << "Both -from and -to must be set";
+        return -1;
+    }
+    std::unique_ptr<leveldb::DB> id_db(OpenDB(FLAGS_from + "/id.db"));
+    std::unique_ptr<leveldb::DB> time_db(OpenDB(FLAGS_from + "/time.db"));
+    if (id_db == NULL || time_db == NULL) {
+        return -1;
+    }
+    std::error_code ec;
+    if (!flare::create_directories(flare::file_path(FLAGS_to), ec) && ec) {
+        FLARE_LOG(ERROR) << "Fail to create directory=" << FLAGS_to << ", " << ec.message();
+        return -1;
+    }
+
+    // Entries of time_db are ordered by their time keys, which is the order
+    // that segments are appended in.
+    SegmentWriter writer(FLAGS_to);
+    size_t nconverted = 0;
+    size_t nskipped = 0;
+    flare::rpc::BriefSpan brief;
+    flare::rpc::RpczSpan span;
+    std::string value;
+    std::unique_ptr<leveldb::Iterator> it(time_db->NewIterator(leveldb::ReadOptions()));
+    for (it->SeekToFirst(); it->Valid(); it->Next()) {
+        if (it->key().size() != 8 ||
+            !brief.ParseFromArray(it->value().data(), it->value().size())) {
+            ++nskipped;
+            continue;
+        }
+        uint32_t key_data[4];
+        ToBigEndian(brief.trace_id(), key_data);
+        ToBigEndian(brief.span_id(), key_data + 2);
+        leveldb::Status st = id_db->Get(leveldb::ReadOptions(),
+                                        leveldb::Slice((char *) key_data, sizeof(key_data)),
+                                        &value);
+        if (!st.ok() || !span.ParseFromString(value)) {
+            // Removed from id_db when it's out of the time window.
+            ++nskipped;
+            continue;
+        }
+        flare::rpc::SpanRecordInfo info;
+        info.trace_id = brief.trace_id();
+        info.span_id = brief.span_id();
+        info.log_id = brief.log_id();
+        info.time_key = (int64_t) ToLittleEndian((const uint32_t *) it->key().data());
+        info.start_real_us = brief.start_real_us();
+        info.latency_us = brief.latency_us();
+        info.error_code = brief.error_code();
+        info.request_size = brief.request_size();
+        info.response_size = brief.response_size();
+        info.type = brief.type();
+        // Stored in front of the record.
+        span.clear_full_method_name();
+        if (!writer.Append(info, brief.full_method_name(), span)) {
+            return -1;
+        }
+        ++nconverted;
+    }
+    if (!it->status().ok()) {
+        FLARE_LOG(ERROR) << "Fail to iterate time.db: " << it->status().ToString();
+        return -1;
+    }
+    FLARE_LOG(INFO) << "Converted " << nconverted << " spans into "
+                    << writer.segment_count() << " segments under " << FLAGS_to
+                    << ", skipped " << nskipped;
+    return 0;
+}